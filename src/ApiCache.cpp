@@ -0,0 +1,235 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+
+#include "ApiCache.h"
+
+#ifdef _WIN32
+#include "GUI.h"
+#define PATH_SEPARATOR "\\"
+#else
+#define PATH_SEPARATOR "/"
+#endif
+
+// First line of a cache file. Changing the listing format means changing this,
+// so files written by older versions are ignored.
+#define CACHE_HEADER "ezLCDLua API 1"
+
+// Where the board keeps the listing while it is sent over. A reply can't
+// have a line break in it, so its lines are separated by API_SEPARATOR.
+#define API_GLOBAL "__ezlcd_api"
+#define API_SEPARATOR ';'
+
+// Bytes of the listing sent back per command
+#define API_PAGE 2048
+
+// Both versions come back in an error message, like everything else that is read from the board
+#define VERSION_SCRIPT "error(tostring(ez and ez.FirmVer) .. \"\\t\" .. tostring(ez and ez.LuaVer), 0)"
+
+// Walks the globals breadth first, so a table that can be reached more than
+// one way is listed under its shortest name. Plain values are only listed
+// inside tables, at the top they are the user's own variables.
+#define WALK_SCRIPT \
+	"local out, seen, queue, i = {}, { [_G] = true }, { { _G, \"\" } }, 1 " \
+	"while queue[i] do " \
+		"local t, path = queue[i][1], queue[i][2] " \
+		"i = i + 1 " \
+		"for k, v in pairs(t) do " \
+			"local kind = type(v) " \
+			"if type(k) == \"string\" and k:match(\"^[%a_][%w_]*$\") and k:sub(1, 7) ~= \"__ezlcd\" and (path ~= \"\" or kind == \"function\" or kind == \"table\") then " \
+				"out[#out + 1] = path .. k .. (kind == \"function\" and \" f\" or kind == \"table\" and \" t\" or \" v\") " \
+				"if kind == \"table\" and not seen[v] and not path:find(\"%..*%.\") then " \
+					"seen[v] = true " \
+					"queue[#queue + 1] = { v, path .. k .. \".\" } " \
+				"end " \
+			"end " \
+		"end " \
+	"end " \
+	"table.sort(out) " \
+	API_GLOBAL " = table.concat(out, \";\") " \
+	"error(tostring(#" API_GLOBAL "), 0)"
+
+static FILE *openFile(const std::string &path, const char *mode) {
+#ifdef _WIN32
+	return _wfopen(GUI::StringFromUTF8(path).c_str(), GUI::StringFromUTF8(mode).c_str());
+#else
+	return fopen(path.c_str(), mode);
+#endif
+}
+
+static bool replaceFile(const std::string &from, const std::string &to) {
+#ifdef _WIN32
+	_wremove(GUI::StringFromUTF8(to).c_str());
+	return _wrename(GUI::StringFromUTF8(from).c_str(), GUI::StringFromUTF8(to).c_str()) == 0;
+#else
+	return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+// Anything but letters, digits, dots and dashes becomes an underscore
+static std::string fileNamePart(const std::string &s) {
+	std::string part = s;
+	for (char &c : part) {
+		if (!isalnum(static_cast<unsigned char>(c)) && c != '.' && c != '-') c = '_';
+	}
+	return part;
+}
+
+DeviceSession::Result ApiCache::fetch(DeviceSession &session, std::string &listing, bool &cached, bool refresh) const {
+	cached = false;
+
+	std::string versions;
+	DeviceSession::Result result = session.runLua(VERSION_SCRIPT, versions);
+	if (result == DeviceSession::Result::NoResponse) return result;
+
+	// Anything else means the script itself failed
+	if (result != DeviceSession::Result::LuaError || versions.find('\t') == std::string::npos || versions.find('\n') != std::string::npos) {
+		listing = versions.empty() ? "Unexpected reply to the version query" : versions;
+		return DeviceSession::Result::LuaError;
+	}
+
+	if (!refresh && load(versions, listing)) {
+		cached = true;
+		return DeviceSession::Result::Ok;
+	}
+
+	// The listing stays on the board until it is cleared, however this ends
+	struct Clear {
+		DeviceSession &session;
+
+		~Clear() {
+			try {
+				std::string ignored;
+				session.runLua(API_GLOBAL " = nil", ignored);
+			}
+			catch (std::exception &) {
+				// Nothing more can be sent, it goes when the board is reset
+			}
+		}
+	} clear = { session };
+
+	std::string message;
+	result = session.runLua(WALK_SCRIPT, message);
+	if (result == DeviceSession::Result::NoResponse) return result;
+
+	char *end = nullptr;
+	const size_t length = strtoul(message.c_str(), &end, 10);
+	if (result != DeviceSession::Result::LuaError || message.empty() || *end != '\0') {
+		listing = message.empty() ? "Unexpected reply to the API listing" : message;
+		return DeviceSession::Result::LuaError;
+	}
+
+	listing = versions + "\n";
+	for (size_t offset = 0; offset < length; offset += API_PAGE) {
+		// Lua strings count from 1 and sub() includes both ends
+		result = session.runLua("error(" API_GLOBAL ":sub(" + std::to_string(offset + 1) + ", " + std::to_string(offset + API_PAGE) + "), 0)", message);
+		if (result == DeviceSession::Result::NoResponse) return result;
+		if (result != DeviceSession::Result::LuaError) {
+			listing = "Unexpected reply to the API listing";
+			return DeviceSession::Result::LuaError;
+		}
+
+		std::replace(message.begin(), message.end(), API_SEPARATOR, '\n');
+		listing += message;
+	}
+
+	if (listing.size() != versions.size() + 1 + length) {
+		listing = "The API listing was cut short";
+		return DeviceSession::Result::LuaError;
+	}
+
+	save(listing);
+	return DeviceSession::Result::Ok;
+}
+
+std::string ApiCache::path(const std::string &versions) const {
+	const size_t tab = versions.find('\t');
+	if (directory.empty() || tab == std::string::npos) return std::string();
+
+	const std::string firmware = versions.substr(0, tab);
+	const std::string lua = versions.substr(tab + 1);
+
+	// Without both versions there is nothing to tell one firmware from another
+	if (firmware == "nil" || lua == "nil") return std::string();
+
+	return directory + PATH_SEPARATOR "ezLCDLua-api-" + fileNamePart(firmware) + "-" + fileNamePart(lua) + ".txt";
+}
+
+bool ApiCache::load(const std::string &versions, std::string &listing) const {
+	const std::string file_path = path(versions);
+	if (file_path.empty()) return false;
+
+	FILE *file = openFile(file_path, "rb");
+	if (!file) return false;
+
+	std::string contents;
+	char buffer[4096];
+	for (size_t count; (count = fread(buffer, 1, sizeof(buffer), file)) > 0;) contents.append(buffer, count);
+	fclose(file);
+
+	// Made by another version of the plugin, or for firmware whose name maps to the same file
+	const std::string expected = CACHE_HEADER "\n" + versions + "\n";
+	if (contents.compare(0, expected.size(), expected) != 0) return false;
+
+	listing = contents.substr(sizeof(CACHE_HEADER "\n") - 1);
+	return true;
+}
+
+bool ApiCache::save(const std::string &listing) const {
+	const std::string file_path = path(listing.substr(0, listing.find('\n')));
+	if (file_path.empty()) return false;
+
+	// Written next to it first so a half written file is never loaded
+	const std::string temp_path = file_path + ".tmp";
+	FILE *file = openFile(temp_path, "wb");
+	if (!file) return false;
+
+	bool written = fputs(CACHE_HEADER "\n", file) >= 0 && fwrite(listing.data(), 1, listing.size(), file) == listing.size();
+	written = fclose(file) == 0 && written;
+
+	return written && replaceFile(temp_path, file_path);
+}
+
+size_t ApiCache::addTo(ApiCatalog &catalog, const std::string &listing) {
+	size_t count = 0;
+
+	// The first line has the versions
+	size_t start = listing.find('\n');
+	while (start != std::string::npos && start + 1 < listing.size()) {
+		const size_t end = listing.find('\n', start + 1);
+		const std::string line = listing.substr(start + 1, end == std::string::npos ? std::string::npos : end - start - 1);
+		start = end;
+
+		const size_t space = line.rfind(' ');
+		if (space == std::string::npos || space + 2 != line.size()) continue;
+
+		const size_t dot = line.rfind('.', space);
+		const std::string table = dot == std::string::npos ? std::string() : line.substr(0, dot);
+		const std::string name = line.substr(dot == std::string::npos ? 0 : dot + 1, space - (dot == std::string::npos ? 0 : dot + 1));
+
+		catalog.add(table, name, line[space + 1] == 'f');
+		++count;
+	}
+
+	catalog.build();
+	return count;
+}
@@ -0,0 +1,59 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#pragma once
+
+#include <string>
+
+#include "ApiCatalog.h"
+#include "DeviceSession.h"
+
+// Finds out what the board's Lua has in it, for autocompletion.
+//
+// The board is asked to walk its globals (the ez table and any other
+// tables, a few levels deep) and send back a listing, one "path kind" line
+// per name where kind is f for a function, t for a table and v for anything
+// else. The first line holds ez.FirmVer and ez.LuaVer, separated by a tab.
+//
+// Listings are kept in the directory as files named after both versions, so
+// a board with firmware that was seen before is only asked for its versions.
+// A board that doesn't report them is walked every time.
+class ApiCache final {
+public:
+	ApiCache() = default;
+	explicit ApiCache(const std::string &directory) : directory(directory) {}
+
+	// Runs on the worker thread. cached tells whether the listing came from
+	// a file; refresh walks the board even if there is one. Returns the
+	// reason in listing if the board couldn't be asked.
+	DeviceSession::Result fetch(DeviceSession &session, std::string &listing, bool &cached, bool refresh = false) const;
+
+	// Where the listing for these versions is kept, empty if it can't be
+	std::string path(const std::string &versions) const;
+
+	bool load(const std::string &versions, std::string &listing) const;
+	bool save(const std::string &listing) const;
+
+	// Adds every name in the listing to its table in the catalog (e.g.
+	// ez.Button.Show goes in "ez.Button") and rebuilds it. Returns the
+	// number of names.
+	static size_t addTo(ApiCatalog &catalog, const std::string &listing);
+
+private:
+	std::string directory;
+};
@@ -0,0 +1,148 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include <algorithm>
+
+#include "ApiCatalog.h"
+
+// Copied from Scintilla
+static inline int MakeUpperCase(int ch) {
+	if (ch < 'a' || ch > 'z')
+		return ch;
+	else
+		return static_cast<char>(ch - 'a' + 'A');
+}
+
+// Copied from Scintilla
+static int CompareNCaseInsensitive(const char *a, const char *b, size_t len) {
+	while (*a && *b && len) {
+		if (*a != *b) {
+			char upperA = static_cast<char>(MakeUpperCase(*a));
+			char upperB = static_cast<char>(MakeUpperCase(*b));
+			if (upperA != upperB)
+				return upperA - upperB;
+		}
+		a++;
+		b++;
+		len--;
+	}
+	if (len == 0)
+		return 0;
+	else
+		// Either *a or *b is nul
+		return *a - *b;
+}
+
+// The order Scintilla sorts its lists in when ignoring case (copied and
+// modified from its Sorter)
+static bool LessIgnoringCase(const std::string &a, const std::string &b) {
+	const size_t len = std::min(a.length(), b.length());
+	int cmp = CompareNCaseInsensitive(a.c_str(), b.c_str(), len);
+	if (cmp == 0)
+		cmp = static_cast<int>(a.length()) - static_cast<int>(b.length());
+	return cmp < 0;
+}
+
+static const std::string empty;
+
+void ApiCatalog::add(const std::string &table, const std::string &name, bool function) {
+	Table &t = tables[table];
+	t.entries.push_back({ name, 0 });
+	t.dirty = true;
+
+	if (function) functions.insert(name);
+}
+
+void ApiCatalog::add(const std::string &table, const char *const *names, size_t count, bool function) {
+	for (size_t i = 0; i < count; ++i) add(table, names[i], function);
+}
+
+void ApiCatalog::build() {
+	for (auto &it : tables) {
+		Table &t = it.second;
+		if (!t.dirty) continue;
+
+		// Names only differing in case go in a fixed order too, so the list can
+		// be merged with others sorted the same way
+		std::sort(t.entries.begin(), t.entries.end(), [](const Entry &a, const Entry &b) { return ApiCatalog::lessByName(a.name, b.name); });
+		t.entries.erase(std::unique(t.entries.begin(), t.entries.end(), [](const Entry &a, const Entry &b) { return a.name == b.name; }), t.entries.end());
+
+		t.list.clear();
+		for (Entry &entry : t.entries) {
+			if (!t.list.empty()) t.list += ' ';
+			entry.offset = t.list.size();
+			t.list += entry.name;
+		}
+
+		t.dirty = false;
+	}
+}
+
+void ApiCatalog::clear() {
+	tables.clear();
+	functions.clear();
+	narrowed.clear();
+}
+
+const std::string &ApiCatalog::complete(const std::string &table, const std::string &prefix) {
+	auto it = tables.find(table);
+	if (it == tables.end()) return empty;
+
+	if (it->second.dirty) build();
+	const Table &t = it->second;
+
+	if (prefix.empty()) return t.list;
+
+	auto first = std::lower_bound(t.entries.begin(), t.entries.end(), prefix, [](const Entry &entry, const std::string &prefix) {
+		return LessIgnoringCase(entry.name, prefix);
+	});
+	auto last = std::upper_bound(first, t.entries.end(), prefix, [](const std::string &prefix, const Entry &entry) {
+		return CompareNCaseInsensitive(prefix.c_str(), entry.name.c_str(), prefix.length()) < 0;
+	});
+
+	if (first == last) return empty;
+	if (first == t.entries.begin() && last == t.entries.end()) return t.list;
+
+	const Entry &back = *(last - 1);
+	narrowed.assign(t.list, first->offset, back.offset + back.name.length() - first->offset);
+	return narrowed;
+}
+
+bool ApiCatalog::isFunction(const std::string &name) const {
+	return functions.count(name) != 0;
+}
+
+bool ApiCatalog::lessIgnoringCase(const std::string &a, const std::string &b) {
+	return LessIgnoringCase(a, b);
+}
+
+bool ApiCatalog::lessByName(const std::string &a, const std::string &b) {
+	if (LessIgnoringCase(a, b)) return true;
+	if (LessIgnoringCase(b, a)) return false;
+	return a < b;
+}
+
+bool ApiCatalog::startsWithIgnoringCase(const std::string &name, const std::string &prefix) {
+	return name.length() >= prefix.length() && CompareNCaseInsensitive(prefix.c_str(), name.c_str(), prefix.length()) == 0;
+}
+
+size_t ApiCatalog::size() const {
+	size_t count = 0;
+	for (const auto &it : tables) count += it.second.entries.size();
+	return count;
+}
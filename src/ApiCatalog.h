@@ -0,0 +1,83 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Names offered by autocompletion, grouped by the table they are in (e.g.
+// "ez" for ez.Cls).
+//
+// Each table's names are sorted and joined into the space separated list
+// SCI_AUTOCSHOW takes once, when the catalog is built. Completing a prefix
+// is a binary search for the matching names, which are a single stretch of
+// that list.
+class ApiCatalog final {
+public:
+	ApiCatalog() = default;
+	ApiCatalog(const ApiCatalog&) = delete;
+	ApiCatalog& operator=(const ApiCatalog&) = delete;
+
+	// Adding a name that is already in the table does nothing. Functions get
+	// parentheses added when they are picked.
+	void add(const std::string &table, const std::string &name, bool function);
+	void add(const std::string &table, const char *const *names, size_t count, bool function);
+
+	// Sorts and joins whatever was added since the last build
+	void build();
+
+	void clear();
+
+	// The names of table starting with prefix, ignoring case, in the order
+	// Scintilla expects with SCI_AUTOCSETIGNORECASE (see lessByName). Empty
+	// if there are none.
+	// Only valid until the next call.
+	const std::string &complete(const std::string &table, const std::string &prefix);
+
+	bool isFunction(const std::string &name) const;
+
+	size_t size() const;
+
+	// The order Scintilla sorts its lists in when ignoring case, the same
+	// with names that only differ in case in a fixed order (the one the
+	// lists are in), and whether name would be shown for prefix
+	static bool lessIgnoringCase(const std::string &a, const std::string &b);
+	static bool lessByName(const std::string &a, const std::string &b);
+	static bool startsWithIgnoringCase(const std::string &name, const std::string &prefix);
+
+private:
+	struct Entry {
+		std::string name;
+		size_t offset; // Where it starts in the table's list
+	};
+
+	struct Table {
+		std::vector<Entry> entries;
+		std::string list;
+		bool dirty = false;
+	};
+
+	std::map<std::string, Table> tables;
+	std::unordered_set<std::string> functions;
+
+	// Holds a narrowed list, which needs its own null terminator
+	std::string narrowed;
+};
@@ -0,0 +1,379 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include "CommandQueue.h"
+
+// How long the worker listens to the device at a time while it has nothing
+// else to do. Anything submitted in the meantime wakes it up right away.
+#define IDLE_POLL_MS 1000
+
+// How long stop() waits for the worker once it was told to abort
+#define STOP_TIMEOUT_MS 2000
+
+CommandQueue::CommandQueue(DeviceSession &session) :
+	session(session),
+	next_id(1),
+	outstanding(0),
+	window(1),
+	stopping(false),
+	finished(false),
+	failed_batch(0),
+	worker(&CommandQueue::run, this) {}
+
+CommandQueue::~CommandQueue() {
+	stop();
+
+	// The worker may still be using the session and the queue
+	std::unique_lock<std::mutex> lock(mutex);
+	stopped.wait(lock, [this] { return finished; });
+}
+
+void CommandQueue::setNotify(std::function<void()> notify) {
+	std::lock_guard<std::mutex> lock(mutex);
+	this->notify = notify;
+}
+
+void CommandQueue::setWindow(size_t window) {
+	std::lock_guard<std::mutex> lock(mutex);
+	this->window = window > 0 ? window : 1;
+}
+
+unsigned int CommandQueue::submit(const char *source, int tag) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (stopping) return 0;
+
+	Request request;
+	request.id = next_id++;
+	request.batch = 0;
+	request.tag = tag;
+	request.counted = true;
+	request.source = source;
+
+	requests.push_back(std::move(request));
+	++outstanding;
+	wakeup.notify_one();
+	session.wake();
+
+	return requests.back().id;
+}
+
+unsigned int CommandQueue::submitBatch(const std::vector<std::string> &sources, int tag) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (stopping || sources.empty()) return 0;
+
+	const unsigned int first = next_id;
+
+	for (const std::string &source : sources) {
+		Request request;
+		request.id = next_id++;
+		request.batch = first;
+		request.tag = tag;
+		request.counted = true;
+		request.source = source;
+
+		requests.push_back(std::move(request));
+		++outstanding;
+	}
+	wakeup.notify_one();
+	session.wake();
+
+	return first;
+}
+
+void CommandQueue::post(std::function<void(DeviceSession &)> task) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (stopping) return;
+
+	Request request;
+	request.id = 0;
+	request.batch = 0;
+	request.tag = 0;
+	request.counted = false;
+	request.task = [task](DeviceSession &session, std::string &) {
+		task(session);
+		return Completion::Status::Ok;
+	};
+
+	requests.push_back(std::move(request));
+	wakeup.notify_one();
+	session.wake();
+}
+
+unsigned int CommandQueue::submitTask(Task task, int tag, bool background) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (stopping) return 0;
+
+	Request request;
+	request.id = next_id++;
+	request.batch = 0;
+	request.tag = tag;
+	request.counted = !background;
+	request.task = task;
+
+	requests.push_back(std::move(request));
+	if (!background) ++outstanding;
+	wakeup.notify_one();
+	session.wake();
+
+	return requests.back().id;
+}
+
+bool CommandQueue::takeCompletion(Completion &completion) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (completions.empty()) return false;
+
+	completion = std::move(completions.front());
+	completions.pop_front();
+	if (completion.counted) --outstanding;
+
+	return true;
+}
+
+size_t CommandQueue::pending() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return outstanding;
+}
+
+void CommandQueue::stop() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (stopping) return;
+
+		stopping = true;
+		for (const Request &request : requests) {
+			if (request.counted) --outstanding;
+		}
+		requests.clear();
+		wakeup.notify_one();
+
+		// Cuts short whatever is in progress, however long its timeout is.
+		// The worker resumes the session once it is done with it.
+		session.abort();
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	const bool done = stopped.wait_for(lock, std::chrono::milliseconds(STOP_TIMEOUT_MS), [this] { return finished; });
+	lock.unlock();
+
+	if (done) {
+		worker.join();
+	}
+	else {
+		// Stuck in a call the port can't interrupt (e.g. opening it). Rather
+		// than hang whoever is stopping, let it finish in the background.
+		worker.detach();
+	}
+}
+
+void CommandQueue::run() {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	session.setOutputHandler([this](DeviceSession::Output kind, const char *data, size_t length) { received(kind, data, length); });
+
+	while (true) {
+		// With nothing to do, listen for whatever the device says on its own
+		// until the port closes
+		while (!stopping && requests.empty() && in_flight.empty()) {
+			lock.unlock();
+			const bool listening = session.pollOutput(IDLE_POLL_MS);
+			lock.lock();
+
+			if (!listening) break;
+		}
+
+		wakeup.wait(lock, [this] { return stopping || !requests.empty() || !in_flight.empty(); });
+		if (requests.empty() && in_flight.empty()) break;
+
+		// Top up the window. Tasks wait until nothing is in flight since they
+		// may change the connection out from under the pending replies.
+		while (in_flight.size() < window && !requests.empty() && !requests.front().task) {
+			// Skipped ones wait for the replies ahead of them so everything
+			// completes in the order it was submitted
+			const bool skipped = requests.front().batch != 0 && requests.front().batch == failed_batch;
+			if (skipped && !in_flight.empty()) break;
+
+			Request request = std::move(requests.front());
+			requests.pop_front();
+
+			if (skipped) {
+				std::string message;
+				lock.unlock();
+				complete(request, Completion::Status::Skipped, message);
+				lock.lock();
+				continue;
+			}
+
+			lock.unlock();
+			try {
+				session.sendLua(request.source);
+			}
+			catch (std::exception &e) {
+				in_flight.push_back(std::move(request));
+				abort(e.what());
+				lock.lock();
+				break;
+			}
+			lock.lock();
+
+			in_flight.push_back(std::move(request));
+		}
+
+		if (in_flight.empty()) {
+			if (!requests.empty() && requests.front().task) {
+				Request request = std::move(requests.front());
+				requests.pop_front();
+				lock.unlock();
+
+				std::string message;
+				Completion::Status status;
+				try {
+					status = request.task(session, message);
+				}
+				catch (std::exception &e) {
+					status = Completion::Status::Failed;
+					message = e.what();
+				}
+
+				// Posted tasks only touch configuration, there is no one to report to
+				if (request.id != 0) {
+					complete(request, status, message);
+				}
+
+				lock.lock();
+			}
+			continue;
+		}
+
+		lock.unlock();
+
+		// Replies come back in the same order the statements were sent
+		std::string message;
+		Completion::Status status;
+		try {
+			switch (session.receiveResult(message)) {
+				case DeviceSession::Result::Ok:
+					status = Completion::Status::Ok;
+					break;
+				case DeviceSession::Result::LuaError:
+					status = Completion::Status::LuaError;
+					break;
+				case DeviceSession::Result::NoResponse:
+				default:
+					status = Completion::Status::NoResponse;
+					break;
+			}
+		}
+		catch (std::exception &e) {
+			abort(e.what());
+			lock.lock();
+			continue;
+		}
+
+		Request request = std::move(in_flight.front());
+		in_flight.pop_front();
+
+		if (status != Completion::Status::Ok && request.batch != 0) {
+			failed_batch = request.batch;
+		}
+
+		complete(request, status, message);
+
+		// Without a reply the link can't be trusted to line up with what is
+		// still in flight, so don't wait on each of those to time out as well
+		if (status == Completion::Status::NoResponse) {
+			while (!in_flight.empty()) {
+				std::string skipped;
+				complete(in_flight.front(), Completion::Status::Skipped, skipped);
+				in_flight.pop_front();
+			}
+		}
+
+		lock.lock();
+	}
+
+	session.setOutputHandler(nullptr);
+	session.close();
+	session.resume();
+
+	finished = true;
+	stopped.notify_all();
+}
+
+void CommandQueue::complete(const Request &request, Completion::Status status, std::string &message) {
+	Completion completion;
+	completion.id = request.id;
+	completion.tag = request.tag;
+	completion.status = status;
+	completion.message = std::move(message);
+	completion.counted = request.counted;
+
+	std::function<void()> notify;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		completions.push_back(std::move(completion));
+		notify = this->notify;
+	}
+
+	if (notify) notify();
+}
+
+void CommandQueue::received(DeviceSession::Output kind, const char *data, size_t length) {
+	const Completion::Status status = kind == DeviceSession::Output::Text ? Completion::Status::Output : Completion::Status::DeviceError;
+
+	std::function<void()> notify;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// Text goes onto the end of whatever hasn't been taken yet, so however
+		// much the device sends the owner is only woken up once for it
+		if (status == Completion::Status::Output && !completions.empty() && completions.back().status == Completion::Status::Output) {
+			completions.back().message.append(data, length);
+			return;
+		}
+
+		Completion completion;
+		completion.id = 0;
+		completion.tag = 0;
+		completion.status = status;
+		completion.message.assign(data, length);
+		completion.counted = false;
+
+		completions.push_back(std::move(completion));
+		notify = this->notify;
+	}
+
+	if (notify) notify();
+}
+
+void CommandQueue::abort(const char *reason) {
+	if (in_flight.empty()) return;
+
+	if (in_flight.front().batch != 0) {
+		failed_batch = in_flight.front().batch;
+	}
+
+	// The first statement gets the blame, the rest never got an answer
+	bool first = true;
+
+	while (!in_flight.empty()) {
+		std::string message = first ? reason : "";
+		complete(in_flight.front(), first ? Completion::Status::Failed : Completion::Status::Skipped, message);
+		in_flight.pop_front();
+		first = false;
+	}
+}
@@ -0,0 +1,138 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DeviceSession.h"
+
+// Result of a statement that went through the CommandQueue
+struct Completion {
+	// Skipped means an earlier statement of the same batch failed, so this
+	// one was never sent. Output and DeviceError don't belong to a statement
+	// (their id is 0): they are the text the device printed and the errors it
+	// raised on its own, in between the results in the order they arrived.
+	enum class Status { Ok, LuaError, NoResponse, Failed, Skipped, Output, DeviceError };
+
+	unsigned int id;
+	int tag;
+	Status status;
+	std::string message; // Lua error or exception text
+	bool counted; // Counts towards CommandQueue::pending()
+};
+
+// Runs all device I/O on a dedicated worker thread so the caller never blocks
+// on the serial link. Statements are executed in the order they are
+// submitted, and their results are collected in a completion queue.
+//
+// Up to window statements are kept in flight on the link instead of waiting
+// for each reply before sending the next one. Replies are matched to
+// statements in order. In between statements the worker keeps listening to
+// the device, so output from scripts that are still running isn't lost.
+class CommandQueue final {
+public:
+	explicit CommandQueue(DeviceSession &session);
+	CommandQueue(const CommandQueue&) = delete;
+	CommandQueue& operator=(const CommandQueue&) = delete;
+	~CommandQueue();
+
+	// Called on the worker thread each time a completion is ready. It is meant
+	// to wake up the owning thread (e.g. by posting a window message), which
+	// then drains the completions with takeCompletion(). Output that arrives
+	// while the last completion is still output is added onto that one
+	// without another call.
+	void setNotify(std::function<void()> notify);
+
+	// Maximum number of statements sent ahead of their replies (at least 1)
+	void setWindow(size_t window);
+
+	// The tag is handed back untouched in the completion
+	unsigned int submit(const char *source, int tag = 0);
+
+	// Statements of a batch depend on each other. Once one of them fails the
+	// rest of the batch that hasn't been sent yet completes as Skipped. With
+	// a window above 1 the ones already in flight when the error comes back
+	// still run. Returns the id of the first statement, the others follow
+	// consecutively.
+	unsigned int submitBatch(const std::vector<std::string> &sources, int tag = 0);
+
+	// Runs the task on the worker thread, in order with the statements. This is
+	// the only safe way to touch the session once the queue is running.
+	void post(std::function<void(DeviceSession &)> task);
+
+	// Same as post() but the task reports back through a completion like a
+	// statement does. Exceptions thrown by the task complete it as Failed.
+	// Background tasks are the owner's own business and aren't counted by
+	// pending().
+	typedef std::function<Completion::Status(DeviceSession &, std::string &message)> Task;
+	unsigned int submitTask(Task task, int tag = 0, bool background = false);
+
+	bool takeCompletion(Completion &completion);
+
+	// Number of statements and tasks whose completion has not been taken
+	// yet, apart from background tasks
+	size_t pending() const;
+
+	// Discards anything not started yet, aborts whatever is in progress and
+	// waits a moment for the worker to close the session and finish. One
+	// stuck in the driver is left to finish on its own; the destructor does
+	// wait for it. Nothing can be submitted afterwards.
+	void stop();
+
+private:
+	struct Request {
+		unsigned int id;
+		unsigned int batch;
+		int tag;
+		bool counted;
+		std::string source;
+		Task task; // Requests without an id don't report a completion
+	};
+
+	DeviceSession &session;
+
+	mutable std::mutex mutex;
+	std::condition_variable wakeup;
+	std::deque<Request> requests;
+	std::deque<Completion> completions;
+	std::function<void()> notify;
+	unsigned int next_id;
+	size_t outstanding;
+	size_t window;
+	bool stopping;
+	bool finished;
+	std::condition_variable stopped;
+
+	// Only used by the worker thread
+	std::deque<Request> in_flight;
+	unsigned int failed_batch;
+
+	std::thread worker;
+
+	void run();
+	void complete(const Request &request, Completion::Status status, std::string &message);
+	void received(DeviceSession::Output kind, const char *data, size_t length);
+	void abort(const char *reason);
+};
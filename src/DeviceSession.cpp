@@ -0,0 +1,817 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "DeviceSession.h"
+
+#define DEFAULT_BAUD_RATE 115200
+#define TIMEOUT_MS 1000
+#define RX_CHUNK 512
+
+// Response deadlines. Until the board has answered anything it gets
+// INITIAL_RESPONSE_MS, after that never less than MIN_RESPONSE_MS.
+#define INITIAL_RESPONSE_MS 500
+#define MIN_RESPONSE_MS 250
+// Output keeps a command's deadline moving, but only up to this many times
+// the deadline it started with
+#define MAX_RESPONSE_FACTOR 20
+// Assumed time per byte of source until a large enough script was timed
+#define DEFAULT_MS_PER_BYTE 0.02
+#define LARGE_SCRIPT 4096
+// Slack on top of the time the link needs to send a command
+#define WRITE_MARGIN_MS 100
+// Longest pause in an error message once the board started sending it
+#define MESSAGE_GAP_MS 100
+// How long to wait for the rest of a line that starts like a reply
+#define OUTPUT_GAP_MS 2
+
+// Sent ahead of everything else on a new connection. Afterwards each line the
+// board prints starts with OUTPUT_MARK (ASCII record separator), so a '1' at
+// the start of any other line has to be a reply.
+#define OUTPUT_MARK 0x1E
+#define MARK_PRINT "if not __ezlcd_print then local p = print __ezlcd_print = p print = function(...) if select(\"#\", ...) == 0 then p(\"\\30\") else p(\"\\30\" .. tostring((...)), select(2, ...)) end end end"
+
+// Every printable character, so a rate that mangles bits is caught
+#define PROBE_TOKEN " !\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`abcdefghijklmnopqrstuvwxyz{|}~"
+#define PROBE_ATTEMPTS 3
+
+// What the handshake has the board fail with, nothing else answers like that
+#define HANDSHAKE_TOKEN "ezLCDLua handshake"
+#define HANDSHAKE_TIMEOUT_MS 500
+// Some drivers take their time opening a port, don't wait on them for long
+#define DETECT_TIMEOUT_MS 2000
+
+// Global table on the device holding the cached chunks
+#define CHUNK_TABLE "__ezlcd_chunks"
+#define CHUNK_MISS "ezlcd-chunk-miss"
+#define MAX_CHUNKS 8
+
+static std::string hashKey(const std::string &source) {
+	// 64 bit FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char c : source) {
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+
+	static const char digits[] = "0123456789abcdef";
+	std::string key(16, '0');
+	for (int i = 15; i >= 0; --i, hash >>= 4) {
+		key[i] = digits[hash & 0xF];
+	}
+	return key;
+}
+
+// Whether the board is on port. A leading NUL ends anything half sent before.
+static bool handshake(const std::string &port, uint32_t baudrate, serial::flowcontrol_t flowcontrol) {
+	static const uint8_t nul = 0;
+	static const uint8_t command = RUN_LUA;
+	static const std::string script = "error(\"" HANDSHAKE_TOKEN "\", 0)";
+	static const std::string expected = std::string(1, static_cast<char>(RUN_LUA_ERROR)) + HANDSHAKE_TOKEN + std::string(1, '\0');
+
+	try {
+		serial::Serial serial(port, baudrate, serial::Timeout::simpleTimeout(HANDSHAKE_TIMEOUT_MS), serial::eightbits, serial::parity_none, serial::stopbits_one, flowcontrol);
+		serial.write({ serial::ConstBuffer(&nul, 1), serial::ConstBuffer(&command, 1), serial::ConstBuffer(script), serial::ConstBuffer(&nul, 1) });
+
+		// Skip over whatever the device was already saying
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(HANDSHAKE_TIMEOUT_MS);
+		std::string reply;
+		while (reply.find(expected) == std::string::npos) {
+			if (std::chrono::steady_clock::now() >= deadline || reply.size() > RX_CHUNK) return false;
+			if (serial.read(reply, std::max<size_t>(serial.available(), 1)) == 0) return false;
+		}
+		return true;
+	}
+	catch (std::exception &) {
+		// Can't be opened, or it's in use
+		return false;
+	}
+}
+
+DeviceSession::DeviceSession() :
+	baudrate(DEFAULT_BAUD_RATE),
+	flowcontrol(serial::flowcontrol_none),
+	serial(nullptr),
+	rx(RX_CHUNK),
+	rx_start(0),
+	rx_end(0),
+	bytes_sent(0),
+	response_known(false),
+	response_ms(0),
+	response_var_ms(0),
+	per_byte_ms(DEFAULT_MS_PER_BYTE),
+	timeout(serial::Timeout::simpleTimeout(TIMEOUT_MS)),
+	line_start(true),
+	settled(false),
+	mark_sent(false),
+	print_marked(false),
+	polling(false),
+	woken(false),
+	wake_pending(false),
+	aborted(false) {}
+
+DeviceSession::~DeviceSession() {
+	close();
+}
+
+void DeviceSession::setPort(const std::string &port) {
+	if (port != this->port) {
+		close();
+		this->port = port;
+
+		// Could well be a different board
+		response_known = false;
+		per_byte_ms = DEFAULT_MS_PER_BYTE;
+	}
+}
+
+void DeviceSession::setBaudrate(uint32_t baudrate) {
+	this->baudrate = baudrate;
+	if (isOpen()) serial->setBaudrate(baudrate);
+}
+
+void DeviceSession::setFlowcontrol(serial::flowcontrol_t flowcontrol) {
+	this->flowcontrol = flowcontrol;
+	if (isOpen()) serial->setFlowcontrol(flowcontrol);
+}
+
+uint32_t DeviceSession::probeBaudrate(const std::vector<uint32_t> &candidates) {
+	const uint32_t original = baudrate;
+	const std::string token = PROBE_TOKEN;
+
+	// A quoted Lua string needs the quote and backslash escaped
+	std::string script = "error(\"";
+	for (char c : token) {
+		if (c == '"' || c == '\\') script.push_back('\\');
+		script.push_back(c);
+	}
+	script.append("\", 0)");
+
+	std::vector<uint32_t> rates(candidates);
+	std::sort(rates.begin(), rates.end(), [](uint32_t a, uint32_t b) { return a > b; });
+
+	// The wrong rates produce nothing but garbage, so the output goes nowhere
+	// until the probe is over, however it ends. Unless a rate worked the
+	// original one comes back too.
+	struct Restore {
+		DeviceSession &session;
+		OutputHandler handler;
+		uint32_t baudrate;
+
+		~Restore() {
+			session.output = handler;
+			if (baudrate == 0) return;
+
+			try {
+				session.setBaudrate(baudrate);
+			}
+			catch (std::exception &) {
+				// The next command opens the port again at the right rate
+				session.close();
+			}
+		}
+	} restore = { *this, nullptr, original };
+	std::swap(restore.handler, output);
+
+	for (uint32_t rate : rates) {
+		bool good = true;
+
+		try {
+			setBaudrate(rate);
+
+			for (int i = 0; i < PROBE_ATTEMPTS && good; ++i) {
+				// Terminate anything left half sent by an earlier (wrong) rate and
+				// throw away whatever garbage the device said about it
+				const uint8_t nul = 0;
+				write({ serial::ConstBuffer(&nul, 1) });
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+				bool reused;
+				connection(reused).flushInput();
+				rx_start = rx_end = 0;
+				line_start = true;
+				mark_sent = print_marked = false;
+
+				std::string message;
+				good = runLua(script, message) == Result::LuaError && message == token;
+			}
+		}
+		catch (std::exception &) {
+			if (aborted) throw;
+
+			// Most likely the driver doesn't support this rate
+			close();
+			good = false;
+		}
+
+		if (good) {
+			restore.baudrate = 0; // Keep it
+			return rate;
+		}
+	}
+
+	return 0;
+}
+
+bool DeviceSession::detectPort() {
+	const std::vector<serial::PortInfo> ports = serial::list_ports();
+
+	// Shared with the probes, one stuck opening its port may outlive this call
+	struct Probes {
+		std::mutex mutex;
+		std::condition_variable done;
+		size_t remaining;
+		size_t found;      // First to answer, or the one with the device ID
+		bool preferred;    // found has the device ID, no need to wait for the rest
+	};
+	const size_t none = ports.size();
+	auto probes = std::make_shared<Probes>();
+	probes->remaining = ports.size();
+	probes->found = none;
+	probes->preferred = false;
+
+	// The session's own port has to be free to be probed
+	close();
+
+	for (size_t i = 0; i < ports.size(); ++i) {
+		const bool preferred = device_id.empty() || ports[i].hardware_id == device_id;
+
+		std::thread([probes, i, none, preferred, port = ports[i].port, baudrate = baudrate, flowcontrol = flowcontrol]() {
+			const bool answered = handshake(port, baudrate, flowcontrol);
+
+			std::lock_guard<std::mutex> lock(probes->mutex);
+			if (answered && !probes->preferred && (preferred || probes->found == none)) {
+				probes->found = i;
+				probes->preferred = preferred;
+			}
+			--probes->remaining;
+			probes->done.notify_one();
+		}).detach();
+	}
+
+	std::unique_lock<std::mutex> lock(probes->mutex);
+	probes->done.wait_for(lock, std::chrono::milliseconds(DETECT_TIMEOUT_MS), [&probes]() { return probes->remaining == 0 || probes->preferred; });
+
+	const size_t found = probes->found;
+	lock.unlock();
+	if (found == none) return false;
+
+	port = ports[found].port;
+
+	// Ports that aren't USB can't be told apart
+	const std::string &id = ports[found].hardware_id;
+	device_id = id == "n/a" ? std::string() : id;
+	return true;
+}
+
+bool DeviceSession::isOpen() const {
+	return serial != nullptr && serial->isOpen();
+}
+
+void DeviceSession::close() {
+	rx_start = rx_end = 0;
+	line_start = true;
+	settled = false;
+	mark_sent = print_marked = false;
+
+	// Their replies are lost with the connection
+	sent.clear();
+
+	// The device may have been reset by the time the port is opened again
+	chunks.clear();
+
+	if (serial == nullptr) return;
+
+	try {
+		serial->close();
+	}
+	catch (std::exception &) {
+		// The handle is being thrown away regardless
+	}
+
+	std::lock_guard<std::mutex> lock(wake_mutex);
+	delete serial;
+	serial = nullptr;
+}
+
+DeviceSession::Result DeviceSession::runLua(const std::string &source, std::string &message) {
+	sendLua(source);
+	return receiveResult(message);
+}
+
+DeviceSession::Result DeviceSession::runCached(const std::string &source, std::string &message, bool &cached) {
+	const std::string key = hashKey(source);
+	const std::string entry = CHUNK_TABLE "[\"" + key + "\"]";
+
+	auto found = std::find(chunks.begin(), chunks.end(), key);
+	cached = found != chunks.end();
+
+	if (cached) {
+		chunks.erase(found);
+
+		Result result = runLua("local f = " CHUNK_TABLE " and " + entry + " if not f then error(\"" CHUNK_MISS "\", 0) end return f()", message);
+		if (result != Result::LuaError || message != CHUNK_MISS) {
+			chunks.push_back(key);
+			return result;
+		}
+
+		// The device lost it, send the whole thing again
+		message.clear();
+		cached = false;
+	}
+
+	// Wrap the source in a function stored on the device. Everything added
+	// in front stays on the first line so the line numbers don't change.
+	std::string wrapped = CHUNK_TABLE " = " CHUNK_TABLE " or {} ";
+	if (chunks.size() >= MAX_CHUNKS) {
+		wrapped += CHUNK_TABLE "[\"" + chunks.front() + "\"] = nil ";
+		chunks.erase(chunks.begin());
+	}
+	wrapped += entry + " = function(...) ";
+	wrapped += source;
+	wrapped += "\nend return " + entry + "()";
+
+	Result result = runLua(wrapped, message);
+
+	// Whatever the result, the function may be stored on the device by now
+	// (it raised an error, or the reply got lost), and it has to count
+	// towards MAX_CHUNKS to be evicted again. If it never compiled the next
+	// run finds that out and sends the whole thing again.
+	chunks.push_back(key);
+
+	return result;
+}
+
+void DeviceSession::sendLua(const std::string &source) {
+	static const uint8_t command = RUN_LUA;
+	static const uint8_t terminator = 0;
+
+	static const std::string mark = MARK_PRINT;
+
+	// Allow twice what the link needs, for USB latency and flow control. The
+	// size is known, so the constant carries all of it. A multiplier in whole
+	// milliseconds per byte would round down to 0 from 20000 baud up.
+	const size_t bytes = source.size() + 2;
+	const double budget = WRITE_MARGIN_MS + 2 * transferMs(bytes + (mark_sent ? 0 : mark.size() + 2));
+	timeout.write_timeout_multiplier = 0;
+	timeout.write_timeout_constant = static_cast<uint32_t>(std::min(std::ceil(budget), static_cast<double>(serial::Timeout::max() - 1)));
+	applyTimeout();
+
+	if (!mark_sent) {
+		if (write({ serial::ConstBuffer(&command, 1), serial::ConstBuffer(mark), serial::ConstBuffer(&terminator, 1) }) != mark.size() + 2)
+			abandonFrame();
+		sent.push_back({ Clock::now(), mark.size() + 2, true });
+		mark_sent = true;
+	}
+
+	// The RUN_LUA command goes out in one write without copying the source
+	if (write({ serial::ConstBuffer(&command, 1), serial::ConstBuffer(source), serial::ConstBuffer(&terminator, 1) }) != bytes)
+		abandonFrame();
+
+	sent.push_back({ Clock::now(), bytes, false });
+}
+
+void DeviceSession::abandonFrame() {
+	// The write timed out part way, leaving the device inside the frame.
+	// Terminate it so the next command is framed right, whatever the device
+	// makes of what it got. Its reply and the ones still in flight are lost
+	// with the connection.
+	try {
+		const uint8_t nul = 0;
+		if (serial != nullptr) serial->write(&nul, 1);
+	}
+	catch (std::exception &) {
+	}
+	close();
+
+	throw std::runtime_error("Timed out sending to the device");
+}
+
+DeviceSession::Result DeviceSession::receiveResult(std::string &message) {
+	// Replies to what the session sent on its own come first
+	while (!sent.empty() && sent.front().internal) {
+		const Sent setup = sent.front();
+		sent.pop_front();
+
+		const Result result = receiveReply(setup, message);
+		if (result == Result::NoResponse) return result;
+
+		print_marked = result == Result::Ok;
+	}
+
+	Sent command = { Clock::now(), 0, false };
+	if (!sent.empty()) {
+		command = sent.front();
+		sent.pop_front();
+	}
+
+	return receiveReply(command, message);
+}
+
+DeviceSession::Result DeviceSession::receiveReply(const Sent &command, std::string &message) {
+	message.clear();
+
+	// With several in flight the board only gets to this one after answering
+	// the one before
+	const Clock::time_point start = std::max(command.time, last_reply);
+
+	// Pass on whatever the script prints until the 1 byte return value shows up
+	while (true) {
+		const Scan scan = scanOutput(true);
+		if (scan == Scan::Reply) break;
+
+		if (scan == Scan::Undecided) {
+			timeout.read_timeout_constant = OUTPUT_GAP_MS + static_cast<uint32_t>(std::ceil(4 * transferMs(1)));
+		}
+		else {
+			// A board that is still printing is clearly alive, so the wait
+			// starts over with each bit of output. A script printing in an
+			// endless loop would hold up everything behind it though, so
+			// there is a limit. A constant of 0 would mean no timeout at all
+			// on Windows.
+			const Clock::time_point now = Clock::now();
+			const double limit = responseTimeout(command.bytes);
+			const double waited = std::chrono::duration<double, std::milli>(now - std::max(start, last_output)).count();
+			const double left = MAX_RESPONSE_FACTOR * limit - std::chrono::duration<double, std::milli>(now - start).count();
+			if (left <= 0) {
+				sent.clear();
+				return Result::NoResponse;
+			}
+			timeout.read_timeout_constant = static_cast<uint32_t>(std::max(std::min(limit - waited, left), 1.0));
+		}
+		timeout.read_timeout_multiplier = 0;
+		applyTimeout();
+
+		// Once the link went quiet the next scan can make up its mind
+		if (!fill() && scan != Scan::Undecided) {
+			// Whatever else is in flight can't be matched up with its reply now
+			sent.clear();
+			return Result::NoResponse;
+		}
+	}
+
+	const uint8_t status = rx[rx_start++];
+	last_reply = Clock::now();
+
+	// The time spent printing says nothing about how quickly the board answers
+	if (last_output < start) {
+		learnResponse(std::chrono::duration<double, std::milli>(last_reply - start).count(), command.bytes);
+	}
+
+	if (status == RUN_LUA_ERROR) {
+		// The error message follows as a null terminated string, and the
+		// board sends it in one go
+		timeout.read_timeout_constant = MESSAGE_GAP_MS;
+		timeout.read_timeout_multiplier = static_cast<uint32_t>(std::ceil(2 * transferMs(1)));
+		applyTimeout();
+
+		readUntil(0, message);
+		return Result::LuaError;
+	}
+
+	// else if (status == RUN_LUA_OK)
+	return Result::Ok;
+}
+
+bool DeviceSession::pollOutput(uint32_t timeout_ms) {
+	if (!isOpen()) return false;
+
+	timeout.read_timeout_constant = timeout_ms;
+	timeout.read_timeout_multiplier = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex);
+
+		// Woken up before it got here, whatever it was for is waiting already
+		if (wake_pending) {
+			wake_pending = false;
+			return true;
+		}
+
+		polling = true;
+		woken = false;
+	}
+
+	bool woke = false;
+	try {
+		applyTimeout();
+		const bool received = fill();
+		{
+			std::lock_guard<std::mutex> lock(wake_mutex);
+			polling = false;
+			woke = woken;
+		}
+
+		// Cut short, the link didn't necessarily go quiet
+		if (!received && woke) settled = false;
+
+		scanOutput(false);
+
+		// A wake up that came once the read was over would cut the next one short
+		if (woke && isOpen()) serial->waitReadable(0);
+	}
+	catch (std::exception &) {
+		// The device went away, the next command reports it
+		{
+			std::lock_guard<std::mutex> lock(wake_mutex);
+			polling = false;
+		}
+		close();
+	}
+
+	return isOpen();
+}
+
+void DeviceSession::wake() {
+	std::lock_guard<std::mutex> lock(wake_mutex);
+
+	// Not waiting yet, so the next pollOutput() doesn't start to
+	if (!polling) {
+		wake_pending = true;
+		return;
+	}
+	if (woken || serial == nullptr) return;
+
+	woken = true;
+	serial->interrupt();
+}
+
+void DeviceSession::abort() {
+	aborted = true;
+
+	std::lock_guard<std::mutex> lock(wake_mutex);
+	if (serial != nullptr) serial->interrupt();
+}
+
+serial::Serial &DeviceSession::connection(bool &reused) {
+	if (aborted) throw std::runtime_error("The connection was stopped");
+
+	if (isOpen()) {
+		try {
+			// Querying the port fails once the device has gone away (e.g. unplugged)
+			serial->available();
+			reused = true;
+			return *serial;
+		}
+		catch (serial::IOException &) {
+			close();
+		}
+	}
+
+	close();
+
+	// Nothing configured, but the board may have been found before
+	if (port.empty()) port = findDevicePort();
+
+	serial::Serial *opened;
+	try {
+		opened = open(port);
+	}
+	catch (serial::IOException &) {
+		// The board may have come back on a different port
+		const std::string moved = findDevicePort();
+		if (moved.empty() || moved == port) throw;
+
+		port = moved;
+		opened = open(port);
+	}
+
+	std::lock_guard<std::mutex> lock(wake_mutex);
+	serial = opened;
+
+	// An abort() while the port was opening had nothing to interrupt
+	if (aborted) throw std::runtime_error("The connection was stopped");
+
+	reused = false;
+	return *serial;
+}
+
+serial::Serial *DeviceSession::open(const std::string &port) const {
+	return new serial::Serial(port, baudrate, timeout, serial::eightbits, serial::parity_none, serial::stopbits_one, flowcontrol);
+}
+
+void DeviceSession::applyTimeout() {
+	if (isOpen()) serial->setTimeout(timeout);
+}
+
+double DeviceSession::transferMs(size_t bytes) const {
+	// 8N1 framing is 10 bits per byte
+	return bytes * 10000.0 / baudrate;
+}
+
+uint32_t DeviceSession::responseTimeout(size_t bytes) const {
+	double ms = INITIAL_RESPONSE_MS;
+	if (response_known) ms = std::max(response_ms + 4 * response_var_ms, static_cast<double>(MIN_RESPONSE_MS));
+
+	// The write returns once the driver has the command, so it may still be
+	// on its way. Then the board has to take in the whole script.
+	ms += transferMs(bytes) + 2 * per_byte_ms * bytes;
+
+	return static_cast<uint32_t>(std::min(std::ceil(ms), static_cast<double>(serial::Timeout::max() - 1)));
+}
+
+void DeviceSession::learnResponse(double ms, size_t bytes) {
+	double board_ms = std::max(ms - transferMs(bytes), 0.0);
+
+	// Only a large script says anything about the time per byte
+	if (bytes >= LARGE_SCRIPT && response_known) {
+		const double rate = std::max(board_ms - response_ms, 0.0) / bytes;
+		per_byte_ms += (rate - per_byte_ms) / 4;
+	}
+	board_ms = std::max(board_ms - per_byte_ms * bytes, 0.0);
+
+	if (!response_known) {
+		response_ms = board_ms;
+		response_var_ms = board_ms / 2;
+		response_known = true;
+	}
+	else {
+		response_var_ms += (std::abs(response_ms - board_ms) - response_var_ms) / 4;
+		response_ms += (board_ms - response_ms) / 8;
+	}
+}
+
+std::string DeviceSession::findDevicePort() const {
+	if (device_id.empty()) return std::string();
+
+	for (const serial::PortInfo &info : serial::list_ports()) {
+		if (info.hardware_id == device_id) return info.port;
+	}
+	return std::string();
+}
+
+size_t DeviceSession::write(std::initializer_list<serial::ConstBuffer> buffers) {
+	bool reused;
+
+	size_t written;
+
+	try {
+		written = connection(reused).write(buffers);
+		bytes_sent += written;
+		return written;
+	}
+	catch (serial::IOException &) {
+		if (!reused) throw;
+	}
+
+	// The cached connection went stale, try again on a fresh one
+	close();
+	written = connection(reused).write(buffers);
+	bytes_sent += written;
+	return written;
+}
+
+size_t DeviceSession::read(uint8_t *buffer, size_t size) {
+	bool reused;
+
+	try {
+		return connection(reused).read(buffer, size);
+	}
+	catch (serial::IOException &) {
+		// Whatever was in flight is lost, so don't bother retrying
+		close();
+		throw;
+	}
+}
+
+bool DeviceSession::fill() {
+	// Move any leftovers to the front so the buffer doesn't keep growing
+	if (rx_start == rx_end) {
+		rx_start = rx_end = 0;
+	}
+	else if (rx_start > 0) {
+		memmove(rx.data(), rx.data() + rx_start, rx_end - rx_start);
+		rx_end -= rx_start;
+		rx_start = 0;
+	}
+
+	bool reused;
+	serial::Serial &port = connection(reused);
+
+	// Block for at least one byte, but take everything that is already waiting
+	size_t wanted = port.available();
+	if (wanted == 0) wanted = 1;
+	if (rx.size() - rx_end < wanted) rx.resize(rx_end + wanted);
+
+	size_t bytes_read = read(rx.data() + rx_end, wanted);
+	rx_end += bytes_read;
+	settled = bytes_read == 0;
+	return bytes_read > 0;
+}
+
+bool DeviceSession::readByte(uint8_t &byte) {
+	if (rx_start == rx_end && !fill()) return false;
+
+	byte = rx[rx_start++];
+	return true;
+}
+
+bool DeviceSession::readUntil(uint8_t terminator, std::string &message) {
+	while (true) {
+		const uint8_t *start = rx.data() + rx_start;
+		const uint8_t *found = static_cast<const uint8_t *>(memchr(start, terminator, rx_end - rx_start));
+
+		if (found != nullptr) {
+			message.append(reinterpret_cast<const char *>(start), found - start);
+			rx_start += found - start + 1; // skip the terminator too
+			return true;
+		}
+
+		message.append(reinterpret_cast<const char *>(start), rx_end - rx_start);
+		rx_start = rx_end;
+
+		if (!fill()) return false;
+	}
+}
+
+DeviceSession::Scan DeviceSession::scanOutput(bool expecting) {
+	while (rx_start < rx_end) {
+		const uint8_t *start = rx.data() + rx_start;
+		const uint8_t *end = rx.data() + rx_end;
+
+		// Printed by print(), so it can only be text
+		if (line_start && *start == OUTPUT_MARK) {
+			++rx_start;
+			line_start = false;
+			continue;
+		}
+
+		// A reply looks like a line starting with '1' or '0'. Unless print()
+		// marks its lines the bytes after it tell them apart: text never has a
+		// NUL in it and a reply never has a line break. Until one of those
+		// arrives the link has to go quiet before it counts as a reply.
+		if (line_start && (*start == RUN_LUA_ERROR || (expecting && *start == RUN_LUA_OK))) {
+			if (*start == RUN_LUA_OK && print_marked) return Scan::Reply;
+
+			// A marked line can't start in the middle of another one either
+			const uint8_t *next = std::find_if(start + 1, end, [](uint8_t c) { return c == '\n' || c == 0 || c == OUTPUT_MARK; });
+
+			const bool reply = next != end ? *next != '\n' : settled;
+			if (!reply && next == end) return Scan::Undecided;
+
+			if (reply && expecting) return Scan::Reply;
+
+			// Nothing is waiting on an error, so something else on the board raised it
+			if (reply && next != end && *next == 0) {
+				emit(Output::Error, start + 1, next - start - 1);
+				rx_start += next - start + 1;
+				continue;
+			}
+		}
+
+		// Pass on the rest of the line, or as much of it as there is. A marked
+		// line starting means this one ended without a line break.
+		const uint8_t *stop = std::find_if(start, end, [](uint8_t c) { return c == '\n' || c == OUTPUT_MARK; });
+		const bool newline = stop != end && *stop == '\n';
+		const bool marked_next = stop != end && *stop == OUTPUT_MARK;
+		if (newline) ++stop;
+
+		// Something written without a line break has the reply right behind
+		// it, so a trailing '1' is held back until it's clear what it is
+		const bool trailing = !newline && expecting && stop > start && stop[-1] == RUN_LUA_OK;
+		if (trailing) --stop;
+
+		emit(Output::Text, start, stop - start);
+		rx_start += stop - start;
+		line_start = newline || marked_next;
+
+		if (trailing) {
+			if (!marked_next && !settled) return Scan::Undecided;
+
+			line_start = true;
+			return Scan::Reply;
+		}
+	}
+
+	return Scan::More;
+}
+
+void DeviceSession::emit(Output kind, const uint8_t *data, size_t length) {
+	if (length == 0 && kind == Output::Text) return;
+
+	last_output = Clock::now();
+	if (output) output(kind, reinterpret_cast<const char *>(data), length);
+}
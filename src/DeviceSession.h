@@ -0,0 +1,214 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "serial/serial.h"
+
+#define RUN_LUA 0xA7
+#define RUN_LUA_OK 0x31
+#define RUN_LUA_ERROR 0x30
+
+// Long lived connection to the ezLCD controller board. The port is opened the
+// first time it is needed and then kept open across statements.
+//
+// Deadlines are worked out per command from its size, the baud rate and how
+// long the board has been taking to answer, so a board that went away is
+// noticed quickly while a large upload still gets all the time it needs.
+class DeviceSession final {
+public:
+	DeviceSession();
+	DeviceSession(const DeviceSession&) = delete;
+	DeviceSession& operator=(const DeviceSession&) = delete;
+	~DeviceSession();
+
+	// Changing the port closes any existing connection
+	void setPort(const std::string &port);
+	const std::string &getPort() const { return port; }
+
+	// Hardware ID (see serial::PortInfo) of the board. If the port can't be
+	// opened the session looks for a port with this ID, so a board that
+	// comes back on a different port after being replugged is found again.
+	void setDeviceId(const std::string &id) { device_id = id; }
+	const std::string &getDeviceId() const { return device_id; }
+
+	// Sends a harmless RUN_LUA handshake to every serial port at once and
+	// switches to the one that answers like a board, preferring the one with
+	// the remembered device ID. Its hardware ID is remembered in its place.
+	// Returns false and leaves the port alone if nothing answered.
+	bool detectPort();
+
+	// These are applied right away if the port is already open
+	void setBaudrate(uint32_t baudrate);
+	uint32_t getBaudrate() const { return baudrate; }
+	void setFlowcontrol(serial::flowcontrol_t flowcontrol);
+	serial::flowcontrol_t getFlowcontrol() const { return flowcontrol; }
+
+	// Tries each rate (fastest first) with a known script the device echoes
+	// back in an error message. The session is left at the fastest rate that
+	// came back intact, which is returned. Returns 0 and keeps the original
+	// rate if none of them worked.
+	uint32_t probeBaudrate(const std::vector<uint32_t> &candidates);
+
+	bool isOpen() const;
+	void close();
+
+	enum class Result { Ok, LuaError, NoResponse };
+
+	// Sends a RUN_LUA command and waits for the reply. If the device reports
+	// an error its message is stored in message.
+	Result runLua(const std::string &source, std::string &message);
+
+	// Like runLua, but the compiled chunk is kept on the device keyed by a hash
+	// of the source. Running the same source again only sends a short call to
+	// the cached function, so the device skips both the upload and compiling
+	// it. Falls back to a full upload if the device no longer has it. cached
+	// tells whether the copy on the device was used.
+	Result runCached(const std::string &source, std::string &message, bool &cached);
+
+	// The two halves of runLua, so several commands can be in flight at once.
+	// The device answers commands in the order they were sent.
+	void sendLua(const std::string &source);
+	Result receiveResult(std::string &message);
+
+	// How long a command of the given size gets for its reply, in ms
+	uint32_t responseTimeout(size_t bytes) const;
+
+	// Everything written to the device so far, framing included
+	uint64_t bytesSent() const { return bytes_sent; }
+
+	// Whatever the device says besides replies: the text scripts print, and
+	// errors raised outside of a command (e.g. in a timer callback), which
+	// the board frames like a RUN_LUA_ERROR reply. Since the status bytes are
+	// the characters '1' and '0', the session has the board's print() mark
+	// each line it sends (see OUTPUT_MARK) before anything else is run.
+	enum class Output { Text, Error };
+	typedef std::function<void(Output kind, const char *data, size_t length)> OutputHandler;
+
+	// The handler runs on whichever thread is reading. Without one the
+	// output is thrown away.
+	void setOutputHandler(OutputHandler handler) { output = handler; }
+
+	// Waits up to timeout_ms for output while no command is in flight. This
+	// never opens the port, it returns false if there is none to listen to.
+	bool pollOutput(uint32_t timeout_ms);
+
+	// Cuts short a pollOutput() that another thread is waiting in, so that
+	// thread gets on with whatever came up without waiting for the timeout.
+	// If none is waiting yet the next one returns right away. Anything else
+	// the session is doing is left alone.
+	void wake();
+
+	// Makes whatever the session is doing on another thread give up as soon
+	// as it can. A read or write in progress is cut short, and everything
+	// that needs the port throws until resume() is called.
+	void abort();
+	void resume() { aborted = false; }
+
+	// Both of these (re)open the port as needed. If a write fails on a
+	// connection that was reused from a previous statement the link is
+	// assumed to be dead and is reopened once before giving up.
+	size_t write(std::initializer_list<serial::ConstBuffer> buffers);
+	size_t read(uint8_t *buffer, size_t size);
+
+	// Framed reads served from an internal buffer. Each refill drains
+	// everything the driver already has queued instead of a byte at a time.
+	// Both return false if the read timed out first.
+	bool readByte(uint8_t &byte);
+	bool readUntil(uint8_t terminator, std::string &message);
+
+private:
+	std::string port;
+	std::string device_id;
+	uint32_t baudrate;
+	serial::flowcontrol_t flowcontrol;
+	serial::Serial *serial;
+
+	// Bytes received but not consumed yet are rx[rx_start, rx_end)
+	std::vector<uint8_t> rx;
+	size_t rx_start;
+	size_t rx_end;
+
+	// Keys of the chunks the device should have, least recently used first
+	std::vector<std::string> chunks;
+
+	typedef std::chrono::steady_clock Clock;
+
+	// Commands sent but not answered yet, when each went out and its size
+	struct Sent {
+		Clock::time_point time;
+		size_t bytes;
+		bool internal; // Sent by the session itself, nobody waits for it
+	};
+	std::deque<Sent> sent;
+	Clock::time_point last_reply;
+	uint64_t bytes_sent;
+
+	// Smoothed time the board takes to answer and how much it varies (as in
+	// RFC 6298), plus the time it spends per byte of source
+	bool response_known;
+	double response_ms;
+	double response_var_ms;
+	double per_byte_ms;
+
+	serial::Timeout timeout;
+
+	OutputHandler output;
+	Clock::time_point last_output;
+
+	// Whether the next byte received starts a line, and whether the link
+	// has gone quiet since it was last read
+	bool line_start;
+	bool settled;
+
+	// Whether the board was asked to mark its printed lines, and did
+	bool mark_sent;
+	bool print_marked;
+
+	// Keeps serial from being replaced while wake() uses it, along with
+	// whether a pollOutput() is waiting and was woken up already, or is
+	// to return right away since wake() came before it started waiting
+	std::mutex wake_mutex;
+	bool polling;
+	bool woken;
+	bool wake_pending;
+	std::atomic<bool> aborted;
+
+	enum class Scan { More, Undecided, Reply };
+
+	serial::Serial &connection(bool &reused);
+	serial::Serial *open(const std::string &port) const;
+	std::string findDevicePort() const;
+	void applyTimeout();
+	double transferMs(size_t bytes) const;
+	void learnResponse(double ms, size_t bytes);
+	bool fill();
+	void abandonFrame();
+	Result receiveReply(const Sent &command, std::string &message);
+	Scan scanOutput(bool expecting);
+	void emit(Output kind, const uint8_t *data, size_t length);
+};
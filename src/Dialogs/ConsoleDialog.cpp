@@ -21,6 +21,7 @@
 #include "ConsoleDialog.h"
 #include "resource.h"
 #include "LuaConsole.h"
+#include "PromptMargin.h"
 
 #include <Commctrl.h>
 
@@ -30,10 +31,19 @@
 #define GET_X_LPARAM(lp) ((int)(short)LOWORD(lp))
 #define GET_Y_LPARAM(lp) ((int)(short)HIWORD(lp))
 
+// Style of error messages in the output window
+#define STYLE_ERROR 39
+
+// Timer on the output window for output that came in less than a frame after the last flush.
+// Scintilla's own timers use small IDs.
+#define IDT_FLUSHOUTPUT 100
+
 ConsoleDialog::ConsoleDialog() :
 	m_console(NULL),
 	m_prompt("> "),
 	m_currentHistory(0),
+	m_pending(0),
+	m_inputLines(0),
 	m_hContext(NULL) {}
 
 ConsoleDialog::~ConsoleDialog() {
@@ -105,18 +115,13 @@ INT_PTR CALLBACK ConsoleDialog::run_dlgProc(UINT message, WPARAM wParam, LPARAM
 
 			// Subclass some stuff
 			SetWindowSubclass((HWND)m_sciInput.GetID(), ConsoleDialog::inputWndProc, 0, reinterpret_cast<DWORD_PTR>(this));
-			SetWindowSubclass((HWND)m_sciOutput.GetID(), ConsoleDialog::scintillaWndProc, 0, reinterpret_cast<DWORD_PTR>(this));
+
+			setPending(m_pending);
 			return FALSE;
-		case WM_SIZE: {
-			RECT rect = { 0, 0, LOWORD(lParam), HIWORD(lParam) };
-			int h = min(m_sciInput.Call(SCI_GETLINECOUNT), 8) * m_sciInput.Call(SCI_TEXTHEIGHT, 1);
-			MoveWindow((HWND)m_sciOutput.GetID(), 0, 0, rect.right, rect.bottom - h - 14, TRUE);
-			MoveWindow((HWND)m_sciInput.GetID(), 0, rect.bottom - h - 14, rect.right - 50, h + 9, TRUE);
-			m_sciOutput.Call(SCI_DOCUMENTEND);
-
-			MoveWindow(::GetDlgItem(_hSelf, IDC_RUN), rect.right - 50, rect.bottom - 30, 50, 25, TRUE);
+		case WM_SIZE:
+			layout(LOWORD(lParam), HIWORD(lParam));
+			MoveWindow(::GetDlgItem(_hSelf, IDC_RUN), LOWORD(lParam) - 50, HIWORD(lParam) - 30, 50, 25, TRUE);
 			return FALSE;
-		}
 		case WM_CONTEXTMENU: {
 				MENUITEMINFO mi;
 				mi.cbSize = sizeof(mi);
@@ -166,23 +171,16 @@ INT_PTR CALLBACK ConsoleDialog::run_dlgProc(UINT message, WPARAM wParam, LPARAM
 				switch (nmhdr->code) {
 					case SCN_MODIFIED: {
 						SCNotification* scn = reinterpret_cast<SCNotification*>(lParam);
-						if ((scn->modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT))) {
-							if (scn->linesAdded != 0) {
+						if ((scn->modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT)) && scn->linesAdded != 0) {
+							// The input grows up to 8 lines, past that only the lines changed
+							if (min(m_sciInput.Call(SCI_GETLINECOUNT), 8) != m_inputLines) {
 								RECT rect;
 								GetClientRect(_hSelf, &rect);
-								int h = min(m_sciInput.Call(SCI_GETLINECOUNT), 8) * m_sciInput.Call(SCI_TEXTHEIGHT, 1);
-								MoveWindow((HWND)m_sciOutput.GetID(), 0, 0, rect.right, rect.bottom - h - 14, TRUE);
-								MoveWindow((HWND)m_sciInput.GetID(), 0, rect.bottom - h - 14, rect.right - 50, h + 9, TRUE);
-								m_sciOutput.Call(SCI_DOCUMENTEND);
+								layout(rect.right, rect.bottom);
 							}
 
-							// Not the most efficient way but by far the easiest to do it here
-							int startLine = 0;
-							int endLine = m_sciInput.Call(SCI_GETLINECOUNT);
-							for (int i = startLine; i < endLine; ++i) {
-								m_sciInput.CallString(SCI_MARGINSETTEXT, i, ">");
-								m_sciInput.Call(SCI_MARGINSETSTYLE, i, STYLE_LINENUMBER);
-							}
+							GUI::ScintillaWindow::Batch batch(m_sciInput);
+							UpdatePrompt(m_sciInput, scn);
 						}
 						break;
 					}
@@ -301,6 +299,12 @@ LRESULT CALLBACK ConsoleDialog::inputWndProc(HWND hWnd, UINT uMsg, WPARAM wParam
 }
 
 void ConsoleDialog::runStatement() {
+	// Anything still buffered came before the statement
+	flushOutput(true);
+
+	// Echoing the statement marks every one of its lines, the status is checked once at the end
+	GUI::ScintillaWindow::Batch batch(m_sciOutput);
+
 	int prevLastLine = m_sciOutput.Call(SCI_GETLINECOUNT);
 	int newLastLine = 0;
 
@@ -313,25 +317,31 @@ void ConsoleDialog::runStatement() {
 	m_sciOutput.Call(SCI_DOCUMENTEND);
 	m_sciOutput.Call(SCI_SETREADONLY, 0);
 	m_sciOutput.CallString(SCI_ADDSTYLEDTEXT, 2 * (tr.chrg.cpMax - tr.chrg.cpMin), tr.lpstrText);
-	writeText(2, "\r\n");
+	m_sciOutput.CallString(SCI_ADDTEXT, 2, "\r\n");
 	m_sciOutput.Call(SCI_SETREADONLY, 1);
+	m_sciOutput.Call(SCI_DOCUMENTEND);
 
 	delete[] tr.lpstrText;
 
 	newLastLine = m_sciOutput.Call(SCI_GETLINECOUNT);
 
-	for (int i = prevLastLine; i < newLastLine; ++i) {
-		m_sciOutput.CallString(SCI_MARGINSETTEXT, i - 1, ">");
-		m_sciOutput.Call(SCI_MARGINSETSTYLE, i - 1, STYLE_LINENUMBER);
-	}
+	MarkPrompt(m_sciOutput, prevLastLine - 1, newLastLine - 2);
 
 	const char *text = (const char *)m_sciInput.CallReturnPointer(SCI_GETCHARACTERPOINTER);
 	historyAdd(GUI::StringFromUTF8(text).c_str());
 	m_console->runStatement(text);
 	m_sciInput.Call(SCI_CLEARALL);
 	m_sciInput.Call(SCI_EMPTYUNDOBUFFER);
-	m_sciInput.CallString(SCI_MARGINSETTEXT, 0, ">");
-	m_sciInput.Call(SCI_MARGINSETSTYLE, 0, STYLE_LINENUMBER);
+	MarkPrompt(m_sciInput, 0, 0); // Clearing removes all margin text
+}
+
+void ConsoleDialog::layout(int width, int height) {
+	m_inputLines = min(m_sciInput.Call(SCI_GETLINECOUNT), 8);
+
+	int h = m_inputLines * m_sciInput.Call(SCI_TEXTHEIGHT, 1);
+	MoveWindow((HWND)m_sciOutput.GetID(), 0, 0, width, height - h - 14, TRUE);
+	MoveWindow((HWND)m_sciInput.GetID(), 0, height - h - 14, width - 50, h + 9, TRUE);
+	m_sciOutput.Call(SCI_DOCUMENTEND);
 }
 
 void ConsoleDialog::setPrompt(const char *prompt) {
@@ -340,19 +350,37 @@ void ConsoleDialog::setPrompt(const char *prompt) {
 	//::SetWindowTextA(::GetDlgItem(_hSelf, IDC_PROMPT), prompt);
 }
 
+void ConsoleDialog::setPending(size_t count) {
+	m_pending = count;
+	if (!isCreated()) return;
+
+	if (count == 0)
+		::SetDlgItemText(_hSelf, IDC_RUN, TEXT("Run"));
+	else
+		::SetDlgItemText(_hSelf, IDC_RUN, (TEXT("Run (") + std::to_wstring(count) + TEXT(")")).c_str());
+}
+
+void ConsoleDialog::notifyCompletion() const {
+	::PostMessage((HWND)m_sciOutput.GetID(), WM_COMMANDCOMPLETE, 0, 0);
+}
+
 void ConsoleDialog::createOutputWindow(HWND hParentWindow) {
 	HWND sci = (HWND)::SendMessage(_hParent, NPPM_CREATESCINTILLAHANDLE, 0, reinterpret_cast<LPARAM>(hParentWindow));
 	SetWindowLongPtr(sci, GWL_STYLE, GetWindowLongPtr(sci, GWL_STYLE) | WS_TABSTOP);
 
 	m_sciOutput.SetID(sci);
 
+	// The output window exists even before the dialog is created, so completions are posted to it
+	SetWindowSubclass(sci, ConsoleDialog::scintillaWndProc, 0, reinterpret_cast<DWORD_PTR>(this));
+	m_output.setNotify([sci]() { ::PostMessage(sci, WM_OUTPUTPENDING, 0, 0); });
+
 	m_sciOutput.Call(SCI_USEPOPUP, 0); 
 
 	// Set up the styles
 	m_console->setupOutput(m_sciOutput);
 
 	// Also add any additional styles
-	m_sciOutput.Call(SCI_STYLESETFORE, 39, 0x0000FF); // Red error message
+	m_sciOutput.Call(SCI_STYLESETFORE, STYLE_ERROR, 0x0000FF); // Red error message
 
 	// Margin for the prompt
 	m_sciOutput.Call(SCI_SETMARGINWIDTHN, 1, m_sciOutput.CallString(SCI_TEXTWIDTH, STYLE_DEFAULT, ">") * 2);
@@ -401,43 +429,62 @@ void ConsoleDialog::createInputWindow(HWND hParentWindow) {
 
 	m_sciInput.Call(SCI_CLEARCMDKEY, SCK_RETURN); // don't allow normal new lines
 
-	m_sciInput.CallString(SCI_MARGINSETTEXT, 0, ">");
-	m_sciInput.Call(SCI_MARGINSETSTYLE, 0, STYLE_LINENUMBER);
+	MarkPrompt(m_sciInput, 0, 0);
 }
 
 LRESULT CALLBACK ConsoleDialog::scintillaWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam, UINT_PTR uIdSubclass, DWORD_PTR dwRefData) {
+	ConsoleDialog *cd = reinterpret_cast<ConsoleDialog *>(dwRefData);
+
+	if (uMsg == WM_COMMANDCOMPLETE) {
+		cd->m_console->processCompletions();
+		return 0;
+	}
+
+	if (uMsg == WM_OUTPUTPENDING) {
+		cd->flushOutput();
+		return 0;
+	}
+
+	if (uMsg == WM_TIMER && wParam == IDT_FLUSHOUTPUT) {
+		KillTimer(hWnd, IDT_FLUSHOUTPUT);
+		cd->flushOutput();
+		return 0;
+	}
+
 	// No idea what this does, but it seems to help a bit.
 	if (uMsg == WM_GETDLGCODE) return DLGC_WANTARROWS | DLGC_WANTCHARS;
 	return DefSubclassProc(hWnd, uMsg, wParam, lParam);
 }
 
 void ConsoleDialog::writeText(size_t length, const char *text) {
-	m_sciOutput.Call(SCI_SETREADONLY, 0);
-	m_sciOutput.CallString(SCI_APPENDTEXT, length, text);
-	m_sciOutput.Call(SCI_SETREADONLY, 1);
-	m_sciOutput.Call(SCI_DOCUMENTEND);
+	m_output.write(text, length);
 }
 
 void ConsoleDialog::writeError(size_t length, const char *text) {
-	typedef struct {
-		unsigned char c;
-		unsigned char style;
-	} cell;
+	m_output.write(text, length, STYLE_ERROR);
+}
 
-	std::vector<cell> cells(length + 1);
+void ConsoleDialog::flushOutput(bool force) {
+	// Everything since the last flush goes in with one insertion and one scroll
+	uint32_t wait = m_output.flush([this](const char *cells, size_t length) {
+		GUI::ScintillaWindow::Batch batch(m_sciOutput);
+		m_sciOutput.Call(SCI_SETREADONLY, 0);
+		m_sciOutput.Call(SCI_SETEMPTYSELECTION, m_sciOutput.Call(SCI_GETLENGTH)); // make sure it's at the end
+		m_sciOutput.CallString(SCI_ADDSTYLEDTEXT, length, cells);
+		m_scrollback.trim(m_sciOutput);
+		m_sciOutput.Call(SCI_SETREADONLY, 1);
+		m_sciOutput.Call(SCI_DOCUMENTEND);
+	}, force);
+
+	if (wait > 0) SetTimer((HWND)m_sciOutput.GetID(), IDT_FLUSHOUTPUT, wait, NULL);
+}
 
-	for (size_t i = 0; i < length; ++i) {
-		cells[i].c = text[i];
-		cells[i].style = 39;
-	}
-	cells[length].c = 0;
-	cells[length].style = 0;
+void ConsoleDialog::setScrollback(size_t lines, size_t bytes) {
+	m_scrollback.setLimits(lines, bytes);
+}
 
-	m_sciOutput.Call(SCI_SETREADONLY, 0);
-	m_sciOutput.Call(SCI_DOCUMENTEND); // make sure it's at the end
-	m_sciOutput.CallString(SCI_ADDSTYLEDTEXT, length * 2, (const char *)cells.data());
-	m_sciOutput.Call(SCI_SETREADONLY, 1);
-	m_sciOutput.Call(SCI_DOCUMENTEND);
+void ConsoleDialog::setScrollbackLog(const wchar_t *path) {
+	m_scrollback.setLog(path && path[0] ? _wfopen(path, L"ab") : nullptr);
 }
 
 void ConsoleDialog::display(bool toShow) const {
@@ -477,6 +524,7 @@ void ConsoleDialog::hide() {
 }
 
 void ConsoleDialog::clearText() {
+	m_output.clear();
 	m_sciOutput.Call(SCI_SETREADONLY, 0);
 	m_sciOutput.Call(SCI_CLEARALL);
 	m_sciOutput.Call(SCI_SETSCROLLWIDTH, 1);
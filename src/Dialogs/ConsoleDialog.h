@@ -27,10 +27,18 @@
 #include "StaticDialog.h"
 #include "Scintilla.h"
 #include "GUI.h"
+#include "OutputSink.h"
+#include "Scrollback.h"
 
 struct NppData;
 class LuaConsole;
 
+// Posted when the LuaConsole has completed statements waiting to be processed
+#define WM_COMMANDCOMPLETE (WM_APP + 1)
+
+// Posted when there is new text for the output window
+#define WM_OUTPUTPENDING (WM_APP + 2)
+
 class ConsoleDialog : public StaticDialog {
 public:
 	ConsoleDialog();
@@ -42,11 +50,24 @@ public:
 	void doDialog();
 	void hide();
 
+	// The text is buffered and shows up with the next frame. Safe to call from any thread
 	void writeText(size_t length, const char *text);
 	void writeError(size_t length, const char *text);
 	void clearText();
+
+	// Oldest output is dropped past either limit (0 for none). If there is a
+	// log file, dropped output is appended to it.
+	void setScrollback(size_t lines, size_t bytes);
+	void setScrollbackLog(const wchar_t *path);
+
 	void setPrompt(const char *prompt);
 
+	// Number of statements still waiting on the device
+	void setPending(size_t count);
+
+	// Safe to call from any thread
+	void notifyCompletion() const;
+
 	HWND getSciOutputHwnd() { return (HWND)m_sciOutput.GetID(); }
 	HWND getSciInputHwnd() { return (HWND)m_sciInput.GetID(); }
 
@@ -65,6 +86,10 @@ private:
 	void createOutputWindow(HWND hParentWindow);
 	void createInputWindow(HWND hParentWindow);
 	void runStatement();
+	void flushOutput(bool force = false);
+
+	// Sizes the output and input windows to fit the input's lines
+	void layout(int width, int height);
 
 	static LRESULT CALLBACK inputWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam, UINT_PTR uIdSubclass, DWORD_PTR dwRefData);
 	static LRESULT CALLBACK scintillaWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam, UINT_PTR uIdSubclass, DWORD_PTR dwRefData);
@@ -79,6 +104,8 @@ private:
 	tTbData m_data;
 	GUI::ScintillaWindow m_sciOutput;
 	GUI::ScintillaWindow m_sciInput;
+	OutputSink m_output;
+	Scrollback m_scrollback;
 
 	LuaConsole *m_console;
 	std::string m_prompt;
@@ -87,6 +114,11 @@ private:
 	std::wstring m_curLine;
 	size_t m_currentHistory;
 
+	size_t m_pending;
+
+	// Lines the input window was last sized for
+	int m_inputLines;
+
 	HMENU m_hContext;
 
 	int *cmdID = nullptr;
@@ -19,14 +19,17 @@
 
 #pragma once
 
+#include <set>
+
 #include "ConsoleDialog.h"
 #include "PluginInterface.h"
 
-#include "serial/serial.h"
-
-#define RUN_LUA 0xA7
-#define RUN_LUA_OK 0x31
-#define RUN_LUA_ERROR 0x30
+#include "ApiCache.h"
+#include "ApiCatalog.h"
+#include "DeviceSession.h"
+#include "CommandQueue.h"
+#include "LuaScanner.h"
+#include "SymbolIndex.h"
 
 class LuaConsole final {
 public:
@@ -37,9 +40,33 @@ public:
 		delete npp_data;
 	}
 
-	void setComPort(std::string& port) { this->port = port; }
-
-	bool runStatement(const char* statement);
+	void setComPort(std::string& port);
+	void setDeviceId(const std::string& id);
+	void setPipelineWindow(size_t window) { queue.setWindow(window); }
+	void setBaudrate(uint32_t baudrate);
+	void setMinify(bool minify) { this->minify = minify; }
+	void setCache(bool cache) { this->cache = cache; }
+	void setFlowcontrol(serial::flowcontrol_t flowcontrol);
+	void setApiCacheDirectory(const std::string& directory) { api_cache = ApiCache(directory); }
+
+	// Probes the device in the background. The callback is run on the UI
+	// thread with the fastest rate that worked.
+	void detectBaudrate(std::function<void(uint32_t)> onDetected);
+
+	// Looks for the board on every serial port in the background. The
+	// callback is run on the UI thread with the port and its hardware ID.
+	void detectPort(std::function<void(const std::string&, const std::string&)> onDetected);
+	void disconnect() { queue.stop(); }
+
+	// Asks the board for everything its Lua has, even if the firmware was
+	// seen before, and replaces the autocomplete lists with it. This happens
+	// on its own, from the cache if possible, after the first statement is run.
+	void refreshCatalog();
+
+	// The statement is queued and runs in the background. Anything it reports
+	// is written to the console once it completes.
+	void runStatement(const char* statement, bool fromFile = false);
+	void processCompletions();
 
 	void setupInput(GUI::ScintillaWindow &sci);
 	void setupOutput(GUI::ScintillaWindow &sci);
@@ -48,18 +75,52 @@ public:
 
 	void showAutoCompletion();
 
+	// Keeps track of the names defined in the Lua files open in Notepad++, so
+	// they can be autocompleted too. sci is the editor showing the buffer.
+	void indexDocument(uintptr_t buffer, HWND sci, bool lua);
+	void documentModified(uintptr_t buffer, HWND sci, const SCNotification *scn);
+	void forgetDocument(uintptr_t buffer);
+
 	ConsoleDialog *console;
 private:
 	NppData* npp_data;
 
 	// Autocomplete lists
-	std::vector<std::string> ez_props;
-	std::vector<std::string> ez_funcs;
+	ApiCatalog catalog;
+	ApiCache api_cache;
+	bool catalog_fetched;
+	bool catalog_retry; // The board didn't answer, try again once it does
+	SymbolIndex symbols;
+	std::set<uintptr_t> indexed;
 
-	std::string port;
+	// Tags used to tell completions apart
+	enum { tag_console, tag_file, tag_probe, tag_detect, tag_catalog, tag_refresh_catalog };
+
+	DeviceSession session;
+	CommandQueue queue;
+
+	std::function<void(uint32_t)> on_baud_detected;
+	std::function<void(const std::string&, const std::string&)> on_port_detected;
+
+	// Local copy of the session's settings for use on the UI thread
+	uint32_t baudrate;
+	bool minify;
+	bool cache;
 
 	GUI::ScintillaWindow *sci_input;
 
+	// Kept so typing in the input doesn't allocate
+	BraceMap braces;
+	int brace_highlight[2];
+	std::string completion_table;
+	std::string completion_word;
+	std::string completion_list;
+	std::string completion_name;
+	std::vector<std::string> completion_defined;
+
+	void fetchCatalog(bool refresh);
+	size_t resetCatalog(const std::string &listing);
+
 	void maintainIndentation();
 	void braceMatch();
 };
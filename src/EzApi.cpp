@@ -0,0 +1,134 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include "EzApi.h"
+
+const char *const EzFunctions[] = {
+	"SetXY",
+	"SetX",
+	"SetY",
+	"GetX",
+	"GetY",
+	"RGB",
+	"GetRed",
+	"GetGreen",
+	"GetBlue",
+	"SetColor",
+	"SetRGBColor",
+	"ReplaceColor",
+	"GetPixel",
+	"SetAlpha",
+	"TrColorNone",
+	"SetTrColor",
+	"SetPenSize",
+	"Deg",
+	"Rad",
+	"Button",
+	"DelButtons",
+	"SetButtonEvents",
+	"Cls",
+	"Fill",
+	"FillBound",
+	"HLine",
+	"VLine",
+	"Line",
+	"LineAng",
+	"Circle",
+	"CircleFill",
+	"Ellipse",
+	"EllipseFill",
+	"Arc",
+	"Pie",
+	"EllipseArc",
+	"EllipsePie",
+	"Box",
+	"BoxFill",
+	"Polygon",
+	"Plot",
+	"SetBmFont",
+	"SetFtFont",
+	"GetNoOfBmFonts",
+	"GetNoOfFtFonts",
+	"CacheFtChars",
+	"SetFtUnibase",
+	"TextNorth",
+	"TextEast",
+	"TextSouth",
+	"TextWest",
+	"SetFtAngle",
+	"PutPictNo",
+	"GetPictHeight",
+	"GetPictWidth",
+	"LightOn",
+	"LightOff",
+	"LightBright",
+	"SdScreenCapture",
+	"Get_ms",
+	"Wait_ms",
+	"SetTime",
+	"Timer",
+	"TimerStart",
+	"TimerStop",
+	"GetTouchX",
+	"GetTouchY",
+	"TouchDn",
+	"SetTouchEvent",
+	"RS232Open",
+	"Rs232Close",
+	"Rs232Tx",
+	"Rs232TxStr",
+	"Rs232RxLen",
+	"Rs232Rxgetc",
+	"I2CopenMaster",
+	"I2CWrite",
+	"I2Cread",
+	"SetPinInp",
+	"SetPinsInp",
+	"SetPinOut",
+	"SetPinsOut",
+	"SetPinIntr",
+	"RestorePin",
+	"RestorePins",
+	"Pin",
+	"Pins",
+	"SetDispFrame",
+	"GetDispFrame",
+	"GetNextDispFrame",
+	"SetDrawFrame",
+	"GetDrawFrame",
+	"GetNoOfFrames",
+	"CopyFrame",
+	"MergeFrame",
+	"CopyRect",
+	"MergeRect",
+	"ExitReq"
+};
+const size_t EzFunctionCount = sizeof(EzFunctions) / sizeof(EzFunctions[0]);
+
+const char *const EzProperties[] = {
+	"Width",
+	"Height",
+	"BytesPerPixel",
+	"FirmVer",
+	"LuaVer",
+	"NoOfFrames",
+	"NoOfPicts",
+	"NoOfBmFonts",
+	"NoOfFtFonts"
+};
+const size_t EzPropertyCount = sizeof(EzProperties) / sizeof(EzProperties[0]);
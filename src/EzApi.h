@@ -0,0 +1,29 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#pragma once
+
+#include <cstddef>
+
+// Names the ezLCD firmware exposes in its global ez table. This is shared by
+// the plugin (for highlighting and autocompletion) and the device simulator.
+extern const char *const EzFunctions[];
+extern const size_t EzFunctionCount;
+
+extern const char *const EzProperties[];
+extern const size_t EzPropertyCount;
@@ -20,107 +20,17 @@
 #include <sstream>
 #include <algorithm>
 #include "LuaConsole.h"
+#include "LuaMinifier.h"
+#include "LuaScanner.h"
+#include "EzApi.h"
 #include "SciLexer.h"
 
 
 #define INDIC_BRACEHIGHLIGHT INDIC_CONTAINER
 #define INDIC_BRACEBADLIGHT INDIC_CONTAINER + 1
 
-// Copied from Scintilla
-inline int MakeUpperCase(int ch) {
-	if (ch < 'a' || ch > 'z')
-		return ch;
-	else
-		return static_cast<char>(ch - 'a' + 'A');
-}
-
-// Copied from Scintilla
-int CompareNCaseInsensitive(const char *a, const char *b, size_t len) {
-	while (*a && *b && len) {
-		if (*a != *b) {
-			char upperA = static_cast<char>(MakeUpperCase(*a));
-			char upperB = static_cast<char>(MakeUpperCase(*b));
-			if (upperA != upperB)
-				return upperA - upperB;
-		}
-		a++;
-		b++;
-		len--;
-	}
-	if (len == 0)
-		return 0;
-	else
-		// Either *a or *b is nul
-		return *a - *b;
-}
-
-// Copied (and modified) from Scintilla
-struct Sorter {
-	bool ignoreCase;
-
-	Sorter(bool ignoreCase_) : ignoreCase(ignoreCase_) {}
-
-	inline bool operator()(const std::string& a, const std::string& b) {
-		auto lenA = a.length();
-		auto lenB = b.length();
-		auto len = min(lenA, lenB);
-		int cmp;
-		if (ignoreCase)
-			cmp = CompareNCaseInsensitive(a.c_str(), b.c_str(), len);
-		else
-			cmp = strncmp(a.c_str(), b.c_str(), len);
-		if (cmp == 0)
-			cmp = static_cast<int>(lenA - lenB);
-		return cmp < 0;
-	}
-};
-
-static std::vector<std::string> &sortCaseInsensitive(std::vector<std::string> &strings) {
-	std::sort(strings.begin(), strings.end(), Sorter(true));
-	return strings;
-}
-
 static bool inline isBrace(int ch) {
-	return strchr("[]{}()", ch) != NULL;
-}
-
-static std::string getRange(GUI::ScintillaWindow *sw, Sci_PositionCR start, Sci_PositionCR end) {
-	if (end <= start) return std::string();
-
-	std::vector<char> buffer(end - start + 1);
-	Sci_TextRange tr;
-	tr.chrg.cpMin = start;
-	tr.chrg.cpMax = end;
-	tr.lpstrText = buffer.data();
-
-	sw->CallPointer(SCI_GETTEXTRANGE, 0, &tr);
-
-	return std::string(buffer.begin(), buffer.end() - 1); // don't copy the null
-}
-
-static std::string getWordAt(GUI::ScintillaWindow *sw, int pos) {
-	int word_start = sw->Call(SCI_WORDSTARTPOSITION, pos, true);
-	int word_end = sw->Call(SCI_WORDENDPOSITION, pos, true);
-	return getRange(sw, word_start, word_end);
-}
-
-static std::string getLuaIdentifierAt(GUI::ScintillaWindow *sw, int pos) {
-	const int line = sw->Call(SCI_LINEFROMPOSITION);
-
-	Sci_TextToFind ttf = {
-		{
-			// Search backwards
-			pos,
-			sw->Call(SCI_POSITIONFROMLINE, line)
-		},
-		"[a-z_][a-z0-9_]*(\\.[a-z_][a-z0-9_]*)*",
-	};
-
-	// Only return the range if it ends at pos
-	if (sw->CallPointer(SCI_FINDTEXT, SCFIND_REGEXP, &ttf) != -1 && ttf.chrgText.cpMax == pos)
-		return getRange(sw, ttf.chrgText.cpMin, ttf.chrgText.cpMax);
-	else
-		return std::string();
+	return ch != '\0' && strchr("[]{}()", ch) != NULL;
 }
 
 template <typename T, typename U>
@@ -174,174 +84,259 @@ static void setStyles(GUI::ScintillaWindow &sci) {
 	sci.Call(SCI_STYLESETBOLD, SCE_LUA_WORD6, 1);
 }
 
-LuaConsole::LuaConsole(NppData& nppData, HINSTANCE hInst) : console(new ConsoleDialog()), npp_data(new NppData) {
+LuaConsole::LuaConsole(NppData& nppData, HINSTANCE hInst) : console(new ConsoleDialog()), npp_data(new NppData), catalog_fetched(false), catalog_retry(false), queue(session), baudrate(115200), minify(false), cache(false) {
 	console->initDialog(hInst, nppData, this);
 	*npp_data = nppData;
 
-	ez_funcs = {
-		"SetXY",
-		"SetX",
-		"SetY",
-		"GetX",
-		"GetY",
-		"RGB",
-		"GetRed",
-		"GetGreen",
-		"GetBlue",
-		"SetColor",
-		"SetRGBColor",
-		"ReplaceColor",
-		"GetPixel",
-		"SetAlpha",
-		"TrColorNone",
-		"SetTrColor",
-		"SetPenSize",
-		"Deg",
-		"Rad",
-		"Button",
-		"DelButtons",
-		"SetButtonEvents",
-		"Cls",
-		"Fill",
-		"FillBound",
-		"HLine",
-		"VLine",
-		"Line",
-		"LineAng",
-		"Circle",
-		"CircleFill",
-		"Ellipse",
-		"EllipseFill",
-		"Arc",
-		"Pie",
-		"EllipseArc",
-		"EllipsePie",
-		"Box",
-		"BoxFill",
-		"Polygon",
-		"Plot",
-		"SetBmFont",
-		"SetFtFont",
-		"GetNoOfBmFonts",
-		"GetNoOfFtFonts",
-		"CacheFtChars",
-		"SetFtUnibase",
-		"TextNorth",
-		"TextEast",
-		"TextSouth",
-		"TextWest",
-		"SetFtAngle",
-		"PutPictNo",
-		"GetPictHeight",
-		"GetPictWidth",
-		"LightOn",
-		"LightOff",
-		"LightBright",
-		"SdScreenCapture",
-		"Get_ms",
-		"Wait_ms",
-		"SetTime",
-		"Timer",
-		"TimerStart",
-		"TimerStop",
-		"GetTouchX",
-		"GetTouchY",
-		"TouchDn",
-		"SetTouchEvent",
-		"RS232Open",
-		"Rs232Close",
-		"Rs232Tx",
-		"Rs232TxStr",
-		"Rs232RxLen",
-		"Rs232Rxgetc",
-		"I2CopenMaster",
-		"I2CWrite",
-		"I2Cread",
-		"SetPinInp",
-		"SetPinsInp",
-		"SetPinOut",
-		"SetPinsOut",
-		"SetPinIntr",
-		"RestorePin",
-		"RestorePins",
-		"Pin",
-		"Pins",
-		"SetDispFrame",
-		"GetDispFrame",
-		"GetNextDispFrame",
-		"SetDrawFrame",
-		"GetDrawFrame",
-		"GetNoOfFrames",
-		"CopyFrame",
-		"MergeFrame",
-		"CopyRect",
-		"MergeRect",
-		"ExitReq"
-	};
+	brace_highlight[0] = brace_highlight[1] = INVALID_POSITION;
 
-	ez_props = {
-		"Width",
-		"Height",
-		"BytesPerPixel",
-		"FirmVer",
-		"LuaVer",
-		"NoOfFrames",
-		"NoOfPicts",
-		"NoOfBmFonts",
-		"NoOfFtFonts"
-	};
+	// Results come back on the worker thread, so hand them over to the UI thread
+	ConsoleDialog *dialog = console;
+	queue.setNotify([dialog]() { dialog->notifyCompletion(); });
+
+	resetCatalog(std::string());
+}
+
+void LuaConsole::setComPort(std::string& port) {
+	// Could be another board
+	catalog_fetched = false;
+	catalog_retry = false;
+	queue.post([port](DeviceSession &session) { session.setPort(port); });
+}
+
+void LuaConsole::setDeviceId(const std::string& id) {
+	queue.post([id](DeviceSession &session) { session.setDeviceId(id); });
+}
+
+void LuaConsole::setBaudrate(uint32_t baudrate) {
+	this->baudrate = baudrate;
+	queue.post([baudrate](DeviceSession &session) { session.setBaudrate(baudrate); });
 }
 
-bool LuaConsole::runStatement(const char* statement) {
-	std::string str = statement;
-	std::vector<uint8_t> t;
-
-	// Build the RUN_LUA command
-	t.push_back(RUN_LUA);
-	t.insert(t.end(), str.cbegin(), str.cend());
-	t.push_back(0);
-
-	try {
-		serial::Serial my_serial(this->port.c_str(), 115200, serial::Timeout::simpleTimeout(1000));
-		my_serial.write(t);
-		t.clear();
-
-		auto bytes_read = my_serial.read(t, 1);
-
-		// Expect 1 byte return value
-		if (bytes_read == 1) {
-			if (t[0] == RUN_LUA_ERROR) {
-				while (true) {
-					t.clear();
-					my_serial.read(t, 1);
-					if (t[0] != 0) {
-						console->writeError(1, (const char*)&t[0]);
-					}
-					else {
-						console->writeError(2, "\r\n");
-						break;
-					}
+void LuaConsole::setFlowcontrol(serial::flowcontrol_t flowcontrol) {
+	queue.post([flowcontrol](DeviceSession &session) { session.setFlowcontrol(flowcontrol); });
+}
+
+void LuaConsole::detectBaudrate(std::function<void(uint32_t)> onDetected) {
+	on_baud_detected = onDetected;
+
+	queue.submitTask([](DeviceSession &session, std::string &message) {
+		uint32_t rate = session.probeBaudrate({ 921600, 460800, 230400, 115200, 57600, 38400, 19200, 9600 });
+		if (rate == 0) return Completion::Status::NoResponse;
+
+		message = std::to_string(rate);
+		return Completion::Status::Ok;
+	}, tag_probe);
+
+	const char *msg = "Detecting baud rate...\r\n";
+	console->writeText(strlen(msg), msg);
+	console->setPending(queue.pending());
+}
+
+void LuaConsole::detectPort(std::function<void(const std::string&, const std::string&)> onDetected) {
+	on_port_detected = onDetected;
+
+	queue.submitTask([](DeviceSession &session, std::string &message) {
+		if (!session.detectPort()) return Completion::Status::NoResponse;
+
+		// A port name can't contain a line break
+		message = session.getPort() + "\n" + session.getDeviceId();
+		return Completion::Status::Ok;
+	}, tag_detect);
+
+	const char *msg = "Looking for the ezLCD controller board...\r\n";
+	console->writeText(strlen(msg), msg);
+	console->setPending(queue.pending());
+}
+
+void LuaConsole::refreshCatalog() {
+	fetchCatalog(true);
+
+	const char *msg = "Reading the API of the ezLCD controller board...\r\n";
+	console->writeText(strlen(msg), msg);
+	console->setPending(queue.pending());
+}
+
+void LuaConsole::fetchCatalog(bool refresh) {
+	catalog_fetched = true;
+
+	const ApiCache cache = api_cache;
+	queue.submitTask([cache, refresh](DeviceSession &session, std::string &message) {
+		bool cached;
+		switch (cache.fetch(session, message, cached, refresh)) {
+			case DeviceSession::Result::Ok: return Completion::Status::Ok;
+			case DeviceSession::Result::LuaError: return Completion::Status::LuaError;
+			default: return Completion::Status::NoResponse;
+		}
+	}, refresh ? tag_refresh_catalog : tag_catalog, !refresh);
+}
+
+// The built in ez names plus whatever is in the listing
+size_t LuaConsole::resetCatalog(const std::string &listing) {
+	catalog.clear();
+	catalog.add("ez", EzFunctions, EzFunctionCount, true);
+	catalog.add("ez", EzProperties, EzPropertyCount, false);
+	return ApiCache::addTo(catalog, listing);
+}
+
+void LuaConsole::runStatement(const char* statement, bool fromFile) {
+	if (!fromFile) {
+		// Several statements go out as a batch, so the rest are skipped once
+		// one fails and they are pipelined if PIPELINE allows it
+		const std::vector<std::string> statements = SplitLuaStatements(statement, strlen(statement));
+		if (statements.size() > 1) queue.submitBatch(statements, tag_console);
+		else queue.submit(statement, tag_console);
+
+		// Queued after the statement so it doesn't hold it up
+		if (!catalog_fetched) fetchCatalog(false);
+		console->setPending(queue.pending());
+		return;
+	}
+
+	std::string source = statement;
+
+	if (minify) {
+		const size_t original = source.size();
+		source = MinifyLua(statement, original);
+
+		// 8N1 is 10 bits on the wire per byte
+		const size_t saved = original - source.size();
+		const size_t saved_ms = baudrate > 0 ? saved * 10 * 1000 / baudrate : 0;
+		std::string msg = "Uploading " + std::to_string(source.size()) + " of " + std::to_string(original) + " bytes (saved "
+			+ std::to_string(saved) + " bytes, ~" + std::to_string(saved_ms) + " ms)\r\n";
+		console->writeText(msg.size(), msg.c_str());
+	}
+
+	if (cache) {
+		queue.submitTask([source](DeviceSession &session, std::string &message) {
+			bool cached;
+			DeviceSession::Result result = session.runCached(source, message, cached);
+
+			if (result == DeviceSession::Result::Ok && cached) {
+				message = "Ran the copy cached on the device (" + std::to_string(source.size()) + " bytes not uploaded)";
+			}
+
+			switch (result) {
+				case DeviceSession::Result::Ok: return Completion::Status::Ok;
+				case DeviceSession::Result::LuaError: return Completion::Status::LuaError;
+				default: return Completion::Status::NoResponse;
+			}
+		}, tag_file);
+	}
+	else {
+		queue.submit(source.c_str(), tag_file);
+	}
+
+	if (!catalog_fetched) fetchCatalog(false);
+	console->setPending(queue.pending());
+}
+
+void LuaConsole::processCompletions() {
+	Completion completion;
+
+	while (queue.takeCompletion(completion)) {
+		if (completion.tag == tag_probe && completion.status != Completion::Status::Failed) {
+			std::string message;
+			if (completion.status == Completion::Status::Ok) {
+				message = "Detected baud rate " + completion.message + "\r\n";
+				console->writeText(message.size(), message.c_str());
+
+				// The session switched already, the copy used for estimates has to follow
+				baudrate = static_cast<uint32_t>(std::stoul(completion.message));
+				if (on_baud_detected) on_baud_detected(baudrate);
+			}
+			else {
+				message = "Unable to detect the baud rate of the ezLCD controller board\r\n";
+				console->writeError(message.size(), message.c_str());
+			}
+			continue;
+		}
+
+		if (completion.tag == tag_detect && completion.status != Completion::Status::Failed) {
+			std::string message;
+			if (completion.status == Completion::Status::Ok) {
+				const size_t newline = completion.message.find('\n');
+				const std::string port = completion.message.substr(0, newline);
+				const std::string id = completion.message.substr(newline + 1);
+
+				message = "Found the ezLCD controller board on " + port + "\r\n";
+				console->writeText(message.size(), message.c_str());
+				if (on_port_detected) on_port_detected(port, id);
+			}
+			else {
+				message = "Unable to find the ezLCD controller board on any port\r\n";
+				console->writeError(message.size(), message.c_str());
+			}
+			continue;
+		}
+
+		if (completion.tag == tag_catalog || completion.tag == tag_refresh_catalog) {
+			if (completion.status == Completion::Status::Ok) {
+				const size_t count = resetCatalog(completion.message);
+				if (completion.tag == tag_refresh_catalog) {
+					const std::string message = "Read " + std::to_string(count) + " names for autocompletion\r\n";
+					console->writeText(message.size(), message.c_str());
 				}
+				continue;
+			}
 
-				return false;
+			// Nobody asked for it, so don't report it. Without a board every
+			// statement would be followed by another fetch timing out, so only
+			// try again once a statement gets an answer.
+			if (completion.tag == tag_catalog) {
+				if (completion.status != Completion::Status::LuaError) catalog_retry = true;
+				continue;
 			}
-			// else if (t[0] == RUN_LUA_OK)
 		}
-		else {
-			const char* message = "Did not receive response from ezLCD controller board\r\n";
-			console->writeError(strlen(message), message);
 
-			return false;
+		const bool answered = completion.status == Completion::Status::Ok || completion.status == Completion::Status::LuaError;
+		if (catalog_retry && answered && (completion.tag == tag_console || completion.tag == tag_file)) {
+			catalog_retry = false;
+			fetchCatalog(false);
 		}
 
-	}
-	catch (std::exception &e) {
-		MessageBox(npp_data->_nppHandle, GUI::StringFromUTF8(e.what()).c_str(), TEXT("ezLCD Lua"), MB_ICONERROR);
+		switch (completion.status) {
+			case Completion::Status::Ok:
+				if (!completion.message.empty()) {
+					completion.message.append("\r\n");
+					console->writeText(completion.message.size(), completion.message.c_str());
+				}
+				break;
+			case Completion::Status::LuaError:
+				completion.message.append("\r\n");
+				console->writeError(completion.message.size(), completion.message.c_str());
+				break;
+			case Completion::Status::NoResponse: {
+				const char* message = "Did not receive response from ezLCD controller board\r\n";
+				console->writeError(strlen(message), message);
+				break;
+			}
+			case Completion::Status::Failed:
+				MessageBox(npp_data->_nppHandle, GUI::StringFromUTF8(completion.message).c_str(), TEXT("ezLCD Lua"), MB_ICONERROR);
+				break;
+			case Completion::Status::Skipped:
+				// Whatever caused it has already been reported
+				continue;
+			case Completion::Status::Output:
+				console->writeText(completion.message.size(), completion.message.c_str());
+				continue;
+			case Completion::Status::DeviceError:
+				completion.message.append("\r\n");
+				console->writeError(completion.message.size(), completion.message.c_str());
+				continue;
+		}
 
-		return false;
+		// Make sure the error is seen when running a file, but leave the focus in the editor
+		if (completion.status != Completion::Status::Ok && completion.tag == tag_file) {
+			int which = -1;
+			SendMessage(npp_data->_nppHandle, NPPM_GETCURRENTSCINTILLA, SCI_UNUSED, (LPARAM)&which);
+
+			console->doDialog();
+			SendMessage(which == 0 ? npp_data->_scintillaMainHandle : npp_data->_scintillaSecondHandle, SCI_GRABFOCUS, SCI_UNUSED, SCI_UNUSED);
+		}
 	}
 
-	return true;
+	console->setPending(queue.pending());
 }
 
 void LuaConsole::setupInput(GUI::ScintillaWindow &sci) {
@@ -415,6 +410,10 @@ bool LuaConsole::processNotification(const SCNotification *scn) {
 			break;
 		}
 		case SCN_MODIFIED:
+			if (scn->modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT)) {
+				braces.invalidate(scn->position);
+			}
+
 			// Detect certain modifcations (e.g. pasting) when auto-complete is active
 			if (scn->modificationType & SC_MOD_INSERTTEXT && scn->length > 1 && scn->linesAdded == 0 && sci_input->Call(SCI_AUTOCACTIVE)) {
 				// Auto-complete needs delayed since caret position information is not updated yet
@@ -422,10 +421,8 @@ bool LuaConsole::processNotification(const SCNotification *scn) {
 			}
 			break;
 		case SCN_AUTOCSELECTION: {
-			std::string text(scn->text);
-
-			// If the suggested text is in the EZ funcs, then auto insert parentheses
-			if (std::find(ez_funcs.begin(), ez_funcs.end(), text) != ez_funcs.end()) {
+			// If the suggested text is a function, then auto insert parentheses
+			if (catalog.isFunction(scn->text) || symbols.isFunction(scn->text)) {
 				acf = acf_parens;
 			}
 			else {
@@ -449,55 +446,137 @@ void LuaConsole::maintainIndentation() {
 }
 
 void LuaConsole::braceMatch() {
-	int curPos = sci_input->Call(SCI_GETCURRENTPOS);
-	int bracePos = INVALID_POSITION;
+	GUI::ScintillaWindow::Batch batch(*sci_input);
+	const char *text = reinterpret_cast<const char *>(sci_input->CallReturnPointer(SCI_GETCHARACTERPOINTER));
+	const size_t length = sci_input->Call(SCI_GETLENGTH);
+	const size_t curPos = sci_input->Call(SCI_GETCURRENTPOS);
+	size_t bracePos = BraceMap::npos;
 
 	// Check on both sides
-	if (isBrace(sci_input->Call(SCI_GETCHARAT, curPos - 1))) {
+	if (curPos > 0 && isBrace(text[curPos - 1])) {
 		bracePos = curPos - 1;
 	}
-	else if (isBrace(sci_input->Call(SCI_GETCHARAT, curPos))) {
+	else if (curPos < length && isBrace(text[curPos])) {
 		bracePos = curPos;
 	}
 
 	// See if we are next to a brace
-	if (bracePos != INVALID_POSITION) {
-		int otherPos = sci_input->Call(SCI_BRACEMATCH, bracePos, 0);
-		if (otherPos != INVALID_POSITION) {
-			sci_input->Call(SCI_BRACEHIGHLIGHT, bracePos, otherPos);
-		}
-		else {
-			sci_input->Call(SCI_BRACEHIGHLIGHT, INVALID_POSITION, INVALID_POSITION);
+	int highlight[2] = { INVALID_POSITION, INVALID_POSITION };
+	if (bracePos != BraceMap::npos) {
+		const size_t otherPos = braces.match(text, length, bracePos);
+		if (otherPos != BraceMap::npos) {
+			highlight[0] = static_cast<int>(bracePos);
+			highlight[1] = static_cast<int>(otherPos);
 		}
 	}
-	else {
-		sci_input->Call(SCI_BRACEHIGHLIGHT, INVALID_POSITION, INVALID_POSITION);
+
+	// This runs every time the caret moves, most of the time nothing changes
+	if (highlight[0] != brace_highlight[0] || highlight[1] != brace_highlight[1]) {
+		sci_input->Call(SCI_BRACEHIGHLIGHT, highlight[0], highlight[1]);
+		brace_highlight[0] = highlight[0];
+		brace_highlight[1] = highlight[1];
 	}
 }
 
 void LuaConsole::showAutoCompletion() {
-	std::string partialWord;
-	int curPos = sci_input->Call(SCI_GETCURRENTPOS);
-	int prevCh = sci_input->Call(SCI_GETCHARAT, curPos - 1);
+	GUI::ScintillaWindow::Batch batch(*sci_input);
+	const char *text = reinterpret_cast<const char *>(sci_input->CallReturnPointer(SCI_GETCHARACTERPOINTER));
+	const size_t curPos = sci_input->Call(SCI_GETCURRENTPOS);
 
 	// The cursor could be at the end of a partial word e.g. editor.Sty|
-	if (isalpha(prevCh) || prevCh == '_') {
-		partialWord = getWordAt(sci_input, curPos - 1);
-
-		// Back up past the partial word
-		prevCh = sci_input->Call(SCI_GETCHARAT, curPos - 1 - partialWord.size());
-		curPos = curPos - static_cast<int>(partialWord.size());
+	const size_t wordStart = LuaWordStart(text, curPos);
+	std::string &partialWord = completion_word;
+	partialWord.assign(text + wordStart, curPos - wordStart);
+
+	// Fields after a . or :, otherwise anything at the top level that starts with the partial word
+	std::string &prev = completion_table;
+	prev.clear();
+	if (wordStart > 0 && (text[wordStart - 1] == '.' || text[wordStart - 1] == ':')) {
+		const size_t start = LuaIdentifierStart(text, wordStart - 1);
+		if (start == wordStart - 1) return;
+
+		prev.assign(text + start, wordStart - 1 - start);
+	}
+	else if (partialWord.empty()) {
+		return;
 	}
 
-	if (prevCh == '.') {
-		std::string prev = getLuaIdentifierAt(sci_input, curPos - 1);
+	// Only what matches the partial word is shown
+	const std::string &names = catalog.complete(prev, partialWord);
 
-		if (prev == "ez") {
-			// Combine the ez properties and functions
-			std::vector<std::string> suggestions(ez_props.begin(), ez_props.end());
-			suggestions.insert(suggestions.end(), ez_funcs.begin(), ez_funcs.end());
+	std::vector<std::string> &defined = completion_defined;
+	defined.clear();
+	symbols.complete(prev, partialWord, defined);
 
-			sci_input->CallString(SCI_AUTOCSHOW, partialWord.size(), join(sortCaseInsensitive(suggestions), ' ').c_str());
+	if (defined.empty()) {
+		if (!names.empty()) {
+			sci_input->CallString(SCI_AUTOCSHOW, partialWord.size(), names.c_str());
 		}
+		return;
+	}
+
+	// Both lists are in the same order, so the names the files define only
+	// have to be merged into the catalog's list, which is walked in place
+	std::string &list = completion_list;
+	std::string &name = completion_name;
+	list.clear();
+
+	auto own = defined.cbegin();
+	auto append = [&list](const char *text, size_t length) {
+		if (!list.empty()) list.push_back(' ');
+		list.append(text, length);
+	};
+
+	for (const char *known = names.c_str(); *known != '\0';) {
+		const size_t length = strcspn(known, " ");
+		name.assign(known, length);
+
+		for (; own != defined.cend() && ApiCatalog::lessByName(*own, name); ++own) append(own->c_str(), own->size());
+		if (own != defined.cend() && *own == name) ++own;
+
+		append(known, length);
+		known += length;
+		if (*known == ' ') ++known;
 	}
+	for (; own != defined.cend(); ++own) append(own->c_str(), own->size());
+
+	sci_input->CallString(SCI_AUTOCSHOW, partialWord.size(), list.c_str());
+}
+
+void LuaConsole::indexDocument(uintptr_t buffer, HWND sci, bool lua) {
+	if (!lua) {
+		forgetDocument(buffer);
+		return;
+	}
+
+	const char *text = reinterpret_cast<const char *>(SendMessage(sci, SCI_GETCHARACTERPOINTER, SCI_UNUSED, SCI_UNUSED));
+	const size_t length = static_cast<size_t>(SendMessage(sci, SCI_GETLENGTH, SCI_UNUSED, SCI_UNUSED));
+
+	symbols.setText(buffer, std::string(text, length));
+	indexed.insert(buffer);
+}
+
+void LuaConsole::documentModified(uintptr_t buffer, HWND sci, const SCNotification *scn) {
+	if (!(scn->modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT)) || indexed.count(buffer) == 0) return;
+
+	// The line the change starts on has become as many lines as were added to it
+	const size_t first = static_cast<size_t>(SendMessage(sci, SCI_LINEFROMPOSITION, scn->position, SCI_UNUSED));
+	const size_t removed = 1 + (scn->linesAdded < 0 ? -scn->linesAdded : 0);
+	const size_t count = 1 + (scn->linesAdded > 0 ? scn->linesAdded : 0);
+
+	std::vector<std::string> lines;
+	lines.reserve(count);
+	for (size_t line = first; line < first + count; ++line) {
+		const Sci_Position start = SendMessage(sci, SCI_POSITIONFROMLINE, line, SCI_UNUSED);
+		const Sci_Position end = SendMessage(sci, SCI_GETLINEENDPOSITION, line, SCI_UNUSED);
+
+		if (end > start) lines.emplace_back(reinterpret_cast<const char *>(SendMessage(sci, SCI_GETRANGEPOINTER, start, end - start)), end - start);
+		else lines.emplace_back();
+	}
+
+	symbols.replaceLines(buffer, first, removed, std::move(lines));
+}
+
+void LuaConsole::forgetDocument(uintptr_t buffer) {
+	if (indexed.erase(buffer) != 0) symbols.remove(buffer);
 }
@@ -0,0 +1,235 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include <cstring>
+
+#include "LuaLexer.h"
+
+static const char *keywords[] = {
+	"and", "break", "do", "else", "elseif", "end", "false", "for", "function", "goto", "if",
+	"in", "local", "nil", "not", "or", "repeat", "return", "then", "true", "until", "while"
+};
+
+static inline bool isNewline(char ch) {
+	return ch == '\n' || ch == '\r';
+}
+
+static inline bool isSpace(char ch) {
+	return ch == ' ' || ch == '\t' || ch == '\f' || ch == '\v';
+}
+
+static inline bool isDigit(char ch) {
+	return ch >= '0' && ch <= '9';
+}
+
+static inline bool isHexDigit(char ch) {
+	return isDigit(ch) || (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F');
+}
+
+static inline bool isNameStart(char ch) {
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_';
+}
+
+static inline bool isNameChar(char ch) {
+	return isNameStart(ch) || isDigit(ch);
+}
+
+bool LuaLexer::isKeyword(const char *text, size_t length) {
+	for (const char *keyword : keywords) {
+		if (strlen(keyword) == length && memcmp(keyword, text, length) == 0)
+			return true;
+	}
+	return false;
+}
+
+size_t LuaLexer::countLines(const char *text, size_t length) {
+	size_t lines = 0;
+
+	for (size_t i = 0; i < length; ++i) {
+		if (isNewline(text[i])) {
+			// \r\n and \n\r count as one
+			if (i + 1 < length && isNewline(text[i + 1]) && text[i + 1] != text[i]) ++i;
+			++lines;
+		}
+	}
+
+	return lines;
+}
+
+// Returns the level of a long bracket starting at the current position, or -1
+int LuaLexer::longBracketLevel() const {
+	if (peek() != '[') return -1;
+
+	int level = 0;
+	while (peek(level + 1) == '=') ++level;
+
+	return peek(level + 1) == '[' ? level : -1;
+}
+
+// Skips past the closing bracket, returns false if it was never found
+bool LuaLexer::skipLongBracket(int level) {
+	pos += level + 2;
+
+	while (pos < length) {
+		if (text[pos] == ']') {
+			int count = 0;
+			while (peek(count + 1) == '=') ++count;
+
+			if (count == level && peek(count + 1) == ']') {
+				pos += count + 2;
+				return true;
+			}
+			pos += count + 1;
+		}
+		else {
+			++pos;
+		}
+	}
+
+	return false;
+}
+
+bool LuaLexer::skipQuotedString() {
+	const char quote = text[pos++];
+
+	while (pos < length) {
+		const char ch = text[pos];
+
+		if (ch == quote) {
+			++pos;
+			return true;
+		}
+		else if (isNewline(ch)) {
+			// Unfinished string, leave the line break for the next token
+			return false;
+		}
+		else if (ch == '\\') {
+			++pos;
+			if (pos >= length) break;
+
+			if (isNewline(text[pos])) {
+				// An escaped line break is part of the string
+				if (pos + 1 < length && isNewline(text[pos + 1]) && text[pos + 1] != text[pos]) ++pos;
+				++pos;
+			}
+			else if (text[pos] == 'z') {
+				// \z skips all following whitespace, line breaks included
+				++pos;
+				while (pos < length && (isSpace(text[pos]) || isNewline(text[pos]))) ++pos;
+			}
+			else {
+				// Everything else (\ddd, \xXX, \u{XXX}) is harmless to step over one at a time
+				++pos;
+			}
+		}
+		else {
+			++pos;
+		}
+	}
+
+	return false;
+}
+
+void LuaLexer::skipNumber() {
+	const char *exponent = "Ee";
+
+	if (peek() == '0' && (peek(1) == 'x' || peek(1) == 'X')) {
+		exponent = "Pp";
+		pos += 2;
+	}
+
+	while (pos < length) {
+		const char ch = text[pos];
+
+		if ((ch == exponent[0] || ch == exponent[1]) && (peek(1) == '+' || peek(1) == '-'))
+			pos += 2;
+		else if (isHexDigit(ch) || ch == '.' || isNameChar(ch))
+			++pos; // Letters glued to a number are an error in Lua, keep them together anyway
+		else
+			break;
+	}
+}
+
+bool LuaLexer::next(LuaToken &token) {
+	if (pos >= length) return false;
+
+	static const char *operators[] = { "...", "..", "==", "~=", "<=", ">=", "<<", ">>", "//", "::" };
+
+	const char ch = text[pos];
+	token.start = pos;
+	token.unterminated = false;
+
+	if (isNewline(ch)) {
+		token.type = LuaToken::Newline;
+		++pos;
+		if (pos < length && isNewline(text[pos]) && text[pos] != ch) ++pos;
+	}
+	else if (isSpace(ch)) {
+		token.type = LuaToken::Whitespace;
+		while (pos < length && isSpace(text[pos])) ++pos;
+	}
+	else if (ch == '-' && peek(1) == '-') {
+		pos += 2;
+		int level = longBracketLevel();
+
+		if (level >= 0) {
+			token.type = LuaToken::LongComment;
+			token.unterminated = !skipLongBracket(level);
+		}
+		else {
+			token.type = LuaToken::Comment;
+			while (pos < length && !isNewline(text[pos])) ++pos;
+		}
+	}
+	else if (isNameStart(ch)) {
+		while (pos < length && isNameChar(text[pos])) ++pos;
+		token.type = isKeyword(text + token.start, pos - token.start) ? LuaToken::Keyword : LuaToken::Name;
+	}
+	else if (isDigit(ch) || (ch == '.' && isDigit(peek(1)))) {
+		token.type = LuaToken::Number;
+		skipNumber();
+	}
+	else if (ch == '"' || ch == '\'') {
+		token.type = LuaToken::String;
+		token.unterminated = !skipQuotedString();
+	}
+	else if (longBracketLevel() >= 0) {
+		token.type = LuaToken::LongString;
+		token.unterminated = !skipLongBracket(longBracketLevel());
+	}
+	else if (static_cast<unsigned char>(ch) >= 0x80) {
+		token.type = LuaToken::Unknown;
+		++pos;
+	}
+	else {
+		token.type = LuaToken::Operator;
+
+		size_t op_length = 1;
+		for (const char *op : operators) {
+			size_t len = strlen(op);
+			if (pos + len <= length && memcmp(text + pos, op, len) == 0) {
+				op_length = len;
+				break;
+			}
+		}
+		pos += op_length;
+	}
+
+	token.length = pos - token.start;
+	return true;
+}
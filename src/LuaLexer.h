@@ -0,0 +1,72 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#pragma once
+
+#include <cstddef>
+
+struct LuaToken {
+	enum Type {
+		Name,
+		Keyword,
+		Number,
+		String,      // Quoted string, including the quotes
+		LongString,  // [[...]] or [==[...]==]
+		Comment,     // -- to the end of the line, not including the line break
+		LongComment, // --[[...]]
+		Operator,
+		Whitespace,  // Spaces, tabs, etc. but never line breaks
+		Newline,     // A single line break, \n, \r, \r\n or \n\r like Lua counts them
+		Unknown
+	};
+
+	Type type;
+	size_t start;
+	size_t length;
+	bool unterminated; // Only for strings and long comments
+};
+
+// Splits Lua 5.x source into tokens following the same rules as Lua's own
+// lexer (llex.c). Every byte of the source ends up in exactly one token, so
+// the tokens can be glued back together to get the original text.
+class LuaLexer final {
+public:
+	LuaLexer(const char *text, size_t length) : text(text), length(length), pos(0) {}
+
+	// Returns false once the end of the text is reached
+	bool next(LuaToken &token);
+
+	size_t position() const { return pos; }
+
+	// Number of line breaks in text, counting them the same way as Newline tokens
+	static size_t countLines(const char *text, size_t length);
+
+	static bool isKeyword(const char *text, size_t length);
+
+private:
+	const char *text;
+	size_t length;
+	size_t pos;
+
+	char peek(size_t offset = 0) const { return pos + offset < length ? text[pos + offset] : '\0'; }
+
+	int longBracketLevel() const;
+	bool skipLongBracket(int level);
+	bool skipQuotedString();
+	void skipNumber();
+};
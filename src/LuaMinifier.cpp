@@ -0,0 +1,96 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include <cstring>
+
+#include "LuaMinifier.h"
+#include "LuaLexer.h"
+
+static inline bool isWordChar(char ch) {
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '_';
+}
+
+// Whether two tokens that used to be separated by whitespace or a comment
+// would be read differently once they are put right next to each other
+static bool needsSpace(char last, LuaToken::Type lastType, char first) {
+	static const char *pairs[] = { "--", "..", "==", "~=", "<=", ">=", "<<", ">>", "//", "::", "[[", "[=" };
+
+	if (isWordChar(last) && isWordChar(first)) return true;
+
+	// e.g. "1 ..x" or "a .. .5"
+	if ((lastType == LuaToken::Number || last == '.') && (first == '.' || (first >= '0' && first <= '9'))) return true;
+
+	for (const char *pair : pairs) {
+		if (pair[0] == last && pair[1] == first) return true;
+	}
+
+	return false;
+}
+
+std::string MinifyLua(const char *source, size_t length) {
+	std::string out;
+	out.reserve(length);
+
+	LuaLexer lexer(source, length);
+	LuaToken token;
+
+	LuaToken::Type lastType = LuaToken::Newline;
+	bool removed = false; // Something was dropped since the last token written
+
+	while (lexer.next(token)) {
+		const char *text = source + token.start;
+
+		switch (token.type) {
+			case LuaToken::Whitespace:
+			case LuaToken::Comment:
+				removed = true;
+				break;
+			case LuaToken::LongComment: {
+				// Keep the line breaks so the line numbers don't shift
+				size_t lines = LuaLexer::countLines(text, token.length);
+				if (lines > 0) {
+					out.append(lines, '\n');
+					lastType = LuaToken::Newline;
+					removed = false;
+				}
+				else {
+					removed = true;
+				}
+				break;
+			}
+			case LuaToken::Newline:
+				out.push_back('\n');
+				lastType = LuaToken::Newline;
+				removed = false;
+				break;
+			default:
+				if (removed && lastType != LuaToken::Newline && needsSpace(out.back(), lastType, text[0]))
+					out.push_back(' ');
+
+				out.append(text, token.length);
+				lastType = token.type;
+				removed = false;
+				break;
+		}
+	}
+
+	// Nothing after the last line matters
+	while (!out.empty() && out.back() == '\n') out.pop_back();
+
+	return out;
+}
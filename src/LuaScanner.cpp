@@ -0,0 +1,257 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include <algorithm>
+#include <cstring>
+
+#include "LuaScanner.h"
+#include "LuaLexer.h"
+
+static const char braceChars[] = "([{)]}";
+
+static inline bool isDigit(char ch) {
+	return ch >= '0' && ch <= '9';
+}
+
+static inline bool isNameChar(char ch) {
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_' || isDigit(ch);
+}
+
+size_t LuaWordStart(const char *text, size_t end) {
+	while (end > 0 && isNameChar(text[end - 1])) --end;
+	return end;
+}
+
+size_t LuaIdentifierStart(const char *text, size_t end) {
+	size_t start = end;
+	size_t pos = end;
+
+	while (true) {
+		// A name can't start with a digit
+		const size_t word = LuaWordStart(text, pos);
+		if (word == pos || isDigit(text[word])) break;
+		start = word;
+
+		// Keep going past a single . with a name in front of it
+		if (word >= 2 && text[word - 1] == '.' && isNameChar(text[word - 2])) pos = word - 1;
+		else break;
+	}
+
+	return start;
+}
+
+static bool isWord(const char *text, const LuaToken &token, const char *word) {
+	return strlen(word) == token.length && memcmp(text + token.start, word, token.length) == 0;
+}
+
+// Tokens a statement can end with
+static bool endsStatement(const char *text, const LuaToken &token) {
+	switch (token.type) {
+		case LuaToken::Name:
+		case LuaToken::Number:
+		case LuaToken::String:
+		case LuaToken::LongString:
+			return true;
+		case LuaToken::Operator:
+			return token.length == 1 && strchr(")]}", text[token.start]);
+		case LuaToken::Keyword:
+			return isWord(text, token, "end") || isWord(text, token, "nil") || isWord(text, token, "true") || isWord(text, token, "false");
+		default:
+			return false;
+	}
+}
+
+// Tokens that can only start a new statement. Anything else after a line
+// break (e.g. ( or a string) could carry on the one before.
+static bool startsStatement(const char *text, const LuaToken &token) {
+	if (token.type == LuaToken::Name) return true;
+	if (token.type != LuaToken::Keyword) return false;
+
+	static const char *const keywords[] = { "do", "for", "function", "if", "repeat", "while" };
+	for (const char *keyword : keywords) {
+		if (isWord(text, token, keyword)) return true;
+	}
+	return false;
+}
+
+std::vector<std::string> SplitLuaStatements(const char *text, size_t length) {
+	std::vector<std::string> statements;
+
+	LuaLexer lexer(text, length);
+	LuaToken token;
+	int depth = 0;      // Blocks and braces still open
+	int loop_heads = 0; // while and for still waiting for their do
+	bool ended = false; // The last token can end a statement and a line break followed it
+	bool last_ends = false;
+	size_t line = 0;
+	size_t start = 0;
+	size_t start_line = 0;
+	bool whole = false;
+
+	while (!whole && lexer.next(token)) {
+		const char *t = text + token.start;
+
+		switch (token.type) {
+			case LuaToken::Whitespace:
+			case LuaToken::Comment:
+				continue;
+			case LuaToken::Newline:
+				++line;
+				if (depth == 0 && last_ends) ended = true;
+				continue;
+			case LuaToken::LongComment:
+				if (token.unterminated) whole = true;
+				line += LuaLexer::countLines(t, token.length);
+				continue;
+			case LuaToken::String:
+			case LuaToken::LongString:
+				if (token.unterminated) whole = true;
+				line += LuaLexer::countLines(t, token.length);
+				break;
+			case LuaToken::Unknown:
+				whole = true;
+				continue;
+			default:
+				break;
+		}
+
+		if (ended && startsStatement(text, token)) {
+			statements.push_back(std::string(start_line, '\n') + std::string(text + start, token.start - start));
+			start = token.start;
+			start_line = line;
+		}
+		ended = false;
+		last_ends = endsStatement(text, token);
+
+		if (token.type == LuaToken::Operator) {
+			if (token.length == 1 && strchr("([{", *t)) ++depth;
+			else if (token.length == 1 && strchr(")]}", *t)) --depth;
+			else if (depth == 0 && isWord(text, token, "::")) whole = true;
+		}
+		else if (token.type == LuaToken::Keyword) {
+			if (isWord(text, token, "while") || isWord(text, token, "for")) {
+				++depth;
+				++loop_heads;
+			}
+			else if (isWord(text, token, "do")) {
+				if (loop_heads > 0) --loop_heads;
+				else ++depth;
+			}
+			else if (isWord(text, token, "function") || isWord(text, token, "if") || isWord(text, token, "repeat")) {
+				++depth;
+			}
+			else if (isWord(text, token, "end") || isWord(text, token, "until")) {
+				--depth;
+			}
+			else if (depth == 0 && (isWord(text, token, "local") || isWord(text, token, "return") || isWord(text, token, "break") || isWord(text, token, "goto"))) {
+				// Locals and labels don't outlive their chunk, and the rest depends on return and break
+				whole = true;
+			}
+		}
+
+		if (depth < 0) whole = true;
+	}
+
+	if (whole || depth != 0 || statements.empty()) {
+		statements.clear();
+		statements.push_back(std::string(text, length));
+		return statements;
+	}
+
+	statements.push_back(std::string(start_line, '\n') + std::string(text + start, length - start));
+	return statements;
+}
+
+void BraceMap::invalidate(size_t position) {
+	dirty = std::min(dirty, position);
+}
+
+size_t BraceMap::match(const char *text, size_t length, size_t position) {
+	update(text, length);
+
+	auto it = std::lower_bound(braces.begin(), braces.end(), position, [](const Brace &brace, size_t position) { return brace.position < position; });
+	if (it == braces.end() || it->position != position) return npos;
+
+	return it->match;
+}
+
+void BraceMap::update(const char *text, size_t length) {
+	if (dirty == npos && scanned == length) return;
+
+	// A change that was never reported, start over
+	if (dirty == npos) dirty = 0;
+	dirty = std::min(dirty, length);
+
+	// Everything before the change stays
+	size_t keep = std::lower_bound(braces.begin(), braces.end(), dirty, [](const Brace &brace, size_t position) { return brace.position < position; }) - braces.begin();
+
+	// Except a [ that could turn out to start a long string, like [= followed by [
+	while (keep > 0) {
+		const size_t position = braces[keep - 1].position;
+		if (text[position] != '[') break;
+
+		size_t i = position + 1;
+		while (i < dirty && text[i] == '=') ++i;
+		if (i < dirty) break;
+
+		--keep;
+	}
+	braces.resize(keep);
+
+	// A brace is a token of its own, so lexing can pick up right after the last one
+	const size_t start = braces.empty() ? 0 : braces.back().position + 1;
+
+	// The ones matched past there are open again
+	for (auto &stack : open) stack.clear();
+	for (size_t i = 0; i < braces.size(); ++i) {
+		Brace &brace = braces[i];
+		if (brace.match != npos && brace.match >= start) brace.match = npos;
+
+		const size_t kind = strchr(braceChars, text[brace.position]) - braceChars;
+		if (brace.match == npos && kind < 3) open[kind].push_back(i);
+	}
+
+	LuaLexer lexer(text + start, length - start);
+	LuaToken token;
+	while (lexer.next(token)) {
+		if (token.type != LuaToken::Operator || token.length != 1) continue;
+
+		const size_t position = start + token.start;
+		const char *brace = static_cast<const char *>(memchr(braceChars, text[position], 6));
+		if (!brace) continue;
+
+		const size_t kind = (brace - braceChars) % 3;
+		if (brace - braceChars < 3) {
+			open[kind].push_back(braces.size());
+			braces.push_back({ position, npos });
+		}
+		else if (!open[kind].empty()) {
+			Brace &opening = braces[open[kind].back()];
+			open[kind].pop_back();
+
+			opening.match = position;
+			braces.push_back({ position, opening.position });
+		}
+		else {
+			braces.push_back({ position, npos });
+		}
+	}
+
+	scanned = length;
+	dirty = npos;
+}
@@ -0,0 +1,75 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Lookups the console input needs while typing, done on the text as one
+// block (e.g. from SCI_GETCHARACTERPOINTER) instead of through Scintilla.
+
+// Where the identifier or chain of them (e.g. ez.Button or Foo.Bar) ending
+// right at end starts. Returns end if there isn't one.
+size_t LuaIdentifierStart(const char *text, size_t end);
+
+// Where the word of name characters ending at end starts, end if there isn't one
+size_t LuaWordStart(const char *text, size_t end);
+
+// Splits input into the statements on its lines so they can be sent as a
+// batch. Each one is padded with line breaks so the line numbers in errors
+// still match. Text that can't be split safely, like locals or a return at
+// the top level that the statements after them need, comes back in one piece.
+std::vector<std::string> SplitLuaStatements(const char *text, size_t length);
+
+// Matching braces, ignoring the ones in strings and comments. Like
+// SCI_BRACEMATCH each kind of brace is only matched with its own kind.
+//
+// The positions of the braces and their matches are kept between calls.
+// After a change only the text from the change on is scanned again, and
+// only when the next match is asked for. Once the vectors have grown to the
+// size of the text no more memory is allocated.
+class BraceMap final {
+public:
+	static const size_t npos = static_cast<size_t>(-1);
+
+	// The text changed from position on
+	void invalidate(size_t position);
+
+	// Position of the brace matching the one at position, npos if there is
+	// none or there is no brace at position
+	size_t match(const char *text, size_t length, size_t position);
+
+private:
+	struct Brace {
+		size_t position;
+		size_t match;
+	};
+
+	// Every brace before scanned, in order
+	std::vector<Brace> braces;
+
+	// Indexes in braces of the ones still open at scanned, for (, [ and {
+	std::vector<size_t> open[3];
+
+	size_t scanned = 0;
+	size_t dirty = 0;
+
+	void update(const char *text, size_t length);
+};
@@ -0,0 +1,85 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include "OutputSink.h"
+
+OutputSink::OutputSink(uint32_t frame_ms) :
+	frame(std::chrono::milliseconds(frame_ms)),
+	notified(false) {}
+
+void OutputSink::setNotify(std::function<void()> notify) {
+	std::lock_guard<std::mutex> lock(mutex);
+	this->notify = notify;
+}
+
+void OutputSink::write(const char *text, size_t length, int style) {
+	if (length == 0) return;
+
+	std::function<void()> notify;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		const size_t start = pending.size();
+		pending.resize(start + length * 2);
+		for (size_t i = 0; i < length; ++i) {
+			pending[start + i * 2] = text[i];
+			pending[start + i * 2 + 1] = static_cast<char>(style);
+		}
+
+		// One wake up is enough until the owner gets around to flushing
+		if (notified) return;
+		notified = true;
+		notify = this->notify;
+	}
+
+	if (notify) notify();
+}
+
+uint32_t OutputSink::flush(const Append &append, bool force) {
+	const Clock::time_point now = Clock::now();
+
+	if (!force && now - last_flush < frame) {
+		auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(last_flush + frame - now).count();
+		return static_cast<uint32_t>(wait > 0 ? wait : 1);
+	}
+
+	// Swap the buffers so writers aren't held up while the pane is updated
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		flushing.swap(pending);
+		notified = false;
+	}
+
+	if (!flushing.empty()) {
+		append(flushing.data(), flushing.size());
+		flushing.clear();
+		last_flush = now;
+	}
+
+	return 0;
+}
+
+void OutputSink::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	pending.clear();
+}
+
+bool OutputSink::empty() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return pending.empty();
+}
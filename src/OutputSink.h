@@ -0,0 +1,74 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+// Collects text for the console's output pane and hands it over in batches,
+// so the pane is changed at most once per frame no matter how many small
+// writes come in.
+//
+// Text is kept as Scintilla cells (each character followed by its style, the
+// layout SCI_ADDSTYLEDTEXT takes), so runs of different styles survive the
+// batching.
+class OutputSink final {
+public:
+	typedef std::function<void(const char *cells, size_t length)> Append;
+
+	// Flushes are at least frame_ms apart, about 60 times a second by default
+	explicit OutputSink(uint32_t frame_ms = 16);
+	OutputSink(const OutputSink&) = delete;
+	OutputSink& operator=(const OutputSink&) = delete;
+
+	// Called by whichever thread writes the first text since the last flush.
+	// It is meant to get the owning thread to call flush().
+	void setNotify(std::function<void()> notify);
+
+	// Safe to call from any thread
+	void write(const char *text, size_t length, int style = 0);
+
+	// Hands everything written so far to append in one piece and returns 0.
+	// If the last flush was less than a frame ago nothing is done unless
+	// forced, and the milliseconds left until the next flush is allowed are
+	// returned instead.
+	uint32_t flush(const Append &append, bool force = false);
+
+	// Drops whatever hasn't been flushed yet
+	void clear();
+
+	bool empty() const;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	const Clock::duration frame;
+
+	mutable std::mutex mutex;
+	std::string pending;
+	bool notified;
+	std::function<void()> notify;
+
+	// Only touched by the thread that flushes
+	std::string flushing;
+	Clock::time_point last_flush;
+};
@@ -0,0 +1,45 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#pragma once
+
+#include "Scintilla.h"
+
+// The ">" shown in the margin of the console's input and of statements
+// echoed to the output. These work with anything that takes Scintilla
+// messages the way GUI::ScintillaWindow does.
+
+// Puts the prompt on lines first to last
+template <typename Sci>
+void MarkPrompt(Sci &sci, int first, int last) {
+	for (int line = first; line <= last; ++line) {
+		sci.CallString(SCI_MARGINSETTEXT, line, ">");
+		sci.Call(SCI_MARGINSETSTYLE, line, STYLE_LINENUMBER);
+	}
+}
+
+// Call with each SCN_MODIFIED of a pane that has the prompt on every line.
+// Scintilla keeps margin text with its line, so only the lines that an
+// insertion added need it; the one they split off is marked again in case.
+template <typename Sci>
+void UpdatePrompt(Sci &sci, const SCNotification *scn) {
+	if (!(scn->modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT)) || scn->linesAdded == 0) return;
+
+	const int line = sci.Call(SCI_LINEFROMPOSITION, scn->position);
+	MarkPrompt(sci, line, scn->linesAdded > 0 ? line + static_cast<int>(scn->linesAdded) : line);
+}
@@ -10,6 +10,8 @@
 #ifndef GUI_H
 #define GUI_H
 
+#include <exception>
+
 #define ELEMENTS(a) (sizeof(a) / sizeof(a[0]))
 
 namespace GUI {
@@ -137,10 +139,35 @@ class ScintillaWindow : public Window {
 	ScintillaWindow &operator=(const ScintillaWindow &) = delete;
 	SciFnDirect fn;
 	sptr_t ptr;
+	int batches;
+	void CheckStatus() {
+		status = fn(ptr, SCI_GETSTATUS, 0, 0);
+		if (status > 0 && status < SC_STATUS_WARN_START)
+			throw ScintillaFailure(status);
+	}
 public:
 	sptr_t status;
-	ScintillaWindow() : fn(0), ptr(0), status() {
-	}
+	ScintillaWindow() : fn(0), ptr(0), batches(0), status() {
+	}
+	// Calls made while a Batch is alive don't ask for the status after each
+	// message. Scintilla keeps a failure until SCI_SETSTATUS clears it, so the
+	// status is asked for once when the outermost Batch ends instead, and
+	// ScintillaFailure is thrown from there. Not while an exception is
+	// already on its way out of the scope though.
+	class Batch {
+		ScintillaWindow &sw;
+		int exceptions;
+	public:
+		explicit Batch(ScintillaWindow &sw_) : sw(sw_), exceptions(std::uncaught_exceptions()) {
+			sw.batches++;
+		}
+		Batch(const Batch &) = delete;
+		Batch &operator=(const Batch &) = delete;
+		~Batch() noexcept(false) {
+			if (--sw.batches == 0 && sw.fn && std::uncaught_exceptions() == exceptions)
+				sw.CheckStatus();
+		}
+	};
 	void SetID(WindowID wid_) {
 		wid = wid_;
 		fn = 0;
@@ -167,16 +194,14 @@ public:
 		if (!fn)
 			throw ScintillaFailure(SC_STATUS_FAILURE);
 		sptr_t retVal = fn(ptr, msg, wParam, lParam);
-		status = fn(ptr, SCI_GETSTATUS, 0, 0);
-		if (status > 0 && status < SC_STATUS_WARN_START)
-			throw ScintillaFailure(status);
+		if (batches == 0)
+			CheckStatus();
 		return static_cast<int>(retVal);
 	}
 	sptr_t CallReturnPointer(unsigned int msg, uptr_t wParam=0, sptr_t lParam=0) {
 		sptr_t retVal = fn(ptr, msg, wParam, lParam);
-		status = fn(ptr, SCI_GETSTATUS, 0, 0);
-		if (status > 0 && status < SC_STATUS_WARN_START)
-			throw ScintillaFailure(status);
+		if (batches == 0)
+			CheckStatus();
 		return retVal;
 	}
 	int CallPointer(unsigned int msg, uptr_t wParam, void *s) {
@@ -0,0 +1,43 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include "Scrollback.h"
+
+Scrollback::Scrollback() :
+	max_lines(0),
+	max_bytes(0),
+	log(nullptr) {}
+
+Scrollback::~Scrollback() {
+	setLog(nullptr);
+}
+
+void Scrollback::setLimits(size_t lines, size_t bytes) {
+	max_lines = lines;
+	max_bytes = bytes;
+}
+
+void Scrollback::setLog(FILE *log) {
+	if (this->log) fclose(this->log);
+	this->log = log;
+}
+
+void Scrollback::save(const char *text, size_t length) {
+	// Stop logging rather than fail the same way on every cut
+	if (fwrite(text, 1, length, log) != length || fflush(log) != 0) setLog(nullptr);
+}
@@ -0,0 +1,91 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+
+#include "Scintilla.h"
+
+// Keeps the console's output window from growing forever.
+//
+// The oldest lines are only cut once the window is a tenth over a limit, and
+// then all the way back down to it, so a cut happens once every so many
+// thousand lines instead of on every append. Whatever is cut can be saved to
+// a log file.
+//
+// Works with anything that takes Scintilla messages the way
+// GUI::ScintillaWindow does.
+class Scrollback final {
+public:
+	Scrollback();
+	Scrollback(const Scrollback&) = delete;
+	Scrollback& operator=(const Scrollback&) = delete;
+	~Scrollback();
+
+	// Either one can be 0 for no limit
+	void setLimits(size_t lines, size_t bytes);
+
+	// Text that is cut is appended to the log, which is closed once it is
+	// replaced. nullptr to just throw it away.
+	void setLog(FILE *log);
+
+	// Call after appending to the window, while it isn't read-only. Returns
+	// the number of bytes cut from the front.
+	template <typename Sci>
+	size_t trim(Sci &sci) {
+		const size_t length = sci.Call(SCI_GETLENGTH);
+		const size_t lines = sci.Call(SCI_GETLINECOUNT);
+
+		// First line that is kept
+		size_t first = 0;
+
+		if (max_lines > 0 && lines > max_lines + max_lines / 10) {
+			first = lines - max_lines;
+		}
+
+		if (max_bytes > 0 && length > max_bytes + max_bytes / 10) {
+			// Only whole lines are cut, so keep from the first line starting within the limit
+			const size_t keep_from = length - max_bytes;
+			size_t line = sci.Call(SCI_LINEFROMPOSITION, keep_from);
+			if (static_cast<size_t>(sci.Call(SCI_POSITIONFROMLINE, line)) < keep_from) ++line;
+			first = std::max(first, line);
+		}
+
+		// The last line might still be coming in
+		first = std::min(first, lines - 1);
+		if (first == 0) return 0;
+
+		const size_t end = sci.Call(SCI_POSITIONFROMLINE, first);
+		if (log) {
+			const char *text = reinterpret_cast<const char *>(sci.CallReturnPointer(SCI_GETRANGEPOINTER, 0, end));
+			save(text, end);
+		}
+		sci.Call(SCI_DELETERANGE, 0, end);
+
+		return end;
+	}
+
+private:
+	size_t max_lines;
+	size_t max_bytes;
+	FILE *log;
+
+	void save(const char *text, size_t length);
+};
@@ -0,0 +1,479 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include "SymbolIndex.h"
+#include "ApiCatalog.h"
+#include "LuaLexer.h"
+
+// Unchanged lines lexed again after an edit before the rest is left for
+// later, and how many lines get lexed before the names are counted
+#define CATCH_UP_LINES 128
+
+// Just enough of the tokens of a line to find what it defines
+struct Token {
+	LuaToken::Type type;
+	const char *text;
+	size_t length;
+
+	bool is(LuaToken::Type t, const char *s) const { return type == t && strlen(s) == length && memcmp(text, s, length) == 0; }
+	bool isName() const { return type == LuaToken::Name; }
+	std::string str() const { return std::string(text, length); }
+};
+
+// Level of the long bracket a token starts with, e.g. 1 for [=[ or --[=[
+static int openingLevel(const LuaToken &token, const char *text) {
+	size_t i = token.start + (token.type == LuaToken::LongComment ? 3 : 1);
+
+	int level = 0;
+	while (text[i++] == '=') ++level;
+	return level;
+}
+
+// Names separated by commas, e.g. after local or for. Lua 5.4 attributes like <const> are skipped.
+static size_t readNames(const std::vector<Token> &tokens, size_t i, std::vector<std::string> &names) {
+	while (i < tokens.size() && tokens[i].isName()) {
+		names.push_back(tokens[i++].str());
+
+		if (i + 2 < tokens.size() && tokens[i].is(LuaToken::Operator, "<") && tokens[i + 1].isName() && tokens[i + 2].is(LuaToken::Operator, ">")) i += 3;
+		if (i + 1 < tokens.size() && tokens[i].is(LuaToken::Operator, ",")) ++i;
+		else break;
+	}
+	return i;
+}
+
+// a.b.c, or a.b:c when a colon is allowed. Returns where it stopped.
+static size_t readChain(const std::vector<Token> &tokens, size_t i, bool colon, std::vector<std::string> &parts) {
+	while (i < tokens.size() && tokens[i].isName()) {
+		parts.push_back(tokens[i++].str());
+
+		if (i + 1 < tokens.size() && tokens[i + 1].isName() && (tokens[i].is(LuaToken::Operator, ".") || (colon && tokens[i].is(LuaToken::Operator, ":")))) {
+			const bool last = tokens[i].text[0] == ':';
+			++i;
+			if (last) {
+				parts.push_back(tokens[i++].str());
+				break;
+			}
+		}
+		else {
+			break;
+		}
+	}
+	return i;
+}
+
+static std::string join(const std::vector<std::string> &parts, size_t count) {
+	std::string joined;
+	for (size_t i = 0; i < count; ++i) {
+		if (i != 0) joined += '.';
+		joined += parts[i];
+	}
+	return joined;
+}
+
+bool SymbolIndex::NameOrder::operator()(const std::string &a, const std::string &b) const {
+	return ApiCatalog::lessByName(a, b);
+}
+
+bool SymbolIndex::NameOrder::operator()(const std::string &name, const Prefix &prefix) const {
+	return ApiCatalog::lessIgnoringCase(name, prefix.text);
+}
+
+bool SymbolIndex::NameOrder::operator()(const Prefix &prefix, const std::string &name) const {
+	return !ApiCatalog::lessIgnoringCase(name, prefix.text);
+}
+
+SymbolIndex::SymbolIndex() : busy(false), stopping(false), catching_up(false), worker(&SymbolIndex::run, this) {}
+
+SymbolIndex::~SymbolIndex() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		edits.clear();
+	}
+	wakeup.notify_one();
+	worker.join();
+}
+
+void SymbolIndex::setText(uintptr_t document, std::string text) {
+	std::lock_guard<std::mutex> lock(mutex);
+	edits.push_back({ Edit::Text, document, 0, 0, std::move(text), {} });
+	wakeup.notify_one();
+}
+
+void SymbolIndex::replaceLines(uintptr_t document, size_t first, size_t removed, std::vector<std::string> lines) {
+	std::lock_guard<std::mutex> lock(mutex);
+	edits.push_back({ Edit::Lines, document, first, removed, std::string(), std::move(lines) });
+	wakeup.notify_one();
+}
+
+void SymbolIndex::remove(uintptr_t document) {
+	std::lock_guard<std::mutex> lock(mutex);
+	edits.push_back({ Edit::Remove, document, 0, 0, std::string(), {} });
+	wakeup.notify_one();
+}
+
+void SymbolIndex::wait() {
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this]() { return edits.empty() && !busy && !catching_up; });
+}
+
+void SymbolIndex::complete(const std::string &table, const std::string &prefix, std::vector<std::string> &names) const {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto t = tables.find(table);
+	if (t == tables.end()) return;
+
+	for (auto it = t->second.lower_bound(Prefix{ prefix }); it != t->second.end() && ApiCatalog::startsWithIgnoringCase(it->first, prefix); ++it) names.push_back(it->first);
+}
+
+bool SymbolIndex::isFunction(const std::string &name) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return functions.count(name) != 0;
+}
+
+size_t SymbolIndex::size() const {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	size_t count = 0;
+	for (const auto &t : tables) count += t.second.size();
+	return count;
+}
+
+void SymbolIndex::run() {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true) {
+		wakeup.wait(lock, [this]() { return stopping || !edits.empty() || catching_up; });
+		if (stopping) return;
+
+		busy = true;
+		bool stale;
+		if (!edits.empty()) {
+			Edit edit = std::move(edits.front());
+			edits.pop_front();
+
+			lock.unlock();
+			apply(edit);
+			stale = std::any_of(documents.begin(), documents.end(), [](const std::pair<const uintptr_t, Document> &d) { return !d.second.stale.empty(); });
+			lock.lock();
+		}
+		else {
+			// Nothing else to do, so catch up some more
+			lock.unlock();
+			stale = catchUp();
+			lock.lock();
+		}
+
+		busy = false;
+		catching_up = stale;
+		if (edits.empty() && !catching_up) idle.notify_all();
+	}
+}
+
+void SymbolIndex::apply(Edit &edit) {
+	if (edit.kind == Edit::Lines) {
+		auto it = documents.find(edit.document);
+		if (it == documents.end()) return;
+
+		Document &document = it->second;
+		const size_t first = std::min(edit.first, document.lines.size());
+		replace(document, first, std::min(edit.removed, document.lines.size() - first), edit.lines);
+		return;
+	}
+
+	auto it = documents.find(edit.document);
+	if (it != documents.end()) {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const auto &line : it->second.lines) count(line->symbols, false);
+		documents.erase(it);
+	}
+
+	if (edit.kind == Edit::Remove) return;
+
+	// Split the same way Scintilla does, so line numbers match
+	std::vector<std::string> lines;
+	const std::string &text = edit.text;
+	size_t start = 0;
+	for (size_t i = 0; i < text.size(); ++i) {
+		if (text[i] == '\r' || text[i] == '\n') {
+			lines.push_back(text.substr(start, i - start));
+			if (text[i] == '\r' && i + 1 < text.size() && text[i + 1] == '\n') ++i;
+			start = i + 1;
+		}
+	}
+	lines.push_back(text.substr(start));
+
+	replace(documents[edit.document], 0, 0, lines);
+}
+
+void SymbolIndex::replace(Document &document, size_t first, size_t removed, std::vector<std::string> &lines) {
+	std::vector<std::unique_ptr<Line>> &doc = document.lines;
+
+	if (removed > lines.size()) {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = first + lines.size(); i < first + removed; ++i) count(doc[i]->symbols, false);
+	}
+
+	// Lines are reused where they can be, so typing within a line doesn't move the rest
+	const size_t reused = std::min(removed, lines.size());
+	if (removed > reused) {
+		doc.erase(doc.begin() + first + reused, doc.begin() + first + removed);
+	}
+	else if (lines.size() > reused) {
+		std::vector<std::unique_ptr<Line>> added(lines.size() - reused);
+		for (auto &line : added) line.reset(new Line());
+		doc.insert(doc.begin() + first + reused, std::make_move_iterator(added.begin()), std::make_move_iterator(added.end()));
+	}
+
+	for (size_t i = 0; i < lines.size(); ++i) doc[first + i]->text = std::move(lines[i]);
+
+	// The replaced lines are lexed in a moment, the ones after them moved
+	std::set<size_t> stale;
+	for (size_t line : document.stale) {
+		if (line < first) stale.insert(line);
+		else if (line > first + removed) stale.insert(line - removed + lines.size());
+	}
+	document.stale.swap(stale);
+
+	relex(document, first, first + lines.size());
+}
+
+bool SymbolIndex::catchUp() {
+	for (auto &it : documents) {
+		Document &document = it.second;
+		if (document.stale.empty()) continue;
+
+		const size_t first = *document.stale.begin();
+		document.stale.erase(document.stale.begin());
+		relex(document, first, first);
+		break;
+	}
+
+	return std::any_of(documents.begin(), documents.end(), [](const std::pair<const uintptr_t, Document> &d) { return !d.second.stale.empty(); });
+}
+
+// Lexes the lines from first up to changed, then goes on until a line starts
+// the way it did before, or CATCH_UP_LINES more were lexed. The names are
+// counted in batches, so the lock isn't taken for every line.
+void SymbolIndex::relex(Document &document, size_t first, size_t changed) {
+	std::vector<std::unique_ptr<Line>> &doc = document.lines;
+	std::vector<Symbol> replaced;
+	size_t counted = first;
+	size_t caught_up = 0;
+
+	State state = first > 0 ? doc[first - 1]->end : State();
+	size_t i = first;
+	bool done = true;
+	for (; i < doc.size(); ++i) {
+		Line &line = *doc[i];
+
+		if (i >= changed) {
+			if (line.start == state) break;
+			if (caught_up++ == CATCH_UP_LINES) {
+				done = false;
+				break;
+			}
+		}
+
+		std::move(line.symbols.begin(), line.symbols.end(), std::back_inserter(replaced));
+		line.start = state;
+		lex(line, state);
+		state = line.end;
+
+		if (i + 1 - counted == CATCH_UP_LINES) {
+			std::lock_guard<std::mutex> lock(mutex);
+			count(replaced, false);
+			for (; counted <= i; ++counted) count(doc[counted]->symbols, true);
+			replaced.clear();
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		count(replaced, false);
+		for (; counted < i; ++counted) count(doc[counted]->symbols, true);
+	}
+
+	// Everything up to where it stopped is in order now
+	document.stale.erase(document.stale.lower_bound(first), document.stale.upper_bound(i));
+	if (!done) document.stale.insert(i);
+}
+
+// Called with the mutex held
+void SymbolIndex::count(const std::vector<Symbol> &symbols, bool add) {
+	if (symbols.empty()) return;
+
+	for (const Symbol &symbol : symbols) {
+		auto &names = tables[symbol.table];
+		Count &c = names[symbol.name];
+
+		if (add) {
+			++c.uses;
+			if (symbol.function && c.functions++ == 0) ++functions[symbol.name];
+			continue;
+		}
+
+		--c.uses;
+		if (symbol.function && --c.functions == 0) {
+			auto f = functions.find(symbol.name);
+			if (--f->second == 0) functions.erase(f);
+		}
+
+		if (c.uses == 0) {
+			names.erase(symbol.name);
+			if (names.empty()) tables.erase(symbol.table);
+		}
+	}
+}
+
+void SymbolIndex::lex(Line &line, const State &start) {
+	line.end = start;
+	line.symbols.clear();
+
+	const char *text = line.text.c_str();
+	size_t offset = 0;
+
+	// Still in the middle of a long string or comment
+	if (start.long_level >= 0) {
+		const std::string close = "]" + std::string(start.long_level, '=') + "]";
+		offset = line.text.find(close);
+		if (offset == std::string::npos) return;
+
+		offset += close.size();
+		line.end.long_level = -1;
+	}
+
+	std::vector<Token> tokens;
+	LuaLexer lexer(text + offset, line.text.size() - offset);
+	LuaToken token;
+	while (lexer.next(token)) {
+		switch (token.type) {
+			case LuaToken::Whitespace:
+			case LuaToken::Comment:
+			case LuaToken::Newline:
+				break;
+			case LuaToken::LongComment:
+			case LuaToken::LongString:
+				if (token.unterminated) line.end.long_level = openingLevel(token, text + offset);
+				if (token.type == LuaToken::LongString) tokens.push_back({ token.type, text + offset + token.start, token.length });
+				break;
+			default:
+				tokens.push_back({ token.type, text + offset + token.start, token.length });
+				break;
+		}
+	}
+
+	std::vector<Symbol> &symbols = line.symbols;
+	std::vector<std::string> &open = line.end.tables;
+	std::vector<std::string> names;
+
+	size_t i = 0;
+	while (i < tokens.size()) {
+		const Token &t = tokens[i];
+
+		if (t.is(LuaToken::Keyword, "function")) {
+			// function a.b:c(x, y), or just function(x, y)
+			std::vector<std::string> parts;
+			i = readChain(tokens, i + 1, true, parts);
+			if (!parts.empty()) symbols.push_back({ join(parts, parts.size() - 1), parts.back(), true });
+
+			if (i < tokens.size() && tokens[i].is(LuaToken::Operator, "(")) {
+				names.clear();
+				i = readNames(tokens, i + 1, names);
+				for (const std::string &name : names) symbols.push_back({ std::string(), name, false });
+			}
+			continue;
+		}
+
+		if (t.is(LuaToken::Keyword, "local") || t.is(LuaToken::Keyword, "for")) {
+			if (i + 1 < tokens.size() && tokens[i + 1].is(LuaToken::Keyword, "function")) {
+				++i;
+				continue;
+			}
+
+			names.clear();
+			i = readNames(tokens, i + 1, names);
+			for (const std::string &name : names) symbols.push_back({ std::string(), name, false });
+
+			// local t = { ... } or local f = function
+			if (names.size() == 1 && i + 1 < tokens.size() && tokens[i].is(LuaToken::Operator, "=")) {
+				if (tokens[i + 1].is(LuaToken::Keyword, "function")) symbols.back().function = true;
+				if (tokens[i + 1].is(LuaToken::Operator, "{")) {
+					open.push_back(names.front());
+					i += 2;
+				}
+			}
+			continue;
+		}
+
+		if (t.is(LuaToken::Operator, "{")) {
+			open.push_back(std::string());
+			++i;
+			continue;
+		}
+
+		if (t.is(LuaToken::Operator, "}")) {
+			if (!open.empty()) open.pop_back();
+			++i;
+			continue;
+		}
+
+		// Only the start of a.b.c = ..., never the middle of a.b.c or a:b
+		const bool after_dot = i > 0 && (tokens[i - 1].is(LuaToken::Operator, ".") || tokens[i - 1].is(LuaToken::Operator, ":"));
+		if (!t.isName() || after_dot) {
+			++i;
+			continue;
+		}
+
+		std::vector<std::string> parts;
+		const size_t end = readChain(tokens, i, false, parts);
+		if (end >= tokens.size() || !tokens[end].is(LuaToken::Operator, "=")) {
+			i = end;
+			continue;
+		}
+
+		const bool function = end + 1 < tokens.size() && tokens[end + 1].is(LuaToken::Keyword, "function");
+		const bool table = end + 1 < tokens.size() && tokens[end + 1].is(LuaToken::Operator, "{");
+
+		// A name = value right inside a constructor is one of its fields
+		const bool field = parts.size() == 1 && !open.empty() && (i == 0 || tokens[i - 1].is(LuaToken::Operator, "{") ||
+			tokens[i - 1].is(LuaToken::Operator, ",") || tokens[i - 1].is(LuaToken::Operator, ";"));
+
+		std::string path;
+		if (field) {
+			if (!open.back().empty()) {
+				symbols.push_back({ open.back(), parts.front(), function });
+				path = open.back() + "." + parts.front();
+			}
+		}
+		else {
+			symbols.push_back({ join(parts, parts.size() - 1), parts.back(), function });
+			path = join(parts, parts.size());
+		}
+
+		i = end + 1;
+		if (table) {
+			open.push_back(path);
+			++i;
+		}
+	}
+}
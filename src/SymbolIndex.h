@@ -0,0 +1,168 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Names defined in the open Lua files, for autocompletion.
+//
+// Each file is kept as lines, along with what the lexer was in the middle
+// of at the end of each line (a long string or comment, table constructors)
+// and the names the line defines:
+//
+//   local a, b            a and b
+//   local function f      f, a function
+//   function t.u:f(x)     f, a function in table "t.u", and x
+//   for i, v in ...       i and v
+//   a.b = 1               b in table "a"
+//   t = { x = 1 }         t, and x in table "t"
+//
+// Only the lines that were changed are lexed again, plus the lines after
+// them until one starts the same way as before, so the cost of an edit
+// doesn't depend on the size of the file. An edit like typing { or [[
+// changes how every line after it starts though. Those lines are caught up
+// CATCH_UP_LINES at a time, and only while there are no edits waiting, so
+// they don't hold up the next keystroke. Names are counted across all the
+// lines and files that define them.
+//
+// All the lexing happens on a worker thread. Everything public can be
+// called from any thread.
+class SymbolIndex final {
+public:
+	SymbolIndex();
+	SymbolIndex(const SymbolIndex&) = delete;
+	SymbolIndex& operator=(const SymbolIndex&) = delete;
+	~SymbolIndex();
+
+	// Replaces everything known about the document
+	void setText(uintptr_t document, std::string text);
+
+	// removed lines starting at first were replaced with lines, which have
+	// no line breaks
+	void replaceLines(uintptr_t document, size_t first, size_t removed, std::vector<std::string> lines);
+
+	void remove(uintptr_t document);
+
+	// Blocks until everything queued so far has been indexed
+	void wait();
+
+	// Appends the names in table ("" for the top level) starting with
+	// prefix, ignoring case, in the order Scintilla expects
+	void complete(const std::string &table, const std::string &prefix, std::vector<std::string> &names) const;
+
+	bool isFunction(const std::string &name) const;
+
+	// Number of different names
+	size_t size() const;
+
+private:
+	struct Symbol {
+		std::string table;
+		std::string name;
+		bool function;
+	};
+
+	// What a line leaves open for the next one
+	struct State {
+		int long_level = -1; // Level of an unfinished long string or comment
+		std::vector<std::string> tables; // Open constructors, "" when not assigned to a name
+
+		bool operator==(const State &other) const { return long_level == other.long_level && tables == other.tables; }
+		bool operator!=(const State &other) const { return !(*this == other); }
+	};
+
+	struct Line {
+		std::string text;
+		State start;
+		State end;
+		std::vector<Symbol> symbols;
+	};
+
+	struct Document {
+		// Kept by pointer so adding or removing a line only moves pointers
+		std::vector<std::unique_ptr<Line>> lines;
+
+		// Lines that may not start the way the line before them ends, where
+		// catching up after an edit was left for later
+		std::set<size_t> stale;
+	};
+
+	struct Edit {
+		enum { Text, Lines, Remove } kind;
+		uintptr_t document;
+		size_t first;
+		size_t removed;
+		std::string text;
+		std::vector<std::string> lines;
+	};
+
+	struct Count {
+		size_t uses = 0;
+		size_t functions = 0;
+	};
+
+	struct Prefix {
+		const std::string &text;
+	};
+
+	// Names only differing in case are different names. Comparing with a
+	// Prefix finds the first name that could start with it.
+	struct NameOrder {
+		typedef void is_transparent;
+		bool operator()(const std::string &a, const std::string &b) const;
+		bool operator()(const std::string &name, const Prefix &prefix) const;
+		bool operator()(const Prefix &prefix, const std::string &name) const;
+	};
+
+	mutable std::mutex mutex;
+	std::condition_variable wakeup;
+	std::condition_variable idle;
+	std::deque<Edit> edits;
+	bool busy;
+	bool stopping;
+	bool catching_up; // Some document has stale lines
+
+	// Guarded by mutex
+	std::map<std::string, std::map<std::string, Count, NameOrder>> tables;
+	std::unordered_map<std::string, size_t> functions;
+
+	// Only used by the worker thread
+	std::map<uintptr_t, Document> documents;
+
+	std::thread worker;
+
+	void run();
+	void apply(Edit &edit);
+	void replace(Document &document, size_t first, size_t removed, std::vector<std::string> &lines);
+	bool catchUp();
+	void relex(Document &document, size_t first, size_t changed);
+	void count(const std::vector<Symbol> &symbols, bool add);
+
+	static void lex(Line &line, const State &start);
+};
@@ -20,6 +20,7 @@
 #include <Windows.h>
 #include <Shellapi.h>
 #include <shlwapi.h>
+#include <string>
 #include <vector>
 
 #include "PluginInterface.h"
@@ -31,6 +32,9 @@
 // --- Menu callbacks ---
 static void showConsole();
 static void editSettings();
+static void detectPort();
+static void detectBaudrate();
+static void refreshCatalog();
 static void executeCurrentFile();
 static void showAbout();
 
@@ -63,10 +67,51 @@ static const wchar_t* GetIniFilePath() {
 	return iniPath;
 }
 
+// Names defined in the current buffer are offered by autocompletion if it is Lua
+static void indexCurrentBuffer() {
+	const uintptr_t buffer = static_cast<uintptr_t>(SendNpp(NPPM_GETCURRENTBUFFERID));
+	luaConsole->indexDocument(buffer, updateScintilla(), SendNpp(NPPM_GETBUFFERLANGTYPE, buffer) == L_LUA);
+}
+
 static void ReadSettings() {
 	wchar_t com_port[1024] = { 0 };
 	GetPrivateProfileString(TEXT("ezLCDLua"), TEXT("PORT"), TEXT(""), com_port, 1023, GetIniFilePath());
 	luaConsole->setComPort(GUI::UTF8FromString(com_port));
+
+	// Hardware ID of the board found by Detect Port, used to find it again if it moves to another port
+	wchar_t device_id[1024] = { 0 };
+	GetPrivateProfileString(TEXT("ezLCDLua"), TEXT("DEVICE"), TEXT(""), device_id, 1023, GetIniFilePath());
+	luaConsole->setDeviceId(GUI::UTF8FromString(device_id));
+
+	luaConsole->setBaudrate(GetPrivateProfileInt(TEXT("ezLCDLua"), TEXT("BAUD"), 115200, GetIniFilePath()));
+
+	// none, software (XON/XOFF) or hardware (RTS/CTS)
+	wchar_t flow_control[32] = { 0 };
+	GetPrivateProfileString(TEXT("ezLCDLua"), TEXT("FLOWCONTROL"), TEXT("none"), flow_control, 31, GetIniFilePath());
+	if (_wcsicmp(flow_control, L"hardware") == 0)
+		luaConsole->setFlowcontrol(serial::flowcontrol_hardware);
+	else if (_wcsicmp(flow_control, L"software") == 0)
+		luaConsole->setFlowcontrol(serial::flowcontrol_software);
+	else
+		luaConsole->setFlowcontrol(serial::flowcontrol_none);
+
+	// Strip comments and whitespace from files before uploading them
+	luaConsole->setMinify(GetPrivateProfileInt(TEXT("ezLCDLua"), TEXT("MINIFY"), 0, GetIniFilePath()) != 0);
+
+	// Keep compiled files on the device so unchanged ones don't get uploaded again
+	luaConsole->setCache(GetPrivateProfileInt(TEXT("ezLCDLua"), TEXT("CACHE"), 0, GetIniFilePath()) != 0);
+
+	// Number of statements that can be sent before the first reply comes back, 1 to wait for each one.
+	// Statements already sent still run when an earlier one fails, so it is off unless asked for.
+	luaConsole->setPipelineWindow(GetPrivateProfileInt(TEXT("ezLCDLua"), TEXT("PIPELINE"), 1, GetIniFilePath()));
+
+	// Lines and bytes of output the console keeps, 0 for no limit. Anything older goes to the log file if there is one.
+	luaConsole->console->setScrollback(GetPrivateProfileInt(TEXT("ezLCDLua"), TEXT("SCROLLBACK"), 0, GetIniFilePath()),
+		GetPrivateProfileInt(TEXT("ezLCDLua"), TEXT("SCROLLBACK_BYTES"), 0, GetIniFilePath()));
+
+	wchar_t scrollback_log[MAX_PATH] = { 0 };
+	GetPrivateProfileString(TEXT("ezLCDLua"), TEXT("SCROLLBACK_LOG"), TEXT(""), scrollback_log, MAX_PATH - 1, GetIniFilePath());
+	luaConsole->console->setScrollbackLog(scrollback_log);
 }
 
 BOOL APIENTRY DllMain(HANDLE hModule, DWORD  reasonForCall, LPVOID lpReserved) {
@@ -108,6 +153,9 @@ extern "C" __declspec(dllexport) FuncItem *getFuncsArray(int *nbF) {
 	funcItems.emplace_back(FuncItem{ TEXT("Execute Current File"), executeCurrentFile, 0, false, &shortcut });
 	funcItems.emplace_back(FuncItem{ TEXT(""), nullptr, 0, false, nullptr }); // separator
 	funcItems.emplace_back(FuncItem{ TEXT("Edit Config File"), editSettings, 0, false, NULL });
+	funcItems.emplace_back(FuncItem{ TEXT("Detect Port"), detectPort, 0, false, NULL });
+	funcItems.emplace_back(FuncItem{ TEXT("Detect Baud Rate"), detectBaudrate, 0, false, NULL });
+	funcItems.emplace_back(FuncItem{ TEXT("Refresh Autocompletion"), refreshCatalog, 0, false, NULL });
 	funcItems.emplace_back(FuncItem{ TEXT("About..."), showAbout, 0, false, NULL });
 
 	*nbF = static_cast<int>(funcItems.size());
@@ -127,10 +175,17 @@ extern "C" __declspec(dllexport) void beNotified(SCNotification *notification) {
 			// If ini doesnt exist create it with default values
 			if (PathFileExists(GetIniFilePath()) == 0) {
 				WritePrivateProfileString(TEXT("ezLCDLua"), TEXT("PORT"), TEXT("COM1"), GetIniFilePath());
+				WritePrivateProfileString(TEXT("ezLCDLua"), TEXT("BAUD"), TEXT("115200"), GetIniFilePath());
+				WritePrivateProfileString(TEXT("ezLCDLua"), TEXT("FLOWCONTROL"), TEXT("none"), GetIniFilePath());
 			}
 
 			ReadSettings();
 
+			// What the board's Lua has in it is kept next to the ini, one file per firmware version
+			wchar_t config_dir[MAX_PATH] = { 0 };
+			SendNpp(NPPM_GETPLUGINSCONFIGDIR, MAX_PATH, (LPARAM)config_dir);
+			luaConsole->setApiCacheDirectory(GUI::UTF8FromString(config_dir));
+
 			break;
 		}
 		case NPPN_TBMODIFICATION: {
@@ -148,7 +203,21 @@ extern "C" __declspec(dllexport) void beNotified(SCNotification *notification) {
 			}
 			break;
 		}
+		case NPPN_BUFFERACTIVATED:
+		case NPPN_LANGCHANGED:
+			indexCurrentBuffer();
+			break;
+		case NPPN_FILEBEFORECLOSE:
+			luaConsole->forgetDocument(nh.idFrom);
+			break;
+		case SCN_MODIFIED:
+			// Only from the view with the focus, the other one can show the same buffer
+			if ((notification->modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT)) && nh.hwndFrom == updateScintilla()) {
+				luaConsole->documentModified(static_cast<uintptr_t>(SendNpp(NPPM_GETCURRENTBUFFERID)), updateScintilla(), notification);
+			}
+			break;
 		case NPPN_SHUTDOWN:
+			luaConsole->disconnect();
 			break;
 	}
 	return;
@@ -178,14 +247,36 @@ static void editSettings() {
 	SendNpp(NPPM_DOOPEN, 0, (LPARAM)GetIniFilePath());
 }
 
+static void detectPort() {
+	luaConsole->console->doDialog();
+
+	// Remember where it is, and what it is so it can be found again
+	luaConsole->detectPort([](const std::string &port, const std::string &id) {
+		WritePrivateProfileString(TEXT("ezLCDLua"), TEXT("PORT"), GUI::StringFromUTF8(port).c_str(), GetIniFilePath());
+		WritePrivateProfileString(TEXT("ezLCDLua"), TEXT("DEVICE"), GUI::StringFromUTF8(id).c_str(), GetIniFilePath());
+	});
+}
+
+static void detectBaudrate() {
+	luaConsole->console->doDialog();
+
+	// Remember the rate so it is used from now on
+	luaConsole->detectBaudrate([](uint32_t baudrate) {
+		WritePrivateProfileString(TEXT("ezLCDLua"), TEXT("BAUD"), std::to_wstring(baudrate).c_str(), GetIniFilePath());
+	});
+}
+
+static void refreshCatalog() {
+	luaConsole->console->doDialog();
+	luaConsole->refreshCatalog();
+}
+
 static void executeCurrentFile() {
 	HWND current_scintilla = updateScintilla();
 	const char* doc = (const char*)SendMessage(current_scintilla, SCI_GETCHARACTERPOINTER, SCI_UNUSED, SCI_UNUSED);
 
-	if (luaConsole->runStatement(doc) == false) {
-		luaConsole->console->doDialog();
-		SendMessage(current_scintilla, SCI_GRABFOCUS, SCI_UNUSED, SCI_UNUSED);
-	}
+	// Any errors will bring up the console once the file has run
+	luaConsole->runStatement(doc, true);
 }
 
 static void showAbout() {
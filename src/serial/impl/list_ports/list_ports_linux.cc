@@ -0,0 +1,160 @@
+#if defined(__linux__)
+
+/*
+ * Copyright (c) 2014 Craig Lilley <cralilley@gmail.com>
+ * This software is made available under the terms of the MIT licence.
+ * A copy of the licence can be obtained from:
+ * http://opensource.org/licenses/MIT
+ */
+
+#include "serial/serial.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using serial::PortInfo;
+using std::vector;
+using std::string;
+
+// Everything is looked up below this, normally "". Setting
+// SERIAL_LIST_PORTS_ROOT points it at a fake /sys and /dev tree instead.
+static string
+root_path()
+{
+	const char *root = getenv("SERIAL_LIST_PORTS_ROOT");
+	return root != NULL ? root : "";
+}
+
+// First line of a sysfs attribute, or "" if there is no such file
+static string
+read_line(const string &path)
+{
+	std::ifstream file(path.c_str());
+	string line;
+	std::getline(file, line);
+	return line;
+}
+
+static bool
+exists(const string &path)
+{
+	return access(path.c_str(), F_OK) == 0;
+}
+
+static string
+real_path(const string &path)
+{
+	char resolved[PATH_MAX];
+	return realpath(path.c_str(), resolved) != NULL ? resolved : "";
+}
+
+static string
+base_name(const string &path)
+{
+	size_t slash = path.find_last_of('/');
+	return slash == string::npos ? path : path.substr(slash + 1);
+}
+
+static string
+dir_name(const string &path)
+{
+	size_t slash = path.find_last_of('/');
+	return slash == string::npos || slash == 0 ? string() : path.substr(0, slash);
+}
+
+// The USB device a tty hangs off, found by walking up from the tty's
+// device until a directory has the USB descriptor attributes
+static string
+usb_device(const string &device, const string &devices_root)
+{
+	for(string dir = device; dir.size() > devices_root.size(); dir = dir_name(dir))
+	{
+		if(exists(dir + "/idVendor") && exists(dir + "/idProduct"))
+			return dir;
+	}
+	return string();
+}
+
+static void
+describe_usb(const string &usb, PortInfo &port_entry)
+{
+	string vid = read_line(usb + "/idVendor");
+	string pid = read_line(usb + "/idProduct");
+	string serial_number = read_line(usb + "/serial");
+	string manufacturer = read_line(usb + "/manufacturer");
+	string product = read_line(usb + "/product");
+
+	// Same form as pyserial and the other platforms' hardware IDs
+	port_entry.hardware_id = "USB VID:PID=" + vid + ":" + pid;
+	if(!serial_number.empty())
+		port_entry.hardware_id += " SNR=" + serial_number;
+
+	if(!manufacturer.empty() && !product.empty() && product.find(manufacturer) == string::npos)
+		port_entry.description = manufacturer + " " + product;
+	else if(!product.empty())
+		port_entry.description = product;
+	else
+		port_entry.description = manufacturer;
+}
+
+vector<PortInfo>
+serial::list_ports()
+{
+	vector<PortInfo> devices_found;
+
+	const string root = root_path();
+	const string class_dir = root + "/sys/class/tty";
+	const string devices_root = real_path(root + "/sys/devices");
+
+	DIR *dir = opendir(class_dir.c_str());
+	if(dir == NULL)
+		return devices_found;
+
+	while(dirent *entry = readdir(dir))
+	{
+		const string name = entry->d_name;
+		if(name[0] == '.')
+			continue;
+
+		// Virtual terminals have no device behind them
+		const string device = real_path(class_dir + "/" + name + "/device");
+		if(device.empty())
+			continue;
+
+		// Nor do the legacy 8250 ports that are always registered, whether
+		// or not there is a UART
+		const string subsystem = base_name(real_path(device + "/subsystem"));
+		if(subsystem == "platform")
+			continue;
+
+		PortInfo port_entry;
+		port_entry.port = root + "/dev/" + name;
+		port_entry.description = name;
+		port_entry.hardware_id = "n/a";
+
+		const string usb = usb_device(device, devices_root);
+		if(!usb.empty())
+			describe_usb(usb, port_entry);
+		else if(subsystem == "pnp")
+			port_entry.hardware_id = read_line(device + "/id");
+
+		devices_found.push_back(port_entry);
+	}
+
+	closedir(dir);
+
+	std::sort(devices_found.begin(), devices_found.end(),
+		[](const PortInfo &a, const PortInfo &b) { return a.port < b.port; });
+
+	return devices_found;
+}
+
+#endif // #if defined(__linux__)
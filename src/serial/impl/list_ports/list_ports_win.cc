@@ -11,6 +11,7 @@
 #include <tchar.h>
 #include <windows.h>
 #include <setupapi.h>
+#include <cfgmgr32.h>
 #include <initguid.h>
 #include <devguid.h>
 #include <cstring>
@@ -22,6 +23,7 @@ using std::string;
 static const DWORD port_name_max_length = 256;
 static const DWORD friendly_name_max_length = 256;
 static const DWORD hardware_id_max_length = 256;
+static const DWORD instance_id_max_length = MAX_DEVICE_ID_LEN;
 
 // Convert a wide Unicode string to an UTF8 string
 std::string utf8_encode(const std::wstring &wstr)
@@ -32,6 +34,59 @@ std::string utf8_encode(const std::wstring &wstr)
 	return strTo;
 }
 
+// The USB device a port belongs to, e.g. USB\VID_0403&PID_6015\EZ123. Adapters
+// like FTDI's put the port on a bus of their own under the USB device, and
+// composite devices have an interface (MI_xx) in between, so the parents are
+// looked at as well. Empty if it isn't on USB.
+static std::string usb_instance_id(DEVINST devinst)
+{
+	for(int depth = 0; depth < 4; ++depth)
+	{
+		TCHAR instance_id[instance_id_max_length];
+
+		if(CM_Get_Device_ID(devinst, instance_id, instance_id_max_length, 0) != CR_SUCCESS)
+			break;
+
+		#ifdef UNICODE
+			std::string id = utf8_encode(instance_id);
+		#else
+			std::string id = instance_id;
+		#endif
+
+		if(id.compare(0, 4, "USB\\") == 0 && id.find("&MI_") == string::npos)
+			return id;
+
+		if(CM_Get_Parent(&devinst, devinst, 0) != CR_SUCCESS)
+			break;
+	}
+
+	return "";
+}
+
+// Same format as on Linux, "USB VID:PID=0403:6015 SNR=EZ123". For devices
+// without a serial number Windows makes up an instance (it has an & in it)
+// from where the device is plugged in. That is still the only way to tell
+// identical ones apart, so it goes in as LOCATION.
+static std::string usb_hardware_id(const std::string &instance_id)
+{
+	size_t vid = instance_id.find("VID_");
+	size_t pid = instance_id.find("PID_");
+	size_t last = instance_id.rfind('\\');
+
+	if(vid == string::npos || pid == string::npos || last == string::npos)
+		return "";
+
+	string hardware_id = "USB VID:PID=" + instance_id.substr(vid + 4, 4) + ":" + instance_id.substr(pid + 4, 4);
+	string instance = instance_id.substr(last + 1);
+
+	if(instance.find('&') == string::npos)
+		hardware_id += " SNR=" + instance;
+	else
+		hardware_id += " LOCATION=" + instance;
+
+	return hardware_id;
+}
+
 vector<PortInfo>
 serial::list_ports()
 {
@@ -136,6 +191,29 @@ serial::list_ports()
 			std::string hardwareId = hardware_id;
 		#endif
 
+		// The hardware ID is the same for every adapter of a kind, the
+		// serial number or instance tells them apart
+
+		std::string usbId = usb_hardware_id(usb_instance_id(device_info_data.DevInst));
+
+		if(!usbId.empty())
+		{
+			hardwareId = usbId;
+		}
+		else
+		{
+			TCHAR instance_id[instance_id_max_length];
+
+			if(SetupDiGetDeviceInstanceId(device_info_set, &device_info_data, instance_id, instance_id_max_length, NULL) == TRUE)
+			{
+				#ifdef UNICODE
+					hardwareId += " ID=" + utf8_encode(instance_id);
+				#else
+					hardwareId += std::string(" ID=") + instance_id;
+				#endif
+			}
+		}
+
 		PortInfo port_entry;
 		port_entry.port = portName;
 		port_entry.description = friendlyName;
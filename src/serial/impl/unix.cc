@@ -0,0 +1,1128 @@
+/* Copyright 2012 William Woodall and John Harrison
+ *
+ * POSIX backend: termios for the line settings, poll for the timeouts.
+ */
+
+#if !defined(_WIN32)
+
+#include <stdio.h>
+#include <string.h>
+#include <sstream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <algorithm>
+
+#if defined(__MACH__)
+# include <AvailabilityMacros.h>
+#endif
+
+#include "serial/impl/unix.h"
+
+#ifndef TIOCINQ
+#ifdef FIONREAD
+#define TIOCINQ FIONREAD
+#else
+#define TIOCINQ 0x541B
+#endif
+#endif
+
+#if defined(MAC_OS_X_VERSION_10_3) && (MAC_OS_X_VERSION_MIN_REQUIRED >= MAC_OS_X_VERSION_10_3)
+#include <IOKit/serial/ioss.h>
+#endif
+
+// Arbitrary baud rates on Linux go through termios2 and BOTHER. The kernel
+// header that declares them (<asm/termbits.h>) clashes with <termios.h>, so
+// the structure is declared here for the architectures that share the
+// generic layout.
+#if defined(__linux__) && defined(TCGETS2) && \
+    (defined(__i386__) || defined(__x86_64__) || defined(__arm__) || \
+     defined(__aarch64__) || defined(__riscv))
+#define SERIAL_HAVE_TERMIOS2
+struct termios2 {
+  tcflag_t c_iflag;
+  tcflag_t c_oflag;
+  tcflag_t c_cflag;
+  tcflag_t c_lflag;
+  cc_t c_line;
+  cc_t c_cc[19];
+  speed_t c_ispeed;
+  speed_t c_ospeed;
+};
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+#endif
+
+// Buffers handed to a single writev
+#define IOV_BATCH 16
+
+using std::string;
+using std::stringstream;
+using std::invalid_argument;
+using serial::ConstBuffer;
+using serial::MillisecondTimer;
+using serial::Serial;
+using serial::SerialException;
+using serial::PortNotOpenedException;
+using serial::IOException;
+
+
+MillisecondTimer::MillisecondTimer (const uint32_t millis)
+  : expiry(timespec_now())
+{
+  int64_t tv_nsec = expiry.tv_nsec + (millis * 1e6);
+  if (tv_nsec >= 1e9) {
+    int64_t sec_diff = tv_nsec / static_cast<int> (1e9);
+    expiry.tv_nsec = tv_nsec % static_cast<int>(1e9);
+    expiry.tv_sec += sec_diff;
+  } else {
+    expiry.tv_nsec = tv_nsec;
+  }
+}
+
+int64_t
+MillisecondTimer::remaining ()
+{
+  timespec now(timespec_now());
+  int64_t millis = (expiry.tv_sec - now.tv_sec) * 1e3;
+  millis += (expiry.tv_nsec - now.tv_nsec) / 1e6;
+  return millis;
+}
+
+timespec
+MillisecondTimer::timespec_now ()
+{
+  timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time;
+}
+
+static timespec
+timespec_from_ns (uint64_t ns)
+{
+  timespec time;
+  time.tv_sec = static_cast<time_t> (ns / 1000000000ull);
+  time.tv_nsec = static_cast<long> (ns % 1000000000ull);
+  return time;
+}
+
+// Timeouts are 32 bit, but constant + multiplier * size can easily overflow
+static uint32_t
+total_timeout_ms (uint32_t constant, uint32_t multiplier, size_t size)
+{
+  uint64_t total = constant + static_cast<uint64_t> (multiplier) * size;
+  return static_cast<uint32_t> (std::min<uint64_t> (total, serial::Timeout::max ()));
+}
+
+static int
+poll_timeout_ms (int64_t timeout)
+{
+  if (timeout < 0) {
+    return 0;
+  }
+  return static_cast<int> (std::min<int64_t> (timeout, INT_MAX));
+}
+
+Serial::SerialImpl::SerialImpl (const string &port, unsigned long baudrate,
+                                bytesize_t bytesize,
+                                parity_t parity, stopbits_t stopbits,
+                                flowcontrol_t flowcontrol)
+  : port_ (port), fd_ (-1), is_open_ (false), xonxoff_ (false), rtscts_ (false),
+    baudrate_ (baudrate), byte_time_ns_ (0), parity_ (parity),
+    bytesize_ (bytesize), stopbits_ (stopbits), flowcontrol_ (flowcontrol)
+{
+  // interrupt () writes a byte to the pipe to wake up whoever is polling
+  if (::pipe (interrupt_) != 0) {
+    THROW (IOException, errno);
+  }
+  for (int i = 0; i < 2; ++i) {
+    ::fcntl (interrupt_[i], F_SETFL, ::fcntl (interrupt_[i], F_GETFL) | O_NONBLOCK);
+    ::fcntl (interrupt_[i], F_SETFD, FD_CLOEXEC);
+  }
+  pthread_mutex_init(&this->read_mutex, NULL);
+  pthread_mutex_init(&this->write_mutex, NULL);
+  if (port_.empty () == false) {
+    try {
+      open ();
+    } catch (...) {
+      // The destructor never runs for an object that failed to construct
+      ::close (interrupt_[0]);
+      ::close (interrupt_[1]);
+      pthread_mutex_destroy(&this->read_mutex);
+      pthread_mutex_destroy(&this->write_mutex);
+      throw;
+    }
+  }
+}
+
+Serial::SerialImpl::~SerialImpl ()
+{
+  close();
+  ::close (interrupt_[0]);
+  ::close (interrupt_[1]);
+  pthread_mutex_destroy(&this->read_mutex);
+  pthread_mutex_destroy(&this->write_mutex);
+}
+
+void
+Serial::SerialImpl::open ()
+{
+  if (port_.empty ()) {
+    throw invalid_argument ("Empty port is invalid.");
+  }
+  if (is_open_ == true) {
+    throw SerialException ("Serial port already open.");
+  }
+
+  do {
+    fd_ = ::open (port_.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+  } while (fd_ == -1 && errno == EINTR);
+
+  if (fd_ == -1) {
+    switch (errno) {
+    case ENFILE:
+    case EMFILE:
+      THROW (IOException, "Too many file handles open.");
+    case ENOENT: {
+      stringstream ss;
+      ss << "Specified port, " << port_ << ", does not exist.";
+      THROW (IOException, ss.str().c_str());
+    }
+    default:
+      THROW (IOException, errno);
+    }
+  }
+
+  try {
+    reconfigurePort();
+  } catch (...) {
+    ::close (fd_);
+    fd_ = -1;
+    throw;
+  }
+  is_open_ = true;
+}
+
+void
+Serial::SerialImpl::reconfigurePort ()
+{
+  if (fd_ == -1) {
+    // Can only operate on a valid file descriptor
+    THROW (IOException, "Invalid file descriptor, is the serial port open?");
+  }
+
+  struct termios options; // The options for the file descriptor
+
+  if (tcgetattr(fd_, &options) == -1) {
+    THROW (IOException, "::tcgetattr");
+  }
+
+  // set up raw mode / no echo / binary
+  options.c_cflag |= (tcflag_t)  (CLOCAL | CREAD);
+  options.c_lflag &= (tcflag_t) ~(ICANON | ECHO | ECHOE | ECHOK | ECHONL |
+                                       ISIG | IEXTEN); //|ECHOPRT
+
+  options.c_oflag &= (tcflag_t) ~(OPOST);
+  options.c_iflag &= (tcflag_t) ~(INLCR | IGNCR | ICRNL | IGNBRK);
+#ifdef IUCLC
+  options.c_iflag &= (tcflag_t) ~IUCLC;
+#endif
+#ifdef PARMRK
+  options.c_iflag &= (tcflag_t) ~PARMRK;
+#endif
+
+  // setup baud rate
+  bool custom_baud = false;
+  speed_t baud;
+  switch (baudrate_) {
+#ifdef B0
+  case 0: baud = B0; break;
+#endif
+#ifdef B50
+  case 50: baud = B50; break;
+#endif
+#ifdef B75
+  case 75: baud = B75; break;
+#endif
+#ifdef B110
+  case 110: baud = B110; break;
+#endif
+#ifdef B134
+  case 134: baud = B134; break;
+#endif
+#ifdef B150
+  case 150: baud = B150; break;
+#endif
+#ifdef B200
+  case 200: baud = B200; break;
+#endif
+#ifdef B300
+  case 300: baud = B300; break;
+#endif
+#ifdef B600
+  case 600: baud = B600; break;
+#endif
+#ifdef B1200
+  case 1200: baud = B1200; break;
+#endif
+#ifdef B1800
+  case 1800: baud = B1800; break;
+#endif
+#ifdef B2400
+  case 2400: baud = B2400; break;
+#endif
+#ifdef B4800
+  case 4800: baud = B4800; break;
+#endif
+#ifdef B7200
+  case 7200: baud = B7200; break;
+#endif
+#ifdef B9600
+  case 9600: baud = B9600; break;
+#endif
+#ifdef B14400
+  case 14400: baud = B14400; break;
+#endif
+#ifdef B19200
+  case 19200: baud = B19200; break;
+#endif
+#ifdef B28800
+  case 28800: baud = B28800; break;
+#endif
+#ifdef B57600
+  case 57600: baud = B57600; break;
+#endif
+#ifdef B76800
+  case 76800: baud = B76800; break;
+#endif
+#ifdef B38400
+  case 38400: baud = B38400; break;
+#endif
+#ifdef B115200
+  case 115200: baud = B115200; break;
+#endif
+#ifdef B128000
+  case 128000: baud = B128000; break;
+#endif
+#ifdef B153600
+  case 153600: baud = B153600; break;
+#endif
+#ifdef B230400
+  case 230400: baud = B230400; break;
+#endif
+#ifdef B256000
+  case 256000: baud = B256000; break;
+#endif
+#ifdef B460800
+  case 460800: baud = B460800; break;
+#endif
+#ifdef B500000
+  case 500000: baud = B500000; break;
+#endif
+#ifdef B576000
+  case 576000: baud = B576000; break;
+#endif
+#ifdef B921600
+  case 921600: baud = B921600; break;
+#endif
+#ifdef B1000000
+  case 1000000: baud = B1000000; break;
+#endif
+#ifdef B1152000
+  case 1152000: baud = B1152000; break;
+#endif
+#ifdef B1500000
+  case 1500000: baud = B1500000; break;
+#endif
+#ifdef B2000000
+  case 2000000: baud = B2000000; break;
+#endif
+#ifdef B2500000
+  case 2500000: baud = B2500000; break;
+#endif
+#ifdef B3000000
+  case 3000000: baud = B3000000; break;
+#endif
+#ifdef B3500000
+  case 3500000: baud = B3500000; break;
+#endif
+#ifdef B4000000
+  case 4000000: baud = B4000000; break;
+#endif
+  default:
+    custom_baud = true;
+    // Set to something standard for now, the real rate is applied below
+#ifdef B38400
+    baud = B38400;
+#else
+    baud = B9600;
+#endif
+  }
+#if defined(_BSD_SOURCE) || defined(__APPLE__)
+  ::cfsetspeed(&options, baud);
+#else
+  ::cfsetispeed(&options, baud);
+  ::cfsetospeed(&options, baud);
+#endif
+
+  // setup char len
+  options.c_cflag &= (tcflag_t) ~CSIZE;
+  if (bytesize_ == eightbits)
+    options.c_cflag |= CS8;
+  else if (bytesize_ == sevenbits)
+    options.c_cflag |= CS7;
+  else if (bytesize_ == sixbits)
+    options.c_cflag |= CS6;
+  else if (bytesize_ == fivebits)
+    options.c_cflag |= CS5;
+  else
+    throw invalid_argument ("invalid char len");
+  // setup stopbits
+  if (stopbits_ == stopbits_one)
+    options.c_cflag &= (tcflag_t) ~(CSTOPB);
+  else if (stopbits_ == stopbits_one_point_five)
+    // ONE POINT FIVE same as TWO.. there is no POSIX support for 1.5
+    options.c_cflag |=  (CSTOPB);
+  else if (stopbits_ == stopbits_two)
+    options.c_cflag |=  (CSTOPB);
+  else
+    throw invalid_argument ("invalid stop bit");
+  // setup parity
+  options.c_iflag &= (tcflag_t) ~(INPCK | ISTRIP);
+  if (parity_ == parity_none) {
+    options.c_cflag &= (tcflag_t) ~(PARENB | PARODD);
+  } else if (parity_ == parity_even) {
+    options.c_cflag &= (tcflag_t) ~(PARODD);
+    options.c_cflag |=  (PARENB);
+  } else if (parity_ == parity_odd) {
+    options.c_cflag |=  (PARENB | PARODD);
+  }
+#ifdef CMSPAR
+  else if (parity_ == parity_mark) {
+    options.c_cflag |=  (PARENB | CMSPAR | PARODD);
+  }
+  else if (parity_ == parity_space) {
+    options.c_cflag |=  (PARENB | CMSPAR);
+    options.c_cflag &= (tcflag_t) ~(PARODD);
+  }
+#else
+  // CMSPAR is not defined on OSX. So do not support mark or space parity.
+  else if (parity_ == parity_mark || parity_ == parity_space) {
+    throw invalid_argument ("OS does not support mark or space parity");
+  }
+#endif  // ifdef CMSPAR
+  else {
+    throw invalid_argument ("invalid parity");
+  }
+  // setup flow control
+  if (flowcontrol_ == flowcontrol_none) {
+    xonxoff_ = false;
+    rtscts_ = false;
+  }
+  if (flowcontrol_ == flowcontrol_software) {
+    xonxoff_ = true;
+    rtscts_ = false;
+  }
+  if (flowcontrol_ == flowcontrol_hardware) {
+    xonxoff_ = false;
+    rtscts_ = true;
+  }
+  // xonxoff
+#ifdef IXANY
+  if (xonxoff_)
+    options.c_iflag |=  (IXON | IXOFF); //|IXANY)
+  else
+    options.c_iflag &= (tcflag_t) ~(IXON | IXOFF | IXANY);
+#else
+  if (xonxoff_)
+    options.c_iflag |=  (IXON | IXOFF);
+  else
+    options.c_iflag &= (tcflag_t) ~(IXON | IXOFF);
+#endif
+  // rtscts
+#ifdef CRTSCTS
+  if (rtscts_)
+    options.c_cflag |=  (CRTSCTS);
+  else
+    options.c_cflag &= (unsigned long) ~(CRTSCTS);
+#elif defined CNEW_RTSCTS
+  if (rtscts_)
+    options.c_cflag |=  (CNEW_RTSCTS);
+  else
+    options.c_cflag &= (unsigned long) ~(CNEW_RTSCTS);
+#else
+#error "OS Support seems wrong."
+#endif
+
+  // Reads never block in the driver, all the waiting happens in poll so the
+  // timeouts can be honoured exactly
+  options.c_cc[VMIN] = 0;
+  options.c_cc[VTIME] = 0;
+
+  // activate settings
+  if (::tcsetattr (fd_, TCSANOW, &options) != 0) {
+    THROW (IOException, errno);
+  }
+
+  // apply custom baud rate, if any
+  if (custom_baud) {
+#if defined(SERIAL_HAVE_TERMIOS2)
+    struct termios2 options2;
+
+    if (::ioctl (fd_, TCGETS2, &options2) == -1) {
+      THROW (IOException, errno);
+    }
+    options2.c_cflag &= (tcflag_t) ~CBAUD;
+    options2.c_cflag |= BOTHER;
+    options2.c_ispeed = static_cast<speed_t> (baudrate_);
+    options2.c_ospeed = static_cast<speed_t> (baudrate_);
+    if (::ioctl (fd_, TCSETS2, &options2) == -1) {
+      THROW (IOException, errno);
+    }
+#elif defined(MAC_OS_X_VERSION_10_4) && (MAC_OS_X_VERSION_MIN_REQUIRED >= MAC_OS_X_VERSION_10_4)
+    // Starting with Tiger, the IOSSIOSPEED ioctl can be used to set arbitrary
+    // baud rates other than those specified by POSIX.
+    speed_t new_baud = static_cast<speed_t> (baudrate_);
+    if (::ioctl (fd_, IOSSIOSPEED, &new_baud, 1) < 0) {
+      THROW (IOException, errno);
+    }
+#else
+    throw invalid_argument ("OS does not currently support custom bauds");
+#endif
+  }
+
+  // Update byte_time_ based on the new settings.
+  if (baudrate_ > 0) {
+    double bit_time_ns = 1e9 / baudrate_;
+    double bits = 1 + bytesize_ + (parity_ == parity_none ? 0 : 1);
+    bits += stopbits_ == stopbits_one_point_five ? 1.5 : static_cast<double> (stopbits_);
+    byte_time_ns_ = static_cast<uint32_t> (bit_time_ns * bits);
+  } else {
+    byte_time_ns_ = 0;
+  }
+}
+
+void
+Serial::SerialImpl::close ()
+{
+  if (is_open_ == true) {
+    if (fd_ != -1) {
+      int ret;
+      ret = ::close (fd_);
+      if (ret == 0) {
+        fd_ = -1;
+      } else {
+        THROW (IOException, errno);
+      }
+    }
+    is_open_ = false;
+  }
+}
+
+bool
+Serial::SerialImpl::isOpen () const
+{
+  return is_open_;
+}
+
+size_t
+Serial::SerialImpl::available ()
+{
+  if (!is_open_) {
+    return 0;
+  }
+  int count = 0;
+  if (-1 == ioctl (fd_, TIOCINQ, &count)) {
+      THROW (IOException, errno);
+  } else {
+      return static_cast<size_t> (count);
+  }
+}
+
+int
+Serial::SerialImpl::poll_ (short events, int timeout_ms, short &revents,
+                           bool &interrupted)
+{
+  pollfd fds[2] = { { fd_, events, 0 }, { interrupt_[0], POLLIN, 0 } };
+
+  int r = ::poll (fds, 2, timeout_ms);
+
+  revents = r > 0 ? fds[0].revents : 0;
+  interrupted = r > 0 && (fds[1].revents & POLLIN) != 0;
+  if (interrupted) {
+    // Used up, the next wait blocks again
+    char drain[16];
+    while (::read (interrupt_[0], drain, sizeof (drain)) > 0) {
+    }
+  }
+  return r;
+}
+
+bool
+Serial::SerialImpl::waitReadable (uint32_t timeout)
+{
+  bool interrupted;
+  return waitReadable_ (timeout, interrupted);
+}
+
+bool
+Serial::SerialImpl::waitReadable_ (uint32_t timeout, bool &interrupted)
+{
+  int timeout_ms = timeout == Timeout::max () ? -1 : poll_timeout_ms (timeout);
+  short revents;
+
+  int r = poll_ (POLLIN, timeout_ms, revents, interrupted);
+
+  // Figure out what happened
+  if (r < 0) {
+    // Select was interrupted
+    if (errno == EINTR) {
+      return false;
+    }
+    // Otherwise there was some error
+    THROW (IOException, errno);
+  }
+  if (revents & (POLLERR | POLLNVAL)) {
+    THROW (IOException, "poll reported an error on the serial port.");
+  }
+  // Data available to read, or a hang up the next read will report. Nothing
+  // means a timeout, or interrupt ().
+  return (revents & (POLLIN | POLLHUP)) != 0;
+}
+
+void
+Serial::SerialImpl::interrupt ()
+{
+  // If the pipe is full a wake up is already pending
+  const char wake = 0;
+  while (::write (interrupt_[1], &wake, 1) < 0 && errno == EINTR) {
+  }
+}
+
+void
+Serial::SerialImpl::waitByteTimes (size_t count)
+{
+  timespec wait_time = timespec_from_ns (static_cast<uint64_t> (byte_time_ns_) * count);
+  while (nanosleep (&wait_time, &wait_time) == -1 && errno == EINTR) {
+  }
+}
+
+size_t
+Serial::SerialImpl::read (uint8_t *buf, size_t size)
+{
+  // If the port is not open, throw
+  if (!is_open_) {
+    throw PortNotOpenedException ("Serial::read");
+  }
+  size_t bytes_read = 0;
+
+  // Calculate total timeout in milliseconds t_c + (t_m * N)
+  MillisecondTimer total_timeout (total_timeout_ms (timeout_.read_timeout_constant,
+                                                    timeout_.read_timeout_multiplier,
+                                                    size));
+
+  // Pre-fill buffer with available bytes
+  {
+    ssize_t bytes_read_now = ::read (fd_, buf, size);
+    if (bytes_read_now > 0) {
+      bytes_read = bytes_read_now;
+    } else if (bytes_read_now < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      THROW (IOException, errno);
+    }
+  }
+
+  while (bytes_read < size) {
+    int64_t timeout_remaining_ms = total_timeout.remaining();
+    if (timeout_remaining_ms <= 0) {
+      // Timed out
+      break;
+    }
+    // Once something has arrived, give up as soon as the line stays quiet for
+    // longer than the inter byte timeout
+    bool inter_byte = bytes_read > 0 &&
+                      timeout_.inter_byte_timeout != Timeout::max () &&
+                      timeout_.inter_byte_timeout < timeout_remaining_ms;
+    uint32_t timeout = inter_byte ? timeout_.inter_byte_timeout
+                                  : static_cast<uint32_t> (timeout_remaining_ms);
+    // Wait for the device to be readable, and then attempt to read.
+    bool interrupted;
+    if (!waitReadable_ (timeout, interrupted)) {
+      if (inter_byte || interrupted) {
+        break;
+      }
+      continue;
+    }
+    // This should be non-blocking returning only what is available now
+    ssize_t bytes_read_now = ::read (fd_, buf + bytes_read, size - bytes_read);
+    if (bytes_read_now < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        continue;
+      }
+      THROW (IOException, errno);
+    }
+    // poll reported readiness but there is nothing to read, which is how a
+    // hang up shows itself. An I/O error like any other, so callers that
+    // reopen the port on one (and the Windows backend) treat it the same.
+    if (bytes_read_now == 0) {
+      THROW (IOException, "device reports readiness to read but "
+                          "returned no data (device disconnected?)");
+    }
+    bytes_read += static_cast<size_t> (bytes_read_now);
+  }
+  return bytes_read;
+}
+
+size_t
+Serial::SerialImpl::write (const uint8_t *data, size_t length)
+{
+  ConstBuffer buffer (data, length);
+  return write (&buffer, 1);
+}
+
+size_t
+Serial::SerialImpl::write (const ConstBuffer *buffers, size_t count)
+{
+  if (is_open_ == false) {
+    throw PortNotOpenedException ("Serial::write");
+  }
+  size_t length = 0;
+  for (size_t i = 0; i < count; ++i) {
+    length += buffers[i].size;
+  }
+  size_t bytes_written = 0;
+
+  // Calculate total timeout in milliseconds t_c + (t_m * N)
+  MillisecondTimer total_timeout (total_timeout_ms (timeout_.write_timeout_constant,
+                                                    timeout_.write_timeout_multiplier,
+                                                    length));
+
+  // Where the next byte to write is
+  size_t index = 0;
+  size_t offset = 0;
+
+  bool first_iteration = true;
+  while (bytes_written < length) {
+    int64_t timeout_remaining_ms = total_timeout.remaining();
+    // Only consider the timeout if it's not the first iteration of the loop
+    // otherwise a timeout of 0 won't be allowed through
+    if (!first_iteration && (timeout_remaining_ms <= 0)) {
+      // Timed out
+      break;
+    }
+    first_iteration = false;
+
+    struct iovec iov[IOV_BATCH];
+    int iovcnt = 0;
+    for (size_t i = index, skip = offset; i < count && iovcnt < IOV_BATCH; ++i, skip = 0) {
+      if (buffers[i].size > skip) {
+        iov[iovcnt].iov_base = const_cast<uint8_t*> (buffers[i].data + skip);
+        iov[iovcnt].iov_len = buffers[i].size - skip;
+        ++iovcnt;
+      }
+    }
+
+    ssize_t bytes_written_now = ::writev (fd_, iov, iovcnt);
+    if (bytes_written_now > 0) {
+      bytes_written += static_cast<size_t> (bytes_written_now);
+
+      // Step past what went out
+      size_t advance = static_cast<size_t> (bytes_written_now);
+      while (advance > 0) {
+        size_t left = buffers[index].size - offset;
+        if (advance < left) {
+          offset += advance;
+          advance = 0;
+        } else {
+          advance -= left;
+          ++index;
+          offset = 0;
+        }
+      }
+      continue;
+    }
+    if (bytes_written_now < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      THROW (IOException, errno);
+    }
+
+    // The driver's buffer is full, wait for room
+    short revents;
+    bool interrupted;
+    int r = poll_ (POLLOUT, poll_timeout_ms (timeout_remaining_ms), revents, interrupted);
+
+    if (r < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      THROW (IOException, errno);
+    }
+    if (r == 0 || (interrupted && revents == 0)) {
+      // Timed out, or cut short by interrupt ()
+      break;
+    }
+    if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+      THROW (IOException, "device reports an error while writing "
+                          "(device disconnected?)");
+    }
+  }
+  return bytes_written;
+}
+
+void
+Serial::SerialImpl::setPort (const string &port)
+{
+  port_ = port;
+}
+
+string
+Serial::SerialImpl::getPort () const
+{
+  return port_;
+}
+
+void
+Serial::SerialImpl::setTimeout (serial::Timeout &timeout)
+{
+  // Applied by read and write themselves, the driver is always non-blocking
+  timeout_ = timeout;
+}
+
+serial::Timeout
+Serial::SerialImpl::getTimeout () const
+{
+  return timeout_;
+}
+
+void
+Serial::SerialImpl::setBaudrate (unsigned long baudrate)
+{
+  baudrate_ = baudrate;
+  if (is_open_)
+    reconfigurePort ();
+}
+
+unsigned long
+Serial::SerialImpl::getBaudrate () const
+{
+  return baudrate_;
+}
+
+void
+Serial::SerialImpl::setBytesize (serial::bytesize_t bytesize)
+{
+  bytesize_ = bytesize;
+  if (is_open_)
+    reconfigurePort ();
+}
+
+serial::bytesize_t
+Serial::SerialImpl::getBytesize () const
+{
+  return bytesize_;
+}
+
+void
+Serial::SerialImpl::setParity (serial::parity_t parity)
+{
+  parity_ = parity;
+  if (is_open_)
+    reconfigurePort ();
+}
+
+serial::parity_t
+Serial::SerialImpl::getParity () const
+{
+  return parity_;
+}
+
+void
+Serial::SerialImpl::setStopbits (serial::stopbits_t stopbits)
+{
+  stopbits_ = stopbits;
+  if (is_open_)
+    reconfigurePort ();
+}
+
+serial::stopbits_t
+Serial::SerialImpl::getStopbits () const
+{
+  return stopbits_;
+}
+
+void
+Serial::SerialImpl::setFlowcontrol (serial::flowcontrol_t flowcontrol)
+{
+  flowcontrol_ = flowcontrol;
+  if (is_open_)
+    reconfigurePort ();
+}
+
+serial::flowcontrol_t
+Serial::SerialImpl::getFlowcontrol () const
+{
+  return flowcontrol_;
+}
+
+void
+Serial::SerialImpl::flush ()
+{
+  if (is_open_ == false) {
+    throw PortNotOpenedException ("Serial::flush");
+  }
+  tcdrain (fd_);
+}
+
+void
+Serial::SerialImpl::flushInput ()
+{
+  if (is_open_ == false) {
+    throw PortNotOpenedException ("Serial::flushInput");
+  }
+  tcflush (fd_, TCIFLUSH);
+}
+
+void
+Serial::SerialImpl::flushOutput ()
+{
+  if (is_open_ == false) {
+    throw PortNotOpenedException ("Serial::flushOutput");
+  }
+  tcflush (fd_, TCOFLUSH);
+}
+
+void
+Serial::SerialImpl::sendBreak (int duration)
+{
+  if (is_open_ == false) {
+    throw PortNotOpenedException ("Serial::sendBreak");
+  }
+  tcsendbreak (fd_, static_cast<int> (duration / 4));
+}
+
+void
+Serial::SerialImpl::setBreak (bool level)
+{
+  if (is_open_ == false) {
+    throw PortNotOpenedException ("Serial::setBreak");
+  }
+
+  if (level) {
+    if (-1 == ioctl (fd_, TIOCSBRK)) {
+      stringstream ss;
+      ss << "setBreak failed on a call to ioctl(TIOCSBRK): " << errno << " " << strerror(errno);
+      throw SerialException(ss.str().c_str());
+    }
+  } else {
+    if (-1 == ioctl (fd_, TIOCCBRK)) {
+      stringstream ss;
+      ss << "setBreak failed on a call to ioctl(TIOCCBRK): " << errno << " " << strerror(errno);
+      throw SerialException(ss.str().c_str());
+    }
+  }
+}
+
+void
+Serial::SerialImpl::setRTS (bool level)
+{
+  if (is_open_ == false) {
+    throw PortNotOpenedException ("Serial::setRTS");
+  }
+
+  int command = TIOCM_RTS;
+
+  if (level) {
+    if (-1 == ioctl (fd_, TIOCMBIS, &command)) {
+      stringstream ss;
+      ss << "setRTS failed on a call to ioctl(TIOCMBIS): " << errno << " " << strerror(errno);
+      throw SerialException(ss.str().c_str());
+    }
+  } else {
+    if (-1 == ioctl (fd_, TIOCMBIC, &command)) {
+      stringstream ss;
+      ss << "setRTS failed on a call to ioctl(TIOCMBIC): " << errno << " " << strerror(errno);
+      throw SerialException(ss.str().c_str());
+    }
+  }
+}
+
+void
+Serial::SerialImpl::setDTR (bool level)
+{
+  if (is_open_ == false) {
+    throw PortNotOpenedException ("Serial::setDTR");
+  }
+
+  int command = TIOCM_DTR;
+
+  if (level) {
+    if (-1 == ioctl (fd_, TIOCMBIS, &command)) {
+      stringstream ss;
+      ss << "setDTR failed on a call to ioctl(TIOCMBIS): " << errno << " " << strerror(errno);
+      throw SerialException(ss.str().c_str());
+    }
+  } else {
+    if (-1 == ioctl (fd_, TIOCMBIC, &command)) {
+      stringstream ss;
+      ss << "setDTR failed on a call to ioctl(TIOCMBIC): " << errno << " " << strerror(errno);
+      throw SerialException(ss.str().c_str());
+    }
+  }
+}
+
+bool
+Serial::SerialImpl::waitForChange ()
+{
+#ifndef TIOCMIWAIT
+
+  while (is_open_ == true) {
+
+    int status;
+
+    if (-1 == ioctl (fd_, TIOCMGET, &status)) {
+        stringstream ss;
+        ss << "waitForChange failed on a call to ioctl(TIOCMGET): " << errno << " " << strerror(errno);
+        throw(SerialException(ss.str().c_str()));
+    } else {
+        if (0 != (status & TIOCM_CTS)
+         || 0 != (status & TIOCM_DSR)
+         || 0 != (status & TIOCM_RI)
+         || 0 != (status & TIOCM_CD))
+        {
+          return true;
+        }
+    }
+
+    usleep(1000);
+  }
+
+  return false;
+#else
+  int command = (TIOCM_CD|TIOCM_DSR|TIOCM_RI|TIOCM_CTS);
+
+  if (-1 == ioctl (fd_, TIOCMIWAIT, &command)) {
+    stringstream ss;
+    ss << "waitForDSR failed on a call to ioctl(TIOCMIWAIT): "
+       << errno << " " << strerror(errno);
+    throw(SerialException(ss.str().c_str()));
+  }
+  return true;
+#endif
+}
+
+bool
+Serial::SerialImpl::getCTS ()
+{
+  if (is_open_ == false) {
+    throw PortNotOpenedException ("Serial::getCTS");
+  }
+
+  int status;
+
+  if (-1 == ioctl (fd_, TIOCMGET, &status)) {
+    stringstream ss;
+    ss << "getCTS failed on a call to ioctl(TIOCMGET): " << errno << " " << strerror(errno);
+    throw(SerialException(ss.str().c_str()));
+  } else {
+    return 0 != (status & TIOCM_CTS);
+  }
+}
+
+bool
+Serial::SerialImpl::getDSR ()
+{
+  if (is_open_ == false) {
+    throw PortNotOpenedException ("Serial::getDSR");
+  }
+
+  int status;
+
+  if (-1 == ioctl (fd_, TIOCMGET, &status)) {
+    stringstream ss;
+    ss << "getDSR failed on a call to ioctl(TIOCMGET): " << errno << " " << strerror(errno);
+    throw(SerialException(ss.str().c_str()));
+  } else {
+    return 0 != (status & TIOCM_DSR);
+  }
+}
+
+bool
+Serial::SerialImpl::getRI ()
+{
+  if (is_open_ == false) {
+    throw PortNotOpenedException ("Serial::getRI");
+  }
+
+  int status;
+
+  if (-1 == ioctl (fd_, TIOCMGET, &status)) {
+    stringstream ss;
+    ss << "getRI failed on a call to ioctl(TIOCMGET): " << errno << " " << strerror(errno);
+    throw(SerialException(ss.str().c_str()));
+  } else {
+    return 0 != (status & TIOCM_RI);
+  }
+}
+
+bool
+Serial::SerialImpl::getCD ()
+{
+  if (is_open_ == false) {
+    throw PortNotOpenedException ("Serial::getCD");
+  }
+
+  int status;
+
+  if (-1 == ioctl (fd_, TIOCMGET, &status)) {
+    stringstream ss;
+    ss << "getCD failed on a call to ioctl(TIOCMGET): " << errno << " " << strerror(errno);
+    throw(SerialException(ss.str().c_str()));
+  } else {
+    return 0 != (status & TIOCM_CD);
+  }
+}
+
+void
+Serial::SerialImpl::readLock ()
+{
+  int result = pthread_mutex_lock(&this->read_mutex);
+  if (result) {
+    THROW (IOException, result);
+  }
+}
+
+void
+Serial::SerialImpl::readUnlock ()
+{
+  int result = pthread_mutex_unlock(&this->read_mutex);
+  if (result) {
+    THROW (IOException, result);
+  }
+}
+
+void
+Serial::SerialImpl::writeLock ()
+{
+  int result = pthread_mutex_lock(&this->write_mutex);
+  if (result) {
+    THROW (IOException, result);
+  }
+}
+
+void
+Serial::SerialImpl::writeUnlock ()
+{
+  int result = pthread_mutex_unlock(&this->write_mutex);
+  if (result) {
+    THROW (IOException, result);
+  }
+}
+
+#endif // !defined(_WIN32)
@@ -2,6 +2,7 @@
 
 /* Copyright 2012 William Woodall and John Harrison */
 
+#include <cstring>
 #include <sstream>
 
 #include "serial/impl/win.h"
@@ -20,6 +21,26 @@ using serial::SerialException;
 using serial::PortNotOpenedException;
 using serial::IOException;
 
+// An OVERLAPPED with an event of its own. Every call gets its own, so the
+// reading and the writing side never wait on each other's event.
+class Overlapped {
+public:
+  Overlapped () {
+    memset (&ov, 0, sizeof (ov));
+    ov.hEvent = CreateEvent (NULL, TRUE, FALSE, NULL);
+    if (ov.hEvent == NULL) {
+      THROW (IOException, "Error creating an event for overlapped I/O.");
+    }
+  }
+  ~Overlapped () {
+    CloseHandle (ov.hEvent);
+  }
+  OVERLAPPED ov;
+private:
+  Overlapped (const Overlapped&);
+  Overlapped& operator= (const Overlapped&);
+};
+
 inline wstring
 _prefix_port_if_needed(const wstring &input)
 {
@@ -39,15 +60,27 @@ Serial::SerialImpl::SerialImpl (const string &port, unsigned long baudrate,
     baudrate_ (baudrate), parity_ (parity),
     bytesize_ (bytesize), stopbits_ (stopbits), flowcontrol_ (flowcontrol)
 {
-  if (port_.empty () == false)
-    open ();
+  // Auto reset, one interrupt () wakes up one wait
+  interrupt_ = CreateEvent(NULL, FALSE, FALSE, NULL);
   read_mutex = CreateMutex(NULL, false, NULL);
   write_mutex = CreateMutex(NULL, false, NULL);
+  if (port_.empty () == false) {
+    try {
+      open ();
+    } catch (...) {
+      // The destructor never runs for an object that failed to construct
+      CloseHandle(interrupt_);
+      CloseHandle(read_mutex);
+      CloseHandle(write_mutex);
+      throw;
+    }
+  }
 }
 
 Serial::SerialImpl::~SerialImpl ()
 {
   this->close();
+  CloseHandle(interrupt_);
   CloseHandle(read_mutex);
   CloseHandle(write_mutex);
 }
@@ -65,12 +98,14 @@ Serial::SerialImpl::open ()
   // See: https://github.com/wjwwood/serial/issues/84
   wstring port_with_prefix = _prefix_port_if_needed(port_);
   LPCWSTR lp_port = port_with_prefix.c_str();
+  // Overlapped, since on a synchronous handle Windows runs one ReadFile or
+  // WriteFile at a time and a reader would hold up every writer
   fd_ = CreateFileW(lp_port,
                     GENERIC_READ | GENERIC_WRITE,
                     0,
                     0,
                     OPEN_EXISTING,
-                    FILE_ATTRIBUTE_NORMAL,
+                    FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
                     0);
 
   if (fd_ == INVALID_HANDLE_VALUE) {
@@ -88,6 +123,13 @@ Serial::SerialImpl::open ()
   }
 
   reconfigurePort();
+
+  // What waitReadable waits for
+  if (!SetCommMask(fd_, EV_RXCHAR)) {
+    CloseHandle(fd_);
+    fd_ = INVALID_HANDLE_VALUE;
+    THROW (IOException, "Error setting the serial port event mask.");
+  }
   is_open_ = true;
 }
 
@@ -315,10 +357,55 @@ Serial::SerialImpl::available ()
 }
 
 bool
-Serial::SerialImpl::waitReadable (uint32_t /*timeout*/)
+Serial::SerialImpl::waitReadable (uint32_t timeout)
 {
-  THROW (IOException, "waitReadable is not implemented on Windows.");
-  return false;
+  if (!is_open_) {
+    throw PortNotOpenedException ("Serial::waitReadable");
+  }
+  // The driver signals EV_RXCHAR as characters arrive. One that arrived
+  // before the wait started may or may not have been signalled already, so
+  // the input queue has the last word. Only one thread can wait at a time.
+  if (WaitForSingleObject (interrupt_, 0) == WAIT_OBJECT_0) {
+    return available () > 0;
+  }
+  const DWORD start = GetTickCount ();
+  while (available () == 0) {
+    const DWORD waited = GetTickCount () - start;
+    if (timeout != Timeout::max () && waited >= timeout) {
+      return false;
+    }
+
+    Overlapped overlapped;
+    DWORD mask = 0;
+    if (WaitCommEvent (fd_, &mask, &overlapped.ov)) {
+      continue;
+    }
+    if (GetLastError () != ERROR_IO_PENDING) {
+      stringstream ss;
+      ss << "Error while waiting on the serial port: " << GetLastError();
+      THROW (IOException, ss.str().c_str());
+    }
+
+    HANDLE events[2] = { overlapped.ov.hEvent, interrupt_ };
+    DWORD r = WaitForMultipleObjects (2, events, FALSE,
+                                      timeout == Timeout::max () ? INFINITE : timeout - waited);
+    if (r != WAIT_OBJECT_0) {
+      // Timed out or interrupted, the wait has to be over before overlapped goes
+      DWORD unused;
+      CancelIoEx (fd_, &overlapped.ov);
+      GetOverlappedResult (fd_, &overlapped.ov, &unused, TRUE);
+      if (r == WAIT_OBJECT_0 + 1) {
+        return available () > 0;
+      }
+    }
+  }
+  return true;
+}
+
+void
+Serial::SerialImpl::interrupt ()
+{
+  SetEvent (interrupt_);
 }
 
 void
@@ -327,14 +414,35 @@ Serial::SerialImpl::waitByteTimes (size_t /*count*/)
   THROW (IOException, "waitByteTimes is not implemented on Windows.");
 }
 
+bool
+Serial::SerialImpl::finish_ (OVERLAPPED &ov, BOOL started, DWORD &transferred)
+{
+  transferred = 0;
+  if (!started && GetLastError () != ERROR_IO_PENDING) {
+    return false;
+  }
+  // The timeouts set with SetCommTimeouts still end it, interrupt () cuts
+  // it short. What got through until then still counts.
+  HANDLE events[2] = { ov.hEvent, interrupt_ };
+  if (WaitForMultipleObjects (2, events, FALSE, INFINITE) != WAIT_OBJECT_0) {
+    CancelIoEx (fd_, &ov);
+  }
+  if (!GetOverlappedResult (fd_, &ov, &transferred, TRUE)) {
+    return GetLastError () == ERROR_OPERATION_ABORTED;
+  }
+  return true;
+}
+
 size_t
 Serial::SerialImpl::read (uint8_t *buf, size_t size)
 {
   if (!is_open_) {
     throw PortNotOpenedException ("Serial::read");
   }
+  Overlapped overlapped;
   DWORD bytes_read;
-  if (!ReadFile(fd_, buf, static_cast<DWORD>(size), &bytes_read, NULL)) {
+  BOOL started = ReadFile(fd_, buf, static_cast<DWORD>(size), NULL, &overlapped.ov);
+  if (!finish_ (overlapped.ov, started, bytes_read)) {
     stringstream ss;
     ss << "Error while reading from the serial port: " << GetLastError();
     THROW (IOException, ss.str().c_str());
@@ -348,8 +456,10 @@ Serial::SerialImpl::write (const uint8_t *data, size_t length)
   if (is_open_ == false) {
     throw PortNotOpenedException ("Serial::write");
   }
+  Overlapped overlapped;
   DWORD bytes_written;
-  if (!WriteFile(fd_, data, static_cast<DWORD>(length), &bytes_written, NULL)) {
+  BOOL started = WriteFile(fd_, data, static_cast<DWORD>(length), NULL, &overlapped.ov);
+  if (!finish_ (overlapped.ov, started, bytes_written)) {
     stringstream ss;
     ss << "Error while writing to the serial port: " << GetLastError();
     THROW (IOException, ss.str().c_str());
@@ -357,6 +467,22 @@ Serial::SerialImpl::write (const uint8_t *data, size_t length)
   return (size_t) (bytes_written);
 }
 
+size_t
+Serial::SerialImpl::write (const ConstBuffer *buffers, size_t count)
+{
+  // WriteFileGather wants page sized and aligned buffers, so write the
+  // buffers one after another
+  size_t bytes_written = 0;
+  for (size_t i = 0; i < count; ++i) {
+    size_t written = write (buffers[i].data, buffers[i].size);
+    bytes_written += written;
+    if (written < buffers[i].size) {
+      break;
+    }
+  }
+  return bytes_written;
+}
+
 void
 Serial::SerialImpl::setPort (const string &port)
 {
@@ -374,7 +500,16 @@ Serial::SerialImpl::setTimeout (serial::Timeout &timeout)
 {
   timeout_ = timeout;
   if (is_open_) {
-    reconfigurePort ();
+    // Only the timeouts changed, so leave the DCB (and the lines) alone
+    COMMTIMEOUTS timeouts = {0};
+    timeouts.ReadIntervalTimeout = timeout_.inter_byte_timeout;
+    timeouts.ReadTotalTimeoutConstant = timeout_.read_timeout_constant;
+    timeouts.ReadTotalTimeoutMultiplier = timeout_.read_timeout_multiplier;
+    timeouts.WriteTotalTimeoutConstant = timeout_.write_timeout_constant;
+    timeouts.WriteTotalTimeoutMultiplier = timeout_.write_timeout_multiplier;
+    if (!SetCommTimeouts(fd_, &timeouts)) {
+      THROW (IOException, "Error setting timeouts.");
+    }
   }
 }
 
@@ -544,13 +679,18 @@ Serial::SerialImpl::waitForChange ()
     return false;
   }
 
-  if (!WaitCommEvent(fd_, &dwCommEvent, NULL)) {
-    // An error occurred waiting for the event.
-    return false;
-  } else {
-    // Event has occurred.
-    return true;
-  }
+  // The handle is overlapped, so even this wait needs an OVERLAPPED
+  Overlapped overlapped;
+  DWORD unused;
+  dwCommEvent = 0;
+  BOOL started = WaitCommEvent(fd_, &dwCommEvent, &overlapped.ov);
+  bool changed = finish_ (overlapped.ov, started, unused) && dwCommEvent != 0;
+
+  // Back to what waitReadable waits for
+  SetCommMask(fd_, EV_RXCHAR);
+
+  // False if an error occurred or it was interrupted
+  return changed;
 }
 
 bool
@@ -78,6 +78,9 @@ public:
   bool
   waitReadable (uint32_t timeout);
 
+  void
+  interrupt ();
+
   void
   waitByteTimes (size_t count);
 
@@ -87,6 +90,9 @@ public:
   size_t
   write (const uint8_t *data, size_t length);
 
+  size_t
+  write (const ConstBuffer *buffers, size_t count);
+
   void
   flush ();
 
@@ -180,9 +186,15 @@ public:
 protected:
   void reconfigurePort ();
 
+  // Waits for an overlapped call to complete, or for interrupt (). started
+  // is what the call returned. Returns false if it failed, with GetLastError
+  // set.
+  bool finish_ (OVERLAPPED &ov, BOOL started, DWORD &transferred);
+
 private:
   wstring port_;               // Path to the file descriptor
   HANDLE fd_;
+  HANDLE interrupt_;           // Event interrupt () sets
 
   bool is_open_;
 
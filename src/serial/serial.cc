@@ -1,13 +1,12 @@
 /* Copyright 2012 William Woodall and John Harrison */
 #include <algorithm>
-
-#if !defined(_WIN32) && !defined(__OpenBSD__) && !defined(__FreeBSD__)
-# include <alloca.h>
-#endif
-
-#if defined (__MINGW32__)
-# define alloca __builtin_alloca
-#endif
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #include "serial/serial.h"
 
@@ -34,11 +33,13 @@ using serial::flowcontrol_t;
 
 class Serial::ScopedReadLock {
 public:
-  ScopedReadLock(SerialImpl *pimpl) : pimpl_(pimpl) {
-    this->pimpl_->readLock();
+  // Full duplex reads skip the lock, there is only the one reader then
+  ScopedReadLock(SerialImpl *pimpl, bool engage = true)
+    : pimpl_(engage ? pimpl : NULL) {
+    if (this->pimpl_) this->pimpl_->readLock();
   }
   ~ScopedReadLock() {
-    this->pimpl_->readUnlock();
+    if (this->pimpl_) this->pimpl_->readUnlock();
   }
 private:
   // Disable copy constructors
@@ -63,29 +64,731 @@ private:
   SerialImpl *pimpl_;
 };
 
+// Initial size of the receive buffer, it only grows for very long EOLs
+#define RX_CAPACITY 4096
+
+// Bytes received from the port but not handed out yet. Everything read goes
+// through here so a line can be cut out of one large read instead of reading
+// a byte at a time.
+class Serial::RxBuffer {
+public:
+  static const size_t npos = static_cast<size_t> (-1);
+
+  RxBuffer () : data_(RX_CAPACITY), head_(0), size_(0) {}
+
+  size_t size () const { return size_; }
+  bool empty () const { return size_ == 0; }
+  bool full () const { return size_ == data_.size (); }
+
+  void
+  clear () {
+    head_ = 0;
+    size_ = 0;
+  }
+
+  // Makes room for at least capacity bytes
+  void
+  reserve (size_t capacity) {
+    if (capacity <= data_.size ())
+      return;
+
+    size_t grown = data_.size ();
+    while (grown < capacity)
+      grown *= 2;
+
+    std::vector<uint8_t> data(grown);
+    copy (&data[0], size_);
+    data_.swap (data);
+    head_ = 0;
+  }
+
+  // Moves up to length bytes from the front into out
+  size_t
+  take (uint8_t *out, size_t length) {
+    length = min (length, size_);
+    copy (out, length);
+    consume (length);
+    return length;
+  }
+
+  void
+  take (string &out, size_t length) {
+    length = min (length, size_);
+
+    // At most two pieces, either side of the wrap
+    size_t first = min (length, data_.size () - head_);
+    out.append (reinterpret_cast<const char*> (&data_[head_]), first);
+    out.append (reinterpret_cast<const char*> (&data_[0]), length - first);
+    consume (length);
+  }
+
+  // Looks for needle starting at offset from, without going past limit.
+  // Returns the offset just past it, or npos.
+  size_t
+  find (const string &needle, size_t from, size_t limit) const {
+    if (needle.empty ())
+      return limit > 0 ? 1 : npos;
+
+    const size_t n = needle.size ();
+    const uint8_t first = static_cast<uint8_t> (needle[0]);
+
+    while (from + n <= limit) {
+      // Scan for the first byte within the contiguous stretch that from is in
+      size_t start = (head_ + from) % data_.size ();
+      size_t stretch = min (limit - n + 1 - from, data_.size () - start);
+      const uint8_t *hit = static_cast<const uint8_t*> (
+        memchr (&data_[start], first, stretch));
+
+      if (hit == NULL) {
+        from += stretch;
+        continue;
+      }
+
+      from += hit - &data_[start];
+      if (matches (needle, from))
+        return from + n;
+      ++from;
+    }
+    return npos;
+  }
+
+  // Free space to read into, as one contiguous block
+  uint8_t *
+  writable (size_t &length) {
+    size_t tail = (head_ + size_) % data_.size ();
+    length = tail >= head_ && size_ < data_.size ()
+               ? data_.size () - tail
+               : head_ - tail;
+    return &data_[tail];
+  }
+
+  void commit (size_t length) { size_ += length; }
+
+private:
+  std::vector<uint8_t> data_;
+  size_t head_;
+  size_t size_;
+
+  void
+  copy (uint8_t *out, size_t length) const {
+    size_t first = min (length, data_.size () - head_);
+    memcpy (out, &data_[head_], first);
+    memcpy (out + first, &data_[0], length - first);
+  }
+
+  void
+  consume (size_t length) {
+    size_ -= length;
+    head_ = size_ == 0 ? 0 : (head_ + length) % data_.size ();
+  }
+
+  bool
+  matches (const string &needle, size_t offset) const {
+    for (size_t i = 0; i < needle.size (); ++i) {
+      if (data_[(head_ + offset + i) % data_.size ()] != static_cast<uint8_t> (needle[i]))
+        return false;
+    }
+    return true;
+  }
+};
+
+// How long the reactor waits for data at a time before checking whether it
+// was stopped or its reads cancelled. Data wakes it up right away regardless.
+#define REACTOR_WAIT_MS 50
+#define REACTOR_CHUNK 4096
+
+class Serial::AsyncReader {
+public:
+  enum Kind { exactly, until, some };
+
+  AsyncReader (Serial *serial)
+    : serial_(serial), stop_(false), busy_(false) {}
+
+  ~AsyncReader () {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wakeup_.notify_one();
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+  void
+  submit (Kind kind, size_t size, const string &delimiter,
+          ReadHandler handler) {
+    Operation op = { kind, size, delimiter, 0, handler };
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ops_.push_back(op);
+      if (!thread_.joinable())
+        thread_ = std::thread(&AsyncReader::run, this);
+    }
+    wakeup_.notify_one();
+  }
+
+  // Fails everything outstanding and waits until the reactor is no longer
+  // touching the port
+  void
+  cancel (const char *reason) {
+    std::deque<Operation> cancelled;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cancelled.swap(ops_);
+      if (std::this_thread::get_id() != thread_.get_id())
+        idle_.wait(lock, [this] { return !busy_; });
+    }
+
+    std::exception_ptr error = std::make_exception_ptr(SerialException(reason));
+    for (size_t i = 0; i < cancelled.size(); ++i)
+      cancelled[i].handler(string(), error);
+  }
+
+private:
+  struct Operation {
+    Kind kind;
+    size_t size;
+    string delimiter;
+    size_t scanned;     // How much of buffer_ is known not to hold the delimiter
+    ReadHandler handler;
+  };
+
+  struct Result {
+    ReadHandler handler;
+    string data;
+  };
+
+  Serial *serial_;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  std::condition_variable idle_;
+  std::deque<Operation> ops_;
+  string buffer_;       // Received but not handed out yet
+  bool stop_;
+  bool busy_;           // Set while the reactor waits on or reads the port
+
+  // Takes the data for op out of buffer_ if enough has arrived
+  bool
+  satisfy (Operation &op, string &data) {
+    size_t length = 0;
+
+    switch (op.kind) {
+    case exactly:
+      if (buffer_.size () < op.size)
+        return false;
+      length = op.size;
+      break;
+    case some:
+      if (buffer_.empty ())
+        return false;
+      length = buffer_.size ();
+      break;
+    case until: {
+      size_t found = buffer_.find (op.delimiter, op.scanned);
+      if (found != string::npos) {
+        length = min (found + op.delimiter.size (), op.size);
+      } else if (buffer_.size () >= op.size) {
+        length = op.size;
+      } else {
+        // The delimiter could still start within the last few bytes
+        if (buffer_.size () >= op.delimiter.size ())
+          op.scanned = buffer_.size () - op.delimiter.size () + 1;
+        return false;
+      }
+      break;
+    }
+    }
+
+    data.assign (buffer_, 0, length);
+    buffer_.erase (0, length);
+    return true;
+  }
+
+  void
+  fail (std::unique_lock<std::mutex> &lock, std::exception_ptr error) {
+    std::deque<Operation> failed;
+    failed.swap(ops_);
+
+    // Whatever was received goes to the read that was waiting on it
+    string partial;
+    partial.swap(buffer_);
+
+    lock.unlock();
+    for (size_t i = 0; i < failed.size(); ++i) {
+      failed[i].handler(partial, error);
+      partial.clear();
+    }
+    lock.lock();
+  }
+
+  void
+  run () {
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint8_t chunk[REACTOR_CHUNK];
+
+    while (true) {
+      busy_ = false;
+      idle_.notify_all();
+      wakeup_.wait(lock, [this] { return stop_ || !ops_.empty (); });
+      if (stop_)
+        break;
+
+      // Hand out everything the buffered data already satisfies
+      std::vector<Result> done;
+      string data;
+      while (!ops_.empty () && satisfy (ops_.front (), data)) {
+        Result result = { ops_.front ().handler, string () };
+        result.data.swap (data);
+        done.push_back (result);
+        ops_.pop_front ();
+      }
+
+      if (!done.empty ()) {
+        lock.unlock();
+        for (size_t i = 0; i < done.size (); ++i)
+          done[i].handler(done[i].data, std::exception_ptr());
+        lock.lock();
+        continue;
+      }
+
+      if (!serial_->isOpen ()) {
+        fail (lock, std::make_exception_ptr(
+                PortNotOpenedException ("Serial::asyncRead")));
+        continue;
+      }
+
+      busy_ = true;
+      lock.unlock();
+
+      size_t bytes_read = 0;
+      std::exception_ptr error;
+      try {
+        const bool locked = serial_->duplex_ == NULL;
+        {
+          // Pick up anything a blocking read left behind first
+          ScopedReadLock read_lock(serial_->pimpl_, locked);
+          bytes_read = serial_->rx_->take (chunk, sizeof(chunk));
+        }
+        if (bytes_read == 0 && serial_->waitReadable (REACTOR_WAIT_MS)) {
+          ScopedReadLock read_lock(serial_->pimpl_, locked);
+          size_t count = std::max<size_t> (serial_->available (), 1);
+          bytes_read = serial_->read_ (chunk, min<size_t> (count, sizeof(chunk)));
+        }
+      } catch (...) {
+        error = std::current_exception ();
+      }
+
+      lock.lock();
+      buffer_.append (reinterpret_cast<const char*> (chunk), bytes_read);
+      if (error)
+        fail (lock, error);
+    }
+  }
+};
+
+// Size of the full duplex receive ring, must be a power of two
+#define DUPLEX_RING 65536
+// How long the full duplex threads wait at a time, for the port or for each
+// other, before checking whether they were stopped
+#define DUPLEX_WAIT_MS 50
+
+// Full duplex mode. The reader thread is the only one reading the port and
+// the producer of ring_, the reading thread its only consumer. Writers push
+// onto a lock-free list that the writer thread is the only one to pop.
+class Serial::Duplex {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  Duplex (SerialImpl *pimpl)
+    : pimpl_(pimpl), ring_(DUPLEX_RING), head_(0), tail_(0), rx_failed_(false),
+      tx_head_(&stub_), tx_tail_(&stub_), queued_(0), tx_failed_(false),
+      discard_(false), interrupted_(false), stop_(false)
+  {
+    reader_ = std::thread(&Duplex::receive, this);
+    writer_ = std::thread(&Duplex::transmit, this);
+  }
+
+  ~Duplex () {
+    stop ();
+  }
+
+  // Sends whatever is queued, then ends both threads
+  void
+  stop () {
+    stop_.store (true);
+    data_.notify ();
+    space_.notify ();
+    pending_.notify ();
+    if (reader_.joinable ())
+      reader_.join ();
+    if (writer_.joinable ())
+      writer_.join ();
+  }
+
+  size_t
+  available () const {
+    return tail_.load (std::memory_order_acquire) - head_.load (std::memory_order_relaxed);
+  }
+
+  bool
+  waitReadable (uint32_t timeout) {
+    const bool ready = data_.wait ([this] { return readable (); }, deadline (timeout));
+    if (interrupted_.exchange (false))
+      return available () > 0;
+    return ready;
+  }
+
+  void
+  interrupt () {
+    interrupted_.store (true);
+    data_.notify ();
+  }
+
+  // Moves up to length bytes out of the ring without waiting
+  size_t
+  take (uint8_t *out, size_t length) {
+    const size_t head = head_.load (std::memory_order_relaxed);
+    length = min (length, tail_.load (std::memory_order_acquire) - head);
+    if (length == 0)
+      return 0;
+
+    // At most two pieces, either side of the wrap
+    const size_t offset = head & (DUPLEX_RING - 1);
+    const size_t first = min (length, DUPLEX_RING - offset);
+    memcpy (out, &ring_[offset], first);
+    memcpy (out + first, &ring_[0], length - first);
+
+    head_.store (head + length, std::memory_order_release);
+    space_.notify ();
+    return length;
+  }
+
+  // Same timeouts as SerialImpl::read, but waits on the ring
+  size_t
+  read (uint8_t *buffer, size_t size) {
+    const Timeout timeout = pimpl_->getTimeout ();
+    const uint64_t total = timeout.read_timeout_constant +
+      static_cast<uint64_t> (timeout.read_timeout_multiplier) * size;
+    const Clock::time_point end = deadline (static_cast<uint32_t> (
+      min<uint64_t> (total, Timeout::max ())));
+
+    size_t bytes_read = take (buffer, size);
+    while (bytes_read < size) {
+      if (rx_failed_.load (std::memory_order_acquire) && available () == 0) {
+        // Hand out what made it first, the next read gets the error
+        if (bytes_read > 0)
+          return bytes_read;
+        std::rethrow_exception (rx_error_);
+      }
+
+      Clock::time_point until = end;
+      if (bytes_read > 0 && timeout.inter_byte_timeout != Timeout::max ())
+        until = std::min (until, deadline (timeout.inter_byte_timeout));
+
+      if (!data_.wait ([this] { return readable (); }, until))
+        break; // Timed out
+
+      const size_t taken = take (buffer + bytes_read, size - bytes_read);
+      if (taken == 0 && (stop_.load () || interrupted_.exchange (false)))
+        break;
+      bytes_read += taken;
+    }
+    return bytes_read;
+  }
+
+  // Queues the buffers as one write
+  size_t
+  send (const ConstBuffer *buffers, size_t count) {
+    if (tx_failed_.load (std::memory_order_acquire))
+      std::rethrow_exception (tx_error_);
+    if (!pimpl_->isOpen ())
+      throw PortNotOpenedException ("Serial::write");
+
+    size_t length = 0;
+    for (size_t i = 0; i < count; ++i)
+      length += buffers[i].size;
+
+    Packet *packet = new Packet;
+    packet->data.reserve (length);
+    for (size_t i = 0; i < count; ++i)
+      packet->data.append (reinterpret_cast<const char*> (buffers[i].data), buffers[i].size);
+
+    // Counted first, so the writer never sees fewer queued than it can pop
+    queued_.fetch_add (1);
+    push (packet);
+    pending_.notify ();
+    return length;
+  }
+
+  // Waits until everything queued so far has been written
+  void
+  drain () {
+    while (!drained_.wait ([this] { return idle (); }, deadline (DUPLEX_WAIT_MS)))
+      ;
+  }
+
+  void
+  discardInput () {
+    head_.store (tail_.load (std::memory_order_acquire), std::memory_order_release);
+    space_.notify ();
+  }
+
+  // Drops everything queued but not written yet
+  void
+  discardOutput () {
+    discard_.store (true);
+    pending_.notify ();
+    while (!drained_.wait ([this] { return !discard_.load (); }, deadline (DUPLEX_WAIT_MS)))
+      ;
+  }
+
+private:
+  // Puts one side to sleep until the other has done something. The mutex
+  // only comes into it once somebody actually has to sleep.
+  class Signal {
+  public:
+    Signal () : waiters_(0) {}
+
+    template <typename Ready> bool
+    wait (Ready ready, Clock::time_point until) {
+      if (ready ())
+        return true;
+
+      std::unique_lock<std::mutex> lock(mutex_);
+      waiters_.fetch_add (1);
+      // Pairs with the fence in notify, so either this sees the change or
+      // notify sees the waiter
+      std::atomic_thread_fence (std::memory_order_seq_cst);
+      bool result = cond_.wait_until (lock, until, ready);
+      waiters_.fetch_sub (1);
+      return result;
+    }
+
+    void
+    notify () {
+      std::atomic_thread_fence (std::memory_order_seq_cst);
+      if (waiters_.load (std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cond_.notify_all ();
+      }
+    }
+
+  private:
+    std::atomic<int> waiters_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+  };
+
+  struct Packet {
+    std::atomic<Packet*> next;
+    string data;
+
+    Packet () : next(NULL) {}
+  };
+
+  SerialImpl *pimpl_;
+  std::thread reader_;
+  std::thread writer_;
+
+  // Receiving side, head_ and tail_ only ever count up
+  std::vector<uint8_t> ring_;
+  std::atomic<size_t> head_;
+  char head_pad_[64];         // Keeps the two ends off each other's cache line
+  std::atomic<size_t> tail_;
+  std::atomic<bool> rx_failed_;
+  std::exception_ptr rx_error_;
+  Signal data_;               // Something arrived
+  Signal space_;              // Something was read
+
+  // Sending side, pushed at tx_head_ and popped from tx_tail_
+  Packet stub_;
+  std::atomic<Packet*> tx_head_;
+  char tx_pad_[64];
+  Packet *tx_tail_;
+  std::atomic<size_t> queued_;
+  std::atomic<bool> tx_failed_;
+  std::exception_ptr tx_error_;
+  std::atomic<bool> discard_;
+  Signal pending_;            // Something was queued
+  Signal drained_;            // The queue went empty
+
+  std::atomic<bool> interrupted_;
+  std::atomic<bool> stop_;
+
+  static Clock::time_point
+  deadline (uint32_t timeout) {
+    return Clock::now () + std::chrono::milliseconds (timeout);
+  }
+
+  bool
+  readable () const {
+    return available () > 0 || rx_failed_.load () || interrupted_.load () ||
+      stop_.load ();
+  }
+
+  bool
+  idle () const {
+    return queued_.load () == 0 || tx_failed_.load ();
+  }
+
+  void
+  push (Packet *packet) {
+    packet->next.store (NULL, std::memory_order_relaxed);
+    Packet *previous = tx_head_.exchange (packet, std::memory_order_acq_rel);
+    previous->next.store (packet, std::memory_order_release);
+  }
+
+  // Returns null when the queue is empty, or a push is half way through
+  Packet *
+  pop () {
+    Packet *tail = tx_tail_;
+    Packet *next = tail->next.load (std::memory_order_acquire);
+
+    if (tail == &stub_) {
+      if (next == NULL)
+        return NULL;
+      tx_tail_ = next;
+      tail = next;
+      next = next->next.load (std::memory_order_acquire);
+    }
+    if (next != NULL) {
+      tx_tail_ = next;
+      return tail;
+    }
+    if (tail != tx_head_.load (std::memory_order_acquire))
+      return NULL;
+
+    // tail is the last one, put the stub behind it so it can be taken
+    push (&stub_);
+    next = tail->next.load (std::memory_order_acquire);
+    if (next != NULL) {
+      tx_tail_ = next;
+      return tail;
+    }
+    return NULL;
+  }
+
+  void
+  receive () {
+    while (!stop_.load (std::memory_order_acquire)) {
+      const size_t tail = tail_.load (std::memory_order_relaxed);
+      const size_t used = tail - head_.load (std::memory_order_acquire);
+
+      if (used == DUPLEX_RING) {
+        // The reading side is behind, leave the rest in the driver for now
+        space_.wait ([this, tail] {
+          return tail - head_.load () < DUPLEX_RING || stop_.load ();
+        }, deadline (DUPLEX_WAIT_MS));
+        continue;
+      }
+
+      const size_t offset = tail & (DUPLEX_RING - 1);
+      const size_t room = min (DUPLEX_RING - used, DUPLEX_RING - offset);
+
+      try {
+        if (!pimpl_->waitReadable (DUPLEX_WAIT_MS))
+          continue;
+        size_t count = min (std::max<size_t> (pimpl_->available (), 1), room);
+        size_t bytes_read = pimpl_->read (&ring_[offset], count);
+        if (bytes_read > 0) {
+          tail_.store (tail + bytes_read, std::memory_order_release);
+          data_.notify ();
+        }
+      } catch (...) {
+        rx_error_ = std::current_exception ();
+        rx_failed_.store (true, std::memory_order_release);
+        data_.notify ();
+        return;
+      }
+    }
+  }
+
+  void
+  transmit () {
+    while (true) {
+      Packet *packet = pop ();
+
+      if (packet == NULL) {
+        if (queued_.load () > 0) {
+          // A writer is part way through pushing
+          std::this_thread::yield ();
+          continue;
+        }
+        if (discard_.load ()) {
+          discard_.store (false);
+          drained_.notify ();
+        }
+        if (stop_.load ())
+          return;
+        pending_.wait ([this] {
+          return queued_.load () > 0 || discard_.load () || stop_.load ();
+        }, deadline (DUPLEX_WAIT_MS));
+        continue;
+      }
+
+      if (!tx_failed_.load () && !discard_.load ())
+        write (packet->data);
+      delete packet;
+
+      if (queued_.fetch_sub (1) == 1)
+        drained_.notify ();
+    }
+  }
+
+  void
+  write (const string &data) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*> (data.data ());
+    size_t written = 0;
+
+    try {
+      // A write timing out just means the device is slow to take it, but
+      // don't hold up stopping over it
+      while (written < data.size ()) {
+        written += pimpl_->write (bytes + written, data.size () - written);
+        if (stop_.load ())
+          break;
+      }
+    } catch (...) {
+      tx_error_ = std::current_exception ();
+      tx_failed_.store (true, std::memory_order_release);
+      drained_.notify ();
+    }
+  }
+};
+
 Serial::Serial (const string &port, uint32_t baudrate, serial::Timeout timeout,
                 bytesize_t bytesize, parity_t parity, stopbits_t stopbits,
                 flowcontrol_t flowcontrol)
  : pimpl_(new SerialImpl (port, baudrate, bytesize, parity,
-                                           stopbits, flowcontrol))
+                                           stopbits, flowcontrol)),
+   rx_(new RxBuffer ()), async_(new AsyncReader (this)), duplex_(NULL)
 {
   pimpl_->setTimeout(timeout);
 }
 
 Serial::~Serial ()
 {
+  // Stops the reactor before the port goes away under it
+  delete async_;
+  delete duplex_;
+  delete rx_;
   delete pimpl_;
 }
 
 void
 Serial::open ()
 {
+  // Nothing received before the port was closed is of any use now
+  rx_->clear ();
   pimpl_->open ();
 }
 
 void
 Serial::close ()
 {
+  async_->cancel ("Serial::close");
+  endDuplex_ ();
   pimpl_->close ();
 }
 
@@ -98,14 +801,36 @@ Serial::isOpen () const
 size_t
 Serial::available ()
 {
-  return pimpl_->available ();
+  if (duplex_)
+    return rx_->size () + duplex_->available ();
+  return rx_->size () + pimpl_->available ();
 }
 
 bool
 Serial::waitReadable ()
 {
   serial::Timeout timeout(pimpl_->getTimeout ());
-  return pimpl_->waitReadable(timeout.read_timeout_constant);
+  return waitReadable(timeout.read_timeout_constant);
+}
+
+bool
+Serial::waitReadable (uint32_t timeout)
+{
+  // Buffered bytes don't need a wait, but a pending interrupt () still goes
+  if (!rx_->empty ())
+    timeout = 0;
+  const bool ready = duplex_ ? duplex_->waitReadable (timeout)
+                             : pimpl_->waitReadable (timeout);
+  return !rx_->empty () || ready;
+}
+
+void
+Serial::interrupt ()
+{
+  if (duplex_)
+    duplex_->interrupt ();
+  else
+    pimpl_->interrupt ();
 }
 
 void
@@ -114,55 +839,190 @@ Serial::waitByteTimes (size_t count)
   pimpl_->waitByteTimes(count);
 }
 
+// Adapts a promise to a ReadHandler
+static Serial::ReadHandler
+promiseHandler (std::future<string> &future)
+{
+  std::shared_ptr<std::promise<string> > promise =
+    std::make_shared<std::promise<string> > ();
+  future = promise->get_future ();
+
+  return [promise] (const string &data, std::exception_ptr error) {
+    if (error)
+      promise->set_exception (error);
+    else
+      promise->set_value (data);
+  };
+}
+
+void
+Serial::asyncRead (size_t size, ReadHandler handler)
+{
+  async_->submit (AsyncReader::exactly, size, string (), handler);
+}
+
+void
+Serial::asyncReadUntil (const string &delimiter, ReadHandler handler,
+                        size_t size)
+{
+  if (delimiter.empty ()) {
+    throw invalid_argument ("Empty delimiter is invalid.");
+  }
+  async_->submit (AsyncReader::until, size, delimiter, handler);
+}
+
+void
+Serial::asyncReadSome (ReadHandler handler)
+{
+  async_->submit (AsyncReader::some, 0, string (), handler);
+}
+
+std::future<string>
+Serial::asyncRead (size_t size)
+{
+  std::future<string> future;
+  asyncRead (size, promiseHandler (future));
+  return future;
+}
+
+std::future<string>
+Serial::asyncReadUntil (const string &delimiter, size_t size)
+{
+  std::future<string> future;
+  asyncReadUntil (delimiter, promiseHandler (future), size);
+  return future;
+}
+
+std::future<string>
+Serial::asyncReadSome ()
+{
+  std::future<string> future;
+  asyncReadSome (promiseHandler (future));
+  return future;
+}
+
+void
+Serial::cancelAsync ()
+{
+  async_->cancel ("Serial::cancelAsync");
+}
+
 size_t
 Serial::read_ (uint8_t *buffer, size_t size)
 {
-  return this->pimpl_->read (buffer, size);
+  // Whatever is buffered first, then straight into the caller's buffer
+  size_t bytes_read = rx_->take (buffer, size);
+  if (bytes_read < size && duplex_)
+    bytes_read += duplex_->read (buffer + bytes_read, size - bytes_read);
+  else if (bytes_read < size)
+    bytes_read += this->pimpl_->read (buffer + bytes_read, size - bytes_read);
+  return bytes_read;
 }
 
 size_t
-Serial::read (uint8_t *buffer, size_t size)
+Serial::fill_ ()
 {
-  ScopedReadLock lock(this->pimpl_);
-  return this->pimpl_->read (buffer, size);
+  // Take everything the driver has queued in one go, or wait for one byte
+  size_t length;
+  uint8_t *free_space = rx_->writable (length);
+  if (duplex_) {
+    size_t wanted = std::max<size_t> (duplex_->available (), 1);
+    size_t bytes_read = duplex_->read (free_space, min (wanted, length));
+    rx_->commit (bytes_read);
+    return bytes_read;
+  }
+
+  size_t wanted = std::max<size_t> (pimpl_->available (), 1);
+  size_t bytes_read = this->pimpl_->read (free_space, min (wanted, length));
+  rx_->commit (bytes_read);
+  return bytes_read;
 }
 
 size_t
-Serial::read (std::vector<uint8_t> &buffer, size_t size)
+Serial::readline_ (string &buffer, size_t size, const string &eol)
+{
+  // An EOL can straddle what has been searched and what comes next
+  const size_t keep = eol.empty () ? 0 : eol.length () - 1;
+  rx_->reserve (2 * eol.length ());
+
+  size_t read_so_far = 0;
+  size_t searched = 0;
+  while (read_so_far < size) {
+    size_t limit = min (rx_->size (), size - read_so_far);
+    size_t end = rx_->find (eol, searched, limit);
+    if (end != RxBuffer::npos) {
+      rx_->take (buffer, end);
+      return read_so_far + end; // EOL found
+    }
+    if (limit == size - read_so_far) {
+      rx_->take (buffer, limit);
+      return size; // Reached the maximum read length
+    }
+
+    if (rx_->full ()) {
+      // The line is longer than the buffer, hand out what is known not to
+      // be part of the EOL
+      size_t spill = rx_->size () - keep;
+      rx_->take (buffer, spill);
+      read_so_far += spill;
+    }
+    searched = rx_->size () > keep ? rx_->size () - keep : 0;
+
+    if (fill_ () == 0) {
+      // Timeout occured waiting for more
+      limit = min (rx_->size (), size - read_so_far);
+      rx_->take (buffer, limit);
+      return read_so_far + limit;
+    }
+  }
+  return read_so_far;
+}
+
+size_t
+Serial::read (uint8_t *buffer, size_t size)
 {
-  ScopedReadLock lock(this->pimpl_);
-  uint8_t *buffer_ = new uint8_t[size];
+  ScopedReadLock lock(this->pimpl_, duplex_ == NULL);
+  return this->read_ (buffer, size);
+}
+
+// Reads straight onto the end of a container, then trims it back to what
+// actually arrived
+template <typename Container, typename Read> static size_t
+read_append (Container &buffer, size_t size, Read read)
+{
+  const size_t old_size = buffer.size ();
+  buffer.resize (old_size + size);
   size_t bytes_read = 0;
 
   try {
-    bytes_read = this->pimpl_->read (buffer_, size);
+    if (size > 0)
+      bytes_read = read (reinterpret_cast<uint8_t*> (&buffer[old_size]), size);
   }
-  catch (const std::exception &e) {
-    delete[] buffer_;
+  catch (...) {
+    buffer.resize (old_size);
     throw;
   }
 
-  buffer.insert (buffer.end (), buffer_, buffer_+bytes_read);
-  delete[] buffer_;
+  buffer.resize (old_size + bytes_read);
   return bytes_read;
 }
 
+size_t
+Serial::read (std::vector<uint8_t> &buffer, size_t size)
+{
+  ScopedReadLock lock(this->pimpl_, duplex_ == NULL);
+  return read_append (buffer, size, [this] (uint8_t *data, size_t length) {
+    return this->read_ (data, length);
+  });
+}
+
 size_t
 Serial::read (std::string &buffer, size_t size)
 {
-  ScopedReadLock lock(this->pimpl_);
-  uint8_t *buffer_ = new uint8_t[size];
-  size_t bytes_read = 0;
-  try {
-    bytes_read = this->pimpl_->read (buffer_, size);
-  }
-  catch (const std::exception &e) {
-    delete[] buffer_;
-    throw;
-  }
-  buffer.append (reinterpret_cast<const char*>(buffer_), bytes_read);
-  delete[] buffer_;
-  return bytes_read;
+  ScopedReadLock lock(this->pimpl_, duplex_ == NULL);
+  return read_append (buffer, size, [this] (uint8_t *data, size_t length) {
+    return this->read_ (data, length);
+  });
 }
 
 string
@@ -176,28 +1036,8 @@ Serial::read (size_t size)
 size_t
 Serial::readline (string &buffer, size_t size, string eol)
 {
-  ScopedReadLock lock(this->pimpl_);
-  size_t eol_len = eol.length ();
-  uint8_t *buffer_ = static_cast<uint8_t*>
-                              (alloca (size * sizeof (uint8_t)));
-  size_t read_so_far = 0;
-  while (true)
-  {
-    size_t bytes_read = this->read_ (buffer_ + read_so_far, 1);
-    read_so_far += bytes_read;
-    if (bytes_read == 0) {
-      break; // Timeout occured on reading 1 byte
-    }
-    if (string (reinterpret_cast<const char*>
-         (buffer_ + read_so_far - eol_len), eol_len) == eol) {
-      break; // EOL found
-    }
-    if (read_so_far == size) {
-      break; // Reached the maximum read length
-    }
-  }
-  buffer.append(reinterpret_cast<const char*> (buffer_), read_so_far);
-  return read_so_far;
+  ScopedReadLock lock(this->pimpl_, duplex_ == NULL);
+  return this->readline_ (buffer, size, eol);
 }
 
 string
@@ -211,39 +1051,20 @@ Serial::readline (size_t size, string eol)
 vector<string>
 Serial::readlines (size_t size, string eol)
 {
-  ScopedReadLock lock(this->pimpl_);
+  ScopedReadLock lock(this->pimpl_, duplex_ == NULL);
   std::vector<std::string> lines;
-  size_t eol_len = eol.length ();
-  uint8_t *buffer_ = static_cast<uint8_t*>
-    (alloca (size * sizeof (uint8_t)));
   size_t read_so_far = 0;
-  size_t start_of_line = 0;
   while (read_so_far < size) {
-    size_t bytes_read = this->read_ (buffer_+read_so_far, 1);
-    read_so_far += bytes_read;
+    string line;
+    size_t bytes_read = this->readline_ (line, size - read_so_far, eol);
     if (bytes_read == 0) {
-      if (start_of_line != read_so_far) {
-        lines.push_back (
-          string (reinterpret_cast<const char*> (buffer_ + start_of_line),
-            read_so_far - start_of_line));
-      }
-      break; // Timeout occured on reading 1 byte
-    }
-    if (string (reinterpret_cast<const char*>
-         (buffer_ + read_so_far - eol_len), eol_len) == eol) {
-      // EOL found
-      lines.push_back(
-        string(reinterpret_cast<const char*> (buffer_ + start_of_line),
-          read_so_far - start_of_line));
-      start_of_line = read_so_far;
+      break; // Timeout occured before anything arrived
     }
-    if (read_so_far == size) {
-      if (start_of_line != read_so_far) {
-        lines.push_back(
-          string(reinterpret_cast<const char*> (buffer_ + start_of_line),
-            read_so_far - start_of_line));
-      }
-      break; // Reached the maximum read length
+    read_so_far += bytes_read;
+    lines.push_back (line);
+    if (line.length () < eol.length () ||
+        line.compare (line.length () - eol.length (), eol.length (), eol) != 0) {
+      break; // Timeout or the maximum read length cut the line short
     }
   }
   return lines;
@@ -252,40 +1073,113 @@ Serial::readlines (size_t size, string eol)
 size_t
 Serial::write (const string &data)
 {
-  ScopedWriteLock lock(this->pimpl_);
-  return this->write_ (reinterpret_cast<const uint8_t*>(data.c_str()),
-                       data.length());
+  ConstBuffer buffer(data);
+  return this->write_ (&buffer, 1);
 }
 
 size_t
 Serial::write (const std::vector<uint8_t> &data)
 {
-  ScopedWriteLock lock(this->pimpl_);
-  return this->write_ (&data[0], data.size());
+  ConstBuffer buffer(data);
+  return this->write_ (&buffer, 1);
 }
 
 size_t
 Serial::write (const uint8_t *data, size_t size)
 {
-  ScopedWriteLock lock(this->pimpl_);
-  return this->write_(data, size);
+  ConstBuffer buffer(data, size);
+  return this->write_ (&buffer, 1);
+}
+
+size_t
+Serial::write (const ConstBuffer *buffers, size_t count)
+{
+  return this->write_ (buffers, count);
 }
 
 size_t
-Serial::write_ (const uint8_t *data, size_t length)
+Serial::write (std::initializer_list<ConstBuffer> buffers)
+{
+  return this->write_ (buffers.begin (), buffers.size ());
+}
+
+size_t
+Serial::write_ (const ConstBuffer *buffers, size_t count)
+{
+  if (duplex_)
+    return duplex_->send (buffers, count);
+
+  ScopedWriteLock lock(this->pimpl_);
+  return pimpl_->write (buffers, count);
+}
+
+void
+Serial::setFullDuplex (bool enabled)
+{
+  if (enabled == (duplex_ != NULL))
+    return;
+
+  // The reactor reads through whichever side is in charge, so it can't be
+  // in the middle of a read while that changes
+  async_->cancel ("Serial::setFullDuplex");
+
+  if (!enabled) {
+    endDuplex_ ();
+    return;
+  }
+
+  if (!pimpl_->isOpen ())
+    throw PortNotOpenedException ("Serial::setFullDuplex");
+
+  // Lets reads and writes already under way finish first
+  ScopedReadLock rlock(this->pimpl_);
+  ScopedWriteLock wlock(this->pimpl_);
+  duplex_ = new Duplex (pimpl_);
+}
+
+bool
+Serial::isFullDuplex () const
 {
-  return pimpl_->write (data, length);
+  return duplex_ != NULL;
+}
+
+void
+Serial::endDuplex_ ()
+{
+  if (duplex_ == NULL)
+    return;
+
+  Duplex *duplex = duplex_;
+  duplex_ = NULL;
+  duplex->stop ();
+
+  // Keep what was received but not read yet
+  rx_->reserve (rx_->size () + duplex->available ());
+  size_t length;
+  uint8_t *free_space;
+  do {
+    free_space = rx_->writable (length);
+    length = duplex->take (free_space, length);
+    rx_->commit (length);
+  } while (length > 0);
+
+  delete duplex;
 }
 
 void
 Serial::setPort (const string &port)
 {
+  // Outside of the locks, the reactor may be waiting on the read lock
+  async_->cancel ("Serial::setPort");
+  endDuplex_ ();
+
   ScopedReadLock rlock(this->pimpl_);
   ScopedWriteLock wlock(this->pimpl_);
   bool was_open = pimpl_->isOpen ();
-  if (was_open) close();
+  if (was_open) pimpl_->close ();
   pimpl_->setPort (port);
-  if (was_open) open ();
+  rx_->clear ();
+  if (was_open) pimpl_->open ();
 }
 
 string
@@ -367,6 +1261,12 @@ Serial::getFlowcontrol () const
 
 void Serial::flush ()
 {
+  if (duplex_) {
+    duplex_->drain ();
+    pimpl_->flush ();
+    return;
+  }
+
   ScopedReadLock rlock(this->pimpl_);
   ScopedWriteLock wlock(this->pimpl_);
   pimpl_->flush ();
@@ -374,12 +1274,21 @@ void Serial::flush ()
 
 void Serial::flushInput ()
 {
-  ScopedReadLock lock(this->pimpl_);
+  ScopedReadLock lock(this->pimpl_, duplex_ == NULL);
+  rx_->clear ();
+  if (duplex_)
+    duplex_->discardInput ();
   pimpl_->flushInput ();
 }
 
 void Serial::flushOutput ()
 {
+  if (duplex_) {
+    duplex_->discardOutput ();
+    pimpl_->flushOutput ();
+    return;
+  }
+
   ScopedWriteLock lock(this->pimpl_);
   pimpl_->flushOutput ();
 }
@@ -43,6 +43,9 @@
 #include <sstream>
 #include <exception>
 #include <stdexcept>
+#include <functional>
+#include <future>
+#include <initializer_list>
 #include <serial/v8stdint.h>
 
 #define THROW(exceptionClass, message) throw exceptionClass(__FILE__, \
@@ -141,6 +144,25 @@ struct Timeout {
   {}
 };
 
+/*!
+ * A block of bytes to be written, which the caller keeps alive for the
+ * duration of the write. Several of them can be written in one go with
+ * Serial::write without first copying them together.
+ */
+struct ConstBuffer {
+  const uint8_t *data;
+  size_t size;
+
+  ConstBuffer (const void *data_, size_t size_)
+  : data(static_cast<const uint8_t*> (data_)), size(size_) {}
+
+  ConstBuffer (const std::string &data_)
+  : data(reinterpret_cast<const uint8_t*> (data_.data ())), size(data_.size ()) {}
+
+  ConstBuffer (const std::vector<uint8_t> &data_)
+  : data(data_.data ()), size(data_.size ()) {}
+};
+
 /*!
  * Class that provides a portable serial port interface.
  */
@@ -226,6 +248,20 @@ public:
   bool
   waitReadable ();
 
+  /*! Block until there is serial data to read or timeout number of
+   * milliseconds have elapsed. Same as waitReadable () but with an explicit
+   * timeout instead of read_timeout_constant. */
+  bool
+  waitReadable (uint32_t timeout);
+
+  /*! Wakes up a thread blocked in read, write or waitReadable on this port,
+   * which returns as if it had timed out, with whatever it got so far. If
+   * none is blocked the next one to block returns right away, and
+   * waitReadable (0) takes such a pending one back. Can be called from any
+   * thread. */
+  void
+  interrupt ();
+
   /*! Block for a period of time corresponding to the transmission time of
    * count characters at present serial settings. This may be used in con-
    * junction with waitReadable to read larger blocks of data from the
@@ -233,6 +269,63 @@ public:
   void
   waitByteTimes (size_t count);
 
+  /*!
+   * Handler for the asynchronous reads. It is called on the port's reactor
+   * thread and must not throw.
+   *
+   * \param data The bytes read. If the read failed this holds whatever had
+   *        been received for it so far.
+   * \param error Null on success, otherwise the exception that ended the
+   *        read (an IO error, the port being closed or cancelAsync).
+   */
+  typedef std::function<void (const std::string &data,
+                              std::exception_ptr error)> ReadHandler;
+
+  /*! Asynchronously reads exactly size bytes.
+   *
+   * Asynchronous reads are serviced in the order they were issued by a
+   * reactor thread started the first time one is issued, which waits for
+   * data with waitReadable and reads whatever has arrived in one go. The
+   * call itself never blocks. They should not be mixed with blocking reads
+   * on the same port, since either could take the bytes the other one is
+   * waiting for.
+   *
+   * \param size How many bytes to read.
+   * \param handler Called once the bytes have arrived, or on failure.
+   */
+  void
+  asyncRead (size_t size, ReadHandler handler);
+
+  /*! Asynchronously reads up to and including delimiter, or size bytes if
+   * the delimiter doesn't show up within them.
+   *
+   * \throw std::invalid_argument if the delimiter is empty
+   */
+  void
+  asyncReadUntil (const std::string &delimiter, ReadHandler handler,
+                  size_t size = 65536);
+
+  /*! Asynchronously reads whatever is received next, at least one byte. */
+  void
+  asyncReadSome (ReadHandler handler);
+
+  /*! Future based versions of the asynchronous reads above. The future
+   * holds the data, or rethrows the exception the read failed with. */
+  std::future<std::string>
+  asyncRead (size_t size);
+
+  std::future<std::string>
+  asyncReadUntil (const std::string &delimiter, size_t size = 65536);
+
+  std::future<std::string>
+  asyncReadSome ();
+
+  /*! Fails every outstanding asynchronous read with a SerialException.
+   * Bytes already received but not handed out yet stay buffered for the
+   * next asynchronous read. Closing the port does this too. */
+  void
+  cancelAsync ();
+
   /*! Read a given amount of bytes from the serial port into a given buffer.
    *
    * The read function will return in one of three cases:
@@ -265,6 +358,10 @@ public:
   read (uint8_t *buffer, size_t size);
 
   /*! Read a given amount of bytes from the serial port into a give buffer.
+   *
+   * The bytes are appended to the end of the buffer, which is grown at most
+   * once and read into directly. Reserving room up front makes repeated
+   * reads allocation free.
    *
    * \param buffer A reference to a std::vector of uint8_t.
    * \param size A size_t defining how many bytes to be read.
@@ -279,6 +376,9 @@ public:
   read (std::vector<uint8_t> &buffer, size_t size = 1);
 
   /*! Read a given amount of bytes from the serial port into a give buffer.
+   *
+   * The bytes are appended to the end of the buffer in place, like the
+   * std::vector version.
    *
    * \param buffer A reference to a std::string.
    * \param size A size_t defining how many bytes to be read.
@@ -401,6 +501,54 @@ public:
   size_t
   write (const std::string &data);
 
+  /*! Write several blocks of bytes to the serial port as one, in order
+   * (a gather write).
+   *
+   * \param buffers An array of count ConstBuffers.
+   * \param count The number of buffers.
+   *
+   * \return A size_t representing the total number of bytes actually
+   * written to the serial port. If the write times out part way this is
+   * less than the sum of the buffer sizes.
+   *
+   * \throw serial::PortNotOpenedException
+   * \throw serial::SerialException
+   * \throw serial::IOException
+   */
+  size_t
+  write (const ConstBuffer *buffers, size_t count);
+
+  /*! Write several blocks of bytes to the serial port as one, e.g.
+   * write ({ ConstBuffer (header, 1), ConstBuffer (payload) }). */
+  size_t
+  write (std::initializer_list<ConstBuffer> buffers);
+
+  /*! Switches full duplex mode on or off.
+   *
+   * In full duplex mode a reader thread owns the receiving side of the port
+   * and passes what it receives on through a lock-free ring, and writes are
+   * queued for a writer thread instead of being made by the caller. Reads
+   * and writes then never take the port's read and write locks, so a thread
+   * streaming device output doesn't wait on one sending commands.
+   *
+   * While it is on:
+   *  - Only one thread may read at a time, asynchronous reads included.
+   *  - write returns once the data is queued. An error sending it is thrown
+   *    by a later write, and flush waits for the queue to empty.
+   *  - close and setPort turn it off, after sending whatever is queued.
+   *
+   * Turning it off keeps anything received but not read yet. Only switch
+   * while no other thread is reading or writing.
+   *
+   * \throw serial::PortNotOpenedException
+   */
+  void
+  setFullDuplex (bool enabled = true);
+
+  /*! Returns true while in full duplex mode. */
+  bool
+  isFullDuplex () const;
+
   /*! Sets the serial port identifier.
    *
    * \param port A const std::string reference containing the address of the
@@ -660,12 +808,34 @@ private:
   class ScopedReadLock;
   class ScopedWriteLock;
 
+  // Bytes received but not read yet
+  class RxBuffer;
+  RxBuffer *rx_;
+
+  // Reactor servicing the asynchronous reads
+  class AsyncReader;
+  AsyncReader *async_;
+
+  // Reader and writer threads for full duplex mode, null otherwise
+  class Duplex;
+  Duplex *duplex_;
+
   // Read common function
   size_t
   read_ (uint8_t *buffer, size_t size);
+  // Reads as much as is available into rx_, at least one byte unless the
+  // read times out
+  size_t
+  fill_ ();
+  // Moves a line from rx_ into buffer, reading more as needed
+  size_t
+  readline_ (std::string &buffer, size_t size, const std::string &eol);
   // Write common function
   size_t
-  write_ (const uint8_t *data, size_t length);
+  write_ (const ConstBuffer *buffers, size_t count);
+  // Stops the full duplex threads, keeping what they received in rx_
+  void
+  endDuplex_ ();
 
 };
 
@@ -757,7 +927,7 @@ struct PortInfo {
   /*! Human readable description of serial device if available. */
   std::string description;
 
-  /*! Hardware ID (e.g. VID:PID of USB serial devices) or "n/a" if not available. */
+  /*! Hardware ID (e.g. VID:PID and serial number of USB serial devices) or "n/a" if not available. */
   std::string hardware_id;
 
 };
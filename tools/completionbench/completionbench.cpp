@@ -0,0 +1,289 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// completionbench - measures the time autocompletion takes per keystroke.
+//
+// Catalogs of 100, 10k and 100k names are made from the real ez names plus
+// made up ones. Names are then typed out one character at a time, and for
+// each keystroke the list for the typed prefix is worked out:
+//
+//   before  The way the console did it before ApiCatalog: copy the names,
+//           sort them, join them with a stringstream, and std::find to
+//           check for a function
+//   after   ApiCatalog::complete() and isFunction()
+//
+// before is slow with big catalogs, so it only gets the first -b
+// keystrokes. Results are printed as JSON.
+//
+// Build:
+//
+//   g++ -std=c++14 -O2 -I../../src completionbench.cpp ../../src/ApiCatalog.cpp ../../src/EzApi.cpp -o completionbench
+//
+// Usage:
+//
+//   completionbench [-k keystrokes] [-b keystrokes]
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "ApiCatalog.h"
+#include "EzApi.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+	size_t keystrokes = 5000;
+	size_t before_keystrokes = 200;
+};
+
+struct Samples {
+	std::vector<double> us;
+
+	double percentile(double p) {
+		if (us.empty()) return 0;
+
+		std::sort(us.begin(), us.end());
+
+		// Nearest rank
+		size_t rank = static_cast<size_t>(p / 100.0 * us.size() + 0.5);
+		return us[std::min(std::max<size_t>(rank, 1), us.size()) - 1];
+	}
+};
+
+// What the console had before ApiCatalog, copied from LuaConsole.cpp
+
+inline int MakeUpperCase(int ch) {
+	if (ch < 'a' || ch > 'z')
+		return ch;
+	else
+		return static_cast<char>(ch - 'a' + 'A');
+}
+
+int CompareNCaseInsensitive(const char *a, const char *b, size_t len) {
+	while (*a && *b && len) {
+		if (*a != *b) {
+			char upperA = static_cast<char>(MakeUpperCase(*a));
+			char upperB = static_cast<char>(MakeUpperCase(*b));
+			if (upperA != upperB)
+				return upperA - upperB;
+		}
+		a++;
+		b++;
+		len--;
+	}
+	if (len == 0)
+		return 0;
+	else
+		// Either *a or *b is nul
+		return *a - *b;
+}
+
+struct Sorter {
+	bool ignoreCase;
+
+	Sorter(bool ignoreCase_) : ignoreCase(ignoreCase_) {}
+
+	inline bool operator()(const std::string& a, const std::string& b) {
+		auto lenA = a.length();
+		auto lenB = b.length();
+		auto len = std::min(lenA, lenB);
+		int cmp;
+		if (ignoreCase)
+			cmp = CompareNCaseInsensitive(a.c_str(), b.c_str(), len);
+		else
+			cmp = strncmp(a.c_str(), b.c_str(), len);
+		if (cmp == 0)
+			cmp = static_cast<int>(lenA - lenB);
+		return cmp < 0;
+	}
+};
+
+static std::vector<std::string> &sortCaseInsensitive(std::vector<std::string> &strings) {
+	std::sort(strings.begin(), strings.end(), Sorter(true));
+	return strings;
+}
+
+template <typename T, typename U>
+static std::string join(const std::vector<T> &v, const U &delim) {
+	std::stringstream ss;
+	for (size_t i = 0; i < v.size(); ++i) {
+		if (i != 0) ss << delim;
+		ss << v[i];
+	}
+	return ss.str();
+}
+
+// Made up names that look like the real ones
+static std::string makeName(std::mt19937 &random) {
+	static const char *const parts[] = {
+		"Set", "Get", "Box", "Fill", "Line", "Font", "Text", "Color", "Button", "Touch", "Wav", "Bitmap",
+		"Serial", "Timer", "Pixel", "Alpha", "Angle", "Frame", "Layer", "Page", "Input", "Output", "Pin", "Bus",
+	};
+	const size_t count = sizeof(parts) / sizeof(parts[0]);
+
+	std::string name;
+	const size_t words = 1 + random() % 3;
+	for (size_t i = 0; i < words; ++i) name += parts[random() % count];
+	if (random() % 2) name += std::to_string(random() % 1000);
+	if (random() % 8 == 0) name[0] = static_cast<char>(tolower(name[0]));
+	return name;
+}
+
+struct Catalog {
+	std::vector<std::string> props;
+	std::vector<std::string> funcs;
+};
+
+static Catalog makeCatalog(size_t size, std::mt19937 &random) {
+	Catalog catalog;
+	catalog.funcs.assign(EzFunctions, EzFunctions + EzFunctionCount);
+	catalog.props.assign(EzProperties, EzProperties + EzPropertyCount);
+
+	std::unordered_set<std::string> names(catalog.funcs.begin(), catalog.funcs.end());
+	names.insert(catalog.props.begin(), catalog.props.end());
+
+	while (catalog.funcs.size() + catalog.props.size() < size) {
+		std::string name = makeName(random);
+		if (!names.insert(name).second) continue;
+
+		if (random() % 4 == 0) catalog.props.push_back(name);
+		else catalog.funcs.push_back(name);
+	}
+
+	// The real ones already go past 100
+	while (catalog.funcs.size() + catalog.props.size() > size) catalog.funcs.pop_back();
+
+	return catalog;
+}
+
+// Every prefix of the picked names, from the empty one on
+static std::vector<std::string> makeKeystrokes(const Catalog &catalog, size_t count, std::mt19937 &random) {
+	std::vector<std::string> keystrokes;
+
+	while (keystrokes.size() < count) {
+		const size_t pick = random() % (catalog.funcs.size() + catalog.props.size());
+		const std::string &name = pick < catalog.funcs.size() ? catalog.funcs[pick] : catalog.props[pick - catalog.funcs.size()];
+
+		for (size_t length = 0; length <= name.size() && keystrokes.size() < count; ++length) keystrokes.push_back(name.substr(0, length));
+	}
+
+	return keystrokes;
+}
+
+// Names only differing in case can be in either order
+static bool sameNames(const std::string &a, const std::string &b) {
+	auto split = [](const std::string &list) {
+		std::vector<std::string> names;
+		std::stringstream ss(list);
+		for (std::string name; ss >> name;) names.push_back(name);
+		std::sort(names.begin(), names.end());
+		return names;
+	};
+	return split(a) == split(b);
+}
+
+static double elapsedUs(Clock::time_point start) {
+	return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+static void run(size_t size, const Options &options, bool last) {
+	std::mt19937 random(static_cast<unsigned int>(size));
+	const Catalog catalog = makeCatalog(size, random);
+	const std::vector<std::string> keystrokes = makeKeystrokes(catalog, options.keystrokes, random);
+
+	// Whatever gets shown, so none of the work can be optimized away
+	size_t shown = 0;
+	size_t functions = 0;
+
+	Samples before;
+	std::string before_list;
+	for (size_t i = 0; i < keystrokes.size() && i < options.before_keystrokes; ++i) {
+		Clock::time_point start = Clock::now();
+
+		std::vector<std::string> suggestions(catalog.props.begin(), catalog.props.end());
+		suggestions.insert(suggestions.end(), catalog.funcs.begin(), catalog.funcs.end());
+		const std::string list = join(sortCaseInsensitive(suggestions), ' ');
+		if (std::find(catalog.funcs.begin(), catalog.funcs.end(), keystrokes[i]) != catalog.funcs.end()) ++functions;
+
+		before.us.push_back(elapsedUs(start));
+		shown += list.size();
+		before_list = list;
+	}
+
+	Clock::time_point start = Clock::now();
+	ApiCatalog api;
+	for (const std::string &name : catalog.funcs) api.add("ez", name, true);
+	for (const std::string &name : catalog.props) api.add("ez", name, false);
+	api.build();
+	const double build_us = elapsedUs(start);
+
+	Samples after;
+	size_t narrowed_bytes = 0;
+	for (const std::string &prefix : keystrokes) {
+		Clock::time_point start = Clock::now();
+
+		const std::string &list = api.complete("ez", prefix);
+		if (api.isFunction(prefix)) ++functions;
+
+		after.us.push_back(elapsedUs(start));
+		narrowed_bytes += list.size();
+	}
+
+	printf("  \"%zu\": { \"names\": %zu, \"build_us\": %.1f, ", size, api.size(), build_us);
+	printf("\"before\": { \"keystrokes\": %zu, \"p50_us\": %.2f, \"p99_us\": %.2f }, ", before.us.size(), before.percentile(50), before.percentile(99));
+	printf("\"after\": { \"keystrokes\": %zu, \"p50_us\": %.2f, \"p99_us\": %.2f, \"mean_list_bytes\": %.0f }, ",
+		after.us.size(), after.percentile(50), after.percentile(99), static_cast<double>(narrowed_bytes) / keystrokes.size());
+	printf("\"same_list\": %s, \"checksum\": %zu }%s\n", sameNames(api.complete("ez", ""), before_list) ? "true" : "false", shown + functions, last ? "" : ",");
+}
+
+static void usage() {
+	fprintf(stderr, "usage: completionbench [-k keystrokes] [-b keystrokes]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	Options options;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "k:b:")) != -1) {
+		switch (opt) {
+			case 'k': options.keystrokes = strtoul(optarg, nullptr, 10); break;
+			case 'b': options.before_keystrokes = strtoul(optarg, nullptr, 10); break;
+			default: usage();
+		}
+	}
+	if (optind != argc || options.keystrokes == 0) usage();
+
+	printf("{\n");
+	run(100, options, false);
+	run(10000, options, false);
+	run(100000, options, true);
+	printf("}\n");
+
+	return 0;
+}
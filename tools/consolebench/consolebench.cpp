@@ -0,0 +1,617 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// consolebench - measures how many lines a second the console can take.
+//
+// The output pane is replaced by an in-memory stand-in that understands the
+// few Scintilla messages the console sends. It keeps the text, styles and
+// line index like Scintilla does, and can spend a set time on every change
+// and scroll to stand in for the window updates Scintilla would do there.
+// Results are printed as JSON.
+//
+//   direct       Every write goes straight to the pane, like the console
+//                did before OutputSink, and the pane is never trimmed
+//   sink         Writes go through OutputSink on the UI thread
+//   sink_thread  Another thread writes while the UI thread flushes
+//   paste        Latency of putting -p lines into the input pane, with the
+//                prompt margin kept up the old way (every line on every
+//                change) and with PromptMargin. Pasted into an empty pane,
+//                pasted into one that already has as many lines, and typed
+//                in a line at a time.
+//
+// Every error line is written one byte per call, the others in one call.
+// -L and -B set the Scrollback limits of the sink runs and -o its log file,
+// -m picks the runs (any of d, s, t and p). peak_bytes is what the stand-in
+// held at most, max_rss_kb is for the whole process so it is best read with
+// a single run.
+//
+// Build:
+//
+//   g++ -std=c++14 -O2 -I../../src -I../../src/Npp consolebench.cpp ../../src/OutputSink.cpp ../../src/Scrollback.cpp -pthread -o consolebench
+//
+// Usage:
+//
+//   consolebench [-n lines] [-s size] [-e every] [-r update_us] [-L lines] [-B bytes] [-o log] [-p lines] [-m runs]
+
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Scintilla.h"
+#include "OutputSink.h"
+#include "PromptMargin.h"
+#include "Scrollback.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+	size_t lines = 200000;
+	size_t size = 40;
+	size_t every = 10;
+	uint32_t update_us = 0;
+	size_t max_lines = 0;
+	size_t max_bytes = 0;
+	std::string log;
+	size_t paste = 2000;
+	std::string runs = "dst";
+};
+
+struct Samples {
+	std::vector<double> us;
+
+	double percentile(double p) {
+		if (us.empty()) return 0;
+
+		std::sort(us.begin(), us.end());
+
+		// Nearest rank
+		size_t rank = static_cast<size_t>(p / 100.0 * us.size() + 0.5);
+		return us[std::min(std::max<size_t>(rank, 1), us.size()) - 1];
+	}
+};
+
+// Stands in for the output Scintilla window
+class Editor {
+public:
+	size_t calls = 0;
+	size_t changes = 0;
+	size_t scrolls = 0;
+	size_t peak_bytes = 0;
+
+	std::string text;
+	std::string styles;
+
+	// Sent after every insertion, like SCN_MODIFIED
+	std::function<void(const SCNotification &)> modified;
+
+	explicit Editor(uint32_t update_us) : update_us(update_us), readonly(false), caret(0), first_visible(0) {
+		line_starts.push_back(0);
+		margins.push_back(0);
+	}
+
+	// Whether every line has the prompt
+	bool prompted() const {
+		return std::find(margins.begin(), margins.end(), 0) == margins.end();
+	}
+
+	int Call(unsigned int msg, uptr_t wParam = 0, sptr_t lParam = 0) {
+		++calls;
+
+		switch (msg) {
+			case SCI_SETREADONLY:
+				readonly = wParam != 0;
+				return 0;
+			case SCI_GETLENGTH:
+				return static_cast<int>(text.size());
+			case SCI_SETEMPTYSELECTION:
+				caret = std::min<size_t>(wParam, text.size());
+				return 0;
+			case SCI_APPENDTEXT:
+				insert(text.size(), reinterpret_cast<const char *>(lParam), wParam, nullptr);
+				return 0;
+			case SCI_ADDTEXT:
+				insert(caret, reinterpret_cast<const char *>(lParam), wParam, nullptr);
+				caret += wParam;
+				return 0;
+			case SCI_ADDSTYLEDTEXT:
+				insert(caret, reinterpret_cast<const char *>(lParam), wParam / 2, reinterpret_cast<const char *>(lParam));
+				caret += wParam / 2;
+				return 0;
+			case SCI_DOCUMENTEND:
+				caret = text.size();
+				scroll();
+				return 0;
+			case SCI_GETLINECOUNT:
+				return static_cast<int>(line_starts.size());
+			case SCI_LINEFROMPOSITION:
+				return static_cast<int>(std::upper_bound(line_starts.begin(), line_starts.end(), wParam) - line_starts.begin() - 1);
+			case SCI_POSITIONFROMLINE:
+				return static_cast<int>(wParam < line_starts.size() ? line_starts[wParam] : text.size());
+			case SCI_DELETERANGE:
+				erase(wParam, lParam);
+				return 0;
+			case SCI_MARGINSETTEXT:
+				margins[wParam] = *reinterpret_cast<const char *>(lParam);
+				update();
+				return 0;
+			case SCI_MARGINSETSTYLE:
+				return 0;
+		}
+		return 0;
+	}
+
+	sptr_t CallReturnPointer(unsigned int msg, uptr_t wParam = 0, sptr_t = 0) {
+		++calls;
+		return msg == SCI_GETRANGEPOINTER ? reinterpret_cast<sptr_t>(text.data() + wParam) : 0;
+	}
+
+	int CallString(unsigned int msg, uptr_t wParam, const char *s) {
+		return Call(msg, wParam, reinterpret_cast<sptr_t>(s));
+	}
+
+private:
+	const uint32_t update_us;
+	bool readonly;
+	size_t caret;
+	size_t first_visible;
+	std::vector<size_t> line_starts;
+	std::vector<char> margins; // First character of each line's margin text
+
+	// Cells holds the text too when given
+	void insert(size_t position, const char *s, size_t length, const char *cells) {
+		if (readonly) return;
+
+		std::string inserted(length, '\0');
+		std::string inserted_styles(length, '\0');
+		for (size_t i = 0; i < length; ++i) {
+			inserted[i] = cells ? cells[i * 2] : s[i];
+			inserted_styles[i] = cells ? cells[i * 2 + 1] : 0;
+		}
+		text.insert(position, inserted);
+		styles.insert(position, inserted_styles);
+
+		// The console only ever adds at the end, which keeps this simple.
+		// New lines start out without margin text, like in Scintilla.
+		const size_t lines = line_starts.size();
+		for (size_t i = 0; i < length; ++i) {
+			if (inserted[i] == '\n') line_starts.push_back(position + i + 1);
+		}
+		margins.resize(line_starts.size(), 0);
+
+		peak_bytes = std::max(peak_bytes, text.capacity() + styles.capacity() + line_starts.capacity() * sizeof(size_t));
+		++changes;
+		update();
+
+		if (modified) {
+			SCNotification scn = {};
+			scn.modificationType = SC_MOD_INSERTTEXT;
+			scn.position = position;
+			scn.length = length;
+			scn.linesAdded = line_starts.size() - lines;
+			modified(scn);
+		}
+	}
+
+	// Scrollback only ever takes whole lines off the front
+	void erase(size_t position, size_t length) {
+		if (readonly || position != 0) return;
+
+		text.erase(0, length);
+		styles.erase(0, length);
+
+		auto kept = std::upper_bound(line_starts.begin(), line_starts.end(), length) - 1;
+		margins.erase(margins.begin(), margins.begin() + (kept - line_starts.begin()));
+		line_starts.erase(line_starts.begin(), kept);
+		for (size_t &start : line_starts) start -= length;
+
+		caret = caret > length ? caret - length : 0;
+		++changes;
+		update();
+	}
+
+	void scroll() {
+		const size_t line = std::upper_bound(line_starts.begin(), line_starts.end(), caret) - line_starts.begin() - 1;
+		const size_t visible = 20;
+		first_visible = line >= visible ? line - visible + 1 : 0;
+
+		++scrolls;
+		update();
+	}
+
+	void update() {
+		if (update_us == 0) return;
+
+		Clock::time_point until = Clock::now() + std::chrono::microseconds(update_us);
+		while (Clock::now() < until) {}
+	}
+};
+
+// The way ConsoleDialog wrote to the pane before OutputSink
+static void writeText(Editor &sci, size_t length, const char *text) {
+	sci.Call(SCI_SETREADONLY, 0);
+	sci.CallString(SCI_APPENDTEXT, length, text);
+	sci.Call(SCI_SETREADONLY, 1);
+	sci.Call(SCI_DOCUMENTEND);
+}
+
+static void writeError(Editor &sci, size_t length, const char *text) {
+	typedef struct {
+		unsigned char c;
+		unsigned char style;
+	} cell;
+
+	std::vector<cell> cells(length + 1);
+
+	for (size_t i = 0; i < length; ++i) {
+		cells[i].c = text[i];
+		cells[i].style = 39;
+	}
+	cells[length].c = 0;
+	cells[length].style = 0;
+
+	sci.Call(SCI_SETREADONLY, 0);
+	sci.Call(SCI_DOCUMENTEND); // make sure it's at the end
+	sci.CallString(SCI_ADDSTYLEDTEXT, length * 2, (const char *)cells.data());
+	sci.Call(SCI_SETREADONLY, 1);
+	sci.Call(SCI_DOCUMENTEND);
+}
+
+// The way ConsoleDialog::flushOutput() writes to the pane
+static OutputSink::Append appendTo(Editor &sci, Scrollback &scrollback, Samples &append_us) {
+	return [&sci, &scrollback, &append_us](const char *cells, size_t length) {
+		Clock::time_point start = Clock::now();
+
+		sci.Call(SCI_SETREADONLY, 0);
+		sci.Call(SCI_SETEMPTYSELECTION, sci.Call(SCI_GETLENGTH));
+		sci.CallString(SCI_ADDSTYLEDTEXT, length, cells);
+		scrollback.trim(sci);
+		sci.Call(SCI_SETREADONLY, 1);
+		sci.Call(SCI_DOCUMENTEND);
+
+		append_us.us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+	};
+}
+
+static void setUp(Scrollback &scrollback, const Options &options) {
+	scrollback.setLimits(options.max_lines, options.max_bytes);
+	if (!options.log.empty()) scrollback.setLog(fopen(options.log.c_str(), "wb"));
+}
+
+static std::string makeLine(size_t index, size_t size) {
+	std::string line = std::to_string(index) + " ";
+	while (line.size() + 2 < size) line += static_cast<char>('a' + line.size() % 26);
+	return line + "\r\n";
+}
+
+static bool isError(size_t index, const Options &options) {
+	return options.every > 0 && index % options.every == options.every - 1;
+}
+
+// Hands every line to write(text, length, error) in the calls the device output would come in
+template <typename Write>
+static void produce(const Options &options, Write write) {
+	for (size_t i = 0; i < options.lines; ++i) {
+		const std::string line = makeLine(i, options.size);
+
+		if (isError(i, options)) {
+			for (char c : line) write(&c, 1, true);
+		}
+		else {
+			write(line.data(), line.size(), false);
+		}
+	}
+}
+
+struct Result {
+	double seconds = 0;
+	size_t calls = 0;
+	size_t changes = 0;
+	size_t scrolls = 0;
+	size_t peak_bytes = 0;
+	size_t final_bytes = 0;
+	bool intact = false;
+	Samples append_us;
+};
+
+// The pane has to end with the last lines produced, whole and with their styles
+static bool intact(const Editor &sci, const Options &options) {
+	size_t end = sci.text.size();
+
+	for (size_t i = options.lines; i-- > 0 && end > 0;) {
+		const std::string line = makeLine(i, options.size);
+		if (line.size() > end) return false;
+
+		end -= line.size();
+		if (sci.text.compare(end, line.size(), line) != 0) return false;
+		if (sci.styles.find_first_not_of(isError(i, options) ? '\x27' : '\0', end) < end + line.size()) return false;
+	}
+
+	return end == 0;
+}
+
+static Result finish(Editor &sci, Clock::time_point start, const Options &options) {
+	Result result;
+	result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	result.calls = sci.calls;
+	result.changes = sci.changes;
+	result.scrolls = sci.scrolls;
+	result.peak_bytes = sci.peak_bytes;
+	result.final_bytes = sci.text.size();
+	result.intact = intact(sci, options);
+	return result;
+}
+
+static Result direct(const Options &options) {
+	Editor sci(options.update_us);
+	Samples append_us;
+	Clock::time_point start = Clock::now();
+
+	produce(options, [&](const char *text, size_t length, bool error) {
+		Clock::time_point call = Clock::now();
+
+		if (error) writeError(sci, length, text);
+		else writeText(sci, length, text);
+
+		append_us.us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - call).count());
+	});
+
+	Result result = finish(sci, start, options);
+	result.append_us = std::move(append_us);
+	return result;
+}
+
+// The UI thread both writes and flushes, like ConsoleDialog does with the
+// completions it processes. Posted messages and the timer are polled.
+static Result sink(const Options &options) {
+	Editor sci(options.update_us);
+	OutputSink output;
+	Scrollback scrollback;
+	Samples append_us;
+	const OutputSink::Append append = appendTo(sci, scrollback, append_us);
+	setUp(scrollback, options);
+
+	bool posted = false;
+	Clock::time_point timer = Clock::time_point::max();
+	output.setNotify([&]() { posted = true; });
+
+	Clock::time_point start = Clock::now();
+
+	produce(options, [&](const char *text, size_t length, bool error) {
+		output.write(text, length, error ? 39 : 0);
+
+		if (posted || Clock::now() >= timer) {
+			posted = false;
+			uint32_t wait = output.flush(append);
+			timer = wait > 0 ? Clock::now() + std::chrono::milliseconds(wait) : Clock::time_point::max();
+		}
+	});
+	output.flush(append, true);
+
+	Result result = finish(sci, start, options);
+	result.append_us = std::move(append_us);
+	return result;
+}
+
+static Result sinkThread(const Options &options) {
+	Editor sci(options.update_us);
+	OutputSink output;
+	Scrollback scrollback;
+	Samples append_us;
+	const OutputSink::Append append = appendTo(sci, scrollback, append_us);
+	setUp(scrollback, options);
+
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	bool posted = false;
+	bool done = false;
+	output.setNotify([&]() {
+		std::lock_guard<std::mutex> lock(mutex);
+		posted = true;
+		wakeup.notify_one();
+	});
+
+	Clock::time_point start = Clock::now();
+
+	std::thread writer([&]() {
+		produce(options, [&](const char *text, size_t length, bool error) {
+			output.write(text, length, error ? 39 : 0);
+		});
+
+		std::lock_guard<std::mutex> lock(mutex);
+		done = true;
+		wakeup.notify_one();
+	});
+
+	Clock::time_point timer = Clock::time_point::max();
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!done) {
+		wakeup.wait_until(lock, std::min(timer, Clock::now() + std::chrono::milliseconds(100)), [&]() { return posted || done || Clock::now() >= timer; });
+		posted = false;
+		lock.unlock();
+
+		uint32_t wait = output.flush(append);
+		timer = wait > 0 ? Clock::now() + std::chrono::milliseconds(wait) : Clock::time_point::max();
+
+		lock.lock();
+	}
+	lock.unlock();
+
+	writer.join();
+	output.flush(append, true);
+
+	Result result = finish(sci, start, options);
+	result.append_us = std::move(append_us);
+	return result;
+}
+
+struct Paste {
+	double us = 0;
+	size_t calls = 0;
+	size_t resizes = 0;
+	bool prompted = false;
+};
+
+// How ConsoleDialog kept the input's prompt before PromptMargin
+static void modifiedBefore(Editor &sci, const SCNotification &scn, size_t &resizes) {
+	if ((scn.modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT))) {
+		if (scn.linesAdded != 0) ++resizes;
+
+		int endLine = sci.Call(SCI_GETLINECOUNT);
+		for (int i = 0; i < endLine; ++i) {
+			sci.CallString(SCI_MARGINSETTEXT, i, ">");
+			sci.Call(SCI_MARGINSETSTYLE, i, STYLE_LINENUMBER);
+		}
+	}
+}
+
+// And the way it does now
+static void modifiedAfter(Editor &sci, const SCNotification &scn, int &input_lines, size_t &resizes) {
+	if ((scn.modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT)) && scn.linesAdded != 0) {
+		if (std::min(sci.Call(SCI_GETLINECOUNT), 8) != input_lines) {
+			input_lines = std::min(sci.Call(SCI_GETLINECOUNT), 8);
+			++resizes;
+		}
+
+		UpdatePrompt(sci, &scn);
+	}
+}
+
+// Puts lines into the input pane, which first gets existing lines without
+// being timed. The block goes in with one insertion, or a line at a time.
+static Paste paste(const Options &options, bool before, size_t existing, bool typed) {
+	Editor sci(options.update_us);
+	Paste result;
+	int input_lines = 1;
+
+	MarkPrompt(sci, 0, 0);
+	sci.modified = [&](const SCNotification &scn) {
+		if (before) modifiedBefore(sci, scn, result.resizes);
+		else modifiedAfter(sci, scn, input_lines, result.resizes);
+	};
+
+	std::string block;
+	for (size_t i = 0; i < options.paste; ++i) block += "ez.Box(" + std::to_string(i) + ", 10, 1)\r\n";
+
+	for (size_t i = 0; i < existing; ++i) sci.CallString(SCI_ADDTEXT, 18, "ez.Cls(ez.Black)\r\n");
+	sci.calls = 0;
+	result.resizes = 0;
+
+	Clock::time_point start = Clock::now();
+
+	if (typed) {
+		for (size_t line = 0, end; line < block.size(); line = end) {
+			end = block.find('\n', line) + 1;
+			sci.CallString(SCI_ADDTEXT, end - line, block.data() + line);
+		}
+	}
+	else {
+		sci.CallString(SCI_ADDTEXT, block.size(), block.data());
+	}
+
+	result.us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+	result.calls = sci.calls;
+	result.prompted = sci.prompted();
+	return result;
+}
+
+static void printPaste(const char *name, const Options &options, size_t existing, bool typed) {
+	Paste before = paste(options, true, existing, typed);
+	Paste after = paste(options, false, existing, typed);
+
+	printf("  \"%s\": { \"lines\": %zu, \"existing_lines\": %zu, ", name, options.paste, existing);
+	printf("\"before_us\": %.1f, \"before_calls\": %zu, \"before_resizes\": %zu, ", before.us, before.calls, before.resizes);
+	printf("\"after_us\": %.1f, \"after_calls\": %zu, \"after_resizes\": %zu, ", after.us, after.calls, after.resizes);
+	printf("\"prompted\": %s },\n", before.prompted && after.prompted ? "true" : "false");
+}
+
+static void printResult(const char *name, Result &result, const Options &options, bool last) {
+	printf("  \"%s\": { \"seconds\": %.3f, \"lines_per_second\": %.0f, ", name, result.seconds, options.lines / result.seconds);
+	printf("\"editor_calls\": %zu, \"changes\": %zu, \"scrolls\": %zu, ", result.calls, result.changes, result.scrolls);
+	printf("\"appends\": %zu, \"append_p50_us\": %.1f, \"append_p99_us\": %.1f, \"append_max_us\": %.1f, ",
+		result.append_us.us.size(), result.append_us.percentile(50), result.append_us.percentile(99), result.append_us.percentile(100));
+	printf("\"peak_bytes\": %zu, \"final_bytes\": %zu, \"intact\": %s }%s\n",
+		result.peak_bytes, result.final_bytes, result.intact ? "true" : "false", last ? "" : ",");
+}
+
+static void usage() {
+	fprintf(stderr, "usage: consolebench [-n lines] [-s size] [-e every] [-r update_us] [-L lines] [-B bytes] [-o log] [-p lines] [-m runs]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	Options options;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:s:e:r:L:B:o:p:m:")) != -1) {
+		switch (opt) {
+			case 'n': options.lines = strtoul(optarg, nullptr, 10); break;
+			case 's': options.size = strtoul(optarg, nullptr, 10); break;
+			case 'e': options.every = strtoul(optarg, nullptr, 10); break;
+			case 'r': options.update_us = static_cast<uint32_t>(strtoul(optarg, nullptr, 10)); break;
+			case 'L': options.max_lines = strtoul(optarg, nullptr, 10); break;
+			case 'B': options.max_bytes = strtoul(optarg, nullptr, 10); break;
+			case 'o': options.log = optarg; break;
+			case 'p': options.paste = strtoul(optarg, nullptr, 10); break;
+			case 'm': options.runs = optarg; break;
+			default: usage();
+		}
+	}
+	if (optind != argc || options.lines == 0 || options.runs.find_first_not_of("dstp") != std::string::npos) usage();
+
+	printf("{\n");
+	printf("  \"lines\": %zu, \"line_bytes\": %zu, \"error_every\": %zu, \"update_us\": %u, \"max_lines\": %zu, \"max_bytes\": %zu,\n",
+		options.lines, std::max<size_t>(options.size, makeLine(options.lines - 1, options.size).size()), options.every, options.update_us,
+		options.max_lines, options.max_bytes);
+
+	// Each result is printed as soon as it is done, so the memory of one run is gone before the next
+	if (options.runs.find('d') != std::string::npos) {
+		Result result = direct(options);
+		printResult("direct", result, options, false);
+	}
+	if (options.runs.find('s') != std::string::npos) {
+		Result result = sink(options);
+		printResult("sink", result, options, false);
+	}
+	if (options.runs.find('t') != std::string::npos) {
+		Result result = sinkThread(options);
+		printResult("sink_thread", result, options, false);
+	}
+
+	if (options.runs.find('p') != std::string::npos) {
+		printPaste("paste", options, 0, false);
+		printPaste("paste_into", options, options.paste, false);
+		printPaste("typed", options, 0, true);
+	}
+
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("  \"max_rss_kb\": %ld\n", usage.ru_maxrss);
+	printf("}\n");
+
+	return 0;
+}
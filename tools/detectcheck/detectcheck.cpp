@@ -0,0 +1,396 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// detectcheck - checks port listing and board detection on Linux.
+//
+// Builds a fake /sys and /dev tree in a temporary directory and points
+// serial::list_ports() at it with SERIAL_LIST_PORTS_ROOT. The tree has
+// three USB adapters, a PNP port, a phantom 8250 port and a virtual
+// terminal. Behind the adapters are a pty that echoes everything, the
+// board (normally the simulator in tools/ezlcdsim) and a pty that never
+// answers. Every check prints what it got next to what it should have been
+// as JSON, and the exit status is 1 if any of them is off.
+//
+//   list        What list_ports() reports for each port, and the ones it
+//               leaves out
+//   detect      detectPort() finding the board and remembering its ID
+//   remembered  A new session with only the ID finding the board
+//   replug      The board coming back as another tty in between statements
+//   absent      detectPort() giving up in time once the board is gone
+//
+// Build (Linux, uses the POSIX serial backend):
+//
+//   g++ -std=c++14 -O2 -I../../src detectcheck.cpp ../../src/DeviceSession.cpp ../../src/serial/serial.cc ../../src/serial/impl/unix.cc ../../src/serial/impl/list_ports/list_ports_linux.cc -pthread -o detectcheck
+//
+// Usage:
+//
+//   ezlcdsim -l /tmp/ttyEZLCD &
+//   detectcheck /tmp/ttyEZLCD > results.json
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DeviceSession.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// Longest detectPort() may take, DETECT_TIMEOUT_MS plus a margin
+#define DETECT_LIMIT_MS 2100
+
+static double elapsedMs(Clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// A pty standing in for a device that isn't the board. It either sends
+// everything straight back or says nothing at all.
+class Pty {
+public:
+	explicit Pty(bool echo) : echo(echo), master(-1), slave(-1), quit(false) {}
+
+	~Pty() {
+		quit = true;
+		if (thread.joinable()) thread.join();
+		if (slave >= 0) close(slave);
+		if (master >= 0) close(master);
+	}
+
+	std::string open() {
+		master = posix_openpt(O_RDWR | O_NOCTTY);
+		if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) return std::string();
+
+		const std::string name = ptsname(master);
+
+		// Keep the slave open so the master doesn't see EIO in between probes
+		slave = ::open(name.c_str(), O_RDWR | O_NOCTTY);
+		termios tio;
+		tcgetattr(slave, &tio);
+		cfmakeraw(&tio);
+		tcsetattr(slave, TCSANOW, &tio);
+
+		thread = std::thread(&Pty::run, this);
+		return name;
+	}
+
+private:
+	bool echo;
+	int master;
+	int slave;
+	std::atomic<bool> quit;
+	std::thread thread;
+
+	void run() {
+		char buffer[4096];
+
+		while (!quit) {
+			pollfd pfd = { master, POLLIN, 0 };
+			if (poll(&pfd, 1, 50) <= 0) continue;
+
+			ssize_t count = read(master, buffer, sizeof(buffer));
+			if (!echo) continue;
+
+			for (ssize_t done = 0; done < count;) {
+				ssize_t written = write(master, buffer + done, count - done);
+				if (written > 0) done += written;
+				else if (errno != EAGAIN && errno != EINTR) return;
+			}
+		}
+	}
+};
+
+// The fake /sys and /dev tree
+class Tree {
+public:
+	std::string open() {
+		char path[] = "/tmp/detectcheck.XXXXXX";
+		if (mkdtemp(path) == nullptr) return std::string();
+		root = path;
+
+		makeDirs("/dev");
+		makeDirs("/sys/class/tty");
+		makeDirs("/sys/bus/usb-serial");
+		makeDirs("/sys/bus/platform");
+		makeDirs("/sys/bus/pnp");
+
+		return root;
+	}
+
+	~Tree() {
+		if (root.empty()) return;
+
+		nftw(root.c_str(), [](const char *path, const struct stat *, int, FTW *) { return ::remove(path); }, 16, FTW_DEPTH | FTW_PHYS);
+	}
+
+	// A USB adapter plugged into hub port bus_port, with the tty behind it
+	// linked to target in /dev
+	void addUsb(const std::string &tty, const std::string &bus_port, const char *vid, const char *pid, const char *serial,
+		const char *manufacturer, const char *product, const std::string &target) {
+		const std::string usb = "/sys/devices/pci0000:00/usb1/" + bus_port;
+		const std::string device = usb + "/" + bus_port + ":1.0/" + tty;
+
+		makeDirs(device);
+		writeLine(usb + "/idVendor", vid);
+		writeLine(usb + "/idProduct", pid);
+		writeLine(usb + "/manufacturer", manufacturer);
+		writeLine(usb + "/product", product);
+		if (serial[0] != '\0') writeLine(usb + "/serial", serial);
+		linkTo(device + "/subsystem", "/sys/bus/usb-serial");
+
+		addClass(tty, device);
+		linkTo("/dev/" + tty, target);
+	}
+
+	// A tty whose device is on the given bus, e.g. platform for the 8250
+	// ports the kernel always registers
+	void addBus(const std::string &tty, const std::string &device, const std::string &bus) {
+		makeDirs(device);
+		linkTo(device + "/subsystem", "/sys/bus/" + bus);
+		addClass(tty, device);
+	}
+
+	// A tty without a device, like a virtual terminal
+	void addVirtual(const std::string &tty) {
+		makeDirs("/sys/class/tty/" + tty);
+	}
+
+	void unplug(const std::string &tty) {
+		unlink((root + "/dev/" + tty).c_str());
+		unlink((root + "/sys/class/tty/" + tty + "/device").c_str());
+		rmdir((root + "/sys/class/tty/" + tty).c_str());
+	}
+
+	void writeLine(const std::string &path, const char *text) {
+		std::ofstream file(root + path);
+		file << text << "\n";
+	}
+
+private:
+	std::string root;
+
+	void makeDirs(const std::string &path) {
+		size_t start = 1;
+
+		while (start <= path.size()) {
+			size_t slash = path.find('/', start);
+			if (slash == std::string::npos) slash = path.size();
+
+			mkdir((root + path.substr(0, slash)).c_str(), 0755);
+			start = slash + 1;
+		}
+	}
+
+	void addClass(const std::string &tty, const std::string &device) {
+		makeDirs("/sys/class/tty/" + tty);
+		linkTo("/sys/class/tty/" + tty + "/device", device);
+	}
+
+	// Targets in the tree are given from the root, the rest as they are
+	void linkTo(const std::string &path, const std::string &target) {
+		const std::string full = target.compare(0, 5, "/sys/") == 0 ? root + target : target;
+		symlink(full.c_str(), (root + path).c_str());
+	}
+};
+
+// Collects the checks of a section and prints them as JSON
+class Report {
+public:
+	explicit Report(const char *section) : first(true), ok(true) {
+		printf("  \"%s\": [\n", section);
+	}
+
+	void text(const char *check, const std::string &got, const std::string &expect) {
+		const bool passed = got == expect;
+		line(passed, "{ \"check\": \"%s\", \"got\": \"%s\", \"expect\": \"%s\", \"ok\": %s }",
+			check, got.c_str(), expect.c_str(), passed ? "true" : "false");
+	}
+
+	// Something that has to be done within limit_ms
+	void within(const char *check, bool done, double ms, double limit_ms) {
+		const bool passed = done && ms <= limit_ms;
+		line(passed, "{ \"check\": \"%s\", \"done\": %s, \"ms\": %.1f, \"limit_ms\": %.1f, \"ok\": %s }",
+			check, done ? "true" : "false", ms, limit_ms, passed ? "true" : "false");
+	}
+
+	// Returns whether every check passed
+	bool end(bool last) {
+		printf("\n  ]%s\n", last ? "" : ",");
+		return ok;
+	}
+
+private:
+	bool first;
+	bool ok;
+
+	template <typename... Args>
+	void line(bool passed, const char *format, Args... args) {
+		printf("%s    ", first ? "" : ",\n");
+		printf(format, args...);
+		first = false;
+		ok = ok && passed;
+	}
+};
+
+#define BOARD_ID "USB VID:PID=0403:6015 SNR=EZ123"
+
+static bool list(const std::string &root, bool last) {
+	Report report("list");
+
+	std::string ports;
+	for (const serial::PortInfo &info : serial::list_ports()) {
+		ports += info.port.substr(root.size()) + " = " + info.description + " = " + info.hardware_id + "; ";
+	}
+
+	// Sorted by port, without the 8250 port or the virtual terminal
+	report.text("ports", ports,
+		"/dev/ttyS1 = ttyS1 = PNP0501; "
+		"/dev/ttyUSB0 = FTDI FT232R USB UART = USB VID:PID=0403:6001 SNR=A601XYZ; "
+		"/dev/ttyUSB1 = EarthLCD ezLCD-5035 = " BOARD_ID "; "
+		"/dev/ttyUSB2 = Prolific USB-Serial Controller = USB VID:PID=067b:2303; ");
+
+	return report.end(last);
+}
+
+static bool detect(const std::string &root, std::string &id, bool last) {
+	Report report("detect");
+
+	DeviceSession session;
+	Clock::time_point start = Clock::now();
+	const bool found = session.detectPort();
+	report.within("detect_port", found, elapsedMs(start), DETECT_LIMIT_MS);
+	report.text("port", session.getPort().substr(std::min(root.size(), session.getPort().size())), "/dev/ttyUSB1");
+	report.text("device_id", session.getDeviceId(), BOARD_ID);
+
+	std::string message;
+	report.text("run", session.runLua("x = 1", message) == DeviceSession::Result::Ok ? "ok" : "failed", "ok");
+
+	id = session.getDeviceId();
+	return report.end(last);
+}
+
+static bool remembered(const std::string &root, const std::string &id, bool last) {
+	Report report("remembered");
+
+	// No port at all, only the ID from last time
+	DeviceSession session;
+	session.setDeviceId(id);
+
+	std::string message;
+	Clock::time_point start = Clock::now();
+	const bool ran = session.runLua("x = 2", message) == DeviceSession::Result::Ok;
+	report.within("run", ran, elapsedMs(start), DETECT_LIMIT_MS);
+	report.text("port", session.getPort().substr(std::min(root.size(), session.getPort().size())), "/dev/ttyUSB1");
+
+	return report.end(last);
+}
+
+static bool replug(Tree &tree, const std::string &root, const std::string &board, bool last) {
+	Report report("replug");
+
+	DeviceSession session;
+	session.detectPort();
+
+	std::string message;
+	session.runLua("x = 3", message);
+	session.close();
+
+	// Unplugged and plugged into another hub port, now as ttyUSB3
+	tree.unplug("ttyUSB1");
+	tree.addUsb("ttyUSB3", "1-4", "0403", "6015", "EZ123", "EarthLCD", "ezLCD-5035", board);
+
+	Clock::time_point start = Clock::now();
+	const bool ran = session.runLua("x = 4", message) == DeviceSession::Result::Ok;
+	report.within("run_after_replug", ran, elapsedMs(start), DETECT_LIMIT_MS);
+	report.text("port", session.getPort().substr(std::min(root.size(), session.getPort().size())), "/dev/ttyUSB3");
+
+	return report.end(last);
+}
+
+static bool absent(Tree &tree, bool last) {
+	Report report("absent");
+
+	tree.unplug("ttyUSB3");
+
+	// Only the echo and the silent pty are left
+	DeviceSession session;
+	Clock::time_point start = Clock::now();
+	const bool found = session.detectPort();
+	report.within("gives_up", !found, elapsedMs(start), DETECT_LIMIT_MS);
+
+	return report.end(last);
+}
+
+static void usage() {
+	fprintf(stderr, "usage: detectcheck port\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 2) usage();
+	const std::string board = argv[1];
+
+	Pty echo(true);
+	Pty silent(false);
+	const std::string echo_name = echo.open();
+	const std::string silent_name = silent.open();
+
+	Tree tree;
+	const std::string root = tree.open();
+
+	if (echo_name.empty() || silent_name.empty() || root.empty()) {
+		perror("detectcheck");
+		return 1;
+	}
+
+	tree.addUsb("ttyUSB0", "1-1", "0403", "6001", "A601XYZ", "FTDI", "FT232R USB UART", echo_name);
+	tree.addUsb("ttyUSB1", "1-2", "0403", "6015", "EZ123", "EarthLCD", "ezLCD-5035", board);
+	tree.addUsb("ttyUSB2", "1-3", "067b", "2303", "", "Prolific", "USB-Serial Controller", silent_name);
+	tree.addBus("ttyS0", "/sys/devices/platform/serial8250", "platform");
+	tree.addBus("ttyS1", "/sys/devices/pnp0/00:01", "pnp");
+	tree.writeLine("/sys/devices/pnp0/00:01/id", "PNP0501");
+	tree.addVirtual("tty0");
+
+	setenv("SERIAL_LIST_PORTS_ROOT", root.c_str(), 1);
+
+	bool ok = true;
+	std::string id;
+
+	printf("{\n");
+	printf("  \"board\": \"%s\",\n", board.c_str());
+
+	ok = list(root, false) && ok;
+	ok = detect(root, id, false) && ok;
+	ok = remembered(root, id, false) && ok;
+	ok = replug(tree, root, board, false) && ok;
+	ok = absent(tree, true) && ok;
+
+	printf("}\n");
+
+	return ok ? 0 : 1;
+}
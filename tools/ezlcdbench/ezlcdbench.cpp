@@ -0,0 +1,519 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// ezlcdbench - measures the console protocol path end to end.
+//
+// Drives the same DeviceSession and CommandQueue the plugin uses against a
+// device on the given port, normally the simulator in tools/ezlcdsim, and
+// prints the results as JSON so they can be compared between releases.
+//
+//   round_trip  Latency of a tiny statement, one at a time
+//   reopen      The same with the port opened and closed around each one,
+//               the way statements were sent before the session kept it
+//               open
+//   pipelined   Tiny statements sent as one batch, the way the console sends
+//               several lines of input, with windows of 1, 4 and 16
+//   idle        Latency of a tiny statement submitted to a CommandQueue that
+//               has been listening to the device in between
+//   upload      Throughput of scripts from 1 KB to 1 MB at each of the
+//               rates, with and without RTS/CTS
+//   cached      Bytes sent and time to the reply for a script uploaded as
+//               source, run through the device's chunk cache the first
+//               time, and run again from the cache
+//   error       Latency and throughput of statements failing with long
+//               messages, read in bulk by the session and one byte per read
+//               call the way the message was read before
+//   catalog     Reading the board's API for autocompletion, from the board
+//               and then from the cache, and again after the firmware
+//               version changes
+//
+// Build (Linux, uses the POSIX serial backend):
+//
+//   g++ -std=c++14 -O2 -I../../src ezlcdbench.cpp ../../src/DeviceSession.cpp ../../src/CommandQueue.cpp ../../src/ApiCache.cpp ../../src/ApiCatalog.cpp ../../src/serial/serial.cc ../../src/serial/impl/unix.cc ../../src/serial/impl/list_ports/list_ports_linux.cc -pthread -o ezlcdbench
+//
+// Usage:
+//
+//   ezlcdsim -l /tmp/ttyEZLCD -f &
+//   ezlcdbench [-b baud] [-n iterations] [-r rate,...] /tmp/ttyEZLCD > results.json
+//
+// -b is the rate for everything but the upload, which goes through the rates
+// given with -r (default: 115200,230400,460800,921600). The simulator only
+// runs at the rate the port is set to with -f.
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ApiCache.h"
+#include "DeviceSession.h"
+#include "CommandQueue.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Samples {
+	std::vector<double> us;
+	size_t failures = 0;
+
+	double percentile(double p) const {
+		if (us.empty()) return 0;
+
+		std::vector<double> sorted(us);
+		std::sort(sorted.begin(), sorted.end());
+
+		// Nearest rank
+		size_t rank = static_cast<size_t>(p / 100.0 * sorted.size() + 0.5);
+		return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+	}
+};
+
+static double elapsedUs(Clock::time_point start) {
+	return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+static void printSamples(const Samples &samples) {
+	printf("\"samples\": %zu, \"failures\": %zu, \"p50_us\": %.1f, \"p99_us\": %.1f",
+		samples.us.size(), samples.failures, samples.percentile(50), samples.percentile(99));
+}
+
+// Valid Lua that is exactly size bytes long
+static std::string makeScript(size_t size) {
+	static const std::string line = "ez.SetXY(12, 34) ez.Box(56, 78, 1)\n";
+
+	std::string script;
+	script.reserve(size);
+	while (script.size() + line.size() <= size) script += line;
+
+	// Pad with a comment, or a space if there is no room for one
+	const size_t padding = size - script.size();
+	if (padding >= 2) script.append("--").append(padding - 2, '-');
+	else script.append(padding, ' ');
+
+	return script;
+}
+
+static Samples roundTrip(DeviceSession &session, size_t iterations) {
+	Samples samples;
+	std::string message;
+
+	for (size_t i = 0; i < iterations; ++i) {
+		Clock::time_point start = Clock::now();
+		DeviceSession::Result result = session.runLua("x=1", message);
+
+		if (result == DeviceSession::Result::Ok) samples.us.push_back(elapsedUs(start));
+		else ++samples.failures;
+	}
+
+	return samples;
+}
+
+// Open, write the command, read the status byte, close
+static Samples reopen(const std::string &port, uint32_t baudrate, size_t iterations) {
+	Samples samples;
+	const uint8_t command[] = { RUN_LUA, 'x', '=', '1', 0 };
+
+	for (size_t i = 0; i < iterations; ++i) {
+		Clock::time_point start = Clock::now();
+		bool ok = false;
+
+		try {
+			serial::Serial serial(port, baudrate, serial::Timeout::simpleTimeout(1000));
+			serial.write(command, sizeof(command));
+
+			uint8_t status = 0;
+			ok = serial.read(&status, 1) == 1 && status == RUN_LUA_OK;
+		}
+		catch (std::exception &) {
+		}
+
+		if (ok) samples.us.push_back(elapsedUs(start));
+		else ++samples.failures;
+	}
+
+	return samples;
+}
+
+// Total time for iterations statements with up to window of them in flight
+static double pipelined(DeviceSession &session, size_t iterations, size_t window, size_t &failures) {
+	std::mutex mutex;
+	std::condition_variable done;
+
+	CommandQueue queue(session);
+	queue.setWindow(window);
+	queue.setNotify([&]() {
+		std::lock_guard<std::mutex> lock(mutex);
+		done.notify_one();
+	});
+
+	Clock::time_point start = Clock::now();
+
+	queue.submitBatch(std::vector<std::string>(iterations, "x=1"));
+
+	failures = 0;
+	size_t completed = 0;
+	Completion completion;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (completed < iterations) {
+		while (queue.takeCompletion(completion)) {
+			if (completion.status != Completion::Status::Ok) ++failures;
+			++completed;
+		}
+		if (completed < iterations) done.wait_for(lock, std::chrono::milliseconds(10));
+	}
+	lock.unlock();
+
+	// The queue closes the session once it goes away, the next run reopens it
+	return elapsedUs(start);
+}
+
+// Each statement goes to a queue that has been idle for IDLE_MS
+#define IDLE_MS 50
+
+static Samples idle(DeviceSession &session, size_t iterations) {
+	std::mutex mutex;
+	std::condition_variable done;
+	Samples samples;
+
+	CommandQueue queue(session);
+	queue.setNotify([&]() {
+		std::lock_guard<std::mutex> lock(mutex);
+		done.notify_one();
+	});
+
+	for (size_t i = 0; i < iterations; ++i) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_MS));
+
+		Clock::time_point start = Clock::now();
+		queue.submit("x=1");
+
+		Completion completion;
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!queue.takeCompletion(completion)) done.wait_for(lock, std::chrono::milliseconds(10));
+
+		if (completion.status == Completion::Status::Ok) samples.us.push_back(elapsedUs(start));
+		else ++samples.failures;
+	}
+
+	return samples;
+}
+
+static Samples upload(DeviceSession &session, const std::string &script, size_t repeat) {
+	Samples samples;
+	std::string message;
+
+	for (size_t i = 0; i < repeat; ++i) {
+		Clock::time_point start = Clock::now();
+		DeviceSession::Result result = session.runLua(script, message);
+
+		if (result == DeviceSession::Result::Ok) samples.us.push_back(elapsedUs(start));
+		else ++samples.failures;
+	}
+
+	return samples;
+}
+
+// A run of each kind and the bytes the last one sent
+struct CachedRuns {
+	Samples source;
+	Samples cold;
+	Samples cached;
+	uint64_t source_bytes = 0;
+	uint64_t cold_bytes = 0;
+	uint64_t cached_bytes = 0;
+};
+
+static void timeRun(DeviceSession &session, const std::string &script, bool use_cache, bool expect_cached, Samples &samples, uint64_t &bytes) {
+	std::string message;
+	bool cached = false;
+
+	const uint64_t before = session.bytesSent();
+	Clock::time_point start = Clock::now();
+	const DeviceSession::Result result = use_cache ? session.runCached(script, message, cached) : session.runLua(script, message);
+	const double us = elapsedUs(start);
+	bytes = session.bytesSent() - before;
+
+	if (result == DeviceSession::Result::Ok && cached == expect_cached) samples.us.push_back(us);
+	else ++samples.failures;
+}
+
+static CachedRuns cachedRuns(DeviceSession &session, size_t size, size_t repeat) {
+	CachedRuns runs;
+
+	for (size_t i = 0; i < repeat; ++i) {
+		// Different every time so the first run through the cache misses
+		const std::string script = makeScript(size) + "-- " + std::to_string(size) + "." + std::to_string(i) + "\n";
+
+		timeRun(session, script, false, false, runs.source, runs.source_bytes);
+		timeRun(session, script, true, false, runs.cold, runs.cold_bytes);
+		timeRun(session, script, true, true, runs.cached, runs.cached_bytes);
+	}
+
+	return runs;
+}
+
+static void printCachedRun(const char *name, const Samples &samples, uint64_t bytes, bool last) {
+	printf("\"%s\": { ", name);
+	printSamples(samples);
+	printf(", \"bytes_sent\": %llu }%s", static_cast<unsigned long long>(bytes), last ? "" : ",\n      ");
+}
+
+static Samples errors(DeviceSession &session, size_t length, size_t iterations) {
+	Samples samples;
+	const std::string expected(length, 'e');
+	const std::string source = "error(\"" + expected + "\", 0)";
+	std::string message;
+
+	for (size_t i = 0; i < iterations; ++i) {
+		Clock::time_point start = Clock::now();
+		DeviceSession::Result result = session.runLua(source, message);
+
+		if (result == DeviceSession::Result::LuaError && message == expected) samples.us.push_back(elapsedUs(start));
+		else ++samples.failures;
+	}
+
+	return samples;
+}
+
+// Sends the statement and reads the message one byte per read call until
+// the NUL, with the port opened once for all of them
+static Samples errorsBytewise(const std::string &port, uint32_t baudrate, size_t length, size_t iterations) {
+	Samples samples;
+	const std::string expected(length, 'e');
+	const std::string source = "error(\"" + expected + "\", 0)";
+
+	const std::string command = static_cast<char>(RUN_LUA) + source + '\0';
+
+	serial::Serial serial(port, baudrate, serial::Timeout::simpleTimeout(1000));
+
+	for (size_t i = 0; i < iterations; ++i) {
+		Clock::time_point start = Clock::now();
+		serial.write(command);
+
+		uint8_t status = 0;
+		bool ok = serial.read(&status, 1) == 1 && status == RUN_LUA_ERROR;
+
+		std::string message;
+		uint8_t c = 0;
+		while (ok && serial.read(&c, 1) == 1 && c != 0) message += static_cast<char>(c);
+
+		if (ok && c == 0 && message == expected) samples.us.push_back(elapsedUs(start));
+		else ++samples.failures;
+	}
+
+	return samples;
+}
+
+static double bytesPerSecond(size_t bytes, const Samples &samples) {
+	const double median = samples.percentile(50);
+	return median > 0 ? bytes / (median / 1e6) : 0.0;
+}
+
+struct CatalogRun {
+	double us = 0;
+	bool ok = false;
+	bool cached = false;
+	size_t names = 0;
+	std::string file;
+};
+
+static CatalogRun fetchCatalog(DeviceSession &session, const ApiCache &cache) {
+	CatalogRun run;
+	std::string listing;
+
+	Clock::time_point start = Clock::now();
+	run.ok = cache.fetch(session, listing, run.cached) == DeviceSession::Result::Ok;
+	if (run.ok) {
+		ApiCatalog catalog;
+		run.names = ApiCache::addTo(catalog, listing);
+	}
+	run.us = elapsedUs(start);
+
+	if (run.ok) run.file = cache.path(listing.substr(0, listing.find('\n')));
+
+	return run;
+}
+
+static void printCatalogRun(const char *name, const CatalogRun &run, bool last) {
+	printf("    \"%s\": { \"ok\": %s, \"cached\": %s, \"names\": %zu, \"us\": %.1f }%s\n",
+		name, run.ok ? "true" : "false", run.cached ? "true" : "false", run.names, run.us, last ? "" : ",");
+}
+
+// A comma separated list of baud rates
+static std::vector<uint32_t> parseRates(const char *text) {
+	std::vector<uint32_t> rates;
+	char *end;
+
+	while (*text != '\0') {
+		const unsigned long rate = strtoul(text, &end, 10);
+		if (end == text || rate == 0 || (*end != ',' && *end != '\0')) return std::vector<uint32_t>();
+
+		rates.push_back(static_cast<uint32_t>(rate));
+		text = *end == ',' ? end + 1 : end;
+	}
+
+	return rates;
+}
+
+static void usage() {
+	fprintf(stderr, "usage: ezlcdbench [-b baud] [-n iterations] [-r rate,...] port\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t baudrate = 115200;
+	size_t iterations = 1000;
+	std::vector<uint32_t> rates = { 115200, 230400, 460800, 921600 };
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:n:r:")) != -1) {
+		switch (opt) {
+			case 'b': baudrate = static_cast<uint32_t>(strtoul(optarg, nullptr, 10)); break;
+			case 'n': iterations = strtoul(optarg, nullptr, 10); break;
+			case 'r': rates = parseRates(optarg); break;
+			default: usage();
+		}
+	}
+	if (optind != argc - 1 || iterations == 0 || rates.empty()) usage();
+
+	DeviceSession session;
+	session.setPort(argv[optind]);
+	session.setBaudrate(baudrate);
+
+	try {
+		// Opens the port so the first sample doesn't pay for it
+		std::string message;
+		session.runLua("", message);
+
+		printf("{\n");
+		printf("  \"port\": \"%s\", \"baudrate\": %u, \"iterations\": %zu,\n", argv[optind], baudrate, iterations);
+
+		printf("  \"round_trip\": { ");
+		printSamples(roundTrip(session, iterations));
+		printf(" },\n");
+
+		// The session's port would be open next to the one being opened
+		session.close();
+		printf("  \"reopen\": { ");
+		printSamples(reopen(argv[optind], baudrate, iterations));
+		printf(" },\n");
+
+		printf("  \"pipelined\": [\n");
+		const size_t windows[] = { 1, 4, 16 };
+		for (size_t i = 0; i < sizeof(windows) / sizeof(windows[0]); ++i) {
+			size_t failures;
+			const double us = pipelined(session, iterations, windows[i], failures);
+			printf("    { \"window\": %zu, \"statements\": %zu, \"failures\": %zu, \"statements_per_second\": %.1f }%s\n",
+				windows[i], iterations, failures, iterations / (us / 1e6), i + 1 < sizeof(windows) / sizeof(windows[0]) ? "," : "");
+		}
+		printf("  ],\n");
+
+		printf("  \"idle\": { \"idle_ms\": %d, ", IDLE_MS);
+		printSamples(idle(session, std::max<size_t>(iterations / 10, 1)));
+		printf(" },\n");
+
+		printf("  \"upload\": [\n");
+		const size_t sizes[] = { 1 << 10, 4 << 10, 16 << 10, 64 << 10, 256 << 10, 1 << 20 };
+		for (size_t r = 0; r < rates.size() * 2; ++r) {
+			const bool rtscts = r % 2 != 0;
+			session.setBaudrate(rates[r / 2]);
+			session.setFlowcontrol(rtscts ? serial::flowcontrol_hardware : serial::flowcontrol_none);
+
+			printf("    { \"baudrate\": %u, \"rtscts\": %s, \"sizes\": [\n", rates[r / 2], rtscts ? "true" : "false");
+			for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+				const size_t size = sizes[i];
+				const Samples samples = upload(session, makeScript(size), size >= (256 << 10) ? 3 : 10);
+
+				printf("      { \"bytes\": %zu, ", size);
+				printSamples(samples);
+				printf(", \"bytes_per_second\": %.1f }%s\n", bytesPerSecond(size, samples), i + 1 < sizeof(sizes) / sizeof(sizes[0]) ? "," : "");
+			}
+			printf("    ] }%s\n", r + 1 < rates.size() * 2 ? "," : "");
+		}
+		printf("  ],\n");
+
+		session.setBaudrate(baudrate);
+		session.setFlowcontrol(serial::flowcontrol_none);
+
+		printf("  \"cached\": [\n");
+		const size_t cached_sizes[] = { 1 << 10, 16 << 10, 64 << 10 };
+		for (size_t i = 0; i < sizeof(cached_sizes) / sizeof(cached_sizes[0]); ++i) {
+			const CachedRuns runs = cachedRuns(session, cached_sizes[i], 3);
+
+			printf("    { \"bytes\": %zu,\n      ", cached_sizes[i]);
+			printCachedRun("source", runs.source, runs.source_bytes, false);
+			printCachedRun("cold", runs.cold, runs.cold_bytes, false);
+			printCachedRun("cached", runs.cached, runs.cached_bytes, true);
+			printf(" }%s\n", i + 1 < sizeof(cached_sizes) / sizeof(cached_sizes[0]) ? "," : "");
+		}
+		printf("  ],\n");
+
+		printf("  \"error\": [\n");
+		const size_t lengths[] = { 16, 256, 4096 };
+		for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+			const size_t repeat = std::max<size_t>(iterations / 10, 1);
+			const Samples bulk = errors(session, lengths[i], repeat);
+
+			// The session reopens its port on the next statement
+			session.close();
+			const Samples bytewise = errorsBytewise(argv[optind], baudrate, lengths[i], repeat);
+
+			printf("    { \"message_bytes\": %zu,\n      \"bulk\": { ", lengths[i]);
+			printSamples(bulk);
+			printf(", \"bytes_per_second\": %.1f },\n      \"bytewise\": { ", bytesPerSecond(lengths[i], bulk));
+			printSamples(bytewise);
+			printf(", \"bytes_per_second\": %.1f } }%s\n", bytesPerSecond(lengths[i], bytewise), i + 1 < sizeof(lengths) / sizeof(lengths[0]) ? "," : "");
+		}
+		printf("  ],\n");
+
+		// Starts out with nothing cached
+		char directory[] = "/tmp/ezlcdbench.XXXXXX";
+		if (!mkdtemp(directory)) throw std::runtime_error("can't make a directory for the API cache");
+		const ApiCache cache(directory);
+
+		printf("  \"catalog\": {\n");
+		const CatalogRun cold = fetchCatalog(session, cache);
+		printCatalogRun("cold", cold, false);
+		printCatalogRun("warm", fetchCatalog(session, cache), false);
+
+		// Looks like a firmware update to the cache
+		session.runLua("ez.FirmVer = ez.FirmVer .. \"-updated\"", message);
+		const CatalogRun updated = fetchCatalog(session, cache);
+		printCatalogRun("updated", updated, true);
+		printf("  }\n");
+
+		remove(cold.file.c_str());
+		remove(updated.file.c_str());
+		rmdir(directory);
+		printf("}\n");
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "ezlcdbench: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
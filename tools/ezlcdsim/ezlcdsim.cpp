@@ -0,0 +1,630 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// ezlcdsim - stands in for an ezLCD controller board on a Linux box.
+//
+// It opens a pseudo terminal and answers RUN_LUA commands on it exactly like
+// the board does: "0xA7 <source> 0x00" is executed in an embedded Lua, then
+// either RUN_LUA_OK or RUN_LUA_ERROR followed by the NUL terminated message is
+// sent back. The global ez table holds a stub for every name the plugin knows
+// about (see EzApi.cpp).
+//
+// Like on the board, print() goes out on the link, and ez.Timer(ms, function)
+// keeps calling the function every ms in between commands until
+// ez.TimerStop(). An error in the timer is sent framed like a RUN_LUA_ERROR
+// reply that nothing asked for.
+//
+// Build (needs the Lua development package, e.g. liblua5.3-dev):
+//
+//   g++ -std=c++14 -O2 -I../../src $(pkg-config --cflags lua5.3) ezlcdsim.cpp ../../src/EzApi.cpp $(pkg-config --libs lua5.3) -pthread -o ezlcdsim
+//
+// Usage:
+//
+//   ezlcdsim [-l link] [-b baud] [-f] [-c us_per_byte] [-q bytes] [-d us] [-v]
+//
+//   -l  Also make the pty available as link (e.g. /tmp/ttyEZLCD)
+//   -b  Emulated link speed in bits per second (default: unlimited)
+//   -f  Emulate whatever speed the host sets on the port instead of -b
+//   -c  Time the board spends per received byte of source, in microseconds
+//   -q  Size of the board's receive buffer. The board then takes source in
+//       while it arrives, and bytes it can't keep up with are lost unless
+//       the host turned on RTS/CTS, which holds the host back instead.
+//   -d  Delay before whatever the board sends reaches the host, in
+//       microseconds, like the latency timer of a USB serial adapter
+//   -v  Log every command
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <lua.hpp>
+
+#include "DeviceSession.h"
+#include "EzApi.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+	const char *link = nullptr;
+	unsigned long baud = 0;
+	bool follow_host = false;
+	double byte_cost_us = 0;
+	size_t receive_buffer = 0;
+	double latency_us = 0;
+	bool verbose = false;
+};
+
+static volatile sig_atomic_t quit = 0;
+
+// What the board sends goes out in pieces of this size at the emulated link
+// speed, about what a USB serial adapter passes on at a time
+#define LINK_PIECE 64
+
+// Where everything the board says goes, at the emulated link speed
+static int host = -1;
+static const Options *host_options = nullptr;
+static Clock::time_point link_free;
+
+// With a latency, what the board sent waits here until it is due at the host
+static std::mutex delayed_mutex;
+static std::condition_variable delayed_ready;
+static std::deque<std::pair<Clock::time_point, std::string>> delayed;
+static bool delayed_stop = false;
+
+// The one timer, LUA_NOREF when it isn't running
+static int timer_function = LUA_NOREF;
+static Clock::duration timer_period;
+static Clock::time_point timer_due;
+
+static void onSignal(int) {
+	quit = 1;
+}
+
+// The speed the host last set on the port, 0 if it isn't one of these
+static unsigned long hostBaud() {
+	static const struct { speed_t speed; unsigned long baud; } speeds[] = {
+		{ B9600, 9600 },
+		{ B19200, 19200 },
+		{ B38400, 38400 },
+		{ B57600, 57600 },
+		{ B115200, 115200 },
+		{ B230400, 230400 },
+#ifdef B460800
+		{ B460800, 460800 },
+#endif
+#ifdef B921600
+		{ B921600, 921600 },
+#endif
+	};
+
+	termios tio;
+	if (tcgetattr(host, &tio) != 0) return 0;
+
+	const speed_t speed = cfgetospeed(&tio);
+	for (const auto &entry : speeds) {
+		if (entry.speed == speed) return entry.baud;
+	}
+	return 0;
+}
+
+// Whether the host turned on RTS/CTS
+static bool hostFlowControl() {
+	termios tio;
+	return tcgetattr(host, &tio) == 0 && (tio.c_cflag & CRTSCTS) != 0;
+}
+
+static unsigned long linkBaud(const Options &options) {
+	return options.follow_host ? hostBaud() : options.baud;
+}
+
+// Time it takes to move count bytes over the link, 8N1 framing is 10 bits per byte
+static Clock::duration transferTime(const Options &options, size_t count) {
+	const unsigned long baud = linkBaud(options);
+	if (baud == 0) return Clock::duration::zero();
+
+	return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(count * 10.0 / baud));
+}
+
+// Like the board with a receive buffer: source arriving faster than the board
+// takes it in fills the buffer, and once that is full the rest comes in only
+// as fast as the board takes it. With RTS/CTS the host waits for it, without
+// the bytes in between are lost, spread evenly over the rest of the source.
+// The terminating NUL is assumed to make it. Returns when the board is done
+// with the source.
+static Clock::time_point receiveSource(const Options &options, std::string &source, Clock::time_point start) {
+	const double cost_us = options.byte_cost_us;
+	const unsigned long baud = linkBaud(options);
+	const double link_us = baud != 0 ? 10e6 / baud : 0;
+	const size_t length = source.size();
+
+	if (cost_us <= link_us || length == 0) {
+		return start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::micro>((length + 2) * link_us + cost_us));
+	}
+
+	if (!hostFlowControl()) {
+		// Bytes received by the time the buffer overflows
+		const double filled = options.receive_buffer * cost_us / (cost_us - link_us);
+
+		if (length > filled) {
+			const double kept = link_us / cost_us;
+			const size_t first = static_cast<size_t>(filled);
+			std::string received = source.substr(0, first);
+
+			for (size_t i = first; i < length; ++i) {
+				if (static_cast<size_t>((i - first + 1) * kept) != static_cast<size_t>((i - first) * kept)) received.push_back(source[i]);
+			}
+			source.swap(received);
+		}
+	}
+
+	return start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::micro>(2 * link_us + length * cost_us));
+}
+
+static bool writeAll(int fd, const char *data, size_t length) {
+	while (length > 0) {
+		ssize_t written = write(fd, data, length);
+
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN) {
+				pollfd pfd = { fd, POLLOUT, 0 };
+				poll(&pfd, 1, 100);
+				continue;
+			}
+			return false;
+		}
+
+		data += written;
+		length -= written;
+	}
+
+	return true;
+}
+
+// Writes out what the board sent once the latency has passed, in order
+static void deliverDelayed() {
+	std::unique_lock<std::mutex> lock(delayed_mutex);
+
+	while (true) {
+		delayed_ready.wait(lock, []() { return delayed_stop || !delayed.empty(); });
+		if (delayed.empty()) return;
+
+		const Clock::time_point due = delayed.front().first;
+		lock.unlock();
+		std::this_thread::sleep_until(due);
+		lock.lock();
+
+		const std::string data = std::move(delayed.front().second);
+		delayed.pop_front();
+
+		lock.unlock();
+		writeAll(host, data.data(), data.size());
+		lock.lock();
+	}
+}
+
+// Holds the data back until the link would have had the time to send it,
+// a piece at a time so the start of a long reply isn't held up by the rest.
+// Oversleeping a little is made up for with the next write.
+static bool sendToHost(const char *data, size_t length) {
+	while (length > 0) {
+		const size_t count = std::min<size_t>(length, LINK_PIECE);
+
+		link_free = std::max(link_free, Clock::now() - std::chrono::milliseconds(5)) + transferTime(*host_options, count);
+		std::this_thread::sleep_until(link_free);
+
+		if (host_options->latency_us <= 0) {
+			if (!writeAll(host, data, count)) return false;
+		}
+		else {
+			// The board carries on meanwhile, only the host sees it later
+			const auto latency = std::chrono::duration<double, std::micro>(host_options->latency_us);
+			std::lock_guard<std::mutex> lock(delayed_mutex);
+			delayed.emplace_back(Clock::now() + std::chrono::duration_cast<Clock::duration>(latency), std::string(data, count));
+			delayed_ready.notify_one();
+		}
+
+		data += count;
+		length -= count;
+	}
+
+	return true;
+}
+
+// Properties the firmware fills in at startup
+static void setProperties(lua_State *L) {
+	static const struct { const char *name; lua_Integer value; } numbers[] = {
+		{ "Width", 320 },
+		{ "Height", 240 },
+		{ "BytesPerPixel", 2 },
+		{ "NoOfFrames", 2 },
+		{ "NoOfPicts", 0 },
+		{ "NoOfBmFonts", 1 },
+		{ "NoOfFtFonts", 0 },
+	};
+
+	for (size_t i = 0; i < EzPropertyCount; ++i) {
+		lua_pushinteger(L, 0);
+		lua_setfield(L, -2, EzProperties[i]);
+	}
+
+	for (const auto &number : numbers) {
+		lua_pushinteger(L, number.value);
+		lua_setfield(L, -2, number.name);
+	}
+
+	lua_pushstring(L, "ezlcdsim");
+	lua_setfield(L, -2, "FirmVer");
+	lua_pushstring(L, LUA_VERSION);
+	lua_setfield(L, -2, "LuaVer");
+}
+
+static int stubFunction(lua_State *L) {
+	lua_pushinteger(L, 0);
+	return 1;
+}
+
+// The few functions scripts commonly depend on the results of
+static lua_Integer cursor_x = 0;
+static lua_Integer cursor_y = 0;
+
+static int ezSetXY(lua_State *L) {
+	cursor_x = luaL_checkinteger(L, 1);
+	cursor_y = luaL_checkinteger(L, 2);
+	return 0;
+}
+
+static int ezSetX(lua_State *L) {
+	cursor_x = luaL_checkinteger(L, 1);
+	return 0;
+}
+
+static int ezSetY(lua_State *L) {
+	cursor_y = luaL_checkinteger(L, 1);
+	return 0;
+}
+
+static int ezGetX(lua_State *L) {
+	lua_pushinteger(L, cursor_x);
+	return 1;
+}
+
+static int ezGetY(lua_State *L) {
+	lua_pushinteger(L, cursor_y);
+	return 1;
+}
+
+static int ezRGB(lua_State *L) {
+	lua_Integer r = luaL_checkinteger(L, 1) & 0xFF;
+	lua_Integer g = luaL_checkinteger(L, 2) & 0xFF;
+	lua_Integer b = luaL_checkinteger(L, 3) & 0xFF;
+	lua_pushinteger(L, (r << 16) | (g << 8) | b);
+	return 1;
+}
+
+static int ezGetRed(lua_State *L) {
+	lua_pushinteger(L, (luaL_checkinteger(L, 1) >> 16) & 0xFF);
+	return 1;
+}
+
+static int ezGetGreen(lua_State *L) {
+	lua_pushinteger(L, (luaL_checkinteger(L, 1) >> 8) & 0xFF);
+	return 1;
+}
+
+static int ezGetBlue(lua_State *L) {
+	lua_pushinteger(L, luaL_checkinteger(L, 1) & 0xFF);
+	return 1;
+}
+
+static const Clock::time_point boot = Clock::now();
+
+static int ezGet_ms(lua_State *L) {
+	lua_pushinteger(L, std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - boot).count());
+	return 1;
+}
+
+static int ezWait_ms(lua_State *L) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(luaL_checkinteger(L, 1)));
+	return 0;
+}
+
+static int ezTimer(lua_State *L) {
+	const lua_Integer period = luaL_checkinteger(L, 1);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+
+	luaL_unref(L, LUA_REGISTRYINDEX, timer_function);
+	lua_pushvalue(L, 2);
+	timer_function = luaL_ref(L, LUA_REGISTRYINDEX);
+	timer_period = std::chrono::milliseconds(std::max<lua_Integer>(period, 0));
+	timer_due = Clock::now() + timer_period;
+	return 0;
+}
+
+static int ezTimerStop(lua_State *L) {
+	luaL_unref(L, LUA_REGISTRYINDEX, timer_function);
+	timer_function = LUA_NOREF;
+	return 0;
+}
+
+static int boardPrint(lua_State *L) {
+	std::string line;
+
+	for (int i = 1; i <= lua_gettop(L); ++i) {
+		size_t length;
+		const char *text = luaL_tolstring(L, i, &length);
+
+		if (i > 1) line.push_back('\t');
+		line.append(text, length);
+		lua_pop(L, 1);
+	}
+	line.append("\r\n");
+
+	sendToHost(line.data(), line.size());
+	return 0;
+}
+
+static lua_State *createState() {
+	static const luaL_Reg functions[] = {
+		{ "SetXY", ezSetXY },
+		{ "SetX", ezSetX },
+		{ "SetY", ezSetY },
+		{ "GetX", ezGetX },
+		{ "GetY", ezGetY },
+		{ "RGB", ezRGB },
+		{ "GetRed", ezGetRed },
+		{ "GetGreen", ezGetGreen },
+		{ "GetBlue", ezGetBlue },
+		{ "Get_ms", ezGet_ms },
+		{ "Wait_ms", ezWait_ms },
+		{ "Timer", ezTimer },
+		{ "TimerStop", ezTimerStop },
+		{ nullptr, nullptr }
+	};
+
+	lua_State *L = luaL_newstate();
+	luaL_openlibs(L);
+
+	lua_newtable(L);
+
+	for (size_t i = 0; i < EzFunctionCount; ++i) {
+		lua_pushcfunction(L, stubFunction);
+		lua_setfield(L, -2, EzFunctions[i]);
+	}
+	luaL_setfuncs(L, functions, 0);
+
+	setProperties(L);
+
+	lua_setglobal(L, "ez");
+
+	lua_pushcfunction(L, boardPrint);
+	lua_setglobal(L, "print");
+
+	return L;
+}
+
+// Runs one chunk and builds the reply for it
+static std::string execute(lua_State *L, const std::string &source) {
+	std::string reply;
+
+	// Same chunk name luaL_loadstring would give it
+	int status = luaL_loadbuffer(L, source.data(), source.size(), source.c_str());
+	if (status == LUA_OK) status = lua_pcall(L, 0, 0, 0);
+
+	if (status == LUA_OK) {
+		reply.push_back(static_cast<char>(RUN_LUA_OK));
+	}
+	else {
+		const char *message = lua_tostring(L, -1);
+
+		reply.push_back(static_cast<char>(RUN_LUA_ERROR));
+		if (message != nullptr)
+			reply.append(message);
+		else
+			reply.append("(error object is a ").append(luaL_typename(L, -1)).append(" value)");
+		reply.push_back('\0');
+	}
+
+	lua_settop(L, 0);
+	return reply;
+}
+
+// Runs the timer if it is due, an error in it goes to the host unasked
+static bool runTimer(lua_State *L) {
+	if (timer_function == LUA_NOREF || Clock::now() < timer_due) return true;
+
+	timer_due = std::max(timer_due + timer_period, Clock::now());
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, timer_function);
+	if (lua_pcall(L, 0, 0, 0) == LUA_OK) return true;
+
+	const char *message = lua_tostring(L, -1);
+	std::string frame(1, static_cast<char>(RUN_LUA_ERROR));
+	frame.append(message != nullptr ? message : "(error object is not a string)");
+	frame.push_back('\0');
+	lua_settop(L, 0);
+
+	return sendToHost(frame.data(), frame.size());
+}
+
+static void usage() {
+	fprintf(stderr, "usage: ezlcdsim [-l link] [-b baud] [-f] [-c us_per_byte] [-q bytes] [-d us] [-v]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	Options options;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "l:b:fc:q:d:v")) != -1) {
+		switch (opt) {
+			case 'l': options.link = optarg; break;
+			case 'b': options.baud = strtoul(optarg, nullptr, 10); break;
+			case 'f': options.follow_host = true; break;
+			case 'c': options.byte_cost_us = strtod(optarg, nullptr); break;
+			case 'q': options.receive_buffer = strtoul(optarg, nullptr, 10); break;
+			case 'd': options.latency_us = strtod(optarg, nullptr); break;
+			case 'v': options.verbose = true; break;
+			default: usage();
+		}
+	}
+
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+		perror("ezlcdsim: posix_openpt");
+		return 1;
+	}
+
+	const char *slave_name = ptsname(master);
+
+	// Keep the slave side open so reads don't fail with EIO while no client is attached
+	int slave = open(slave_name, O_RDWR | O_NOCTTY);
+	if (slave < 0) {
+		perror("ezlcdsim: open slave");
+		return 1;
+	}
+
+	termios tio;
+	tcgetattr(slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+
+	if (options.link != nullptr) {
+		unlink(options.link);
+		if (symlink(slave_name, options.link) != 0) {
+			perror("ezlcdsim: symlink");
+			return 1;
+		}
+	}
+
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	printf("%s\n", options.link != nullptr ? options.link : slave_name);
+	fflush(stdout);
+
+	host = master;
+	host_options = &options;
+
+	std::thread delivery(deliverDelayed);
+
+	lua_State *L = createState();
+
+	std::string source;
+	bool in_command = false;
+	Clock::time_point command_start;
+	char buffer[4096];
+
+	while (!quit) {
+		// The timer only gets to run while the board isn't busy with a command
+		int wait = 200;
+		if (!in_command && timer_function != LUA_NOREF) {
+			if (!runTimer(L)) {
+				perror("ezlcdsim: write");
+				break;
+			}
+
+			if (timer_function != LUA_NOREF) {
+				const auto until = std::chrono::duration_cast<std::chrono::milliseconds>(timer_due - Clock::now()).count();
+				wait = static_cast<int>(std::max<long long>(std::min<long long>(until, wait), 0));
+			}
+		}
+
+		pollfd pfd = { master, POLLIN, 0 };
+		if (poll(&pfd, 1, wait) <= 0) continue;
+
+		ssize_t count = read(master, buffer, sizeof(buffer));
+		if (count < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EIO) continue;
+			perror("ezlcdsim: read");
+			break;
+		}
+
+		for (ssize_t i = 0; i < count; ++i) {
+			const unsigned char ch = static_cast<unsigned char>(buffer[i]);
+
+			if (!in_command) {
+				// Anything outside of a command is line noise to the board
+				if (ch == RUN_LUA) {
+					in_command = true;
+					command_start = Clock::now();
+					source.clear();
+				}
+				continue;
+			}
+
+			if (ch != 0) {
+				source.push_back(static_cast<char>(ch));
+				continue;
+			}
+
+			in_command = false;
+
+			// The host wrote the command all at once, hold it back until it would
+			// have made it across the link and been taken in by the board
+			if (options.receive_buffer != 0) {
+				std::this_thread::sleep_until(receiveSource(options, source, command_start));
+			}
+			else {
+				const auto cost = std::chrono::duration<double, std::micro>(source.size() * options.byte_cost_us);
+				std::this_thread::sleep_until(command_start + transferTime(options, source.size() + 2) + std::chrono::duration_cast<Clock::duration>(cost));
+			}
+
+			const std::string reply = execute(L, source);
+
+			if (options.verbose) {
+				fprintf(stderr, "%zu bytes -> %s\n", source.size(), reply[0] == RUN_LUA_OK ? "OK" : reply.c_str() + 1);
+			}
+
+			if (!sendToHost(reply.data(), reply.size())) {
+				perror("ezlcdsim: write");
+				quit = 1;
+				break;
+			}
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(delayed_mutex);
+		delayed_stop = true;
+		delayed_ready.notify_one();
+	}
+	delivery.join();
+
+	lua_close(L);
+	close(slave);
+	close(master);
+
+	if (options.link != nullptr) unlink(options.link);
+
+	return 0;
+}
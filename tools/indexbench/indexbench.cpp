@@ -0,0 +1,221 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// indexbench - measures how long SymbolIndex takes to catch up with an edit.
+//
+// Lua files of 1k, 10k and 50k lines are made up out of the kind of code
+// ezLCD scripts have, and indexed in full. Then edits are made the way
+// SCN_MODIFIED reports them, and the time from handing the edit over until
+// the worker is done with it is taken:
+//
+//   full      Indexing the whole file, once
+//   char      A character typed somewhere in a line
+//   newline   A line split in two
+//   brace     A { typed and taken out again, which changes how every line
+//             after it starts until it is closed, so catching up with it
+//             costs a full pass
+//   next      How long the next keystroke after such a { waits until what
+//             it typed can be completed
+//
+// Results are printed as JSON.
+//
+// Build:
+//
+//   g++ -std=c++14 -O2 -I../../src indexbench.cpp ../../src/SymbolIndex.cpp ../../src/ApiCatalog.cpp ../../src/LuaLexer.cpp -pthread -o indexbench
+//
+// Usage:
+//
+//   indexbench [-n edits]
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SymbolIndex.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Samples {
+	std::vector<double> us;
+
+	double percentile(double p) {
+		if (us.empty()) return 0;
+
+		std::sort(us.begin(), us.end());
+
+		// Nearest rank
+		size_t rank = static_cast<size_t>(p / 100.0 * us.size() + 0.5);
+		return us[std::min(std::max<size_t>(rank, 1), us.size()) - 1];
+	}
+};
+
+static double elapsedUs(Clock::time_point start) {
+	return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+// Functions, tables and comments in about the mix a real script has
+static std::vector<std::string> makeLines(size_t count) {
+	std::vector<std::string> lines;
+	size_t n = 0;
+
+	while (lines.size() < count) {
+		const std::string id = std::to_string(n++);
+		const std::vector<std::string> block = {
+			"-- Screen " + id,
+			"local screen" + id + " = {",
+			"\ttitle = \"Screen " + id + "\",",
+			"\tcolor = ez.RGB(0, 128, 255),",
+			"\tbuttons = { ok = 1, cancel = 2 },",
+			"}",
+			"",
+			"function screen" + id + ".draw(x, y)",
+			"\tez.SetColor(screen" + id + ".color)",
+			"\tez.Box(x, y, x + 100, y + 20, 1)",
+			"\tfor i, button in pairs(screen" + id + ".buttons) do",
+			"\t\tlocal label = \"[\" .. i .. \"]\"",
+			"\t\tez.SetXY(x + button * 10, y)",
+			"\tend",
+			"end",
+			"",
+			"--[[ Old version",
+			"function screen" + id + ".old() end",
+			"]]",
+			"count" + id + " = 0",
+			"",
+		};
+		for (const std::string &line : block) {
+			if (lines.size() < count) lines.push_back(line);
+		}
+	}
+
+	return lines;
+}
+
+static std::string joinLines(const std::vector<std::string> &lines) {
+	std::string text;
+	for (size_t i = 0; i < lines.size(); ++i) {
+		if (i != 0) text += "\r\n";
+		text += lines[i];
+	}
+	return text;
+}
+
+static double timeEdit(SymbolIndex &index, size_t first, size_t removed, std::vector<std::string> lines) {
+	Clock::time_point start = Clock::now();
+	index.replaceLines(1, first, removed, std::move(lines));
+	index.wait();
+	return elapsedUs(start);
+}
+
+static void printSamples(const char *name, Samples &samples, bool last) {
+	printf("\"%s\": { \"edits\": %zu, \"p50_us\": %.1f, \"p99_us\": %.1f }%s", name, samples.us.size(), samples.percentile(50), samples.percentile(99), last ? "" : ", ");
+}
+
+static void run(size_t size, size_t edits, bool last) {
+	std::mt19937 random(static_cast<unsigned int>(size));
+	std::vector<std::string> lines = makeLines(size);
+
+	SymbolIndex index;
+	Clock::time_point start = Clock::now();
+	index.setText(1, joinLines(lines));
+	index.wait();
+	const double full_us = elapsedUs(start);
+	const size_t names = index.size();
+
+	Samples chars, newlines, braces, next;
+	for (size_t i = 0; i < edits; ++i) {
+		const size_t line = random() % lines.size();
+		std::string &text = lines[line];
+
+		text.insert(random() % (text.size() + 1), 1, 'x');
+		chars.us.push_back(timeEdit(index, line, 1, { text }));
+
+		// Split it, and join it back together
+		const size_t split = random() % (text.size() + 1);
+		newlines.us.push_back(timeEdit(index, line, 1, { text.substr(0, split), text.substr(split) }));
+		timeEdit(index, line, 2, { text });
+
+		// Only a few, they go through the whole rest of the file
+		if (i < edits / 10 + 1) {
+			braces.us.push_back(timeEdit(index, line, 1, { "{" + text }));
+			timeEdit(index, line, 1, { text });
+
+			// Typed right behind it, on a new first line so it doesn't depend
+			// on the {
+			const std::string probe = "probe" + std::to_string(i);
+			std::vector<std::string> found;
+			start = Clock::now();
+			index.replaceLines(1, line, 1, { "{" + text });
+			index.replaceLines(1, 0, 0, { "local " + probe + " = 1" });
+			while (found.empty()) {
+				index.complete("", probe, found);
+				std::this_thread::sleep_for(std::chrono::microseconds(20));
+			}
+			next.us.push_back(elapsedUs(start));
+
+			index.replaceLines(1, 0, 1, {});
+			index.replaceLines(1, line, 1, { text });
+			index.wait();
+		}
+	}
+
+	// Everything should be back where it started, apart from the x's
+	SymbolIndex check;
+	check.setText(1, joinLines(lines));
+	check.wait();
+
+	printf("  \"%zu\": { \"names\": %zu, \"full_us\": %.1f, ", size, names, full_us);
+	printSamples("char", chars, false);
+	printSamples("newline", newlines, false);
+	printSamples("brace", braces, false);
+	printSamples("next", next, false);
+	printf("\"same_as_full\": %s }%s\n", index.size() == check.size() ? "true" : "false", last ? "" : ",");
+}
+
+static void usage() {
+	fprintf(stderr, "usage: indexbench [-n edits]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	size_t edits = 1000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+			case 'n': edits = strtoul(optarg, nullptr, 10); break;
+			default: usage();
+		}
+	}
+	if (optind != argc || edits == 0) usage();
+
+	printf("{\n");
+	run(1000, edits, false);
+	run(10000, edits, false);
+	run(50000, edits, true);
+	printf("}\n");
+
+	return 0;
+}
@@ -0,0 +1,209 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// minibench - measures how fast the Lua minifier gets through a corpus.
+//
+// Minifies each file given on the command line, or without any a made up
+// script with the comments, indentation and strings ezLCD scripts have, and
+// prints as JSON for each of them:
+//
+//   mb_per_second  Input minified per second, best of the repeats
+//   bytes          In and out, and how much of it was saved
+//   wire_ms        How long the upload takes at the given baud rate before
+//                  and after
+//   same_tokens    Whether the output has the same tokens as the input, apart
+//                  from whitespace and comments, each on the line it was on,
+//                  so error messages from the device still point at the
+//                  right line
+//   stable         Whether minifying the output again changes nothing
+//
+// The exit status is 1 if any file fails either check.
+//
+// Build:
+//
+//   g++ -std=c++14 -O2 -I../../src minibench.cpp ../../src/LuaMinifier.cpp ../../src/LuaLexer.cpp -o minibench
+//
+// Usage:
+//
+//   minibench [-b baud] [-m megabytes] [-r repeats] [file.lua ...]
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "LuaLexer.h"
+#include "LuaMinifier.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// Functions, tables, comments and strings in about the mix a real script has
+static std::string makeScript(size_t size) {
+	std::string text;
+	size_t n = 0;
+
+	while (text.size() < size) {
+		const std::string id = std::to_string(n++);
+		text +=
+			"-- Screen " + id + "\r\n"
+			"-- Draws the screen and its buttons, called from the main loop\r\n"
+			"local screen" + id + " = {\r\n"
+			"\ttitle = \"Screen " + id + "\\t\\\"main\\\"\",\r\n"
+			"\tcolor = ez.RGB(0, 128, 255),  -- light blue\r\n"
+			"\tbuttons = { ok = 1, cancel = 2 },\r\n"
+			"}\r\n"
+			"\r\n"
+			"function screen" + id + ".draw(x, y)\r\n"
+			"\tez.SetColor(screen" + id + ".color)\r\n"
+			"\tez.Box(x, y, x + 100, y + 20, 1)\r\n"
+			"\tfor i, button in pairs(screen" + id + ".buttons) do\r\n"
+			"\t\tlocal label = \"[\" .. i .. \"]\"\r\n"
+			"\t\tez.SetXY(x + button * 10, y)\r\n"
+			"\t\tprint(label, 1 .. 2, 0x1F, 1e-3)\r\n"
+			"\tend\r\n"
+			"\tlocal help = [[\r\n"
+			"\t  Press OK to go on\r\n"
+			"\t]]\r\n"
+			"end\r\n"
+			"\r\n"
+			"--[==[ Old version\r\n"
+			"function screen" + id + ".old() end\r\n"
+			"]==]\r\n"
+			"count" + id + " = 0\r\n"
+			"\r\n";
+	}
+
+	return text;
+}
+
+static bool readFile(const char *path, std::string &text) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) return false;
+
+	text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	return true;
+}
+
+// Everything but whitespace and comments, with the line each one starts on
+static std::vector<std::pair<size_t, std::string>> codeTokens(const std::string &text) {
+	std::vector<std::pair<size_t, std::string>> tokens;
+	LuaLexer lexer(text.data(), text.size());
+	LuaToken token;
+	size_t line = 1;
+
+	while (lexer.next(token)) {
+		const char *start = text.data() + token.start;
+
+		switch (token.type) {
+			case LuaToken::Whitespace:
+			case LuaToken::Comment:
+			case LuaToken::LongComment:
+			case LuaToken::Newline:
+				break;
+			default:
+				tokens.emplace_back(line, std::string(start, token.length));
+				break;
+		}
+		line += LuaLexer::countLines(start, token.length);
+	}
+
+	return tokens;
+}
+
+// 8N1 is 10 bits on the wire per byte
+static double transferMs(size_t bytes, uint32_t baudrate) {
+	return bytes * 10 * 1000.0 / baudrate;
+}
+
+// Returns whether the checks passed
+static bool run(const std::string &name, const std::string &text, uint32_t baudrate, size_t repeats, bool last) {
+	double best = 0;
+	std::string minified;
+
+	for (size_t i = 0; i < repeats; ++i) {
+		Clock::time_point start = Clock::now();
+		minified = MinifyLua(text.data(), text.size());
+		const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		if (i == 0 || seconds < best) best = seconds;
+	}
+
+	const bool same_tokens = codeTokens(text) == codeTokens(minified);
+	const bool stable = MinifyLua(minified.data(), minified.size()) == minified;
+
+	printf("    { \"name\": \"%s\", \"mb_per_second\": %.1f, ", name.c_str(), best > 0 ? text.size() / best / 1e6 : 0.0);
+	printf("\"bytes_in\": %zu, \"bytes_out\": %zu, \"saved_percent\": %.1f, ", text.size(), minified.size(),
+		text.empty() ? 0.0 : 100.0 * (text.size() - minified.size()) / text.size());
+	printf("\"wire_ms_in\": %.1f, \"wire_ms_out\": %.1f, ", transferMs(text.size(), baudrate), transferMs(minified.size(), baudrate));
+	printf("\"same_tokens\": %s, \"stable\": %s }%s\n", same_tokens ? "true" : "false", stable ? "true" : "false", last ? "" : ",");
+
+	return same_tokens && stable;
+}
+
+static void usage() {
+	fprintf(stderr, "usage: minibench [-b baud] [-m megabytes] [-r repeats] [file.lua ...]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t baudrate = 115200;
+	size_t megabytes = 8;
+	size_t repeats = 5;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:m:r:")) != -1) {
+		switch (opt) {
+			case 'b': baudrate = static_cast<uint32_t>(strtoul(optarg, nullptr, 10)); break;
+			case 'm': megabytes = strtoul(optarg, nullptr, 10); break;
+			case 'r': repeats = strtoul(optarg, nullptr, 10); break;
+			default: usage();
+		}
+	}
+	if (baudrate == 0 || megabytes == 0 || repeats == 0) usage();
+
+	bool ok = true;
+
+	printf("{\n");
+	printf("  \"baudrate\": %u,\n", baudrate);
+	printf("  \"corpus\": [\n");
+
+	if (optind == argc) {
+		ok = run("generated", makeScript(megabytes << 20), baudrate, repeats, true);
+	}
+	else {
+		for (int i = optind; i < argc; ++i) {
+			std::string text;
+			if (!readFile(argv[i], text)) {
+				fprintf(stderr, "minibench: can't read %s\n", argv[i]);
+				return 2;
+			}
+			ok = run(argv[i], text, baudrate, repeats, i + 1 == argc) && ok;
+		}
+	}
+
+	printf("  ]\n");
+	printf("}\n");
+
+	return ok ? 0 : 1;
+}
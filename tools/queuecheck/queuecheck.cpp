@@ -0,0 +1,449 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// queuecheck - checks CommandQueue against the simulator on a pty.
+//
+// Runs the same CommandQueue and DeviceSession the console uses against the
+// simulator in tools/ezlcdsim. Every check prints what it got next to what it
+// should have been as JSON, and the exit status is 1 if any of them is off.
+//
+//   order       Statements with tags, some of them failing, complete in the
+//               order they were submitted with their own tag and status,
+//               and pending() counts down to nothing
+//   busy        Submitting while the worker waits on a statement that
+//               takes a while returns right away, and the next statement
+//               completes after it
+//   output      What a statement prints arrives before its completion
+//   batch       Once a statement of a batch fails the rest that haven't
+//               been sent yet are skipped, everything completes in the order
+//               it was submitted, and the next batch runs again
+//   stop        stop() while the device is in a long ez.Wait_ms() and while
+//               it prints in a loop returns within the queue's stop timeout,
+//               and before the statement would have timed out on its own
+//
+// Build (Linux, uses the POSIX serial backend):
+//
+//   g++ -std=c++14 -O2 -I../../src queuecheck.cpp ../../src/CommandQueue.cpp ../../src/DeviceSession.cpp ../../src/serial/serial.cc ../../src/serial/impl/unix.cc ../../src/serial/impl/list_ports/list_ports_linux.cc -pthread -o queuecheck
+//
+// Usage:
+//
+//   ezlcdsim -l /tmp/ttyEZLCD &
+//   queuecheck [-b baud] [-w window] /tmp/ttyEZLCD > results.json
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CommandQueue.h"
+#include "DeviceSession.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// The same as in CommandQueue.cpp
+#define STOP_TIMEOUT_MS 2000
+
+// How long to wait for completions before calling it a failure
+#define WAIT_MS 5000
+
+static double elapsedMs(Clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static const char *statusName(Completion::Status status) {
+	switch (status) {
+		case Completion::Status::Ok: return "ok";
+		case Completion::Status::LuaError: return "lua_error";
+		case Completion::Status::NoResponse: return "no_response";
+		case Completion::Status::Failed: return "failed";
+		case Completion::Status::Skipped: return "skipped";
+		case Completion::Status::Output: return "output";
+		default: return "device_error";
+	}
+}
+
+// Collects the checks of a section and prints them as JSON
+class Report {
+public:
+	explicit Report(const char *section) : first(true), ok(true) {
+		printf("  \"%s\": [\n", section);
+	}
+
+	void text(const char *check, const std::string &got, const std::string &expect) {
+		const bool passed = got == expect;
+		line(passed, "{ \"check\": \"%s\", \"got\": \"%s\", \"expect\": \"%s\", \"ok\": %s }",
+			check, got.c_str(), expect.c_str(), passed ? "true" : "false");
+	}
+
+	void value(const char *check, double value, double expect) {
+		const bool passed = value == expect;
+		line(passed, "{ \"check\": \"%s\", \"value\": %.15g, \"expect\": %.15g, \"ok\": %s }", check, value, expect, passed ? "true" : "false");
+	}
+
+	// A value that has to be at least min and at most max
+	void range(const char *check, double value, double min, double max) {
+		const bool passed = value >= min && value <= max;
+		line(passed, "{ \"check\": \"%s\", \"value\": %.1f, \"min\": %.1f, \"max\": %.1f, \"ok\": %s }",
+			check, value, min, max, passed ? "true" : "false");
+	}
+
+	// Returns whether every check passed
+	bool end(bool last) {
+		printf("\n  ]%s\n", last ? "" : ",");
+		return ok;
+	}
+
+private:
+	bool first;
+	bool ok;
+
+	template <typename... Args>
+	void line(bool passed, const char *format, Args... args) {
+		printf("%s    ", first ? "" : ",\n");
+		printf(format, args...);
+		first = false;
+		ok = ok && passed;
+	}
+};
+
+// Takes completions as the queue announces them, the way the console does
+// when its posted message comes in
+class Collector {
+public:
+	explicit Collector(CommandQueue &queue) : queue(queue), notified(0) {
+		queue.setNotify([this] {
+			std::lock_guard<std::mutex> lock(mutex);
+			++notified;
+			wakeup.notify_one();
+		});
+	}
+
+	~Collector() {
+		queue.setNotify(nullptr);
+	}
+
+	// Waits until count statements have completed, output is collected in
+	// between. Returns false if they didn't within WAIT_MS.
+	bool wait(size_t count) {
+		const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(WAIT_MS);
+
+		while (statements() < count) {
+			Completion completion;
+			if (queue.takeCompletion(completion)) {
+				completions.push_back(std::move(completion));
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(mutex);
+			const size_t seen = notified;
+			if (!wakeup.wait_until(lock, deadline, [&] { return notified != seen; })) {
+				// One may have come in between taking and waiting
+				lock.unlock();
+				if (!queue.takeCompletion(completion)) return false;
+				completions.push_back(std::move(completion));
+			}
+		}
+
+		return true;
+	}
+
+	size_t statements() const {
+		size_t count = 0;
+		for (const Completion &completion : completions) {
+			if (completion.id != 0) ++count;
+		}
+		return count;
+	}
+
+	// Statement completions only, in the order they came in
+	std::vector<Completion> results() const {
+		std::vector<Completion> results;
+		for (const Completion &completion : completions) {
+			if (completion.id != 0) results.push_back(completion);
+		}
+		return results;
+	}
+
+	std::vector<Completion> completions;
+
+private:
+	CommandQueue &queue;
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	size_t notified;
+};
+
+static bool order(DeviceSession &session, size_t window, bool last) {
+	Report report("order");
+
+	CommandQueue queue(session);
+	queue.setWindow(window);
+	Collector collector(queue);
+
+	static const struct { const char *source; const char *status; } statements[] = {
+		{ "x = 1", "ok" },
+		{ "error(\"first\", 0)", "lua_error" },
+		{ "x = x + 1", "ok" },
+		{ "x = ", "lua_error" },
+		{ "x = x + 1", "ok" },
+		{ "assert(x == 3)", "ok" },
+	};
+	const size_t count = sizeof(statements) / sizeof(statements[0]);
+
+	std::vector<unsigned int> ids;
+	for (size_t i = 0; i < count; ++i) {
+		ids.push_back(queue.submit(statements[i].source, static_cast<int>(100 + i)));
+	}
+	report.value("pending_after_submit", static_cast<double>(queue.pending()), static_cast<double>(count));
+
+	report.text("completed", collector.wait(count) ? "yes" : "no", "yes");
+
+	const std::vector<Completion> results = collector.results();
+	bool in_order = results.size() == count;
+	bool tags = results.size() == count;
+	std::string statuses;
+	std::string expected;
+
+	for (size_t i = 0; i < results.size() && i < count; ++i) {
+		in_order = in_order && results[i].id == ids[i];
+		tags = tags && results[i].tag == static_cast<int>(100 + i);
+		statuses += std::string(i > 0 ? " " : "") + statusName(results[i].status);
+		expected += std::string(i > 0 ? " " : "") + statements[i].status;
+	}
+	for (size_t i = results.size(); i < count; ++i) {
+		expected += std::string(i > 0 ? " " : "") + statements[i].status;
+	}
+
+	report.text("in_order", in_order ? "yes" : "no", "yes");
+	report.text("tags", tags ? "yes" : "no", "yes");
+	report.text("statuses", statuses, expected);
+	report.text("error_message", results.size() > 1 ? results[1].message : "", "first");
+	report.value("pending_after_taking", static_cast<double>(queue.pending()), 0);
+
+	return report.end(last);
+}
+
+// How long the busy statement keeps the device waiting, short of the
+// session's shortest reply timeout so it still gets its reply
+#define BUSY_MS 150
+
+// How long submit() may take, it only queues the statement
+#define SUBMIT_MS 5
+
+static bool busy(DeviceSession &session, bool last) {
+	Report report("busy");
+
+	CommandQueue queue(session);
+	Collector collector(queue);
+
+	char source[64];
+	snprintf(source, sizeof(source), "ez.Wait_ms(%d)", BUSY_MS);
+
+	Clock::time_point start = Clock::now();
+	queue.submit(source, 1);
+
+	// Let the worker get as far as waiting on the reply
+	std::this_thread::sleep_for(std::chrono::milliseconds(BUSY_MS / 10));
+
+	Clock::time_point submitted = Clock::now();
+	queue.submit("y = 2", 2);
+	report.range("submit_ms", elapsedMs(submitted), 0, SUBMIT_MS);
+	report.value("pending", static_cast<double>(queue.pending()), 2);
+
+	report.text("completed", collector.wait(2) ? "yes" : "no", "yes");
+	const double ms = elapsedMs(start);
+
+	const std::vector<Completion> results = collector.results();
+	report.text("first", results.size() > 0 ? statusName(results[0].status) : "", "ok");
+	report.text("second", results.size() > 1 ? statusName(results[1].status) : "", "ok");
+	report.value("second_tag", results.size() > 1 ? results[1].tag : 0, 2);
+	report.range("both_ms", ms, BUSY_MS, BUSY_MS + WAIT_MS);
+
+	return report.end(last);
+}
+
+static bool output(DeviceSession &session, bool last) {
+	Report report("output");
+
+	CommandQueue queue(session);
+	Collector collector(queue);
+
+	queue.submit("print(\"hello\") print(\"world\")");
+	report.text("completed", collector.wait(1) ? "yes" : "no", "yes");
+
+	// Output may come in several pieces, they count as one
+	std::string text;
+	std::string sequence;
+	const char *previous = "";
+	for (const Completion &completion : collector.completions) {
+		const char *name = statusName(completion.status);
+		if (completion.status == Completion::Status::Output) text += completion.message;
+		if (std::string(name) != previous) sequence += std::string(sequence.empty() ? "" : " ") + name;
+		previous = name;
+	}
+
+	report.text("sequence", sequence, "output ok");
+	report.text("text", text == "hello\r\nworld\r\n" ? "hello world" : text, "hello world");
+
+	return report.end(last);
+}
+
+static bool batch(DeviceSession &session, size_t window, bool last) {
+	Report report("batch");
+
+	CommandQueue queue(session);
+	queue.setWindow(window);
+	Collector collector(queue);
+
+	const std::vector<std::string> sources = { "z = 1", "error(\"stop\", 0)", "z = 2", "z = 3", "z = 4", "z = 5", "z = 6", "z = 7" };
+	const unsigned int first = queue.submitBatch(sources, 7);
+	const unsigned int second = queue.submitBatch({ "z = 10", "assert(z == 10)" }, 8);
+
+	report.value("second_id", second, first + sources.size());
+	report.text("completed", collector.wait(sources.size() + 2) ? "yes" : "no", "yes");
+
+	// The window is topped up once more after the first reply, so the failed
+	// statement is followed by window - 1 that were already on their way
+	std::string expected = "ok lua_error";
+	for (size_t i = 2; i < sources.size(); ++i) expected += i <= window ? " ok" : " skipped";
+	expected += " ok ok";
+
+	// In the order they came in, the skipped ones wait for the replies ahead
+	// of them
+	std::string statuses;
+	for (const Completion &completion : collector.results()) {
+		statuses += std::string(statuses.empty() ? "" : " ") + statusName(completion.status);
+	}
+	report.text("statuses", statuses, expected);
+	report.value("pending", static_cast<double>(queue.pending()), 0);
+
+	return report.end(last);
+}
+
+// How long the device has to stay quiet to be done
+#define QUIET_MS 200
+
+// Reads and throws away whatever the device sends until it goes quiet
+static void drain(const std::string &port, uint32_t baudrate) {
+	serial::Serial serial(port, baudrate, serial::Timeout::simpleTimeout(QUIET_MS));
+	uint8_t buffer[512];
+
+	while (serial.read(buffer, sizeof(buffer)) > 0) {
+	}
+}
+
+// Longer than the stop timeout, so finishing in time means it was cut short
+#define LONG_MS 4000
+
+static void stopDuring(Report &report, DeviceSession &session, const std::string &port, const char *name, const char *source) {
+	Clock::time_point stopped;
+	double ms;
+	std::string status;
+
+	// Stopping any later than this could just be the statement timing out
+	const double timeout = std::min<double>(session.responseTimeout(strlen(source) + 2), STOP_TIMEOUT_MS);
+
+	{
+		CommandQueue queue(session);
+		queue.submit(source);
+
+		// Let the device get into it
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+		stopped = Clock::now();
+		queue.stop();
+		ms = elapsedMs(stopped);
+
+		Completion completion;
+		while (queue.takeCompletion(completion)) {
+			if (completion.id != 0) status = statusName(completion.status);
+		}
+	}
+
+	// Depending on where the abort finds the worker the statement either
+	// never gets its reply or fails outright, it doesn't complete either way
+	report.range(name, ms, 0, timeout);
+	report.text((std::string(name) + "_cut_short").c_str(), status == "no_response" || status == "failed" ? "yes" : status, "yes");
+
+	// The simulator is still busy with it, wait it out. A board's link drops
+	// what it sends while the port is closed but a pty keeps it, so throw
+	// away the rest of its output and the late reply before the next
+	// statement can take it for its own.
+	std::this_thread::sleep_for(std::chrono::milliseconds(LONG_MS + 500));
+	drain(port, session.getBaudrate());
+}
+
+static bool stop(DeviceSession &session, const std::string &port, bool last) {
+	Report report("stop");
+
+	char source[128];
+	snprintf(source, sizeof(source), "ez.Wait_ms(%d)", LONG_MS);
+	stopDuring(report, session, port, "wait_ms", source);
+
+	snprintf(source, sizeof(source), "local t = ez.Get_ms() while ez.Get_ms() - t < %d do print(t) end", LONG_MS);
+	stopDuring(report, session, port, "print_loop_ms", source);
+
+	return report.end(last);
+}
+
+static void usage() {
+	fprintf(stderr, "usage: queuecheck [-b baud] [-w window] port\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t baudrate = 115200;
+	size_t window = 4;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:w:")) != -1) {
+		switch (opt) {
+			case 'b': baudrate = static_cast<uint32_t>(strtoul(optarg, nullptr, 10)); break;
+			case 'w': window = strtoul(optarg, nullptr, 10); break;
+			default: usage();
+		}
+	}
+	if (optind != argc - 1 || baudrate == 0 || window == 0) usage();
+
+	DeviceSession session;
+	session.setPort(argv[optind]);
+	session.setBaudrate(baudrate);
+
+	bool ok = true;
+
+	printf("{\n");
+	printf("  \"port\": \"%s\", \"baudrate\": %u, \"window\": %zu,\n", argv[optind], baudrate, window);
+
+	ok = order(session, window, false) && ok;
+	ok = busy(session, false) && ok;
+	ok = output(session, false) && ok;
+	ok = batch(session, window, false) && ok;
+	ok = stop(session, argv[optind], true) && ok;
+
+	printf("}\n");
+
+	return ok ? 0 : 1;
+}
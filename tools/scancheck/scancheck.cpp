@@ -0,0 +1,206 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// scancheck - checks the console's identifier and brace scanner.
+//
+//   identifier  What LuaIdentifierStart picks out at the end of a few
+//               pieces of input
+//   braces      A BraceMap kept up to date through random edits, made of
+//               braces, long brackets, quotes, comments and line breaks,
+//               has to match a fresh BraceMap at every position. Edits
+//               sometimes pile up before the next lookup, like typing
+//               does in between caret moves.
+//
+// Every check prints what it got next to what it should have been as
+// JSON, and the exit status is 1 if any of them is off.
+//
+// Build:
+//
+//   g++ -std=c++14 -O2 -I../../src scancheck.cpp ../../src/LuaScanner.cpp ../../src/LuaLexer.cpp -o scancheck
+//
+// Usage:
+//
+//   scancheck [-n edits] [-s seed] > results.json
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+
+#include "LuaScanner.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// Collects the checks of a section and prints them as JSON
+class Report {
+public:
+	explicit Report(const char *section) : first(true), ok(true) {
+		printf("  \"%s\": [\n", section);
+	}
+
+	void text(const char *check, const std::string &got, const std::string &expect) {
+		const bool passed = got == expect;
+		line(passed, "{ \"check\": \"%s\", \"got\": \"%s\", \"expect\": \"%s\", \"ok\": %s }",
+			check, got.c_str(), expect.c_str(), passed ? "true" : "false");
+	}
+
+	void value(const char *check, double value, double expect) {
+		const bool passed = value == expect;
+		line(passed, "{ \"check\": \"%s\", \"value\": %.15g, \"expect\": %.15g, \"ok\": %s }", check, value, expect, passed ? "true" : "false");
+	}
+
+	// Only reported, there is nothing to compare it with
+	void count(const char *check, double value) {
+		line(true, "{ \"check\": \"%s\", \"value\": %.15g }", check, value);
+	}
+
+	// Returns whether every check passed
+	bool end(bool last) {
+		printf("\n  ]%s\n", last ? "" : ",");
+		return ok;
+	}
+
+private:
+	bool first;
+	bool ok;
+
+	template <typename... Args>
+	void line(bool passed, const char *format, Args... args) {
+		printf("%s    ", first ? "" : ",\n");
+		printf(format, args...);
+		first = false;
+		ok = ok && passed;
+	}
+};
+
+static bool identifier(bool last) {
+	Report report("identifier");
+
+	static const struct { const char *input; const char *expect; } cases[] = {
+		{ "Foo.Bar", "Foo.Bar" },
+		{ "x = ez.Button", "ez.Button" },
+		{ "a..b", "b" },
+		{ "1.5", "" },
+		{ "t[1].x", "x" },
+		{ "  ", "" },
+		{ "a.b.c", "a.b.c" },
+		{ "_G.x1", "_G.x1" },
+		{ "x.1a", "" },
+	};
+
+	for (const auto &c : cases) {
+		const size_t end = strlen(c.input);
+		const size_t start = LuaIdentifierStart(c.input, end);
+		report.text(c.input, std::string(c.input + start, end - start), c.expect);
+	}
+
+	return report.end(last);
+}
+
+// Longest the text gets, edits past it cut it back to half
+#define MAX_TEXT 400
+
+static bool braces(size_t edits, unsigned seed, bool last) {
+	Report report("braces");
+
+	static const char *const pieces[] = { "(", ")", "[", "]", "{", "}", "[[", "]]", "[=", "=[", "\"", "'", "--", "\n", "x", "=", "--[[", "-" };
+	const size_t piece_count = sizeof(pieces) / sizeof(pieces[0]);
+
+	std::mt19937 random(seed);
+	std::string text = "f(a[1], { b = [[ ( ]] })\n";
+	BraceMap kept;
+
+	size_t lookups = 0;
+	size_t mismatches = 0;
+	size_t first_mismatch = 0;
+	Clock::time_point start = Clock::now();
+
+	for (size_t edit = 0; edit < edits; ++edit) {
+		const size_t position = random() % (text.size() + 1);
+
+		if (random() % 3 == 0 && position < text.size()) {
+			text.erase(position, std::min<size_t>(random() % 4 + 1, text.size() - position));
+		}
+		else {
+			text.insert(position, pieces[random() % piece_count]);
+		}
+		kept.invalidate(position);
+
+		if (text.size() > MAX_TEXT) {
+			text.erase(MAX_TEXT / 2);
+			kept.invalidate(MAX_TEXT / 2);
+		}
+
+		// Let edits pile up now and then
+		if (random() % 2) continue;
+
+		BraceMap fresh;
+		for (size_t q = 0; q < text.size(); ++q) {
+			++lookups;
+			if (kept.match(text.data(), text.size(), q) != fresh.match(text.data(), text.size(), q)) {
+				if (mismatches++ == 0) first_mismatch = edit;
+				break;
+			}
+		}
+	}
+
+	report.count("edits", static_cast<double>(edits));
+	report.count("lookups", static_cast<double>(lookups));
+	report.count("seconds", std::chrono::duration<double>(Clock::now() - start).count());
+	report.value("mismatched_edits", static_cast<double>(mismatches), 0);
+	if (mismatches > 0) report.count("first_mismatched_edit", static_cast<double>(first_mismatch));
+
+	return report.end(last);
+}
+
+static void usage() {
+	fprintf(stderr, "usage: scancheck [-n edits] [-s seed]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	size_t edits = 200000;
+	unsigned seed = 7;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+		switch (opt) {
+			case 'n': edits = strtoul(optarg, nullptr, 10); break;
+			case 's': seed = static_cast<unsigned>(strtoul(optarg, nullptr, 10)); break;
+			default: usage();
+		}
+	}
+	if (optind != argc) usage();
+
+	bool ok = true;
+
+	printf("{\n");
+	printf("  \"seed\": %u,\n", seed);
+
+	ok = identifier(false) && ok;
+	ok = braces(edits, seed, true) && ok;
+
+	printf("}\n");
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,232 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// scibench - measures how many messages a second GUI::ScintillaWindow gets
+// through, asking for the status after every one and inside a Batch.
+//
+// The window's direct function is replaced by a stand-in that answers the
+// messages the console sends with made up values, and can spend a set time
+// on each one to stand in for Scintilla's own work. The console's hot paths
+// are sent the way it sends them:
+//
+//   call    SCI_GETLENGTH over and over
+//   margin  MarkPrompt on 1000 lines at a time, like a paste into the input
+//   flush   What flushing the output does for each batch of output
+//   brace   What braceMatch does each time the caret moves
+//
+// messages are the ones the console sends, direct_calls also counts the
+// status queries. Last the stand-in fails a message inside a Batch, to check
+// ScintillaFailure comes out when the Batch ends. Results are printed as JSON.
+//
+// Build:
+//
+//   g++ -std=c++17 -O2 -I../../src -I../../src/Npp -I../../src/SciTE scibench.cpp -o scibench
+//
+// Usage:
+//
+//   scibench [-n messages] [-c cost_ns]
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include "Scintilla.h"
+#include "GUI.h"
+#include "PromptMargin.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// Everything the stand-in knows about its window
+struct Standin {
+	sptr_t status = 0;
+	sptr_t fail_on = 0; // Message that sets the status to SC_STATUS_FAILURE
+	uint32_t cost_ns = 0;
+	uint64_t calls = 0;
+	char text[64] = "while true do ez.Wait_ms(10) end";
+};
+
+static Standin standin;
+
+static void spend(uint32_t ns) {
+	if (ns == 0) return;
+
+	const Clock::time_point until = Clock::now() + std::chrono::nanoseconds(ns);
+	while (Clock::now() < until) {
+	}
+}
+
+static __attribute__((noinline)) sptr_t directFunction(sptr_t ptr, unsigned int msg, uptr_t wParam, sptr_t lParam) {
+	Standin &sci = *reinterpret_cast<Standin *>(ptr);
+	sci.calls++;
+	spend(sci.cost_ns);
+
+	if (static_cast<sptr_t>(msg) == sci.fail_on) sci.status = SC_STATUS_FAILURE;
+
+	switch (msg) {
+		case SCI_GETSTATUS: return sci.status;
+		case SCI_SETSTATUS: sci.status = static_cast<sptr_t>(wParam); return 0;
+		case SCI_GETLENGTH: return 32;
+		case SCI_GETCURRENTPOS: return 16;
+		case SCI_GETLINECOUNT: return 1;
+		case SCI_LINEFROMPOSITION: return 0;
+		case SCI_GETCHARACTERPOINTER: return reinterpret_cast<sptr_t>(sci.text);
+	}
+	return lParam != 0;
+}
+
+// GUIWin.cpp isn't built, SetID only asks for the direct function through here
+sptr_t GUI::ScintillaWindow::Send(unsigned int msg, uptr_t, sptr_t) {
+	switch (msg) {
+		case SCI_GETDIRECTFUNCTION: return reinterpret_cast<sptr_t>(directFunction);
+		case SCI_GETDIRECTPOINTER: return reinterpret_cast<sptr_t>(&standin);
+	}
+	return 0;
+}
+
+// Each of these sends about count messages and returns how many it sent
+static size_t sendCalls(GUI::ScintillaWindow &sw, size_t count) {
+	for (size_t i = 0; i < count; ++i) sw.Call(SCI_GETLENGTH);
+	return count;
+}
+
+static size_t sendMargin(GUI::ScintillaWindow &sw, size_t count) {
+	size_t sent = 0;
+	while (sent < count) {
+		MarkPrompt(sw, 0, 999);
+		sent += 2000;
+	}
+	return sent;
+}
+
+static size_t sendFlush(GUI::ScintillaWindow &sw, size_t count) {
+	static const char cells[] = "h\0e\0l\0l\0o\0\r\0\n\0";
+
+	size_t sent = 0;
+	while (sent < count) {
+		sw.Call(SCI_SETREADONLY, 0);
+		sw.Call(SCI_SETEMPTYSELECTION, sw.Call(SCI_GETLENGTH));
+		sw.CallString(SCI_ADDSTYLEDTEXT, sizeof(cells) - 1, cells);
+		sw.Call(SCI_SETREADONLY, 1);
+		sw.Call(SCI_DOCUMENTEND);
+		sent += 6;
+	}
+	return sent;
+}
+
+static size_t sendBrace(GUI::ScintillaWindow &sw, size_t count) {
+	size_t sent = 0;
+	while (sent < count) {
+		const char *text = reinterpret_cast<const char *>(sw.CallReturnPointer(SCI_GETCHARACTERPOINTER));
+		const int length = sw.Call(SCI_GETLENGTH);
+		const int curPos = sw.Call(SCI_GETCURRENTPOS);
+		sw.Call(SCI_BRACEHIGHLIGHT, text[curPos] == '(' ? curPos : INVALID_POSITION, length);
+		sent += 4;
+	}
+	return sent;
+}
+
+struct Result {
+	double per_sec;
+	uint64_t calls;
+};
+
+template <typename F>
+static Result timeRun(GUI::ScintillaWindow &sw, size_t count, bool batched, F send) {
+	standin.calls = 0;
+
+	Clock::time_point start = Clock::now();
+	size_t sent;
+	if (batched) {
+		GUI::ScintillaWindow::Batch batch(sw);
+		sent = send(sw, count);
+	}
+	else {
+		sent = send(sw, count);
+	}
+	const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	return { sent / seconds, standin.calls };
+}
+
+template <typename F>
+static void run(GUI::ScintillaWindow &sw, const char *name, size_t count, F send) {
+	const Result checked = timeRun(sw, count, false, send);
+	const Result batched = timeRun(sw, count, true, send);
+
+	printf("  \"%s\": { \"checked_per_sec\": %.0f, \"checked_direct_calls\": %llu, \"batched_per_sec\": %.0f, \"batched_direct_calls\": %llu, \"speedup\": %.2f },\n",
+		name, checked.per_sec, static_cast<unsigned long long>(checked.calls), batched.per_sec, static_cast<unsigned long long>(batched.calls), batched.per_sec / checked.per_sec);
+}
+
+// A failure in the middle of a Batch comes out when it ends, and not before
+static bool failureThrownAtEnd(GUI::ScintillaWindow &sw) {
+	standin.fail_on = SCI_DOCUMENTEND;
+
+	bool reached_end = false;
+	bool thrown = false;
+	try {
+		GUI::ScintillaWindow::Batch batch(sw);
+		sendFlush(sw, 6);
+		sendCalls(sw, 10);
+		reached_end = true;
+	}
+	catch (const GUI::ScintillaFailure &failure) {
+		thrown = failure.status == SC_STATUS_FAILURE;
+	}
+
+	standin.fail_on = 0;
+	standin.status = 0;
+
+	return reached_end && thrown;
+}
+
+static void usage() {
+	fprintf(stderr, "usage: scibench [-n messages] [-c cost_ns]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	size_t count = 10000000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:c:")) != -1) {
+		switch (opt) {
+			case 'n': count = strtoul(optarg, nullptr, 10); break;
+			case 'c': standin.cost_ns = static_cast<uint32_t>(strtoul(optarg, nullptr, 10)); break;
+			default: usage();
+		}
+	}
+	if (optind != argc || count == 0) usage();
+
+	// Anything not null will do for the window
+	GUI::ScintillaWindow sw;
+	sw.SetID(&standin);
+
+	printf("{\n");
+	printf("  \"messages\": %zu, \"cost_ns\": %u,\n", count, standin.cost_ns);
+	run(sw, "call", count, sendCalls);
+	run(sw, "margin", count, sendMargin);
+	run(sw, "flush", count, sendFlush);
+	run(sw, "brace", count, sendBrace);
+	printf("  \"failure_thrown_at_end\": %s\n", failureThrownAtEnd(sw) ? "true" : "false");
+	printf("}\n");
+
+	return 0;
+}
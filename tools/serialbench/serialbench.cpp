@@ -0,0 +1,240 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// serialbench - measures serial::Serial with a reader and writers at once.
+//
+// One thread reads everything that comes back while the others write
+// messages as fast as they can, first with the normal locking and then in
+// full duplex mode. Whatever is written has to come back: without a port
+// it makes a pseudo terminal that echoes, otherwise the port needs a
+// loopback plug (TX wired to RX). Results are printed as JSON.
+//
+// Build (Linux, uses the POSIX serial backend):
+//
+//   g++ -std=c++14 -O2 -I../../src serialbench.cpp ../../src/serial/serial.cc ../../src/serial/impl/unix.cc -pthread -o serialbench
+//
+// Usage:
+//
+//   serialbench [-b baud] [-n messages] [-s size] [-w writers] [port]
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "serial/serial.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+	uint32_t baud = 115200;
+	size_t messages = 20000;
+	size_t size = 32;
+	size_t writers = 1;
+};
+
+struct Samples {
+	std::vector<double> us;
+
+	void add(Clock::time_point start) {
+		us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+	}
+
+	double percentile(double p) {
+		if (us.empty()) return 0;
+
+		std::sort(us.begin(), us.end());
+
+		// Nearest rank
+		size_t rank = static_cast<size_t>(p / 100.0 * us.size() + 0.5);
+		return us[std::min(std::max<size_t>(rank, 1), us.size()) - 1];
+	}
+};
+
+// The other end of the pty, sends everything straight back
+class Echo {
+public:
+	Echo() : master(-1), quit(false) {}
+
+	~Echo() {
+		quit = true;
+		if (thread.joinable()) thread.join();
+		if (slave >= 0) close(slave);
+		if (master >= 0) close(master);
+	}
+
+	std::string open() {
+		master = posix_openpt(O_RDWR | O_NOCTTY);
+		if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) return std::string();
+
+		const std::string name = ptsname(master);
+
+		// Keep the slave open so the master doesn't see EIO in between runs
+		slave = ::open(name.c_str(), O_RDWR | O_NOCTTY);
+		termios tio;
+		tcgetattr(slave, &tio);
+		cfmakeraw(&tio);
+		tcsetattr(slave, TCSANOW, &tio);
+
+		thread = std::thread(&Echo::run, this);
+		return name;
+	}
+
+private:
+	int master;
+	int slave = -1;
+	std::atomic<bool> quit;
+	std::thread thread;
+
+	void run() {
+		char buffer[4096];
+
+		while (!quit) {
+			pollfd pfd = { master, POLLIN, 0 };
+			if (poll(&pfd, 1, 50) <= 0) continue;
+
+			ssize_t count = read(master, buffer, sizeof(buffer));
+			for (ssize_t done = 0; done < count;) {
+				ssize_t written = write(master, buffer + done, count - done);
+				if (written > 0) done += written;
+				else if (errno != EAGAIN && errno != EINTR) return;
+			}
+		}
+	}
+};
+
+struct Result {
+	double seconds = 0;
+	size_t received = 0;
+	Samples write_us;
+	Samples read_us;
+};
+
+static Result run(serial::Serial &port, const Options &options, bool duplex) {
+	Result result;
+	const size_t total = options.messages * options.size;
+	const std::string message(options.size, 'x');
+
+	port.flushInput();
+	port.setFullDuplex(duplex);
+
+	std::vector<Samples> write_us(options.writers);
+	Clock::time_point start = Clock::now();
+
+	std::thread reader([&]() {
+		std::vector<uint8_t> buffer(4096);
+
+		while (result.received < total) {
+			Clock::time_point call = Clock::now();
+			size_t count = port.read(buffer.data(), std::min(buffer.size(), std::max<size_t>(port.available(), 1)));
+			if (count == 0) break; // Timed out, something got lost
+			result.read_us.add(call);
+			result.received += count;
+		}
+	});
+
+	std::vector<std::thread> writers;
+	for (size_t w = 0; w < options.writers; ++w) {
+		writers.emplace_back([&, w]() {
+			for (size_t i = w; i < options.messages; i += options.writers) {
+				Clock::time_point call = Clock::now();
+				port.write(message);
+				write_us[w].add(call);
+			}
+		});
+	}
+
+	for (auto &writer : writers) writer.join();
+	reader.join();
+
+	result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	for (const auto &samples : write_us) result.write_us.us.insert(result.write_us.us.end(), samples.us.begin(), samples.us.end());
+
+	port.setFullDuplex(false);
+	return result;
+}
+
+static void printResult(const char *name, Result &result, const Options &options, bool last) {
+	const size_t total = options.messages * options.size;
+
+	printf("  \"%s\": { \"bytes\": %zu, \"received\": %zu, \"bytes_per_second\": %.1f, ",
+		name, total, result.received, result.received / result.seconds);
+	printf("\"write_p50_us\": %.1f, \"write_p99_us\": %.1f, ", result.write_us.percentile(50), result.write_us.percentile(99));
+	printf("\"read_calls\": %zu, \"read_p50_us\": %.1f, \"read_p99_us\": %.1f }%s\n",
+		result.read_us.us.size(), result.read_us.percentile(50), result.read_us.percentile(99), last ? "" : ",");
+}
+
+static void usage() {
+	fprintf(stderr, "usage: serialbench [-b baud] [-n messages] [-s size] [-w writers] [port]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	Options options;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:n:s:w:")) != -1) {
+		switch (opt) {
+			case 'b': options.baud = static_cast<uint32_t>(strtoul(optarg, nullptr, 10)); break;
+			case 'n': options.messages = strtoul(optarg, nullptr, 10); break;
+			case 's': options.size = strtoul(optarg, nullptr, 10); break;
+			case 'w': options.writers = strtoul(optarg, nullptr, 10); break;
+			default: usage();
+		}
+	}
+	if (optind < argc - 1 || options.messages == 0 || options.size == 0 || options.writers == 0) usage();
+
+	Echo echo;
+	std::string name = optind < argc ? argv[optind] : echo.open();
+	if (name.empty()) {
+		perror("serialbench: posix_openpt");
+		return 1;
+	}
+
+	try {
+		serial::Serial port(name, options.baud, serial::Timeout::simpleTimeout(1000));
+
+		printf("{\n");
+		printf("  \"port\": \"%s\", \"baudrate\": %u, \"messages\": %zu, \"message_bytes\": %zu, \"writers\": %zu,\n",
+			name.c_str(), options.baud, options.messages, options.size, options.writers);
+
+		Result locked = run(port, options, false);
+		printResult("locked", locked, options, false);
+
+		Result duplex = run(port, options, true);
+		printResult("full_duplex", duplex, options, true);
+
+		printf("}\n");
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "serialbench: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,550 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// serialcheck - checks the POSIX backend of the serial library on a pty.
+//
+// Makes a pseudo terminal, opens its slave side with serial::Serial and
+// plays the device on the master side. Every check prints what it measured
+// next to what it should have been as JSON, and the exit status is 1 if
+// any of them is off.
+//
+//   timeouts    Reads that time out empty, partly or with the data
+//               trickling in, waitReadable, a write blocked on a full pty
+//               and waitByteTimes, all against their configured timeouts
+//   async       What the asynchronous reads hand back, how cancelAsync and
+//               close end them, how quickly they wake up compared to a
+//               blocking read, and interrupt() waking a waitReadable
+//   readline    Lines of random length, some over 8 KB, cut up at random
+//               places on the way, have to come out of readline unchanged.
+//               Then the throughput of 64 byte lines and the read calls
+//               each one takes (from /proc/self/io)
+//   alloc       Heap allocations per read into a reused vector or string,
+//               and per RUN_LUA frame sent as a gather write
+//
+// Build (Linux, uses the POSIX serial backend):
+//
+//   g++ -std=c++14 -O2 -I../../src serialcheck.cpp ../../src/serial/serial.cc ../../src/serial/impl/unix.cc -pthread -o serialcheck
+//
+// Usage:
+//
+//   serialcheck [-l lines] > results.json
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "serial/serial.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// How late a timeout may fire, a loaded machine is slow to wake up
+#define LATE_MS 25
+
+// Every allocation in the program goes through here to be counted
+static std::atomic<size_t> allocations(0);
+
+void *operator new(size_t size) {
+	++allocations;
+	void *p = malloc(size > 0 ? size : 1);
+	if (p == nullptr) throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p) noexcept {
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+	free(p);
+}
+
+static double elapsedMs(Clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// The device side of the pty
+class Pty {
+public:
+	Pty() : master(-1), slave(-1) {}
+
+	~Pty() {
+		if (slave >= 0) close(slave);
+		if (master >= 0) close(master);
+	}
+
+	std::string open() {
+		master = posix_openpt(O_RDWR | O_NOCTTY);
+		if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) return std::string();
+
+		const std::string name = ptsname(master);
+
+		// Keep the slave open so the master doesn't see EIO in between ports
+		slave = ::open(name.c_str(), O_RDWR | O_NOCTTY);
+		termios tio;
+		tcgetattr(slave, &tio);
+		cfmakeraw(&tio);
+		tcsetattr(slave, TCSANOW, &tio);
+
+		return name;
+	}
+
+	void send(const std::string &data) {
+		for (size_t done = 0; done < data.size();) {
+			ssize_t written = write(master, data.data() + done, data.size() - done);
+			if (written > 0) done += written;
+			else std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+	}
+
+	// Sends data after delay_ms without holding up the caller
+	std::thread sendLater(std::string data, int delay_ms) {
+		return std::thread([this, data, delay_ms]() {
+			std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+			send(data);
+		});
+	}
+
+	// Throws away whatever the port wrote
+	void drain() {
+		char buffer[4096];
+		while (read(master, buffer, sizeof(buffer)) > 0) {}
+	}
+
+	int fd() const { return master; }
+
+private:
+	int master;
+	int slave;
+};
+
+// Collects the checks of a section and prints them as JSON
+class Report {
+public:
+	explicit Report(const char *section) : first(true), ok(true) {
+		printf("  \"%s\": [\n", section);
+	}
+
+	// Something that should have taken expect_ms, and not come back much later
+	void timing(const char *check, double ms, double expect_ms) {
+		const bool passed = ms >= expect_ms - 1 && ms <= expect_ms + LATE_MS;
+		line(passed, "{ \"check\": \"%s\", \"ms\": %.1f, \"expect_ms\": %.1f, \"ok\": %s }", check, ms, expect_ms, passed ? "true" : "false");
+	}
+
+	// Same as timing() but for a call that also hands back a count
+	void timing(const char *check, size_t count, size_t expect_count, double ms, double expect_ms) {
+		const bool passed = count == expect_count && ms >= expect_ms - 1 && ms <= expect_ms + LATE_MS;
+		line(passed, "{ \"check\": \"%s\", \"count\": %zu, \"expect_count\": %zu, \"ms\": %.1f, \"expect_ms\": %.1f, \"ok\": %s }",
+			check, count, expect_count, ms, expect_ms, passed ? "true" : "false");
+	}
+
+	void text(const char *check, const std::string &got, const std::string &expect) {
+		const bool passed = got == expect;
+		line(passed, "{ \"check\": \"%s\", \"got\": \"%s\", \"expect\": \"%s\", \"ok\": %s }",
+			check, escape(got).c_str(), escape(expect).c_str(), passed ? "true" : "false");
+	}
+
+	// Only reported, there is nothing to compare it with
+	void latency(const char *check, std::vector<double> &us) {
+		std::sort(us.begin(), us.end());
+		line(true, "{ \"check\": \"%s\", \"samples\": %zu, \"p50_us\": %.1f, \"p99_us\": %.1f }",
+			check, us.size(), us[us.size() / 2], us[us.size() * 99 / 100]);
+	}
+
+	// Only reported, like latency()
+	void rate(const char *check, size_t lines, double mb_per_second, double reads_per_line) {
+		line(true, "{ \"check\": \"%s\", \"lines\": %zu, \"mb_per_second\": %.1f, \"read_calls_per_line\": %.3f }",
+			check, lines, mb_per_second, reads_per_line);
+	}
+
+	void value(const char *check, double value, double expect) {
+		const bool passed = value == expect;
+		line(passed, "{ \"check\": \"%s\", \"value\": %.15g, \"expect\": %.15g, \"ok\": %s }", check, value, expect, passed ? "true" : "false");
+	}
+
+	// Returns whether every check passed
+	bool end(bool last) {
+		printf("\n  ]%s\n", last ? "" : ",");
+		return ok;
+	}
+
+private:
+	bool first;
+	bool ok;
+
+	static std::string escape(const std::string &text) {
+		std::string escaped;
+		for (char ch : text) {
+			if (ch == '\r') escaped += "\\r";
+			else if (ch == '\n') escaped += "\\n";
+			else if (ch == '"' || ch == '\\') escaped += std::string("\\") + ch;
+			else escaped += ch;
+		}
+		return escaped;
+	}
+
+	template <typename... Args>
+	void line(bool passed, const char *format, Args... args) {
+		printf("%s    ", first ? "" : ",\n");
+		printf(format, args...);
+		first = false;
+		ok = ok && passed;
+	}
+};
+
+static bool timeouts(Pty &pty, const std::string &name, bool last) {
+	Report report("timeouts");
+
+	// 50 ms between bytes, reads get 300 ms plus 10 per byte, writes 200 ms
+	serial::Serial port(name, 250000, serial::Timeout(50, 300, 10, 200, 0));
+	report.value("custom_baudrate", port.getBaudrate(), 250000);
+
+	uint8_t buffer[16];
+	Clock::time_point start = Clock::now();
+	size_t count = port.read(buffer, 10);
+	report.timing("empty_read", count, 0, elapsedMs(start), 400);
+
+	// The read returns once nothing else came for the inter byte timeout
+	std::thread sender = pty.sendLater("abc", 20);
+	start = Clock::now();
+	count = port.read(buffer, 10);
+	report.timing("partial_read", count, 3, elapsedMs(start), 70);
+	sender.join();
+
+	// Bytes 30 ms apart keep the read going until all of them are there
+	sender = std::thread([&pty]() {
+		for (int i = 0; i < 10; ++i) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(30));
+			pty.send("x");
+		}
+	});
+	start = Clock::now();
+	count = port.read(buffer, 10);
+	report.timing("trickle_read", count, 10, elapsedMs(start), 300);
+	sender.join();
+
+	start = Clock::now();
+	const bool readable = port.waitReadable();
+	report.timing("wait_readable", readable ? 1 : 0, 0, elapsedMs(start), 300);
+
+	// Nobody reads the master, so the pty fills up and the write times out
+	std::vector<uint8_t> big(1 << 20, 'a');
+	start = Clock::now();
+	count = port.write(big);
+	const double write_ms = elapsedMs(start);
+	report.timing("blocked_write", count < big.size() ? 1 : 0, 1, write_ms, 200);
+	pty.drain();
+
+	// 10 bits per byte at 250000 baud
+	start = Clock::now();
+	port.waitByteTimes(2500);
+	report.timing("wait_byte_times", elapsedMs(start), 100);
+
+	return report.end(last);
+}
+
+// The exception a read failed with
+static std::string failure(std::future<std::string> &read) {
+	try {
+		read.get();
+		return "(none)";
+	}
+	catch (std::exception &e) {
+		return e.what();
+	}
+}
+
+static bool async(Pty &pty, const std::string &name, bool last) {
+	Report report("async");
+
+	serial::Serial port(name, 115200, serial::Timeout::simpleTimeout(1000));
+
+	// Queued reads are served in order from the same data
+	std::future<std::string> line = port.asyncReadUntil("\r\n");
+	std::future<std::string> exact = port.asyncRead(5);
+	std::future<std::string> some = port.asyncReadSome();
+	pty.send("hello\r\nworldXYZ");
+	report.text("read_until", line.get(), "hello\r\n");
+	report.text("read_exact", exact.get(), "world");
+	report.text("read_some", some.get(), "XYZ");
+
+	// A size limit ends the read before the delimiter, the rest stays
+	line = port.asyncReadUntil("END", 4);
+	pty.send("abcdefEND");
+	report.text("read_until_limit", line.get(), "abcd");
+	report.text("read_until_rest", port.asyncReadUntil("END").get(), "efEND");
+
+	// A delimiter split across two reads of the port
+	line = port.asyncReadUntil("\r\n");
+	pty.send("ab\r");
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	pty.send("\ncd");
+	report.text("read_until_split", line.get(), "ab\r\n");
+	report.text("read_some_left_over", port.asyncReadSome().get(), "cd");
+
+	some = port.asyncReadSome();
+	port.cancelAsync();
+	report.value("cancel_fails_read", failure(some) != "(none)", 1);
+
+	// From the write on the device side to the reader having the byte
+	std::vector<double> async_us;
+	for (int i = 0; i < 2000; ++i) {
+		some = port.asyncReadSome();
+		Clock::time_point start = Clock::now();
+		pty.send("x");
+		some.get();
+		async_us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+	}
+	report.latency("async_wakeup", async_us);
+
+	std::vector<double> blocking_us;
+	uint8_t byte;
+	for (int i = 0; i < 2000; ++i) {
+		Clock::time_point start = Clock::now();
+		pty.send("x");
+		port.read(&byte, 1);
+		blocking_us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+	}
+	report.latency("blocking_read", blocking_us);
+
+	// interrupt() ends a wait right away, and one nobody waited for is
+	// taken back by waitReadable (0)
+	std::thread waker([&port]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		port.interrupt();
+	});
+	Clock::time_point start = Clock::now();
+	bool readable = port.waitReadable(1000);
+	report.timing("interrupt_wakes_wait", readable ? 1 : 0, 0, elapsedMs(start), 50);
+	waker.join();
+
+	port.interrupt();
+	port.waitReadable(0);
+	start = Clock::now();
+	readable = port.waitReadable(100);
+	report.timing("interrupt_taken_back", readable ? 1 : 0, 0, elapsedMs(start), 100);
+
+	some = port.asyncReadSome();
+	port.close();
+	report.value("close_fails_read", failure(some) != "(none)", 1);
+
+	return report.end(last);
+}
+
+// Sends data in pieces of random size with a pause now and then, like a
+// USB adapter handing over what it has
+static void sendChunked(Pty &pty, const std::string &data, unsigned seed) {
+	std::mt19937 random(seed);
+
+	for (size_t done = 0; done < data.size();) {
+		const size_t size = std::min<size_t>(1 + random() % 700, data.size() - done);
+		pty.send(data.substr(done, size));
+		done += size;
+
+		if (random() % 8 == 0) std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+}
+
+// Read system calls the process has made so far
+static unsigned long readCalls() {
+	FILE *io = fopen("/proc/self/io", "r");
+	if (io == nullptr) return 0;
+
+	char line[128];
+	unsigned long calls = 0;
+	while (fgets(line, sizeof(line), io) != nullptr) {
+		if (strncmp(line, "syscr:", 6) == 0) calls = strtoul(line + 6, nullptr, 10);
+	}
+	fclose(io);
+
+	return calls;
+}
+
+static bool readline(Pty &pty, const std::string &name, size_t lines, bool last) {
+	Report report("readline");
+
+	serial::Serial port(name, 115200, serial::Timeout::simpleTimeout(200));
+
+	// Mostly short lines, some longer than the ring, and stray CRs in front
+	// of the CRLF
+	std::mt19937 random(42);
+	std::vector<std::string> expected;
+	std::string all;
+	for (int i = 0; i < 3000; ++i) {
+		const size_t length = random() % 20 == 0 ? 5000 + random() % 3000 : random() % 100;
+
+		std::string line;
+		for (size_t j = 0; j < length; ++j) line.push_back(static_cast<char>('a' + random() % 26));
+		if (random() % 5 == 0) line += "\r";
+		line += "\r\n";
+
+		expected.push_back(line);
+		all += line;
+	}
+
+	std::thread sender(sendChunked, std::ref(pty), all, 1);
+	size_t mismatches = 0;
+	for (const std::string &line : expected) {
+		if (port.readline(65536, "\r\n") != line) ++mismatches;
+	}
+	sender.join();
+	report.value("random_lines_mismatched", mismatches, 0);
+
+	// What is left after the last EOL still comes out of readlines
+	pty.send("one\ntwo\nthr");
+	std::string joined;
+	for (const std::string &line : port.readlines()) joined += line + "|";
+	report.text("readlines", joined, "one\n|two\n|thr|");
+
+	pty.send("abcdefghij");
+	report.text("readline_limit", port.readline(4), "abcd");
+	report.text("read_after_readline", port.read(6), "efghij");
+
+	// Throughput, the device sends as fast as the pty takes it
+	const std::string line = std::string(62, 'x') + "\r\n";
+	std::string many;
+	many.reserve(line.size() * lines);
+	for (size_t i = 0; i < lines; ++i) many += line;
+
+	const unsigned long calls = readCalls();
+	Clock::time_point start = Clock::now();
+	sender = std::thread([&pty, &many]() { pty.send(many); });
+	size_t received = 0;
+	for (size_t i = 0; i < lines; ++i) received += port.readline(65536, "\r\n").size();
+	sender.join();
+	const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	report.rate("throughput", lines, received / seconds / 1e6, static_cast<double>(readCalls() - calls) / lines);
+	report.value("throughput_bytes", received, many.size());
+
+	return report.end(last);
+}
+
+#define ALLOC_CALLS 1000
+
+static bool alloc(Pty &pty, const std::string &name, bool last) {
+	Report report("alloc");
+
+	serial::Serial port(name, 115200, serial::Timeout::simpleTimeout(100));
+	const std::string chunk(64, 'x');
+
+	// Room for everything up front, so only the read itself could allocate
+	std::vector<uint8_t> vector;
+	vector.reserve(chunk.size() * ALLOC_CALLS);
+	size_t before = allocations;
+	for (int i = 0; i < ALLOC_CALLS; ++i) {
+		pty.send(chunk);
+		port.read(vector, chunk.size());
+	}
+	report.value("read_vector_per_call", static_cast<double>(allocations - before) / ALLOC_CALLS, 0);
+
+	std::string string;
+	string.reserve(chunk.size() * ALLOC_CALLS);
+	before = allocations;
+	for (int i = 0; i < ALLOC_CALLS; ++i) {
+		pty.send(chunk);
+		port.read(string, chunk.size());
+	}
+	report.value("read_string_per_call", static_cast<double>(allocations - before) / ALLOC_CALLS, 0);
+
+	// The frame DeviceSession sends, header, source and terminator in one write
+	const uint8_t command = 0xA7;
+	const uint8_t terminator = 0;
+	const std::string source(200, 'x');
+	before = allocations;
+	for (int i = 0; i < ALLOC_CALLS; ++i) {
+		port.write({ serial::ConstBuffer(&command, 1), serial::ConstBuffer(source), serial::ConstBuffer(&terminator, 1) });
+		pty.drain();
+	}
+	report.value("gather_write_per_call", static_cast<double>(allocations - before) / ALLOC_CALLS, 0);
+	report.value("bytes_read", vector.size() + string.size(), 2 * chunk.size() * ALLOC_CALLS);
+
+	return report.end(last);
+}
+
+static void usage() {
+	fprintf(stderr, "usage: serialcheck [-l lines]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	size_t lines = 50000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "l:")) != -1) {
+		switch (opt) {
+			case 'l': lines = strtoul(optarg, nullptr, 10); break;
+			default: usage();
+		}
+	}
+	if (optind != argc || lines == 0) usage();
+
+	Pty pty;
+	const std::string name = pty.open();
+	if (name.empty()) {
+		perror("serialcheck: posix_openpt");
+		return 1;
+	}
+
+	// The master has to be non-blocking for drain()
+	fcntl(pty.fd(), F_SETFL, fcntl(pty.fd(), F_GETFL) | O_NONBLOCK);
+
+	bool ok = true;
+
+	try {
+		printf("{\n");
+		printf("  \"port\": \"%s\",\n", name.c_str());
+
+		ok = timeouts(pty, name, false) && ok;
+		ok = async(pty, name, false) && ok;
+		ok = readline(pty, name, lines, false) && ok;
+		ok = alloc(pty, name, true) && ok;
+
+		printf("}\n");
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "serialcheck: %s\n", e.what());
+		return 1;
+	}
+
+	return ok ? 0 : 1;
+}
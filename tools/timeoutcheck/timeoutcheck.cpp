@@ -0,0 +1,304 @@
+// This file is part of ezLCDLua
+//
+// Copyright (C)2020 Earth Computer Technologies, Inc
+//
+// ezLCDLua is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// timeoutcheck - checks DeviceSession's size-aware timeouts over a slow link.
+//
+// Runs against the simulator in tools/ezlcdsim with the link speed
+// emulated, so uploads take as long as they would on the wire. Every check
+// prints what it got next to what it should have been as JSON, and the exit
+// status is 1 if any of them is off.
+//
+//   learn       The reply timeout for a small statement before and after
+//               the session has seen how quickly the board answers
+//   upload      A 64 KB script that takes seconds on the wire still gets
+//               its reply, and the timeout for it covers the transfer
+//   error       A long error message comes back whole
+//   dead        With the simulator stopped (SIGSTOP), a statement gives up
+//               after the learned timeout instead of the initial one
+//   partial     With the simulator stopped, an upload that only gets part
+//               way fails, the session closes, and the simulator gets the
+//               frame terminated so it answers the stub and the next
+//               statement runs
+//
+// Build (Linux, uses the POSIX serial backend):
+//
+//   g++ -std=c++14 -O2 -I../../src timeoutcheck.cpp ../../src/DeviceSession.cpp ../../src/serial/serial.cc ../../src/serial/impl/unix.cc ../../src/serial/impl/list_ports/list_ports_linux.cc -pthread -o timeoutcheck
+//
+// Usage:
+//
+//   ezlcdsim -l /tmp/ttyEZLCD -b 115200 -c 2 &
+//   timeoutcheck [-b baud] -p $! /tmp/ttyEZLCD > results.json
+//
+//   -b  Baud rate, the same as the simulator's (default: 115200)
+//   -p  Process ID of the simulator, for the dead section
+
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include "DeviceSession.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// How late a timeout may fire, a loaded machine is slow to wake up
+#define LATE_MS 25
+
+static double elapsedMs(Clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static const char *resultName(DeviceSession::Result result) {
+	switch (result) {
+		case DeviceSession::Result::Ok: return "ok";
+		case DeviceSession::Result::LuaError: return "lua_error";
+		default: return "no_response";
+	}
+}
+
+// Collects the checks of a section and prints them as JSON
+class Report {
+public:
+	explicit Report(const char *section) : first(true), ok(true) {
+		printf("  \"%s\": [\n", section);
+	}
+
+	void text(const char *check, const std::string &got, const std::string &expect) {
+		const bool passed = got == expect;
+		line(passed, "{ \"check\": \"%s\", \"got\": \"%s\", \"expect\": \"%s\", \"ok\": %s }",
+			check, got.c_str(), expect.c_str(), passed ? "true" : "false");
+	}
+
+	// A value that has to be at least min and at most max
+	void range(const char *check, double value, double min, double max) {
+		const bool passed = value >= min && value <= max;
+		line(passed, "{ \"check\": \"%s\", \"value\": %.1f, \"min\": %.1f, \"max\": %.1f, \"ok\": %s }",
+			check, value, min, max, passed ? "true" : "false");
+	}
+
+	// Returns whether every check passed
+	bool end(bool last) {
+		printf("\n  ]%s\n", last ? "" : ",");
+		return ok;
+	}
+
+private:
+	bool first;
+	bool ok;
+
+	template <typename... Args>
+	void line(bool passed, const char *format, Args... args) {
+		printf("%s    ", first ? "" : ",\n");
+		printf(format, args...);
+		first = false;
+		ok = ok && passed;
+	}
+};
+
+// A statement is 5 bytes on the wire with its framing
+#define SMALL_BYTES 5
+
+// 8N1 is 10 bits on the wire per byte
+static double transferMs(size_t bytes, uint32_t baudrate) {
+	return bytes * 10 * 1000.0 / baudrate;
+}
+
+static bool learn(DeviceSession &session, bool last) {
+	Report report("learn");
+
+	const double initial = session.responseTimeout(SMALL_BYTES);
+
+	std::string message;
+	report.text("first", resultName(session.runLua("x=1", message)), "ok");
+	for (int i = 0; i < 50; ++i) session.runLua("x=1", message);
+
+	// The simulator answers in well under a millisecond, so the timeout
+	// comes down to its floor
+	report.range("initial_ms", initial, 0, 1e9);
+	report.range("learned_ms", session.responseTimeout(SMALL_BYTES), 0, initial - 1);
+
+	return report.end(last);
+}
+
+static bool upload(DeviceSession &session, uint32_t baudrate, bool last) {
+	Report report("upload");
+
+	std::string script;
+	while (script.size() < 65536 - 40) script += "ez.SetXY(12, 34) ez.Box(56, 78, 1)\n";
+	const double wire_ms = transferMs(script.size() + 2, baudrate);
+
+	report.range("timeout_before_ms", session.responseTimeout(script.size() + 2), wire_ms, 1e9);
+
+	std::string message;
+	Clock::time_point start = Clock::now();
+	report.text("result", resultName(session.runLua(script, message)), "ok");
+
+	// Proves the link speed is emulated, otherwise there is nothing to check
+	report.range("upload_ms", elapsedMs(start), wire_ms, 1e9);
+	report.range("timeout_after_ms", session.responseTimeout(script.size() + 2), wire_ms, 1e9);
+
+	return report.end(last);
+}
+
+static bool error(DeviceSession &session, bool last) {
+	Report report("error");
+
+	std::string message;
+	report.text("result", resultName(session.runLua("error(\"" + std::string(3000, 'e') + "\", 0)", message)), "lua_error");
+	report.range("message_bytes", message.size(), 3000, 3000);
+
+	return report.end(last);
+}
+
+static bool dead(DeviceSession &session, pid_t simulator, bool last) {
+	Report report("dead");
+
+	const double timeout = session.responseTimeout(SMALL_BYTES);
+
+	kill(simulator, SIGSTOP);
+
+	std::string message;
+	Clock::time_point start = Clock::now();
+	const DeviceSession::Result result = session.runLua("x=1", message);
+	const double ms = elapsedMs(start);
+
+	kill(simulator, SIGCONT);
+
+	// A few milliseconds either way don't matter, giving up well short of the
+	// initial timeout is what counts
+	report.text("result", resultName(result), "no_response");
+	report.range("gave_up_ms", ms, timeout - 10, timeout + LATE_MS);
+
+	return report.end(last);
+}
+
+// Fast enough that the write times out within seconds once the pty is full
+#define PARTIAL_BAUD 921600
+#define PARTIAL_BYTES (128 << 10)
+
+// The simulator reads what it got at its own emulated speed first
+#define PARTIAL_REPLY_MS 30000
+
+// How long the simulator has to stay quiet to be done
+#define QUIET_MS 500
+
+// Reads and throws away whatever the simulator sends until it goes quiet
+static void drain(serial::Serial &serial) {
+	serial::Timeout quiet = serial::Timeout::simpleTimeout(QUIET_MS);
+	serial.setTimeout(quiet);
+
+	uint8_t buffer[512];
+	while (serial.read(buffer, sizeof(buffer)) > 0) {
+	}
+}
+
+static bool partial(const std::string &port, pid_t simulator, bool last) {
+	Report report("partial");
+
+	// The statement the dead section gave up on gets its reply by now
+	{
+		serial::Serial raw(port, PARTIAL_BAUD);
+		drain(raw);
+	}
+
+	DeviceSession session;
+	session.setPort(port);
+	session.setBaudrate(PARTIAL_BAUD);
+
+	std::string message;
+	report.text("before", resultName(session.runLua("x=1", message)), "ok");
+
+	std::string script;
+	while (script.size() < PARTIAL_BYTES) script += "ez.SetXY(12, 34) ez.Box(56, 78, 1)\n";
+
+	kill(simulator, SIGSTOP);
+
+	std::string failure;
+	try {
+		session.sendLua(script);
+	}
+	catch (std::exception &e) {
+		failure = e.what();
+	}
+
+	kill(simulator, SIGCONT);
+
+	report.text("failed", failure.empty() ? "no" : "yes", "yes");
+	report.text("closed", session.isOpen() ? "no" : "yes", "yes");
+
+	// Only a terminated frame gets an answer, the stub doesn't compile
+	uint8_t status = 0;
+	{
+		serial::Serial raw(port, PARTIAL_BAUD, serial::Timeout::simpleTimeout(PARTIAL_REPLY_MS));
+		raw.read(&status, 1);
+		drain(raw);
+	}
+	report.text("stub_reply", status == RUN_LUA_ERROR ? "lua_error" : status == RUN_LUA_OK ? "ok" : "none", "lua_error");
+
+	report.text("after", resultName(session.runLua("x=1", message)), "ok");
+
+	return report.end(last);
+}
+
+static void usage() {
+	fprintf(stderr, "usage: timeoutcheck [-b baud] -p simulator_pid port\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t baudrate = 115200;
+	pid_t simulator = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:p:")) != -1) {
+		switch (opt) {
+			case 'b': baudrate = static_cast<uint32_t>(strtoul(optarg, nullptr, 10)); break;
+			case 'p': simulator = static_cast<pid_t>(strtol(optarg, nullptr, 10)); break;
+			default: usage();
+		}
+	}
+	if (optind != argc - 1 || simulator <= 0 || baudrate == 0) usage();
+
+	DeviceSession session;
+	session.setPort(argv[optind]);
+	session.setBaudrate(baudrate);
+
+	bool ok = true;
+
+	try {
+		printf("{\n");
+		printf("  \"port\": \"%s\", \"baudrate\": %u,\n", argv[optind], baudrate);
+
+		ok = learn(session, false) && ok;
+		ok = upload(session, baudrate, false) && ok;
+		ok = error(session, false) && ok;
+		ok = dead(session, simulator, false) && ok;
+	ok = partial(argv[optind], simulator, true) && ok;
+
+		printf("}\n");
+	}
+	catch (std::exception &e) {
+		fprintf(stderr, "timeoutcheck: %s\n", e.what());
+		return 1;
+	}
+
+	return ok ? 0 : 1;
+}